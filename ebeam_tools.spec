@@ -13,9 +13,12 @@ BuildRequires:	libxrandr-devel
 BuildRequires:	imagemagick
 
 %description
-This package provide 2 programs for handling ebeam kernel driver based devices calibration:
+This package provide 5 programs for handling ebeam kernel driver based devices calibration:
    o ebeam_calibrator : the graphical utility to actually calibrate the device
    o ebeam_state : a command-line program to save and restore previous calibration
+   o ebeam_daemon : restores the saved calibration when a device is plugged in
+   o ebeam_boot : restores the kernel driver calibration at boot, without X
+   o ebeam_uinput : calibration in userspace, for kernels without the ebeam driver
 
 %prep
 %setup -q
@@ -48,6 +51,7 @@ rm -rf %{buildroot}
 %{_mandir}/man1/*
 %{_iconsdir}/hicolor/*/apps/*
 %{_datadir}/pixmaps/*
+%dir %{_localstatedir}/lib/ebeam_tools
 
 
 %changelog
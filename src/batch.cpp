@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "batch.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+#include "xstats.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <stdexcept>
+
+BatchCalibrator::BatchCalibrator(const char* store0, int revision0)
+  : store_path(store0),
+    revision(revision0),
+    display(NULL)
+{
+}
+
+BatchCalibrator::~BatchCalibrator()
+{
+    for (unsigned i = 0; i < jobs.size(); i++) {
+        delete jobs[i].lock;
+        delete jobs[i].calibrator;
+    }
+
+    if (display) {
+        Calibrator::flush_device_cache();
+        XCloseDisplay(display);
+    }
+}
+
+void* BatchCalibrator::run_job(void* arg)
+{
+    Job* job = (Job*) arg;
+    TraceSpan span("batch_job");
+    double t = now_ms();
+
+    if (job->save && !job->calibrator->make_state(job->state))
+        job->ok = false;
+
+    if (job->ok && job->entry) {
+        EbeamCalibration cal;
+        bool status;
+
+        job->calibrator->load_state(job->entry->state);
+        job->calibrator->get_calibration(cal);
+        job->request = DeviceLock::request_hash(DEVLOCK_APPLY, &cal,
+                                                job->calibrator->is_zoned());
+
+        // released by run() once evdev is synced too
+        job->lock = new DeviceLock(job->device->dir);
+
+        if (!job->lock->acquire(true))
+            job->ok = false;
+        else if (job->lock->coalesce(job->request, &status)) {
+            job->coalesced = true;
+            job->ok = status;
+        } else if (!job->calibrator->set_ebeam_calibration()) {
+            fprintf(stderr, "ERROR: unable to set eBeam calibration "
+                            "of '%s'.\n", job->device->name);
+            job->ok = false;
+        }
+    }
+
+    job->t_sysfs = now_ms() - t;
+
+    return NULL;
+}
+
+bool BatchCalibrator::run(bool save, bool restore)
+{
+    double t_start = now_ms();
+    bool ok = true;
+
+    display = X_ROUND_TRIP(XOpenDisplay(NULL));
+    if (display == NULL) {
+        fprintf(stderr, "ERROR: Unable to connect to X server.\n");
+        return false;
+    }
+
+    XPhase phase(display, "batch");
+
+    if (Calibrator::find_devices(display, NULL, false, devices) == 0) {
+        fprintf(stderr, "Error: No eBeam device found.\n");
+        return false;
+    }
+
+    ProfileStore store(store_path);
+    if (restore && !store.open())
+        return false;
+
+    // X side : one calibrator per device on the shared display
+    jobs.resize(devices.size());
+    for (unsigned i = 0; i < devices.size(); i++) {
+        Job& job = jobs[i];
+        const EbeamDevice& dev = devices[i];
+
+        memset(&job, 0, sizeof(job));
+        job.device = &dev;
+        job.save = save;
+        job.ok = true;
+
+        try {
+            job.calibrator = new Calibrator(dev.id, dev.name, dev.dir,
+                                            dev.key,
+                                            PRECISION, THR_DOUBLECLICK,
+                                            0, 0, 0, 0,
+                                            NULL, NULL, display);
+        } catch (std::runtime_error& e) {
+            fprintf(stderr, "ERROR: '%s' : %s\n", dev.name, e.what());
+            job.ok = false;
+            continue;
+        }
+        job.calibrator->set_deferred_sync(true);
+
+        if (!job.calibrator->get_profile_key(job.key)) {
+            job.ok = false;
+            continue;
+        }
+
+        if (restore) {
+            job.entry = store.find(job.key, revision);
+            if (job.entry == NULL) {
+                fprintf(stderr, "ERROR: no profile revision %d for %s\n",
+                                revision, job.key);
+                job.ok = false;
+            }
+        }
+    }
+
+    // sysfs side, in parallel
+    for (unsigned i = 0; i < jobs.size(); i++) {
+        if (!jobs[i].ok)
+            continue;
+        if (pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i]) == 0)
+            jobs[i].started = true;
+        else {
+            fprintf(stderr, "ERROR: unable to start a thread.\n");
+            jobs[i].ok = false;
+        }
+    }
+
+    for (unsigned i = 0; i < jobs.size(); i++)
+        if (jobs[i].started)
+            pthread_join(jobs[i].thread, NULL);
+
+    // evdev properties, queued on the shared connection
+    for (unsigned i = 0; i < jobs.size(); i++) {
+        Job& job = jobs[i];
+        if (!job.ok || !job.entry || job.coalesced)
+            continue;
+
+        double t = now_ms();
+        if (!job.calibrator->sync_evdev_calibration()) {
+            fprintf(stderr, "ERROR: unable to set X calibration "
+                            "of '%s'.\n", job.device->name);
+            job.ok = false;
+        }
+        job.t_x = now_ms() - t;
+    }
+
+    double t_sync = now_ms();
+    X_ROUND_TRIP(XSync(display, False));
+    t_sync = now_ms() - t_sync;
+
+    // restores done, let other processes in
+    for (unsigned i = 0; i < jobs.size(); i++) {
+        Job& job = jobs[i];
+        if (job.lock && !job.coalesced)
+            job.lock->done(job.request, job.ok);
+        delete job.lock;
+        job.lock = NULL;
+    }
+
+    // profile store updates
+    if (save) {
+        ProfileStore out(store_path);
+        for (unsigned i = 0; i < jobs.size(); i++)
+            if (jobs[i].ok && !out.put(jobs[i].key, jobs[i].state))
+                jobs[i].ok = false;
+    }
+
+    // report
+    for (unsigned i = 0; i < jobs.size(); i++) {
+        const Job& job = jobs[i];
+        printf("%-32s %-48s %-9s sysfs %8.3f ms, X %8.3f ms\n",
+               devices[i].name, job.key[0] ? job.key : devices[i].key,
+               !job.ok ? "FAILED" : job.coalesced ? "coalesced" : "ok",
+               job.t_sysfs, job.t_x);
+        ok = ok && job.ok;
+    }
+    printf("%u device(s), XSync %.3f ms, total %.3f ms\n",
+           (unsigned) jobs.size(), t_sync, now_ms() - t_start);
+
+    return ok;
+}
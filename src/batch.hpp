@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _batch_hpp
+#define _batch_hpp
+
+#include "calibrator.hpp"
+#include "profile_store.hpp"
+#include "devlock.hpp"
+
+#include <pthread.h>
+
+/*
+ * Save or restore the profile of every eBeam device in one invocation.
+ *
+ * Devices are enumerated once, over one X connection shared by all the
+ * calibrators. The sysfs part (the slow one, 14 file writes per device)
+ * runs in one thread per device; the evdev properties are then queued on
+ * the shared connection and flushed with a single XSync.
+ *
+ * Each restored device stays locked (see devlock.hpp) from its sysfs
+ * write to the XSync.
+ */
+class BatchCalibrator
+{
+public:
+    BatchCalibrator(const char* store0, int revision0);
+    ~BatchCalibrator();
+
+    // save and/or restore all devices, print per-device timing
+    // Returns false if any device failed
+    bool run(bool save, bool restore);
+
+private:
+    /// per device work
+    struct Job {
+        const EbeamDevice*  device;
+        Calibrator*         calibrator;
+        char                key[PROFILE_KEY_LEN];
+        const ProfileEntry* entry;      // profile to restore
+        StateRecord         state;      // profile to save
+        bool                save;
+        bool                ok;
+        DeviceLock*         lock;       // held while restoring
+        uint32_t            request;    // restore request hash
+        bool                coalesced;  // restored by another process
+        double              t_sysfs;    // sysfs read/write, in ms
+        double              t_x;        // evdev properties, in ms
+        pthread_t           thread;
+        bool                started;
+    };
+
+    // thread body : sysfs part of a job
+    static void* run_job(void* job);
+
+    const char* const store_path;
+    const int revision;
+
+    Display* display;
+    std::vector<EbeamDevice> devices;
+    std::vector<Job> jobs;
+};
+
+#endif
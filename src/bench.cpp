@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "bench.hpp"
+#include "timing.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+// target duration of a batch of calls, in ms
+#define BENCH_BATCH_MS 0.05
+
+///
+/// allocation counting : the program's malloc wraps the libc one
+///
+
+static unsigned long bench_allocs = 0;
+
+#ifdef __GLIBC__
+#define BENCH_ALLOCS 1
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) throw()
+{
+    bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) throw()
+{
+    bench_allocs++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) throw()
+{
+    bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+#define BENCH_ALLOCS 0
+#endif
+
+///
+/// instructions counter
+///
+
+static int perf_open()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void perf_start(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static long long perf_stop(int fd)
+{
+    long long count = -1;
+
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+    }
+#endif
+
+    return count;
+}
+
+MicroBench::MicroBench(double min_ms0, const char* filter0)
+  : min_ms(min_ms0),
+    filter(filter0),
+    perf_fd(perf_open())
+{
+}
+
+MicroBench::~MicroBench()
+{
+    if (perf_fd >= 0)
+        close(perf_fd);
+}
+
+bool MicroBench::run(const char* name, void (*fn)(void* arg), void* arg)
+{
+    if (filter && strstr(name, filter) == NULL)
+        return false;
+
+    // warm up, and size the batches
+    unsigned long batch = 1;
+    double t_batch;
+    for (;;) {
+        t_batch = now_ms();
+        for (unsigned long i = 0; i < batch; i++)
+            fn(arg);
+        t_batch = now_ms() - t_batch;
+        if (t_batch >= BENCH_BATCH_MS || batch >= (1ul << 24))
+            break;
+        batch *= 2;
+    }
+
+    // no allocation of ours while measuring : samples never grows past
+    // the capacity reserved here
+    std::vector<double> samples;
+    samples.reserve(2 * (size_t) (std::max(min_ms, 0.0) /
+                                  std::max(t_batch, 1e-6)) + 16);
+
+    unsigned long allocs = bench_allocs;
+    double total = 0;
+
+    perf_start(perf_fd);
+    while (total < min_ms && samples.size() < samples.capacity()) {
+        double t = now_ms();
+        for (unsigned long i = 0; i < batch; i++)
+            fn(arg);
+        t = now_ms() - t;
+
+        samples.push_back(t * 1e6 / batch);
+        total += t;
+    }
+    long long instructions = perf_stop(perf_fd);
+
+    // min_ms <= 0 : nothing measured
+    if (samples.empty()) {
+        fprintf(stderr, "ERROR: %s : no sample in %g ms\n", name, min_ms);
+        return false;
+    }
+
+    allocs = bench_allocs - allocs;
+
+    BenchResult r;
+    r.name = name;
+    r.calls = batch * samples.size();
+    r.mean_ns = total * 1e6 / r.calls;
+    std::sort(samples.begin(), samples.end());
+    r.p99_batch_ns = samples[(samples.size() - 1) * 99 / 100];
+    r.allocs = BENCH_ALLOCS ? (double) allocs / r.calls : -1;
+    r.instructions = instructions >= 0 ? (double) instructions / r.calls
+                                       : -1;
+    results.push_back(r);
+
+    return true;
+}
+
+void MicroBench::report(FILE* fp) const
+{
+    fprintf(fp, "%-24s %10s %12s %12s %10s %12s\n", "benchmark", "calls",
+            "mean ns", "p99 batch ns", "allocs", "instructions");
+
+    for (unsigned i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        char allocs[16], instructions[16];
+
+        if (r.allocs >= 0)
+            snprintf(allocs, sizeof(allocs), "%.2f", r.allocs);
+        else
+            snprintf(allocs, sizeof(allocs), "n/a");
+        if (r.instructions >= 0)
+            snprintf(instructions, sizeof(instructions), "%.0f",
+                     r.instructions);
+        else
+            snprintf(instructions, sizeof(instructions), "n/a");
+
+        fprintf(fp, "%-24s %10lu %12.1f %12.1f %10s %12s\n", r.name,
+                r.calls, r.mean_ns, r.p99_batch_ns, allocs, instructions);
+    }
+}
+
+bool MicroBench::write_json(const char* path) const
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        return FAILURE;
+    }
+
+    char host[64];
+    if (gethostname(host, sizeof(host)) != 0)
+        snprintf(host, sizeof(host), "localhost");
+    host[sizeof(host) - 1] = 0;
+
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"host\": \"%s\",\n"
+                "  \"time\": %ld,\n  \"benchmarks\": [\n",
+            VERSION, host, (long) time(NULL));
+
+    for (unsigned i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+
+        fprintf(fp, "    { \"name\": \"%s\", \"calls\": %lu, "
+                    "\"mean_ns\": %.3f, \"p99_batch_mean_ns\": %.3f, ",
+                r.name, r.calls, r.mean_ns, r.p99_batch_ns);
+        if (r.allocs >= 0)
+            fprintf(fp, "\"allocs_per_call\": %.4f, ", r.allocs);
+        else
+            fprintf(fp, "\"allocs_per_call\": null, ");
+        if (r.instructions >= 0)
+            fprintf(fp, "\"instructions_per_call\": %.1f }", r.instructions);
+        else
+            fprintf(fp, "\"instructions_per_call\": null }");
+        fprintf(fp, "%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _bench_hpp
+#define _bench_hpp
+
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Micro benchmark harness (ebeam_bench, make bench) : a function is called
+ * in batches for a minimum time, and reported with
+ *   - mean time per call, and 99th percentile of the batch means, in ns
+ *     (calls are too short to be timed one by one),
+ *   - heap allocations per call (malloc, calloc, realloc ; glibc only),
+ *   - instructions per call (perf counter ; Linux, when permitted).
+ * Results go to a table, and to a JSON file for tracking over releases.
+ */
+
+/// result of a benchmark
+struct BenchResult {
+    const char* name;
+    unsigned long calls;
+    double mean_ns;
+    double p99_batch_ns;    // 99th percentile of the batch means
+    double allocs;          // per call, -1 if unknown
+    double instructions;    // per call, -1 if unknown
+};
+
+/// Class for running micro benchmarks
+class MicroBench
+{
+public:
+    // min_ms : minimum measured time per benchmark
+    // filter : only run the benchmarks whose name contains it, or NULL
+    MicroBench(double min_ms, const char* filter);
+    ~MicroBench();
+
+    // benchmark fn(arg)
+    // Returns false if skipped by the filter
+    bool run(const char* name, void (*fn)(void* arg), void* arg);
+
+    // table of the results
+    void report(FILE* fp) const;
+
+    // machine readable results
+    bool write_json(const char* path) const;
+
+    const std::vector<BenchResult>& get_results() const { return results; }
+
+private:
+    double min_ms;
+    const char* filter;
+    int perf_fd;            // instructions counter, -1 if none
+
+    std::vector<BenchResult> results;
+};
+
+#endif
@@ -21,13 +21,18 @@
 
 #include <sys/types.h>
 #include <string.h>
-#include <dirent.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
 // X
 #include <X11/Xatom.h>
@@ -38,17 +43,23 @@
 #include <X11/extensions/Xrandr.h> // support for multi-head setups
 #endif
 
-// gnu gsl
-#include <gsl/gsl_errno.h>
-#include <gsl/gsl_vector.h>
-#include <gsl/gsl_matrix.h>
-#include <gsl/gsl_permutation.h>
-#include <gsl/gsl_linalg.h>
-#include <gsl/gsl_blas.h>
+#include "profile_store.hpp"
+#include "devlock.hpp"
+#include "batch.hpp"
+#include "service.hpp"
+#include "timing.hpp"
+#include "session.hpp"
+#include "trace.hpp"
+#include "xstats.hpp"
+#include "probes.hpp"
+#include "monitor.hpp"
 
 /// static verbose
 bool Calibrator::verbose = false;
 
+/// start of the cli command, for timing reports
+static double t_start = 0;
+
 /// strdup helper : non-ansi
 static char* my_strdup(const char* s) {
     size_t len = strlen(s) + 1;
@@ -63,6 +74,7 @@ static char* my_strdup(const char* s) {
 Calibrator::Calibrator(XID device_id0,
                        const char* const device_name0,
                        const char* const device_dir0,
+                       const char* const device_key0,
                        const int precision0,
                        const int threshold_doubleclick0,
                        const int z_min_x0,
@@ -70,10 +82,15 @@ Calibrator::Calibrator(XID device_id0,
                        const int z_max_x0,
                        const int z_max_y0,
                        const char* ifile0,
-                       const char* ofile0)
-  : device_id(device_id0),
+                       const char* ofile0,
+                       Display* display0)
+  : display(display0),
+    own_display(display0 == NULL),
+    deferred_sync(false),
+    device_id(device_id0),
     device_name(device_name0),
     device_dir(device_dir0),
+    device_key(device_key0),
     precision(precision0),
     threshold_doubleclick(threshold_doubleclick0),
     min_x(z_min_x0),
@@ -81,37 +98,35 @@ Calibrator::Calibrator(XID device_id0,
     max_x(z_max_x0),
     max_y(z_max_y0),
     ifile(ifile0),
-    ofile(ofile0)
+    ofile(ofile0),
+    state_format(STATE_BINARY),
+    profile_store(NULL),
+    profile_save(false),
+    profile_restore(false),
+    profile_revision(0),
+    query(false),
+    reset(false),
+    session_file(NULL),
+    offline(false)
 {
+    TraceSpan span("Calibrator");
+
     int screen_num;
     
     reset_tuples();
 
-    display = XOpenDisplay(NULL);
+    if (own_display)
+        display = X_ROUND_TRIP(XOpenDisplay(NULL));
     if (display == NULL) {
         throw std::runtime_error("Unable to connect to X server.");
     }
 
-    screen_num = DefaultScreen(display);
+    XPhase phase(display, "calibrator_setup");
 
-#ifdef HAVE_X11_XRANDR
-    int nsizes;
+    screen_num = DefaultScreen(display);
 
-    XRRScreenSize* randrsize = XRRSizes(display, screen_num, &nsizes);
-    if (nsizes != 0) {
-        Rotation screenrot = 0;
-        XRRRotations(display, screen_num, &screenrot);
-        bool rot = screenrot & RR_Rotate_90 || screenrot & RR_Rotate_270;
-        screen_width = rot ? randrsize->height : randrsize->width;
-        screen_height = rot ? randrsize->width : randrsize->height;
-    } else {
-        screen_width = DisplayWidth(display, screen_num);
-        screen_height = DisplayHeight(display, screen_num);
-    }
-#else
-    screen_width = DisplayWidth(display, screen_num);
-    screen_height = DisplayHeight(display, screen_num);
-#endif
+    get_screen_geometry(display, screen_num,
+                        screen_width, screen_height, screen_rotation);
 
     zoned = true;
     if (!(min_x | min_y | max_x | max_y)) {
@@ -120,17 +135,73 @@ Calibrator::Calibrator(XID device_id0,
 	zoned = false;
     }
     
-    dev = XOpenDevice(display, device_id);
+    dev = X_ROUND_TRIP(XOpenDevice(display, device_id));
     if (!dev) {
-        XCloseDisplay(display);
+        if (own_display) {
+            XStats::close_display(display);
+            XCloseDisplay(display);
+        }
         throw std::runtime_error("Unable to open device.");
     }
 }
 
+Calibrator::Calibrator(const char* const device_name0,
+                       const int precision0,
+                       const int threshold_doubleclick0,
+                       const int z_min_x0,
+                       const int z_min_y0,
+                       const int z_max_x0,
+                       const int z_max_y0,
+                       const int width0,
+                       const int height0,
+                       const int rotation0,
+                       const char* const device_dir0)
+  : display(NULL),
+    own_display(false),
+    deferred_sync(false),
+    devInfo(NULL),
+    dev(NULL),
+    device_id(0),
+    device_name(device_name0),
+    device_dir(device_dir0),
+    device_key(NULL),
+    precision(precision0),
+    threshold_doubleclick(threshold_doubleclick0),
+    min_x(z_min_x0),
+    min_y(z_min_y0),
+    max_x(z_max_x0),
+    max_y(z_max_y0),
+    screen_width(width0),
+    screen_height(height0),
+    screen_rotation(rotation0),
+    ifile(NULL),
+    ofile(NULL),
+    state_format(STATE_BINARY),
+    profile_store(NULL),
+    profile_save(false),
+    profile_restore(false),
+    profile_revision(0),
+    query(false),
+    reset(false),
+    session_file(NULL),
+    offline(true)
+{
+    reset_tuples();
+
+    zoned = true;
+    if (!(min_x | min_y | max_x | max_y)) {
+        max_x = screen_width -1;
+        max_y = screen_height -1;
+        zoned = false;
+    }
+}
+
 Calibrator::~Calibrator ()
 {
-    XCloseDevice(display, dev);
-    XCloseDisplay(display);
+    if (dev)
+        XCloseDevice(display, dev);
+    if (own_display)
+        XCloseDisplay(display);
 }
 
 ///
@@ -145,7 +216,8 @@ static void usage_gui(char* cmd)
     fprintf(stderr, "\t-v, --verbose: "
                     "print debug messages during the process\n");
     fprintf(stderr, "\t--list: list calibratable input devices and quit\n");
-    fprintf(stderr, "\t--device <device name or id>: "
+    fprintf(stderr, "\t--device <device name, id, vendor:product, "
+                    "serial:<serial> or phys:<usb port>>: "
                     "select a specific device to calibrate\n");
     fprintf(stderr, "\t--zone <min_x min_y max_x max_y>: set the active zone "
                     "(default: full screen)\n");
@@ -153,9 +225,61 @@ static void usage_gui(char* cmd)
                     "(default: %i)\n", PRECISION);
     fprintf(stderr, "\t--threshold: set the misclick threshold "
                     "(0=off, default: %i)\n", THR_DOUBLECLICK);
+    fprintf(stderr, "\t--record <file>: record the session "
+                    "(raw events, targets, result) to a log\n");
+    fprintf(stderr, "\t--replay <file>: replay a recorded session, "
+                    "without X nor device, and quit\n");
+    fprintf(stderr, "\t--simulate <sessions>: calibrate a simulated pen "
+                    "and device, report accuracy and speed, and quit\n");
+    fprintf(stderr, "\t--sim-model <projective|radial>: simulated board "
+                    "mapping (default: projective)\n");
+    fprintf(stderr, "\t--sim-noise <sigma>: simulated raw jitter "
+                    "(default: 3)\n");
+    fprintf(stderr, "\t--trace <file>: write the phase timings "
+                    "as a Chrome trace\n");
+    fprintf(stderr, "\t--xstats: print the X requests, round trips "
+                    "and server waits per phase at exit\n");
+}
+
+/// offline calibrator replaying a session log
+static Calibrator* make_calibrator_replay(const char* file)
+{
+    SessionLog log;
+    const SessionRecord* setup = NULL;
+    const SessionRecord* zone = NULL;
+
+    if (!log.load(file))
+        exit(1);
+
+    for (unsigned i = 0; i < log.get_count() && !(setup && zone); i++) {
+        const SessionRecord& rec = log.get_record(i);
+        if (rec.type == SESSION_SETUP && !setup)
+            setup = &rec;
+        else if (rec.type == SESSION_ZONE && setup && !zone)
+            zone = &rec;
+    }
+
+    if (!setup || !zone) {
+        fprintf(stderr, "Error: no screen setup in session log %s\n", file);
+        exit(1);
+    }
+
+    // same parameters as the recorded session
+    bool zoned = setup->v.i[5];
+    Calibrator* calibrator =
+        new Calibrator(my_strdup(log.get_header()->device),
+                       setup->v.i[3], setup->v.i[4],
+                       zoned ? zone->v.i[0] : 0, zoned ? zone->v.i[1] : 0,
+                       zoned ? zone->v.i[2] : 0, zoned ? zone->v.i[3] : 0,
+                       setup->v.i[0], setup->v.i[1], setup->v.i[2]);
+    calibrator->set_session_file(file);
+
+    return calibrator;
 }
 
-Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
+Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv,
+                                            int offline_width,
+                                            int offline_height)
 {
     bool list_devices = false;
     const char* pre_device = NULL;
@@ -165,6 +289,8 @@ Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
     int z_min_y = 0;
     int z_max_x = 0;
     int z_max_y = 0;
+    const char* record = NULL;
+    const char* replay = NULL;
 
     // parse input
     if (argc > 1) {
@@ -181,6 +307,10 @@ Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
             if (strcmp("-v", argv[i]) == 0 ||
                 strcmp("--verbose", argv[i]) == 0) {
                 verbose = true;
+                EbeamSysfs::verbose = true;
+                DeviceLock::verbose = true;
+                SessionLog::verbose = true;
+                Homography::verbose = true;
                 fprintf(stderr, "ebeam_calibrator v%s\n", VERSION);
             } else
 
@@ -243,6 +373,47 @@ Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
                     usage_gui(argv[0]);
                     exit(1);
                 }
+            } else
+
+            // Record the session ?
+            if (strcmp("--record", argv[i]) == 0) {
+                if (argc > i+1)
+                    record = argv[++i];
+                else {
+                    fprintf(stderr, "Error: --record needs a file name "
+                                    "as argument.\n");
+                    usage_gui(argv[0]);
+                    exit(1);
+                }
+            } else
+
+            // Replay a session ?
+            if (strcmp("--replay", argv[i]) == 0) {
+                if (argc > i+1)
+                    replay = argv[++i];
+                else {
+                    fprintf(stderr, "Error: --replay needs a file name "
+                                    "as argument.\n");
+                    usage_gui(argv[0]);
+                    exit(1);
+                }
+            } else
+
+            // Phase timings ?
+            if (strcmp("--trace", argv[i]) == 0) {
+                if (argc > i+1)
+                    Trace::start(argv[++i]);
+                else {
+                    fprintf(stderr, "Error: --trace needs a file name "
+                                    "as argument.\n");
+                    usage_gui(argv[0]);
+                    exit(1);
+                }
+            } else
+
+            // X traffic accounting ?
+            if (strcmp("--xstats", argv[i]) == 0) {
+                XStats::enable();
             } else {
 
                 // unknown option
@@ -253,13 +424,22 @@ Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
         }
     }
 
+    // no X nor device needed
+    if (replay)
+        return make_calibrator_replay(replay);
+    if (offline_width > 0)
+        return new Calibrator("offline", precision, thr_doubleclick,
+                              z_min_x, z_min_y, z_max_x, z_max_y,
+                              offline_width, offline_height, 0);
+
     // Find the device
     XID         device_id   = (XID) -1;
     const char* device_name = NULL;
     const char* device_dir  = NULL;
+    const char* device_key  = NULL;
 
     int nr_found = find_device(pre_device, list_devices,
-                               device_id, device_name, device_dir);
+                               device_id, device_name, device_dir, device_key);
 
     if (list_devices) {
         // list printed in find_device
@@ -279,18 +459,24 @@ Calibrator* Calibrator::make_calibrator_gui(int argc, char** argv)
 
     } else if (nr_found > 1) {
         fprintf(stderr, "Warning: multiple eBeam devices found.\n");
-        fprintf(stderr, "         Calibrating last one ('%s')\n", device_name);
-        fprintf(stderr, "         Use --device to select another one.\n");
+        fprintf(stderr, "         Calibrating last one ('%s', %s)\n",
+                        device_name, device_key);
+        fprintf(stderr, "         Use --device to select another one, "
+                        "e.g. by serial: or phys:.\n");
     }
 
     if (verbose) {
         fprintf(stderr, "Selected device: '%s'\n", device_name);
     }
 
-    return new Calibrator(device_id, device_name, device_dir,
-                          precision, thr_doubleclick,
-			  z_min_x, z_min_y, z_max_x, z_max_y,
-			  NULL, NULL);
+    Calibrator* calibrator =
+        new Calibrator(device_id, device_name, device_dir, device_key,
+                       precision, thr_doubleclick,
+                       z_min_x, z_min_y, z_max_x, z_max_y,
+                       NULL, NULL);
+    calibrator->set_session_file(record);
+
+    return calibrator;
 }
 
 static void usage_cli(char* cmd)
@@ -303,11 +489,125 @@ static void usage_cli(char* cmd)
                     "save current calibration to file.\n", cmd);
     fprintf(stderr, "\t%s [options] --restore <file>: "
                     "restore calibration from file.\n", cmd);
+    fprintf(stderr, "\t%s [options] --convert <infile> <outfile>: "
+                    "convert a state file and quit.\n", cmd);
+    fprintf(stderr, "\t%s [options] --save | --restore: "
+                    "save/restore the device profile in the profile store.\n",
+                    cmd);
+    fprintf(stderr, "\t%s [options] --all --save | --restore: "
+                    "save/restore the profiles of all devices.\n", cmd);
+    fprintf(stderr, "\t%s [options] --history: "
+                    "list the stored revisions of the device profile.\n", cmd);
+    fprintf(stderr, "\t%s [options] --query: "
+                    "print the current calibration.\n", cmd);
+    fprintf(stderr, "\t%s [options] --reset: "
+                    "reset the device to uncalibrated.\n", cmd);
+    fprintf(stderr, "\t%s [options] --monitor <landmarks>: "
+                    "watch taps near landmarks for calibration drift.\n",
+                    cmd);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "\t-v, --verbose: "
                     "print debug messages during the process.\n");
-    fprintf(stderr, "\t--device <device name or id>: "
+    fprintf(stderr, "\t--device <device name, id, vendor:product, "
+                    "serial:<serial> or phys:<usb port>>: "
                     "select a specific device.\n");
+    fprintf(stderr, "\t--format <text|binary>: "
+                    "state file format to write (default: binary).\n");
+    fprintf(stderr, "\t--store <file>: "
+                    "profile store (default: %s).\n", PROFILE_STORE_PATH);
+    fprintf(stderr, "\t--revision <n>: "
+                    "restore the n-th previous profile (default: 0, latest).\n");
+    fprintf(stderr, "\t--socket <path>: "
+                    "calibration service socket of ebeam_daemon.\n");
+    fprintf(stderr, "\t--no-service: "
+                    "don't use ebeam_daemon, even if it is running.\n");
+    fprintf(stderr, "\t--trace <file>: "
+                    "write the phase timings as a Chrome trace.\n");
+    fprintf(stderr, "\t--xstats: "
+                    "print the X requests and round trips per phase at exit.\n");
+    fprintf(stderr, "\t--threshold <px>: "
+                    "drift alert threshold of --monitor (default: %d).\n",
+                    MONITOR_THRESHOLD);
+}
+
+/// save/restore/query/reset through ebeam_daemon
+static bool run_service_client(const char* path, const char* device,
+                               const char* ifile, const char* ofile,
+                               StateFormat format,
+                               bool save_profile, bool restore_profile,
+                               int revision, bool query, bool reset)
+{
+    ServiceRequest req;
+    ServiceReply rep;
+
+    if (Calibrator::verbose)
+        fprintf(stderr, "Using calibration service %s\n", path);
+
+    // saving
+    if (ofile || save_profile) {
+        Service::init_request(req, SERVICE_SAVE, device);
+        if (save_profile)
+            req.flags |= SERVICE_STORE;
+
+        if (!Service::call(path, req, rep))
+            return FAILURE;
+
+        if (ofile && !StateFile::save(ofile, rep.state, format))
+            return FAILURE;
+
+        if (Calibrator::verbose && save_profile)
+            fprintf(stderr, "Calibration data saved to profile %s "
+                            "(revision %u)\n", rep.key, rep.revision);
+    }
+
+    if (query) {
+        Service::init_request(req, SERVICE_QUERY, device);
+
+        if (!Service::call(path, req, rep))
+            return FAILURE;
+
+        Calibrator::print_state(rep.key, rep.state);
+    }
+
+    if (reset) {
+        Service::init_request(req, SERVICE_RESET, device);
+
+        if (!Service::call(path, req, rep))
+            return FAILURE;
+    }
+
+    // restoring
+    if (ifile) {
+        StateFile state;
+
+        if (!state.load(ifile))
+            return FAILURE;
+
+        Service::init_request(req, SERVICE_RESTORE, device);
+        req.state = *state.get_record();
+        StateFile::seal(req.state);
+
+        if (!Service::call(path, req, rep))
+            return FAILURE;
+    }
+
+    if (restore_profile) {
+        Service::init_request(req, SERVICE_RESTORE, device);
+        req.flags |= SERVICE_STORE;
+        req.revision = revision;
+
+        if (!Service::call(path, req, rep))
+            return FAILURE;
+
+        if (Calibrator::verbose)
+            fprintf(stderr, "Calibration data restored from profile %s "
+                            "(revision %u)\n", rep.key, rep.revision);
+    }
+
+    if (Calibrator::verbose)
+        fprintf(stderr, "Done in %.3f ms (service)\n", now_ms() - t_start);
+
+    return SUCCESS;
 }
 
 Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
@@ -316,6 +616,27 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
     const char* pre_device = NULL;
     const char* ifile = NULL;
     const char* ofile = NULL;
+    const char* cfile_in = NULL;
+    const char* cfile_out = NULL;
+    bool format_set = false;
+    StateFormat format = STATE_BINARY;
+    const char* store = PROFILE_STORE_PATH;
+    bool save_profile = false;
+    bool restore_profile = false;
+    bool show_history = false;
+    const char* landmarks = NULL;
+    double threshold = MONITOR_THRESHOLD;
+    bool all_devices = false;
+    int revision = 0;
+    bool query = false;
+    bool reset = false;
+    bool use_service = true;
+    bool store_set = false;
+    bool socket_set = false;
+    char socket_path[108];
+
+    t_start = now_ms();
+    Service::default_path(socket_path, sizeof(socket_path));
 
     // parse input
     if (argc > 1) {
@@ -332,6 +653,12 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
             if (strcmp("-v", argv[i]) == 0 ||
                 strcmp("--verbose", argv[i]) == 0) {
                 verbose = true;
+                StateFile::verbose = true;
+                ProfileStore::verbose = true;
+                EbeamSysfs::verbose = true;
+                Service::verbose = true;
+                DeviceLock::verbose = true;
+                DriftMonitor::verbose = true;
                 fprintf(stderr, "ebeam_state v%s\n", VERSION);
             } else
 
@@ -354,12 +681,44 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
                 }
             } else
 
-            // Save ?
+            // Save ? without file name, use the profile store
             if (strcmp("--save", argv[i]) == 0) {
-                if (argc > i+1)
+                if (argc > i+1 && argv[i+1][0] != '-')
                     ofile = argv[++i];
+                else
+                    save_profile = true;
+
+            } else
+
+            // Restore ? without file name, use the profile store
+            if (strcmp("--restore", argv[i]) == 0) {
+                if (argc > i+1 && argv[i+1][0] != '-')
+                    ifile = argv[++i];
+                else
+                    restore_profile = true;
+
+            } else
+
+            // Profile store ?
+            if (strcmp("--store", argv[i]) == 0) {
+                if (argc > i+1) {
+                    store = argv[++i];
+                    store_set = true;
+                } else {
+                    fprintf(stderr, "Error: --store needs a file name "
+                                    "as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // Profile revision ?
+            if (strcmp("--revision", argv[i]) == 0) {
+                if (argc > i+1)
+                    revision = atoi(argv[++i]);
                 else {
-                    fprintf(stderr, "Error: --save needs a file name "
+                    fprintf(stderr, "Error: --revision needs a number "
                                     "as argument;\n");
                     usage_cli(argv[0]);
                     exit(1);
@@ -367,12 +726,117 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
 
             } else
 
-            // Restore ?
-            if (strcmp("--restore", argv[i]) == 0) {
+            // Profile history ?
+            if (strcmp("--history", argv[i]) == 0) {
+                show_history = true;
+
+            } else
+
+            // All devices ?
+            if (strcmp("--all", argv[i]) == 0) {
+                all_devices = true;
+
+            } else
+
+            // Query ?
+            if (strcmp("--query", argv[i]) == 0) {
+                query = true;
+
+            } else
+
+            // Reset ?
+            if (strcmp("--reset", argv[i]) == 0) {
+                reset = true;
+
+            } else
+
+            // Drift monitor ?
+            if (strcmp("--monitor", argv[i]) == 0) {
                 if (argc > i+1)
-                    ifile = argv[++i];
+                    landmarks = argv[++i];
+                else {
+                    fprintf(stderr, "Error: --monitor needs a landmarks "
+                                    "file as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // Drift alert threshold ?
+            if (strcmp("--threshold", argv[i]) == 0) {
+                if (argc > i+1 && atof(argv[i+1]) > 0)
+                    threshold = atof(argv[++i]);
+                else {
+                    fprintf(stderr, "Error: --threshold needs a distance "
+                                    "in px as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // Service socket ?
+            if (strcmp("--socket", argv[i]) == 0) {
+                if (argc > i+1) {
+                    snprintf(socket_path, sizeof(socket_path), "%s",
+                             argv[++i]);
+                    socket_set = true;
+                } else {
+                    fprintf(stderr, "Error: --socket needs a file name "
+                                    "as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // Don't use the service ?
+            if (strcmp("--no-service", argv[i]) == 0) {
+                use_service = false;
+
+            } else
+
+            // Phase timings ?
+            if (strcmp("--trace", argv[i]) == 0) {
+                if (argc > i+1)
+                    Trace::start(argv[++i]);
                 else {
-                    fprintf(stderr, "Error: --restore needs a file name "
+                    fprintf(stderr, "Error: --trace needs a file name "
+                                    "as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // X traffic accounting ?
+            if (strcmp("--xstats", argv[i]) == 0) {
+                XStats::enable();
+
+            } else
+
+            // State file format ?
+            if (strcmp("--format", argv[i]) == 0) {
+                if (argc > i+1 && StateFile::parse_format(argv[i+1], format)) {
+                    format_set = true;
+                    i++;
+                } else {
+                    fprintf(stderr, "Error: --format needs 'text' or 'binary' "
+                                    "as argument;\n");
+                    usage_cli(argv[0]);
+                    exit(1);
+                }
+
+            } else
+
+            // Convert ?
+            if (strcmp("--convert", argv[i]) == 0) {
+                if (argc > i+2) {
+                    cfile_in = argv[++i];
+                    cfile_out = argv[++i];
+                } else {
+                    fprintf(stderr, "Error: --convert needs 2 file names "
                                     "as argument;\n");
                     usage_cli(argv[0]);
                     exit(1);
@@ -394,13 +858,72 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
         exit(1);
     }
 
+    // Conversion doesn't need any device
+    if (cfile_in) {
+        StateFile in;
+
+        if (!in.load(cfile_in))
+            exit(1);
+
+        // default to the other format
+        if (!format_set)
+            format = (in.get_format() == STATE_TEXT) ? STATE_BINARY
+                                                     : STATE_TEXT;
+
+        if (!StateFile::save(cfile_out, *in.get_record(), format))
+            exit(1);
+
+        if (verbose)
+            fprintf(stderr, "Converted %s to %s\n", cfile_in, cfile_out);
+        exit(0);
+    }
+
+    // All devices, through the profile store
+    if (all_devices) {
+        if (ifile || ofile || pre_device || !(save_profile || restore_profile)) {
+            fprintf(stderr, "Error: --all only works with --save/--restore "
+                            "without file name, and no --device.\n");
+            usage_cli(argv[0]);
+            exit(1);
+        }
+
+        BatchCalibrator batch(store, revision);
+        exit(batch.run(save_profile, restore_profile) ? 0 : 1);
+    }
+
+    // ebeam_daemon running : it has the devices at hand, use it
+    bool command = ifile || ofile || save_profile || restore_profile ||
+                   query || reset;
+
+    // it has its own profile store
+    if (use_service && store_set && (save_profile || restore_profile)) {
+        if (verbose)
+            fprintf(stderr, "--store given : not using the calibration "
+                            "service\n");
+        use_service = false;
+    }
+
+    // no daemon of our own : the system one
+    if (use_service && command && !socket_set &&
+        !Service::available(socket_path))
+        snprintf(socket_path, sizeof(socket_path), "%s", SERVICE_SOCKET_PATH);
+
+    if (use_service && command && !list_devices && !show_history &&
+        Service::available(socket_path)) {
+        bool ok = run_service_client(socket_path, pre_device, ifile, ofile,
+                                     format, save_profile, restore_profile,
+                                     revision, query, reset);
+        exit(ok ? 0 : 1);
+    }
+
     // Find the device
     XID         device_id   = (XID) -1;
     const char* device_name = NULL;
     const char* device_dir  = NULL;
+    const char* device_key  = NULL;
 
     int nr_found = find_device(pre_device, list_devices,
-                               device_id, device_name, device_dir);
+                               device_id, device_name, device_dir, device_key);
 
     if (list_devices) {
         // list printed in find_device
@@ -422,191 +945,423 @@ Calibrator* Calibrator::make_calibrator_cli(int argc, char** argv)
 
     } else if (nr_found > 1) {
         fprintf(stderr, "Warning: multiple eBeam devices found.\n");
-        fprintf(stderr, "         Calibrating last one ('%s')\n", device_name);
-        fprintf(stderr, "         Use --device to select another one.\n");
+        fprintf(stderr, "         Calibrating last one ('%s', %s)\n",
+                        device_name, device_key);
+        fprintf(stderr, "         Use --device to select another one, "
+                        "e.g. by serial: or phys:.\n");
     }
 
     if (verbose) {
         fprintf(stderr, "Selected device: '%s'\n", device_name);
     }
 
-    return new Calibrator(device_id, device_name, device_dir,
-                          PRECISION, THR_DOUBLECLICK,
-                          0, 0, 0, 0,
-                          ifile, ofile);
+    Calibrator* calibrator = new Calibrator(device_id, device_name,
+                                            device_dir, device_key,
+                                            PRECISION, THR_DOUBLECLICK,
+                                            0, 0, 0, 0,
+                                            ifile, ofile);
+    calibrator->set_state_format(format);
+    calibrator->set_profile_store(store, save_profile, restore_profile,
+                                  revision);
+    calibrator->set_query_reset(query, reset);
+
+    if (show_history) {
+        bool ok = calibrator->list_profile_history();
+        delete calibrator;
+        exit(ok ? 0 : 1);
+    }
+
+    if (landmarks) {
+        bool ok = calibrator->monitor_drift(landmarks, threshold);
+        delete calibrator;
+        exit(ok ? 0 : 1);
+    }
+
+    return calibrator;
 }
 
 int Calibrator::find_device(const char* pre_device,
                             bool list_devices,
                             XID& device_id,
                             const char*& device_name,
-			    const char*& device_dir)
+			    const char*& device_dir,
+                            const char*& device_key)
 {
-    bool pre_device_is_id = true;
-    int found = 0;
-    int xi_opcode;
-    int event;
-    int error;
-    int ndevices;        // number of input devices found
-    char *device_event;
-    char buffer[128];
-    
+    TraceSpan span("find_device");
     Display* display;
-    Atom prop;
-    Atom act_type;
-    int act_format;
-    unsigned long nitems, bytes_after;
-    unsigned char *data;
-    XDeviceInfoPtr list;
-    XDeviceInfoPtr slist;
+    std::vector<EbeamDevice> devices;
 
-    display = XOpenDisplay(NULL);
+    display = X_ROUND_TRIP(XOpenDisplay(NULL));
     if (display == NULL) {
         fprintf(stderr, "ERROR: Unable to connect to X server.\n");
         return 0;
     }
 
-    if (!XQueryExtension(display, "XInputExtension",
-                                  &xi_opcode, &event, &error)) {
-        fprintf(stderr, "ERROR : X Input extension not available.\n");
+    find_devices(display, pre_device, list_devices, devices);
+
+    flush_device_cache();
+    XCloseDisplay(display);
+
+    if (devices.empty())
         return 0;
-    }
 
-    // verbose, get Xi version
-    if (verbose) {
-        XExtensionVersion *version = XGetExtensionVersion(display, INAME);
+    // last one
+    const EbeamDevice& last = devices.back();
+    device_id = last.id;
+    device_name = last.name;
+    device_dir = last.dir;
+    device_key = last.key;
 
-        if (version && (version != (XExtensionVersion*) NoSuchExtension)) {
-            fprintf(stderr, "%s version is %i.%i\n",
-                   INAME, version->major_version, version->minor_version);
-            XFree(version);
-        }
-    }
+    return devices.size();
+}
 
-    // device's node property : /dev/input/eventXX
-    prop = XInternAtom (display, "Device Node", False);
-    if (!prop) {
-        fprintf(stderr, "ERROR : Device Node property not found\n");
-	return 0;
-    }
-    
-    if (pre_device != NULL) {
-        // check whether the pre_device is an ID (only digits)
-        int len = strlen(pre_device);
-        for (int loop=0; loop<len; loop++) {
-            if (!isdigit(pre_device[loop])) {
-                pre_device_is_id = false;
-                break;
-            }
-        }
-    }
+/// session cache of find_devices, see flush_device_cache
+static Display* cache_display = NULL;
+static std::vector<EbeamDevice> cache_devices;
 
-    // get input devices list
-    slist=list=(XDeviceInfoPtr) XListInputDevices(display, &ndevices);
+/// X errors on devices that vanish or don't exist
+static bool x_error = false;
 
-    for (int i=0; i<ndevices; i++, list++)
-    {
-        if (list->use == IsXKeyboard || list->use == IsXPointer)
-            // virtual master device
-            continue;
+static int trap_x_error(Display*, XErrorEvent*)
+{
+    x_error = true;
+    return 0;
+}
 
-        // if we are looking for a specific device
-        if (pre_device != NULL) {
-            if ((pre_device_is_id && list->id == (XID) atoi(pre_device)) ||
-                (!pre_device_is_id && strcmp(list->name, pre_device) == 0)) {
-                // OK, fall through
-            } else {
-                // skip, not this device
-                continue;
+/// copy of a device, with its own strings
+static EbeamDevice dup_device(const EbeamDevice& dev)
+{
+    EbeamDevice copy;
+
+    copy.id = dev.id;
+    copy.name = my_strdup(dev.name);
+    copy.event = my_strdup(dev.event);
+    copy.dir = my_strdup(dev.dir);
+    copy.key = my_strdup(dev.key);
+    copy.ident = dev.ident;
+
+    return copy;
+}
+
+/// identity order : stable across boots, unlike the X enumeration order
+static bool identity_less(const EbeamDevice& a, const EbeamDevice& b)
+{
+    int cmp = strcmp(a.key, b.key);
+
+    return cmp < 0 || (cmp == 0 && a.id < b.id);
+}
+
+/// is info an eBeam device ? (local checks only, no request)
+static bool is_ebeam_device(const XIDeviceInfo* info)
+{
+    // not a virtual master device
+    if (info->use != XISlavePointer && info->use != XIFloatingSlave)
+        return false;
+
+    // name must contains "eBeam"
+    if (!strstr(info->name, "eBeam"))
+        return false;
+
+    // two absolute axes with a range
+    int axes = 0;
+    for (int j = 0; j < info->num_classes; j++) {
+        const XIValuatorClassInfo* v =
+            (const XIValuatorClassInfo*) info->classes[j];
+
+        if (v->type != XIValuatorClass || v->number > 1)
+            continue;
+
+        if (v->mode != XIModeAbsolute) {
+            if (Calibrator::verbose)
+                fprintf(stderr, "Skipping device '%s' id=%i : "
+                                "does not report Absolute events.\n",
+                                info->name, info->deviceid);
+            return false;
+        }
+
+        if (!(v->min == -1 && v->max == -1))
+            axes++;
+    }
+
+    if (axes < 2) {
+        if (Calibrator::verbose)
+            fprintf(stderr, "Skipping device '%s' id=%i : does "
+                            "not have two calibratable axes.\n",
+                            info->name, info->deviceid);
+        return false;
+    }
+
+    return true;
+}
+
+/// fill device from its Device Node property : one round trip
+static bool get_device_node(Display* display, const XIDeviceInfo* info,
+                            Atom prop, EbeamDevice& device)
+{
+    Atom act_type;
+    int act_format;
+    unsigned long nitems, bytes_after;
+    unsigned char *data;
+    char buffer[128];
+
+    if (X_ROUND_TRIP(XIGetProperty(display, info->deviceid, prop, 0, 1000,
+                                   False, AnyPropertyType, &act_type,
+                                   &act_format, &nitems, &bytes_after,
+                                   &data)) != Success) {
+        if (Calibrator::verbose)
+            fprintf(stderr, "Skipping device '%s' id=%i : "
+                            "no device node.\n",
+                            info->name, info->deviceid);
+        return false;
+    }
+
+    if (nitems == 0) {
+        if (Calibrator::verbose)
+            fprintf(stderr, "Skipping device '%s' id=%i : "
+                            "0 device node.\n",
+                            info->name, info->deviceid);
+        XFree(data);
+        return false;
+    }
+
+    if ( !( (act_type == XA_STRING) && (act_format == 8) ) ||
+         !strstr((char *) data, "event") ) {
+        if (Calibrator::verbose)
+            fprintf(stderr, "Skipping device '%s' id=%i : "
+                            "bad device node format.\n",
+                            info->name, info->deviceid);
+        XFree(data);
+        return false;
+    }
+
+    // All clear, good device
+    device.id = info->deviceid;
+    device.name = my_strdup(info->name);
+    device.event = my_strdup(strstr((char *) data, "event"));
+    EbeamSysfs::event_dir(device.event, buffer, sizeof(buffer));
+    device.dir = my_strdup(buffer);
+    EbeamSysfs::identify(device.dir, device.ident);
+    device.key = EbeamSysfs::device_key(device.ident);
+    XFree(data);
+
+    if (Calibrator::verbose)
+        fprintf(stderr, "  Using %s sysfs directory (%s, %04x:%04x).\n",
+                        device.dir, device.key,
+                        device.ident.vendor, device.ident.product);
+
+    return true;
+}
+
+int Calibrator::find_devices(Display* display,
+                             const char* pre_device,
+                             bool list_devices,
+                             std::vector<EbeamDevice>& devices)
+{
+    bool pre_device_is_id = true;
+    bool pre_device_is_ident = false;
+    int xi_opcode;
+    int event;
+    int error;
+    int major = 2, minor = 0;
+    int ndevices;        // number of input devices found
+    int ncandidates = 0; // number of Device Node requests
+    double t = now_ms();
+
+    if (pre_device != NULL) {
+        // check whether the pre_device is an ID (only digits)
+        int len = strlen(pre_device);
+        for (int loop=0; loop<len; loop++) {
+            if (!isdigit(pre_device[loop])) {
+                pre_device_is_id = false;
+                break;
             }
         }
+        pre_device_is_ident = EbeamSysfs::is_selector(pre_device);
+    }
+
+    // whole enumeration already done on this display
+    if (pre_device == NULL && display == cache_display) {
+        for (unsigned i = 0; i < cache_devices.size(); i++) {
+            devices.push_back(dup_device(cache_devices[i]));
+            if (list_devices)
+                printf("Device '%s' id=%i (%s, %04x:%04x, %s)\n",
+                       cache_devices[i].name, (int)cache_devices[i].id,
+                       cache_devices[i].event, cache_devices[i].ident.vendor,
+                       cache_devices[i].ident.product, cache_devices[i].key);
+        }
+        if (verbose)
+            fprintf(stderr, "Using cached device list.\n");
+        return devices.size();
+    }
+
+    XPhase phase(display, "find_devices");
+
+    if (!X_ROUND_TRIP(XQueryExtension(display, "XInputExtension",
+                                      &xi_opcode, &event, &error)) ||
+        X_ROUND_TRIP(XIQueryVersion(display, &major, &minor)) != Success) {
+        fprintf(stderr, "ERROR : X Input extension 2.0 not available.\n");
+        return 0;
+    }
+
+    // verbose, get Xi version
+    if (verbose)
+        fprintf(stderr, "%s version is %i.%i\n", INAME, major, minor);
+
+    // device's node property : /dev/input/eventXX
+    Atom prop = X_ROUND_TRIP(XInternAtom(display, "Device Node", False));
+    if (!prop) {
+        fprintf(stderr, "ERROR : Device Node property not found\n");
+        return 0;
+    }
+
+    // get input devices : only the given one when we have its id
+    XIDeviceInfo* list;
+    if (pre_device != NULL && pre_device_is_id) {
+        XErrorHandler old = XSetErrorHandler(trap_x_error);
+        x_error = false;
+        list = X_ROUND_TRIP(XIQueryDevice(display, atoi(pre_device),
+                                          &ndevices));
+        X_ROUND_TRIP(XSync(display, False));
+        XSetErrorHandler(old);
+        if (x_error) {
+            if (list)
+                XIFreeDeviceInfo(list);
+            list = NULL;
+            ndevices = 0;
+        }
+    } else
+        list = X_ROUND_TRIP(XIQueryDevice(display, XIAllDevices, &ndevices));
+
+    // filter locally : Device Node is only asked for eBeam candidates
+    for (int i=0; i<ndevices; i++) {
+        const XIDeviceInfo* info = list + i;
+        EbeamDevice device;
 
-        if (!strstr(list->name,"eBeam")) // name must contains "eBeam"
+        // if we are looking for a specific device, by name
+        if (pre_device != NULL && !pre_device_is_id && !pre_device_is_ident &&
+            strcmp(info->name, pre_device) != 0)
             continue;
 
-        XAnyClassPtr any = (XAnyClassPtr) (list->inputclassinfo);
-        for (int j=0; j<list->num_classes; j++)
-        {
-            if (any->c_class == ValuatorClass)
-            {
-                XValuatorInfoPtr V = (XValuatorInfoPtr) any;
-                XAxisInfoPtr ax = (XAxisInfoPtr) V->axes;
-
-                if (V->mode != Absolute) {
-                    if (verbose)
-                        fprintf(stderr, "Skipping device '%s' id=%i : "
-                                        "does not report Absolute events.\n",
-                                        list->name, (int)list->id);
-                } else if (V->num_axes < 2 ||
-                           (ax[0].min_value == -1 && ax[0].max_value == -1) ||
-                           (ax[1].min_value == -1 && ax[1].max_value == -1)) {
-                    if (verbose)
-                        fprintf(stderr, "Skipping device '%s' id=%i : does "
-                                        "not have two calibratable axes.\n",
-                                        list->name, (int)list->id);
-                } else {
-                    /* eBeam device found */
-
-                    // check Device Node
-                    if (!XIGetProperty (display, list->id, prop, 0, 1000, False,
-                                        AnyPropertyType, &act_type, &act_format,
-                                        &nitems, &bytes_after, &data) == Success) {
-                        if (verbose)
-                            fprintf(stderr, "Skipping device '%s' id=%i : "
-                                            "no device node.\n",
-                                            list->name, (int)list->id);
-                        continue;
-                    }
-
-                    if (nitems == 0) {
-                        if (verbose)
-                            fprintf(stderr, "Skipping device '%s' id=%i : "
-                                            "0 device node.\n",
-                                            list->name, (int)list->id);
-			continue;
-                    }
-                    
-                    if ( !( (act_type == XA_STRING) && (act_format == 8) ) ) {
-                        if (verbose)
-                            fprintf(stderr, "Skipping device '%s' id=%i : "
-                                            "bad device node format.\n",
-                                            list->name, (int)list->id);
-                        XFree(data);
-			continue;
-                    }
-                    
-                    // All clear, good device
-		    found++;
-                    device_id = list->id;
-                    device_name = my_strdup(list->name);
-                    device_event = my_strdup(strstr((char *) data, "event"));
-		    sprintf(buffer,
-			    "/sys/class/input/%s/device/device/", device_event);
-                    device_dir = my_strdup(buffer);
-                    XFree (data);
-    
-                    if (list_devices)
-                        printf("Device '%s' id=%i (%s)\n",
-                               device_name, (int)device_id, device_event);
-                    if (verbose)
-                        fprintf(stderr, "  Using %s sysfs directory.\n",
-                                        device_dir);
-                }
-            }
+        if (!is_ebeam_device(info))
+            continue;
+
+        ncandidates++;
+        if (!get_device_node(display, info, prop, device))
+            continue;
 
-            /*
-             * Increment 'any' to point to the next item in the linked
-             * list.  The length is in bytes, so 'any' must be cast to
-             * a character pointer before being incremented.
-             */
-            any = (XAnyClassPtr) ((char *) any + any->length);
+        // or by usb identity, known once the sysfs dir is
+        if (pre_device_is_ident &&
+            !EbeamSysfs::match(device.ident, pre_device)) {
+            free_device(device);
+            continue;
         }
+
+        EBEAM_PROBE4(device_found, (int) device.id, device.name, device.event,
+                     device.dir);
+        devices.push_back(device);
     }
 
-    XFreeDeviceList(slist);
-    XCloseDisplay(display);
+    if (list)
+        XIFreeDeviceInfo(list);
+
+    std::sort(devices.begin(), devices.end(), identity_less);
+
+    if (list_devices)
+        for (unsigned i = 0; i < devices.size(); i++)
+            printf("Device '%s' id=%i (%s, %04x:%04x, %s)\n",
+                   devices[i].name, (int)devices[i].id, devices[i].event,
+                   devices[i].ident.vendor, devices[i].ident.product,
+                   devices[i].key);
+
+    // keep the whole enumeration for the session
+    if (pre_device == NULL) {
+        flush_device_cache();
+        for (unsigned i = 0; i < devices.size(); i++)
+            cache_devices.push_back(dup_device(devices[i]));
+        cache_display = display;
+    }
+
+    EBEAM_PROBE4(find_devices, ndevices, ncandidates, (int) devices.size(),
+                 (int64_t) ((now_ms() - t) * 1000));
+
+    if (verbose)
+        fprintf(stderr, "Device discovery : %d input devices, "
+                        "%d candidates, %.3f ms\n",
+                        ndevices, ncandidates, now_ms() - t);
+
+    return devices.size();
+}
+
+bool Calibrator::match_device(const EbeamDevice& device,
+                              const char* pre_device)
+{
+    bool is_id = pre_device[0] != 0;
+
+    for (const char* p = pre_device; *p; p++)
+        if (!isdigit(*p))
+            is_id = false;
 
-    return found;
+    if (is_id)
+        return device.id == (XID) atoi(pre_device);
+
+    if (EbeamSysfs::is_selector(pre_device))
+        return EbeamSysfs::match(device.ident, pre_device);
+
+    return strcmp(device.name, pre_device) == 0;
+}
+
+void Calibrator::flush_device_cache()
+{
+    for (unsigned i = 0; i < cache_devices.size(); i++)
+        free_device(cache_devices[i]);
+
+    cache_devices.clear();
+    cache_display = NULL;
+}
+
+void Calibrator::get_screen_geometry(Display* display, int screen_num,
+                                     int& width, int& height, int& rotation)
+{
+    width = DisplayWidth(display, screen_num);
+    height = DisplayHeight(display, screen_num);
+    rotation = 0;
+
+#ifdef HAVE_X11_XRANDR
+    XPhase phase(display, "screen_geometry");
+    XRRScreenConfiguration* conf = X_ROUND_TRIP(
+        XRRGetScreenInfo(display, RootWindow(display, screen_num)));
+    if (conf == NULL)
+        return;
+
+    // current size, not the first supported one
+    int nsizes;
+    Rotation screenrot = 0;
+    SizeID current = XRRConfigCurrentConfiguration(conf, &screenrot);
+    XRRScreenSize* randrsize = XRRConfigSizes(conf, &nsizes);
+
+    if (current < nsizes) {
+        bool rot = screenrot & RR_Rotate_90 || screenrot & RR_Rotate_270;
+        width = rot ? randrsize[current].height : randrsize[current].width;
+        height = rot ? randrsize[current].width : randrsize[current].height;
+    }
+
+    if (screenrot & RR_Rotate_90)
+        rotation = 90;
+    else if (screenrot & RR_Rotate_180)
+        rotation = 180;
+    else if (screenrot & RR_Rotate_270)
+        rotation = 270;
+
+    XRRFreeScreenConfigInfo(conf);
+#endif
+}
+
+void Calibrator::free_device(EbeamDevice& device)
+{
+    free((void*) device.name);
+    free((void*) device.event);
+    free((void*) device.dir);
+    free((void*) device.key);
 }
 
 ///
@@ -627,6 +1382,7 @@ bool Calibrator::add_click(int X, int Y, int x, int y)
                     fprintf(stderr, "Not adding click %i raw(%i, %i) : "
                                     "within %i units of previous click\n",
                                     num+1, X, Y, threshold_doubleclick);
+                EBEAM_PROBE6(add_click, num+1, X, Y, x, y, false);
                 return FAILURE;
             }
             i--;
@@ -643,6 +1399,8 @@ bool Calibrator::add_click(int X, int Y, int x, int y)
         fprintf(stderr, "Adding click %i : raw(%i, %i) <=> screen(%i, %i)\n",
                         tuples.num, X, Y, x, y);
 
+    EBEAM_PROBE6(add_click, tuples.num, X, Y, x, y, true);
+
     return SUCCESS;
 }
 
@@ -663,217 +1421,81 @@ bool Calibrator::finish()
         return FAILURE;
     }
 
-    if (!set_ebeam_calibration()) {
-        fprintf(stderr, "ERROR: unable to set eBeam calibration.\n");
+    // replay : nothing to apply, simulation : the simulated driver only
+    if (offline)
+        return device_dir ? set_ebeam_calibration() : SUCCESS;
+
+    EbeamCalibration cal;
+    get_calibration(cal);
+
+    DeviceLock lock(device_dir);
+    if (!lock.acquire(true))
         return FAILURE;
-    }
 
-    if (!sync_evdev_calibration()) {
+    bool status = SUCCESS;
+
+    if (!set_ebeam_calibration()) {
+        fprintf(stderr, "ERROR: unable to set eBeam calibration.\n");
+        status = FAILURE;
+    } else if (!sync_evdev_calibration()) {
         fprintf(stderr, "ERROR: unable to set X calibration.\n");
-        return FAILURE;
+        status = FAILURE;
     }
 
-    return SUCCESS;
+    lock.done(DeviceLock::request_hash(DEVLOCK_APPLY, &cal, zoned), status);
+
+    return status;
 }
 
 bool Calibrator::reset_ebeam_calibration()
 {
-    char fname[100];
-    sprintf(fname, "%s", device_dir);
-    strcat(fname, "calibrated");
+    return EbeamSysfs::reset_calibration(device_dir);
+}
+
+bool Calibrator::get_ebeam_calibration()
+{
+    EbeamCalibration cal;
 
-    FILE *fp;
-    if ( !(fp = fopen(fname, "w")) ) {
-        fprintf(stderr, "ERROR: unable to open %s for writing.\n", fname);
+    if (!EbeamSysfs::read_calibration(device_dir, cal))
         return FAILURE;
-    }
-    fprintf(fp, "0");
-    fclose(fp);
 
-    if (verbose)
-        fprintf(stderr, "eBeam calibration resetted.\n");
+    min_x = cal.min_x;
+    min_y = cal.min_y;
+    max_x = cal.max_x;
+    max_y = cal.max_y;
+
+    for (int i = 0; i<9 ; i++)
+        H[i] = cal.H[i];
 
     return SUCCESS;
 }
 
-bool Calibrator::get_ebeam_calibration()
+void Calibrator::get_calibration(EbeamCalibration& cal)
 {
-    FILE *fp;
-    char fname[100];
-
-#define READ(DATA)                                                             \
-    sprintf(fname, "%s%s", device_dir, #DATA);                                 \
-    if ( !(fp = fopen(fname, "r")) ) {                                         \
-        fprintf(stderr, "ERROR: unable to open %s\n", fname);                  \
-        return FAILURE;                                                        \
-    }                                                                          \
-    if ( !(fscanf(fp, "%d", &DATA)) ) {                                        \
-        fprintf(stderr, "ERROR: unable to parse %s\n", fname);                 \
-        fclose(fp);                                                            \
-        return FAILURE;                                                        \
-    }                                                                          \
-    if (verbose)                                                               \
-        fprintf(stderr, "Read %d from %s\n", DATA, fname);                     \
-    fclose(fp);
-
-READ(min_x)
-READ(min_y)
-READ(max_x)
-READ(max_y)
-
-
-    for (int i=1; i<=9; i++) {
-        sprintf(fname, "%sh%d", device_dir, i);
-        fp = fopen(fname, "r");
-        if ( !(fp = fopen(fname, "r")) ) {
-            fprintf(stderr, "ERROR: unable to open %s for reading.\n", fname);
-            return FAILURE;
-        }
-        if ( !(fscanf(fp, "%lld", &H[i-1])) ) {
-            fprintf(stderr, "ERROR: unable to parse %s\n", fname);
-            fclose(fp);
-            return FAILURE;
-        }
-        if (verbose)
-            fprintf(stderr, "Read %lld from %s\n", H[i-1], fname);
-        fclose(fp);
-    }
+    cal.min_x = min_x;
+    cal.min_y = min_y;
+    cal.max_x = max_x;
+    cal.max_y = max_y;
 
-    return SUCCESS;
+    for (int i = 0; i<9 ; i++)
+        cal.H[i] = H[i];
 }
 
 bool Calibrator::set_ebeam_calibration()
 {
-    int n = 0; // number of file written
-    DIR* dp = opendir(device_dir);
-
-    if (dp == NULL) {
-        fprintf(stderr, "ERROR: unable to open %s\n", device_dir);
-        return FAILURE;
-    }
-
-    dirent* ep;
-    while ((ep = readdir(dp))) {
-        char fname[100];
-        char value[50];
-        sprintf(fname, "%s", device_dir); // end with /
-
-        if (strcmp(ep->d_name, "min_x") == 0) {
-            strcat(fname, "min_x");
-            sprintf(value, "%d", min_x);
-        } else
-
-        if (strcmp(ep->d_name, "min_y") == 0) {
-            strcat(fname, "min_y");
-            sprintf(value, "%d", min_y);
-        } else
-
-        if (strcmp(ep->d_name, "max_x") == 0) {
-            strcat(fname, "max_x");
-            sprintf(value, "%d", max_x);
-        } else
-
-        if (strcmp(ep->d_name, "max_y") == 0) {
-            strcat(fname, "max_y");
-            sprintf(value, "%d", max_y);
-        } else
-
-        if (strcmp(ep->d_name, "h1") == 0) {
-            strcat(fname, "h1");
-            sprintf(value, "%lld", H[0]);
-        } else
-
-        if (strcmp(ep->d_name, "h2") == 0) {
-            strcat(fname, "h2");
-            sprintf(value, "%lld", H[1]);
-        } else
-
-        if (strcmp(ep->d_name, "h3") == 0) {
-            strcat(fname, "h3");
-            sprintf(value, "%lld", H[2]);
-        } else
-
-        if (strcmp(ep->d_name, "h4") == 0) {
-            strcat(fname, "h4");
-            sprintf(value, "%lld", H[3]);
-        } else
-
-        if (strcmp(ep->d_name, "h5") == 0) {
-            strcat(fname, "h5");
-            sprintf(value, "%lld", H[4]);
-        } else
-
-        if (strcmp(ep->d_name, "h6") == 0) {
-            strcat(fname, "h6");
-            sprintf(value, "%lld", H[5]);
-        } else
-
-        if (strcmp(ep->d_name, "h7") == 0) {
-            strcat(fname, "h7");
-            sprintf(value, "%lld", H[6]);
-        } else
-
-        if (strcmp(ep->d_name, "h8") == 0) {
-            strcat(fname, "h8");
-            sprintf(value, "%lld", H[7]);
-        } else
-
-        if (strcmp(ep->d_name, "h9") == 0) {
-            strcat(fname, "h9");
-            sprintf(value, "%lld", H[8]);
-        } else
-            continue;
-
-        if (verbose)
-            fprintf(stderr, "Writing %s to %s\n", value, fname);
-
-        // do the write
-        FILE *fp;
-
-        if ( !(fp = fopen(fname, "w")) ) {
-            fprintf(stderr, "ERROR: unable to open %s for writing.\n", fname);
-            closedir(dp);
-            return FAILURE;
-        }
-
-        fprintf(fp, "%s", value);
-        fclose(fp);
-        n++;
-    }
-
-    if (n != 13) {
-        fprintf(stderr, "ERROR: only %d parameters set, "
-                        "not in sync with ebeam kernel module ?\n", n);
-        closedir(dp);
-        return FAILURE;
-    }
-
-    // enabling calibration
-    char fname[100];
-    sprintf(fname, "%s", device_dir);
-    strcat(fname, "calibrated");
-
-    FILE *fp;
-
-    if ( !(fp = fopen(fname, "w")) ) {
-        fprintf(stderr, "ERROR: unable to open %s for writing.\n", fname);
-        closedir(dp);
-        return FAILURE;
-    }
-
-    fprintf(fp, "%u", 1);
-    fclose(fp);
-
-    if (verbose)
-        fprintf(stderr, "eBeam calibration done\n");
+    TraceSpan span("set_ebeam_calibration");
+    EbeamCalibration cal;
 
-    closedir(dp);
+    get_calibration(cal);
 
-    return SUCCESS;
+    return EbeamSysfs::write_calibration(device_dir, cal);
 }
 
 bool Calibrator::sync_evdev_calibration()
 {
+    TraceSpan span("sync_evdev_calibration");
+    XPhase phase(display, "sync_evdev_calibration");
+
     // "Evdev Axis Calibration"
     // 4 32-bit values, order min-x, max-x, min-y, max-y
 
@@ -900,7 +1522,7 @@ bool Calibrator::sync_evdev_calibration()
     } data_f;
     
     // Axis Calibration
-    prop = XInternAtom(display, "Evdev Axis Calibration", False);
+    prop = X_ROUND_TRIP(XInternAtom(display, "Evdev Axis Calibration", False));
     if (prop == None) {
         fprintf(stderr, "ERROR : Evdev Axis Calibration property not found.\n");
         return FAILURE;
@@ -915,18 +1537,22 @@ bool Calibrator::sync_evdev_calibration()
 
     XIChangeProperty(display, device_id, prop, XA_INTEGER, 32, PropModeReplace,
                      data_i.c, 4);
+    EBEAM_PROBE3(xi_property, (int) device_id, "Evdev Axis Calibration", 4);
 
-    XSync(display, false);
+    if (!deferred_sync)
+        X_ROUND_TRIP(XSync(display, false));
     free(data_i.c);
 
     // Set Coordinate Transformation Matrix if not fullscreen zone
     if (zoned) {
-        prop_float = XInternAtom(display, "FLOAT", False);
+        prop_float = X_ROUND_TRIP(XInternAtom(display, "FLOAT", False));
         if (prop_float == None) {
             fprintf(stderr, "ERROR : Float atom not found..\n");
             return FAILURE;
         }
-        prop = XInternAtom(display, "Coordinate Transformation Matrix", False);
+        prop = X_ROUND_TRIP(XInternAtom(display,
+                                        "Coordinate Transformation Matrix",
+                                        False));
         if (prop == None) {
             fprintf(stderr, "ERROR : Coordinate Transformation Matrix property not found.\n");
             return FAILURE;
@@ -938,8 +1564,11 @@ bool Calibrator::sync_evdev_calibration()
 
         XIChangeProperty(display, device_id, prop, prop_float, 32, PropModeReplace,
                          data_f.c, 9);
+        EBEAM_PROBE3(xi_property, (int) device_id,
+                     "Coordinate Transformation Matrix", 9);
 
-        XSync(display, false);
+        if (!deferred_sync)
+            X_ROUND_TRIP(XSync(display, false));
         free(data_f.c);
     }
     
@@ -951,6 +1580,8 @@ bool Calibrator::sync_evdev_calibration()
 
 bool Calibrator::reset_evdev_calibration()
 {
+    XPhase phase(display, "reset_evdev_calibration");
+
     // "Evdev Axis Calibration"
     // a number of 0 value reset evdev to uncalibrated.
 
@@ -976,7 +1607,7 @@ bool Calibrator::reset_evdev_calibration()
         float *f;
     } data_f;
     
-    prop = XInternAtom(display, "Evdev Axis Calibration", False);
+    prop = X_ROUND_TRIP(XInternAtom(display, "Evdev Axis Calibration", False));
     if (prop == None) {
         fprintf(stderr, "ERROR : Evdev Axis Calibration property not found.\n");
         return FAILURE;
@@ -984,17 +1615,21 @@ bool Calibrator::reset_evdev_calibration()
 
     XIChangeProperty(display, device_id, prop, XA_INTEGER, 32, PropModeReplace,
                      data.c, 0);
+    EBEAM_PROBE3(xi_property, (int) device_id, "Evdev Axis Calibration", 0);
 
-    XSync(display, false);
+    if (!deferred_sync)
+        X_ROUND_TRIP(XSync(display, false));
 
     // Set Coordinate Transformation Matrix to identity
-    prop_float = XInternAtom(display, "FLOAT", False);
+    prop_float = X_ROUND_TRIP(XInternAtom(display, "FLOAT", False));
     if (prop_float == None) {
         fprintf(stderr, "ERROR : Float atom not found..\n");
         return FAILURE;
     }
 
-    prop = XInternAtom(display, "Coordinate Transformation Matrix", False);
+    prop = X_ROUND_TRIP(XInternAtom(display,
+                                        "Coordinate Transformation Matrix",
+                                        False));
     if (prop == None) {
         fprintf(stderr, "ERROR : Coordinate Transformation Matrix property not found.\n");
         return FAILURE;
@@ -1006,8 +1641,11 @@ bool Calibrator::reset_evdev_calibration()
 
     XIChangeProperty(display, device_id, prop, prop_float, 32, PropModeReplace,
                      data_f.c, 9);
+    EBEAM_PROBE3(xi_property, (int) device_id,
+                 "Coordinate Transformation Matrix", 9);
 
-    XSync(display, false);
+    if (!deferred_sync)
+        X_ROUND_TRIP(XSync(display, false));
     free(data_f.c);
 
     if (verbose)
@@ -1016,116 +1654,437 @@ bool Calibrator::reset_evdev_calibration()
     return SUCCESS;
 }
 
+void Calibrator::set_profile_store(const char* store, bool save, bool restore,
+                                   int revision)
+{
+    profile_store = store;
+    profile_save = save;
+    profile_restore = restore;
+    profile_revision = revision;
+}
+
+void Calibrator::get_output_name(Display* display, char* name, size_t len)
+{
+    snprintf(name, len, "default");
+
+#ifdef HAVE_X11_XRANDR
+    Window root = DefaultRootWindow(display);
+
+    // no output probing : fast enough to follow a screen change
+    XPhase phase(display, "output_name");
+    XRRScreenResources* res =
+        X_ROUND_TRIP(XRRGetScreenResourcesCurrent(display, root));
+    if (res == NULL)
+        return;
+
+    // primary output, or the first one in use
+    RROutput output = X_ROUND_TRIP(XRRGetOutputPrimary(display, root));
+    for (int i = 0; output == None && i < res->noutput; i++) {
+        XRROutputInfo* info =
+            X_ROUND_TRIP(XRRGetOutputInfo(display, res, res->outputs[i]));
+        if (info && info->crtc != None)
+            output = res->outputs[i];
+        if (info)
+            XRRFreeOutputInfo(info);
+    }
+
+    if (output != None) {
+        XRROutputInfo* info =
+            X_ROUND_TRIP(XRRGetOutputInfo(display, res, output));
+        if (info) {
+            snprintf(name, len, "%s", info->name);
+            XRRFreeOutputInfo(info);
+        }
+    }
+
+    XRRFreeScreenResources(res);
+#endif
+}
+
+bool Calibrator::get_profile_key(char* key)
+{
+    return make_profile_key(display, device_key, key);
+}
+
+bool Calibrator::make_profile_key(Display* display, const char* device_key,
+                                  char* key)
+{
+    char host[64];
+    char output[32];
+
+    if (gethostname(host, sizeof(host)) != 0)
+        snprintf(host, sizeof(host), "localhost");
+    host[sizeof(host) - 1] = 0;
+
+    get_output_name(display, output, sizeof(output));
+
+    if (!ProfileStore::make_key(key, device_key, host, output)) {
+        fprintf(stderr, "ERROR: profile key too long for '%s'\n", device_key);
+        return FAILURE;
+    }
+
+    if (verbose)
+        fprintf(stderr, "Profile key : %s\n", key);
+
+    return SUCCESS;
+}
+
+bool Calibrator::list_profile_history()
+{
+    char key[PROFILE_KEY_LEN];
+    ProfileStore store(profile_store);
+
+    if (!get_profile_key(key) || !store.open())
+        return FAILURE;
+
+    const ProfileEntry* entry;
+    int n = store.history(key, &entry);
+
+    if (n == 0) {
+        printf("No profile for %s in %s\n", key, profile_store);
+        return FAILURE;
+    }
+
+    for (int i = 0; i < n; i++, entry++) {
+        char date[32];
+        time_t t = entry->time;
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        printf("%d: revision %u, %s, %dx%d, zone %d %d %d %d\n",
+               i, entry->revision, date,
+               entry->state.screen_width, entry->state.screen_height,
+               entry->state.min_x, entry->state.min_y,
+               entry->state.max_x, entry->state.max_y);
+    }
+
+    return SUCCESS;
+}
+
+bool Calibrator::monitor_drift(const char* landmarks_file, double threshold)
+{
+    char key[PROFILE_KEY_LEN];
+    ProfileStore store(profile_store);
+    std::vector<Landmark> landmarks;
+
+    if (!DriftMonitor::load_landmarks(landmarks_file, landmarks))
+        return FAILURE;
+
+    if (!get_profile_key(key) || !store.open())
+        return FAILURE;
+
+    const ProfileEntry* entry = store.find(key, profile_revision);
+    if (entry == NULL) {
+        fprintf(stderr, "ERROR: no profile revision %d for %s\n",
+                        profile_revision, key);
+        return FAILURE;
+    }
+
+    // the stored calibration, for the current screen
+    EbeamCalibration cal;
+    load_state(entry->state);
+    get_calibration(cal);
+
+    PenTransform transform;
+    transform.set_calibration(cal, screen_width, screen_height);
+
+    // driver calibration enabled : the events are already screen positions
+    bool driver = EbeamSysfs::is_calibrated(device_dir);
+    if (driver) {
+        EbeamCalibration live;
+        if (EbeamSysfs::read_calibration(device_dir, live) &&
+            memcmp(live.H, cal.H, sizeof(cal.H)) != 0)
+            fprintf(stderr, "WARNING: the driver calibration differs from "
+                            "the stored profile %s\n", key);
+    }
+
+    // ebeam_uinput running : it grabs the device, its output device
+    // has the screen positions
+    char event[16];
+    char node[64] = "";
+    bool uinput = !driver &&
+        EbeamSysfs::find_named(UINPUT_DEVICE_NAME, event, sizeof(event));
+    if (uinput)
+        snprintf(node, sizeof(node), "/dev/input/%s", event);
+
+    // else the evdev node of the device
+    std::vector<SysfsDevice> nodes;
+    if (!uinput)
+        EbeamSysfs::scan(nodes);
+    for (unsigned i = 0; i < nodes.size(); i++)
+        if (strcmp(nodes[i].dir, device_dir) == 0)
+            snprintf(node, sizeof(node), "/dev/input/%s", nodes[i].event);
+
+    if (node[0] == 0) {
+        fprintf(stderr, "ERROR: no event node for %s\n", device_dir);
+        return FAILURE;
+    }
+
+    // raw positions, calibrated by X : through the stored calibration
+    DriftMonitor monitor(driver || uinput ? NULL : &transform,
+                         screen_width, screen_height, threshold);
+    if (!monitor.set_landmarks(landmarks) || !monitor.open_input(node))
+        return FAILURE;
+
+    if (verbose)
+        fprintf(stderr, "Watching '%s' against profile %s (revision %u), "
+                        "threshold %g px\n", device_name, key,
+                        entry->revision, threshold);
+
+    bool ok = monitor.run();
+    monitor.report(stdout);
+
+    return ok;
+}
+
+bool Calibrator::make_state(StateRecord& rec)
+{
+    memset(&rec, 0, sizeof(rec));
+
+    // don't read while another process writes
+    DeviceLock lock(device_dir);
+    if (!lock.acquire(false))
+        return FAILURE;
+
+    // get current calibration data
+    if ( !get_ebeam_calibration() ) {
+        fprintf(stderr, "ERROR: unable to retrieve actual calibration.\n");
+        return FAILURE;
+    }
+
+    // H[8] is 10^precision
+    for (long long h = H[8]; h >= 10; h /= 10)
+        rec.precision++;
+
+    rec.zoned = !((min_x == 0) & (min_y == 0) &
+                  (max_x == screen_width -1) & (max_y == screen_height -1));
+    rec.min_x = min_x;
+    rec.min_y = min_y;
+    rec.max_x = max_x;
+    rec.max_y = max_y;
+    rec.screen_width = screen_width;
+    rec.screen_height = screen_height;
+    rec.rotation = screen_rotation;
+
+    for (int i = 0; i<9 ; i++)
+        rec.H[i] = H[i];
+
+    // resolution independent copy
+    StateFile::normalize(rec);
+
+    return SUCCESS;
+}
+
+void Calibrator::load_state(const StateRecord& saved)
+{
+    StateRecord rec;
+
+    // recompose for the current screen geometry
+    if (!StateFile::rescale(saved, screen_width, screen_height,
+                            screen_rotation, rec) && verbose)
+        fprintf(stderr, "WARNING: unknown screen geometry in state, "
+                        "restoring as is.\n");
+
+    min_x = rec.min_x;
+    min_y = rec.min_y;
+    max_x = rec.max_x;
+    max_y = rec.max_y;
+
+    for (int i = 0; i<9 ; i++)
+        H[i] = rec.H[i];
+
+    if (rec.zoned >= 0)
+        zoned = rec.zoned;
+    else
+        zoned = !((min_x == 0) & (min_y == 0) &
+                  (max_x == screen_width -1) & (max_y == screen_height -1));
+
+    if (verbose) {
+        if (zoned)
+            fprintf(stderr, "Active zone : %i %i %i %i\n",
+                            min_x, min_y, max_x, max_y);
+        else
+            fprintf(stderr, "Active zone : full screen\n");
+    }
+}
+
+bool Calibrator::set_screen_geometry(int width, int height, int rotation)
+{
+    if (width == screen_width && height == screen_height &&
+        rotation == screen_rotation)
+        return false;
+
+    if (verbose)
+        fprintf(stderr, "Screen geometry : %dx%d, rotation %d\n",
+                        width, height, rotation);
+
+    screen_width = width;
+    screen_height = height;
+    screen_rotation = rotation;
+
+    return true;
+}
+
+bool Calibrator::apply_state(const StateRecord& rec)
+{
+    EbeamCalibration cal;
+    bool status = SUCCESS;
+
+    load_state(rec);
+    get_calibration(cal);
+
+    // one writer at a time, identical concurrent requests applied once
+    uint32_t request = DeviceLock::request_hash(DEVLOCK_APPLY, &cal, zoned);
+    DeviceLock lock(device_dir);
+
+    if (!lock.acquire(true))
+        return FAILURE;
+
+    if (lock.coalesce(request, &status))
+        return status;
+
+    if (!set_ebeam_calibration()) {
+        fprintf(stderr, "ERROR: unable to set eBeam calibration.\n");
+        status = FAILURE;
+    } else if (!sync_evdev_calibration()) {
+        fprintf(stderr, "ERROR: unable to set X calibration.\n");
+        status = FAILURE;
+    }
+
+    lock.done(request, status);
+
+    return status;
+}
+
+bool Calibrator::reset_calibration()
+{
+    uint32_t request = DeviceLock::request_hash(DEVLOCK_RESET, NULL, false);
+    DeviceLock lock(device_dir);
+    bool status = SUCCESS;
+
+    if (!lock.acquire(true))
+        return FAILURE;
+
+    if (lock.coalesce(request, &status))
+        return status;
+
+    status = reset_ebeam_calibration() && reset_evdev_calibration();
+    lock.done(request, status);
+
+    return status;
+}
+
 bool Calibrator::do_calib_io()
 {
-    FILE *fp;
+    TraceSpan span("do_calib_io");
+    bool do_save = ofile || profile_save;
+    bool do_restore = ifile || profile_restore;
+    char key[PROFILE_KEY_LEN];
 
-    if (ifile && ofile && verbose)
+    if (do_save && do_restore && verbose)
         fprintf(stderr, "WARNING: Doing save and restore.\n");
 
-    if (!ifile && !ofile) {
+    if (!do_save && !do_restore && !query && !reset) {
         fprintf(stderr, "ERROR: No file to save/restore.\n");
         return FAILURE;
     }
 
+    if ((profile_save || profile_restore || query) && !get_profile_key(key))
+        return FAILURE;
+
     // saving
-    if (ofile) {
-        if ( !(fp = fopen(ofile, "w")) ) {
-            fprintf(stderr, "ERROR: unable to open %s for writing.\n", ofile);
-            return FAILURE;
-        }
+    if (do_save) {
+        StateRecord rec;
 
-        // get current calibration data
-        if ( !get_ebeam_calibration() ) {
-            fprintf(stderr, "ERROR: unable to retrieve actual calibration.\n");
-            fclose(fp);
+        if (!make_state(rec))
             return FAILURE;
-        }
 
-        // version
-        fprintf(fp, "%s\n", VERSION);
+        if (ofile) {
+            if (!StateFile::save(ofile, rec, state_format))
+                return FAILURE;
 
-        // min/max
-        fprintf(fp, "%d\n%d\n%d\n%d\n", min_x, max_x, min_y, max_y);
+            if (verbose)
+                fprintf(stderr, "Calibration data saved to %s\n", ofile);
+        }
 
-        // H matrix
-        for (int i = 0; i<9 ; i++)
-            fprintf(fp, "%lld\n",H[i]);
+        if (profile_save) {
+            ProfileStore store(profile_store);
 
-        fclose(fp);
+            if (!store.put(key, rec))
+                return FAILURE;
 
-        if (verbose)
-            fprintf(stderr, "Calibration data saved to %s\n", ofile);
+            if (verbose)
+                fprintf(stderr, "Calibration data saved to profile %s\n", key);
+        }
     }
 
-    // restoring
-    if (ifile) {
-        char version[10];
+    if (query) {
+        StateRecord rec;
 
-        if ( !(fp = fopen(ifile, "r")) ) {
-            fprintf(stderr, "ERROR: unable to open %s for reading.\n", ifile);
+        if (!make_state(rec))
             return FAILURE;
-        }
 
-        // version check
-        // for now, keep going
-        if (fscanf(fp, "%s\n", version) != 1) {
-            fprintf(stderr, "ERROR: bad state file (version) %s\n", ifile);
-            fclose(fp);
-            return FAILURE;
-        }
-        
-        if (strcmp(version, VERSION) != 0) {
-            fprintf(stderr, "WARNING: version mismatch : state file is %s, "
-                            "application is %s.\n", version, VERSION);
-            fprintf(stderr, "         Proceeding anyway.\n");
-        }
+        print_state(key, rec);
+    }
+
+    if (reset && !reset_calibration())
+        return FAILURE;
+
+    // restoring
+    if (ifile) {
+        StateFile state;
 
-        // min/max
-        if (fscanf(fp, "%d\n%d\n%d\n%d\n",
-                       &min_x, &max_x, &min_y, &max_y) != 4) {
-            fprintf(stderr, "ERROR: bad state file (min/max) %s\n", ifile);
-            fclose(fp);
+        if (!state.load(ifile) || !apply_state(*state.get_record()))
             return FAILURE;
-        }
 
-        // H matrix
-        for (int i = 0; i<9 ; i++)
-            if ( !fscanf(fp, "%lld\n",&H[i]) ) {
-                fprintf(stderr, "ERROR: bad state file (H coefs) %s\n", ifile);
-                fclose(fp);
-                return FAILURE;
-            }
+        if (verbose)
+            fprintf(stderr, "Calibration data restored from %s\n", ifile);
+    }
 
-        fclose(fp);
+    if (profile_restore) {
+        ProfileStore store(profile_store);
 
-        if ((min_x == 0) & (min_y == 0) & (max_x == screen_width -1) & (max_y == screen_height -1)) {
-            zoned = false;
-            if (verbose)
-                fprintf(stderr, "Active zone : full screen\n");
-        } else {
-            zoned = true;
-            if (verbose)
-                fprintf(stderr, "Active zone : %i %i %i %i\n", min_x, min_y, max_x, max_y);
-        }
+        if (!store.open())
+            return FAILURE;
 
-        if (!set_ebeam_calibration()) {
-            fprintf(stderr, "ERROR: unable to set eBeam calibration.\n");
+        const ProfileEntry* entry = store.find(key, profile_revision);
+        if (entry == NULL) {
+            fprintf(stderr, "ERROR: no profile revision %d for %s in %s\n",
+                            profile_revision, key, profile_store);
             return FAILURE;
         }
 
-        if (!sync_evdev_calibration()) {
-            fprintf(stderr, "ERROR: unable to set X calibration.\n");
+        if (!apply_state(entry->state))
             return FAILURE;
-        }
 
         if (verbose)
-            fprintf(stderr, "Calibration data restored from %s\n", ifile);
+            fprintf(stderr, "Calibration data restored from profile %s "
+                            "(revision %u)\n", key, entry->revision);
     }
 
+    if (verbose && t_start)
+        fprintf(stderr, "Done in %.3f ms (direct)\n", now_ms() - t_start);
+
     return SUCCESS;
 }
 
+void Calibrator::print_state(const char* key, const StateRecord& rec)
+{
+    printf("Profile key : %s\n", key);
+    printf("Screen : %dx%d, rotation %d\n",
+           rec.screen_width, rec.screen_height, rec.rotation);
+
+    if (rec.zoned)
+        printf("Active zone : %d %d %d %d\n",
+               rec.min_x, rec.min_y, rec.max_x, rec.max_y);
+    else
+        printf("Active zone : full screen\n");
+
+    printf("H matrix :\n");
+    for (int i=0; i<3; i++)
+        printf("[%19lld ; %19lld ; %19lld]\n",
+               (long long) rec.H[3*i], (long long) rec.H[3*i+1],
+               (long long) rec.H[3*i+2]);
+}
+
 void Calibrator::compute_XCTM(float* m)
 {
     m[0] = (max_x - min_x +1)/((float)screen_width);
@@ -1161,90 +2120,16 @@ void Calibrator::set_XCTM_to_identity(float* m)
 
 bool Calibrator::find_H()
 {
-    /*
-    * See :
-    * http://www.csc.kth.se/~perrose/files/pose-init-model/node17_ct.html
-    *
-    * solve A.h=b instead of calculing h=inv(A).b
-    */
-
-    // disable gsl error handler
-    gsl_set_error_handler_off();
-
-    gsl_vector * h = gsl_vector_calloc(8); // H coefs (h11, h12, ... , h32)
-
-    gsl_matrix * A = gsl_matrix_alloc (8, 8); // A : linear equations matrix
+    TraceSpan span("find_H");
+    int64_t t = EBEAM_PROBE_START(find_H);
 
-    // fill A, 2 row at a time
-    for (int p=0; p<4; p++) {               // 4 tuples
-        int X = tuples.tuple[p].dev_X;      // device
-        int Y = tuples.tuple[p].dev_Y;
-        int x = tuples.tuple[p].scr_x;      // screen
-        int y = tuples.tuple[p].scr_y;
+    bool ok = Homography::solve(tuples.tuple, tuples.num, precision,
+                                SOLVER_LU, H);
 
-        gsl_matrix_set (A, p*2, 0, X);      // first row
-        gsl_matrix_set (A, p*2, 1, Y);
-        gsl_matrix_set (A, p*2, 2, 1);
-        gsl_matrix_set (A, p*2, 3, 0);
-        gsl_matrix_set (A, p*2, 4, 0);
-        gsl_matrix_set (A, p*2, 5, 0);
-        gsl_matrix_set (A, p*2, 6, -(X*x));
-        gsl_matrix_set (A, p*2, 7, -(Y*x));
+    EBEAM_PROBE4(find_H, tuples.num, precision, EBEAM_PROBE_ELAPSED(t), ok);
 
-        gsl_matrix_set (A, p*2+1, 0, 0);    // second row
-        gsl_matrix_set (A, p*2+1, 1, 0);
-        gsl_matrix_set (A, p*2+1, 2, 0);
-        gsl_matrix_set (A, p*2+1, 3, X);
-        gsl_matrix_set (A, p*2+1, 4, Y);
-        gsl_matrix_set (A, p*2+1, 5, 1);
-        gsl_matrix_set (A, p*2+1, 6, -(X*y));
-        gsl_matrix_set (A, p*2+1, 7, -(Y*y));
-    }
-
-    gsl_vector * b = gsl_vector_calloc(8);  // b coefs (x1, y1, .., x4, y4)
-
-    for (int p=0; p<4; p++) {               // 4 tuples
-        gsl_vector_set (b, p*2,   tuples.tuple[p].scr_x);
-        gsl_vector_set (b, p*2+1, tuples.tuple[p].scr_y);
-    }
-
-    // LU decomposition
-    int s;
-    gsl_matrix * LU = gsl_matrix_calloc(8,8);
-    gsl_permutation * p  = gsl_permutation_alloc(8);
-
-    if (gsl_matrix_memcpy(LU,A)) {
-        fprintf(stderr, "ERROR: gsl memcopy failed.\n");
-        return FAILURE;
-    }
-
-    if (gsl_linalg_LU_decomp(LU,p,&s)) {
-        fprintf(stderr, "ERROR: gsl LU decomposition failed.\n");
-        return FAILURE;
-    }
-
-    // solve A * h = b
-    if (gsl_linalg_LU_solve(LU, p, b, h)) {
-        fprintf(stderr, "ERROR: gsl solver failed.\n");
+    if (!ok)
         return FAILURE;
-    }
-
-    // fill H (long long) with rounded (h (double) scaled by 10^precision)
-    for (int i=0; i<8; i++) {
-        if (gsl_vector_get(h, i) >= 0)
-            H[i] = (long long) (((long double) gsl_vector_get(h, i)) *
-                                ((long double) pow(10.0,precision)) + 0.5);
-        else
-            H[i] = (long long) (((long double) gsl_vector_get(h, i)) *
-                                ((long double) pow(10.0,precision)) - 0.5);
-    }
-    H[8] = (long long) pow(10.0,precision);
-
-    gsl_permutation_free(p);
-    gsl_matrix_free(LU);
-    gsl_vector_free(h);
-    gsl_matrix_free(A);
-    gsl_vector_free(b);
 
     if (verbose) {
         fprintf(stderr, "Computed H matrix :\n");
@@ -1258,67 +2143,12 @@ bool Calibrator::find_H()
 
 bool Calibrator::test_H()
 {
-   /*
-    * From ebeam.c kernel driver, keep in sync
-    *
-    * s64 scale;
-    * scale = ebeam->cursetting.h7 * ebeam->X +
-    *         ebeam->cursetting.h8 * ebeam->Y +
-    *         ebeam->cursetting.h9;
-    *
-    * We *must* round the result, but not with (int) (v1/v2 + 0.5)
-    *
-    * (int) (v1/v2 + 0.5) <=> (int) ( (2*v1 + v2)/(2*v2) )
-    *
-    * ebeam->x = (int) ((((ebeam->cursetting.h1 * ebeam->X +
-    *                      ebeam->cursetting.h2 * ebeam->Y +
-    *                      ebeam->cursetting.h3) << 1) + scale) /
-    *                      (scale << 1));
-    * ebeam->y = (int) ((((ebeam->cursetting.h4 * ebeam->X +
-    *                      ebeam->cursetting.h5 * ebeam->Y +
-    *                      ebeam->cursetting.h6) << 1) + scale) /
-    *                      (scale << 1));
-    */
+    TraceSpan span("test_H");
+    int64_t t = EBEAM_PROBE_START(test_H);
 
-    for (int p=0; p<4; p++) { // points
-        int X = tuples.tuple[p].dev_X; // device
-        int Y = tuples.tuple[p].dev_Y;
+    bool ok = Homography::test(tuples.tuple, tuples.num, H);
 
-        long long div = (H[6] * X + H[7] * Y + H[8]);
-        if (div == 0) {
-            if (verbose)
-                fprintf(stderr, "ERROR: Bad H matrix : division by zero\n");
-            return FAILURE;
-        }
-
-        int x = (int) ((2 * (H[0] * X + H[1] * Y + H[2]) + div)/(2*div));
-        int y = (int) ((2 * (H[3] * X + H[4] * Y + H[5]) + div)/(2*div));
-
-        if ((x != tuples.tuple[p].scr_x) || (y != tuples.tuple[p].scr_y)) {
-            if (verbose)
-                fprintf(stderr, "ERROR: Bad H matrix :\n");
-                fprintf(stderr, "Point %i : dev(%i ; %i) => scr(%i ; %i), "
-                                "real(%i ; %i)\n",
-                                p+1, X, Y, x, y,
-                                tuples.tuple[p].scr_x, tuples.tuple[p].scr_y);
-            return FAILURE;
-        }
-    }
+    EBEAM_PROBE3(test_H, tuples.num, EBEAM_PROBE_ELAPSED(t), ok);
 
-    return SUCCESS;
+    return ok;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -23,6 +23,12 @@
 #include <X11/Xlib.h>
 #include <X11/extensions/XInput.h>
 
+#include <vector>
+
+#include "state.hpp"
+#include "sysfs.hpp"
+#include "homography.hpp"
+
 #ifndef SUCCESS
 #define SUCCESS 1
 #endif
@@ -35,22 +41,6 @@
  */
 #define THR_DOUBLECLICK 16
 
-/*
- * eBeam kernel driver use integer (long long) math.
- * We scale computed H matrix by a 10^PRECISION factor before
- * converting to long long values.
- * NOTE :
- * long long can held 2^63,
- * internal calculus (in long long) involves int*coef,
- * so, worst case, coef have to be less than 2^48, approx 10^14.
- *
- * Below 10^9, calulated screen value may be inaccurate.
- * Above 10^14, calculus may overflow.
- *
- * Defaulting to 10^12
- */
-#define PRECISION 12
-
 /// Names of the points
 enum {
     UL = 0,  // Upper-left
@@ -60,20 +50,22 @@ enum {
     NUM_POINTS
 };
 
-/// struct to hold associated device and screen coordinates
-struct Tuple {
-    int dev_X;
-    int dev_Y;
-    int scr_x;
-    int scr_y;
-};
-
 /// struct to hold all tuples
 struct Tuples {
     int num;
     Tuple tuple[NUM_POINTS];
 };
 
+/// struct to hold a device found by find_devices
+struct EbeamDevice {
+    XID         id;
+    const char* name;
+    const char* event;  // eventXX
+    const char* dir;    // sysfs directory
+    const char* key;    // stable identity, see EbeamSysfs::device_key
+    DeviceIdentity ident;   // usb vendor, product, serial and port
+};
+
 /// Class for calculating new calibration parameters
 class Calibrator
 {
@@ -81,6 +73,7 @@ public:
     Calibrator(XID device_id0,
                const char* const device_name0,
                const char* const device_dir0,
+               const char* const device_key0,
                const int precision0,
                const int threshold_doubleclick0,
                const int z_min_x0,
@@ -88,24 +81,77 @@ public:
                const int z_max_x0,
                const int z_max_y0,
                const char* ifile0,
-               const char* ofile0);
+               const char* ofile0,
+               Display* display0 = NULL);
+
+    // offline calibrator, for session replays (see session.hpp) : no X
+    // nor device, the calibration is computed but not applied, unless a
+    // simulated driver dir is given (see simulator.hpp)
+    Calibrator(const char* const device_name0,
+               const int precision0,
+               const int threshold_doubleclick0,
+               const int z_min_x0,
+               const int z_min_y0,
+               const int z_max_x0,
+               const int z_max_y0,
+               const int width0,
+               const int height0,
+               const int rotation0,
+               const char* const device_dir0 = NULL);
 
     ~Calibrator();
 
     // Parse arguments and create calibrator for gui
-    static Calibrator* make_calibrator_gui(int argc, char** argv);
+    // With offline_width > 0 : no X nor device, an offline calibrator for
+    // a offline_width x offline_height screen (synthetic sessions)
+    static Calibrator* make_calibrator_gui(int argc, char** argv,
+                                           int offline_width = 0,
+                                           int offline_height = 0);
 
     // Parse arguments and create calibrator for cli
     static Calibrator* make_calibrator_cli(int argc, char** argv);
 
-    // Find a eBeam device (using XInput) and fill device_id and device_name
+    // Find a eBeam device (using XInput) and fill device_id, device_name,
+    // device_dir and device_key
     // Returns the number of devices found,
-    // If pre_device is NULL, the last eBeam device found is selected.
+    // If pre_device is NULL, the last eBeam device in identity order is
+    // selected.
     static int find_device(const char* pre_device,
                            bool list_devices,
                            XID& device_id,
                            const char*& device_name,
-			   const char*& device_dir);
+			   const char*& device_dir,
+                           const char*& device_key);
+
+    // Get the current screen size (as seen by X, rotation applied) and
+    // rotation, in degrees
+    static void get_screen_geometry(Display* display, int screen_num,
+                                    int& width, int& height, int& rotation);
+
+    // Find all eBeam devices using an open display, sorted by identity
+    // Returns the number of devices found
+    // A whole enumeration (no pre_device) is cached for the display,
+    // until flush_device_cache()
+    static int find_devices(Display* display,
+                            const char* pre_device,
+                            bool list_devices,
+                            std::vector<EbeamDevice>& devices);
+
+    // does device match pre_device : an X id, an identity selector
+    // (see EbeamSysfs::match) or a device name ?
+    static bool match_device(const EbeamDevice& device,
+                             const char* pre_device);
+
+    // forget the cached enumeration (devices added or removed, display
+    // closed)
+    static void flush_device_cache();
+
+    // release the strings of a device found by find_devices
+    static void free_device(EbeamDevice& device);
+
+    // profile store key of a device : identity@host/output
+    static bool make_profile_key(Display* display, const char* device_key,
+                                 char* key);
 
     // get the device Id
     XID get_device_id() { return device_id; };
@@ -120,6 +166,15 @@ public:
     int get_max_x() { return max_x; };
     int get_max_y() { return max_y; };
 
+    // calibration parameters
+    int get_precision() const { return precision; }
+    int get_threshold() const { return threshold_doubleclick; }
+
+    // session log to record, or to replay if offline
+    const char* get_session_file() const { return session_file; }
+    void set_session_file(const char* file) { session_file = file; }
+    bool is_offline() const { return offline; }
+
     // get the number of clicks already registered
     int get_numclicks() const { return tuples.num; }
 
@@ -150,13 +205,60 @@ public:
     // save/restore calibration data
     bool do_calib_io();
 
+    // state file format used when saving
+    void set_state_format(StateFormat fmt) { state_format = fmt; }
+
+    // save/restore through a profile store instead of (or with) files
+    void set_profile_store(const char* store, bool save, bool restore,
+                           int revision);
+
+    // print the stored revisions of the device profile
+    bool list_profile_history();
+
+    // watch the pen-down positions near landmarks against the stored
+    // profile, alert when the drift exceeds threshold px (see monitor.hpp)
+    bool monitor_drift(const char* landmarks_file, double threshold);
+
+    // also print and/or reset the calibration in do_calib_io
+    void set_query_reset(bool query0, bool reset0)
+        { query = query0; reset = reset0; }
+
+    // print a calibration state
+    static void print_state(const char* key, const StateRecord& rec);
+
+    // profile store key of the device : identity@host/output
+    bool get_profile_key(char* key);
+
+    // fill a state record from the ebeam driver calibration
+    bool make_state(StateRecord& rec);
+
+    // take calibration data from a state record, rescaled for the screen
+    void load_state(const StateRecord& rec);
+
+    // set ebeam driver and evdev calibration from a state record
+    bool apply_state(const StateRecord& rec);
+
+    // new screen geometry (RandR change), for the next load_state
+    // Returns false if it is the current one
+    bool set_screen_geometry(int width, int height, int rotation);
+
+    // reset ebeam driver and evdev to uncalibrated
+    bool reset_calibration();
+
+    // calibration data, as set in the ebeam driver
+    void get_calibration(EbeamCalibration& cal);
+
+    // don't wait for the X server after property changes,
+    // the caller will XSync() the display
+    void set_deferred_sync(bool deferred) { deferred_sync = deferred; }
+
+    // compute X11 Coordinate Transformation Matrix
+    void compute_XCTM(float* m);
+
     // Be verbose or not
     static bool verbose;
 
 private:
-    // compute X11 Coordinate Transformation Matrix
-    void compute_XCTM(float* m);
-    
     // reset XCTM to identity
     void set_XCTM_to_identity(float* m);
     
@@ -166,9 +268,15 @@ private:
     // test H
     bool test_H();
 
+    // name of the primary RandR output, or of the first one in use if
+    // there is no primary, "default" without RandR
+    static void get_output_name(Display* display, char* name, size_t len);
+
 private:
     // X objects
     Display     *display;
+    bool        own_display;   // opened by us, not shared
+    bool        deferred_sync;
     XDeviceInfo *devInfo;
     XDevice     *dev;
 
@@ -181,6 +289,9 @@ private:
     // sysfs path to the device
     const char* const device_dir;
 
+    // stable identity of the device (usb serial or port path)
+    const char* const device_key;
+
     // Precision : H matrix coefs are scaled by 10^precision
     // before long long conversion.
     int precision;
@@ -205,10 +316,28 @@ private:
     // screen geometry
     int screen_width;
     int screen_height;
+    int screen_rotation;
 
     // file path to save/restore
     const char* const ifile;
     const char* const ofile;
+
+    // state file format used when saving
+    StateFormat state_format;
+
+    // profile store
+    const char* profile_store;
+    bool profile_save;
+    bool profile_restore;
+    int profile_revision;
+
+    // print, reset the calibration
+    bool query;
+    bool reset;
+
+    // session log, replayed without X nor device
+    const char* session_file;
+    bool offline;
 };
 
 #endif
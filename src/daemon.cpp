@@ -0,0 +1,732 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "daemon.hpp"
+#include "sysfs.hpp"
+#include "devlock.hpp"
+#include "timing.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <stdexcept>
+
+#include <X11/extensions/XInput2.h>
+
+#ifdef HAVE_X11_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+/// static verbose
+bool RestoreDaemon::verbose = false;
+
+/// set by SIGINT/SIGTERM
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+/// devices come and go : don't die on a BadDevice
+static int on_x_error(Display* display, XErrorEvent* ev)
+{
+    char msg[128];
+
+    XGetErrorText(display, ev->error_code, msg, sizeof(msg));
+    fprintf(stderr, "WARNING: X error : %s (request %d.%d)\n",
+                    msg, ev->request_code, ev->minor_code);
+
+    return 0;
+}
+
+RestoreDaemon::RestoreDaemon(const char* store0, const char* socket0,
+                             gid_t group0)
+  : store_path(store0),
+    socket_path(socket0),
+    socket_group(group0),
+    store(store0),
+    display(NULL),
+    xi_opcode(0),
+    rr_event_base(0),
+    screen_width(0),
+    screen_height(0),
+    screen_rotation(0),
+    t_screen(0),
+    uevent_fd(-1),
+    service_fd(-1)
+{
+}
+
+RestoreDaemon::~RestoreDaemon()
+{
+    for (unsigned i = 0; i < managed.size(); i++) {
+        delete managed[i].calibrator;
+        Calibrator::free_device(managed[i].device);
+    }
+
+    if (uevent_fd >= 0)
+        close(uevent_fd);
+
+    if (service_fd >= 0) {
+        close(service_fd);
+        unlink(socket_path);
+    }
+
+    if (display) {
+        Calibrator::flush_device_cache();
+        XCloseDisplay(display);
+    }
+}
+
+bool RestoreDaemon::init()
+{
+    int event, error;
+    int major = 2, minor = 0;
+
+    // kernel uevents
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;     // kernel events, not udev ones
+
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd < 0 ||
+        bind(uevent_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "ERROR: unable to listen to kernel uevents : %s\n",
+                        strerror(errno));
+        return FAILURE;
+    }
+    fcntl(uevent_fd, F_SETFL, O_NONBLOCK);
+    fcntl(uevent_fd, F_SETFD, FD_CLOEXEC);
+
+    // X, hierarchy events on the root window
+    display = XOpenDisplay(NULL);
+    if (display == NULL) {
+        fprintf(stderr, "ERROR: Unable to connect to X server.\n");
+        return FAILURE;
+    }
+    XSetErrorHandler(on_x_error);
+
+    if (!XQueryExtension(display, "XInputExtension",
+                                  &xi_opcode, &event, &error) ||
+        XIQueryVersion(display, &major, &minor) != Success) {
+        fprintf(stderr, "ERROR: X Input extension 2.0 not available.\n");
+        return FAILURE;
+    }
+
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+    memset(bits, 0, sizeof(bits));
+    XISetMask(bits, XI_HierarchyChanged);
+
+    XIEventMask mask;
+    mask.deviceid = XIAllDevices;
+    mask.mask_len = sizeof(bits);
+    mask.mask = bits;
+    XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+
+    // RandR, screen resize and rotation
+    Calibrator::get_screen_geometry(display, DefaultScreen(display),
+                                    screen_width, screen_height,
+                                    screen_rotation);
+#ifdef HAVE_X11_XRANDR
+    int rr_error_base;
+    int rr_major = 0, rr_minor = 0;
+    if (XRRQueryExtension(display, &rr_event_base, &rr_error_base) &&
+        XRRQueryVersion(display, &rr_major, &rr_minor)) {
+        int rr_mask = RRScreenChangeNotifyMask;
+
+        // crtc events since RandR 1.2
+        if (rr_major > 1 || (rr_major == 1 && rr_minor >= 2))
+            rr_mask |= RRCrtcChangeNotifyMask;
+        XRRSelectInput(display, DefaultRootWindow(display), rr_mask);
+    } else {
+        rr_event_base = 0;
+        fprintf(stderr, "WARNING: no RandR, screen changes are ignored.\n");
+    }
+#endif
+
+    if (!store.open())
+        return FAILURE;
+
+    // restoring doesn't need the service : keep going without it
+    if (socket_path &&
+        (service_fd = Service::listen(socket_path, socket_group)) < 0)
+        fprintf(stderr, "WARNING: no calibration service on %s, "
+                        "restoring only.\n", socket_path);
+
+    // devices already there
+    scan_devices();
+
+    return SUCCESS;
+}
+
+bool RestoreDaemon::run()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      // no SA_RESTART : interrupt poll()
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (verbose)
+        fprintf(stderr, "Waiting for eBeam devices (store %s).\n", store_path);
+
+    while (!quit) {
+        struct pollfd fds[3];
+
+        // events read along with replies are already queued
+        if (XPending(display))
+            read_x_events();
+
+        fds[0].fd = uevent_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = ConnectionNumber(display);
+        fds[1].events = POLLIN;
+        fds[2].fd = service_fd;     // ignored by poll() if -1
+        fds[2].events = POLLIN;
+
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: poll : %s\n", strerror(errno));
+            return FAILURE;
+        }
+
+        if (fds[0].revents & POLLIN)
+            read_uevents();
+
+        if (fds[1].revents & (POLLIN | POLLHUP))
+            read_x_events();
+
+        if (fds[2].revents & POLLIN)
+            serve_client();
+    }
+
+    if (verbose)
+        fprintf(stderr, "Exiting.\n");
+
+    return SUCCESS;
+}
+
+void RestoreDaemon::read_uevents()
+{
+    char buf[8192];
+    ssize_t len;
+
+    while ((len = recv(uevent_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        double t = now_ms();
+        const char* action = NULL;
+        const char* subsystem = NULL;
+        const char* devname = NULL;
+
+        // "action@devpath" then "KEY=value" strings, 0 separated
+        buf[len] = 0;
+        for (char* p = buf + strlen(buf) + 1; p < buf + len;
+             p += strlen(p) + 1) {
+            if (strncmp(p, "ACTION=", 7) == 0)
+                action = p + 7;
+            else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+                subsystem = p + 10;
+            else if (strncmp(p, "DEVNAME=", 8) == 0)
+                devname = p + 8;
+        }
+
+        if (action && subsystem && devname &&
+            strcmp(action, "add") == 0 &&
+            strcmp(subsystem, "input") == 0 &&
+            strncmp(devname, "input/event", 11) == 0)
+            restore_sysfs(devname + 6, t);
+    }
+}
+
+void RestoreDaemon::read_x_events()
+{
+    bool rescan = false;
+
+    while (XPending(display)) {
+        XEvent ev;
+        XNextEvent(display, &ev);
+
+        if (read_randr_event(ev))
+            continue;
+
+        XGenericEventCookie* cookie = &ev.xcookie;
+        if (cookie->type != GenericEvent ||
+            cookie->extension != xi_opcode ||
+            !XGetEventData(display, cookie))
+            continue;
+
+        if (cookie->evtype == XI_HierarchyChanged) {
+            XIHierarchyEvent* hev = (XIHierarchyEvent*) cookie->data;
+
+            for (int i = 0; i < hev->num_info; i++) {
+                // evdev properties exist once the device is enabled
+                if (hev->info[i].flags & XIDeviceEnabled)
+                    rescan = true;
+                if (hev->info[i].flags & XISlaveRemoved)
+                    drop_device(hev->info[i].deviceid);
+            }
+        }
+
+        XFreeEventData(display, cookie);
+    }
+
+    if (rescan)
+        scan_devices();
+
+    // a mode change comes as several events : all read, apply once
+    if (t_screen != 0)
+        reapply_devices();
+}
+
+#ifdef HAVE_X11_XRANDR
+/// RandR rotation bits to degrees
+static int rotation_degrees(Rotation rot)
+{
+    if (rot & RR_Rotate_90)
+        return 90;
+    if (rot & RR_Rotate_180)
+        return 180;
+    if (rot & RR_Rotate_270)
+        return 270;
+    return 0;
+}
+#endif
+
+bool RestoreDaemon::read_randr_event(XEvent& ev)
+{
+#ifdef HAVE_X11_XRANDR
+    if (rr_event_base == 0)
+        return false;
+
+    if (ev.type == rr_event_base + RRScreenChangeNotify) {
+        const XRRScreenChangeNotifyEvent* sev =
+            (const XRRScreenChangeNotifyEvent*) &ev;
+
+        // keep Xlib's idea of the root size up to date
+        XRRUpdateConfiguration(&ev);
+
+        // the event holds the unrotated size, as XRRUpdateConfiguration
+        bool swap = (sev->rotation & (RR_Rotate_90 | RR_Rotate_270)) != 0;
+        screen_width = swap ? sev->height : sev->width;
+        screen_height = swap ? sev->width : sev->height;
+        screen_rotation = rotation_degrees(sev->rotation);
+    } else if (ev.type == rr_event_base + RRNotify) {
+        const XRRCrtcChangeNotifyEvent* cev =
+            (const XRRCrtcChangeNotifyEvent*) &ev;
+
+        if (cev->subtype != RRNotify_CrtcChange)
+            return true;
+
+        // only a crtc showing the whole root tells the rotation,
+        // its size is the mode size, before rotation
+        bool swap = (cev->rotation & (RR_Rotate_90 | RR_Rotate_270)) != 0;
+        int width = swap ? cev->height : cev->width;
+        int height = swap ? cev->width : cev->height;
+        if (cev->mode == None || cev->x != 0 || cev->y != 0 ||
+            width != screen_width || height != screen_height)
+            return true;
+
+        screen_rotation = rotation_degrees(cev->rotation);
+    } else
+        return false;
+
+    if (t_screen == 0)
+        t_screen = now_ms();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void RestoreDaemon::reapply_devices()
+{
+    bool sync = false;
+
+    for (unsigned i = 0; i < managed.size(); i++) {
+        const EbeamDevice& dev = managed[i].device;
+        Calibrator* calibrator = managed[i].calibrator;
+        StateRecord live;
+        char key[PROFILE_KEY_LEN];
+
+        // the output, thus the profile, may have changed too
+        const ProfileEntry* entry = find_profile(dev.key, key);
+
+        // no profile : the current calibration, for the old geometry
+        if (entry == NULL && !calibrator->make_state(live))
+            continue;
+
+        if (!calibrator->set_screen_geometry(screen_width, screen_height,
+                                             screen_rotation))
+            continue;
+
+        if (!calibrator->apply_state(entry ? entry->state : live)) {
+            fprintf(stderr, "ERROR: unable to re-apply '%s'.\n", dev.name);
+            continue;
+        }
+        sync = true;
+
+        printf("'%s' id=%d : re-applied for %dx%d, rotation %d, from %s\n",
+               dev.name, (int) dev.id, screen_width, screen_height,
+               screen_rotation, entry ? key : "current calibration");
+    }
+
+    if (sync) {
+        XSync(display, False);
+        printf("Screen change applied in %.3f ms\n", now_ms() - t_screen);
+    }
+    fflush(stdout);
+
+    t_screen = 0;
+}
+
+const ProfileEntry* RestoreDaemon::find_profile(const char* device_key,
+                                                char* key)
+{
+    if (!Calibrator::make_profile_key(display, device_key, key))
+        return NULL;
+
+    // another process may have saved a profile since last time
+    if (!store.refresh())
+        return NULL;
+
+    const ProfileEntry* entry = store.find(key);
+    if (entry == NULL && verbose)
+        fprintf(stderr, "No profile for %s\n", key);
+
+    return entry;
+}
+
+void RestoreDaemon::restore_sysfs(const char* event, double t_uevent)
+{
+    char dir[128];
+    char key[PROFILE_KEY_LEN];
+
+    EbeamSysfs::event_dir(event, dir, sizeof(dir));
+    if (!EbeamSysfs::is_ebeam(dir))
+        return;
+
+    char* device_key = EbeamSysfs::device_key(dir);
+    const ProfileEntry* entry = find_profile(device_key, key);
+    free(device_key);
+
+    if (entry == NULL)
+        return;
+
+    // rescale for the current screen, as Calibrator::load_state does
+    int width, height, rotation;
+    StateRecord rec;
+    EbeamCalibration cal;
+
+    Calibrator::get_screen_geometry(display, DefaultScreen(display),
+                                    width, height, rotation);
+    StateFile::rescale(entry->state, width, height, rotation, rec);
+    EbeamSysfs::from_state(rec, cal);
+
+    uint32_t request = DeviceLock::request_hash(DEVLOCK_SYSFS, &cal,
+                                                rec.zoned);
+    DeviceLock lock(dir);
+    bool ok = SUCCESS;
+
+    if (!lock.acquire(true))
+        return;
+
+    if (!lock.coalesce(request, &ok)) {
+        ok = EbeamSysfs::write_calibration(dir, cal);
+        lock.done(request, ok);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: unable to set eBeam calibration of %s.\n",
+                        event);
+        return;
+    }
+
+    Pending p;
+    snprintf(p.event, sizeof(p.event), "%s", event);
+    p.time = t_uevent;
+    pending.push_back(p);
+
+    printf("%s : driver calibration restored from %s (revision %u) "
+           "in %.3f ms\n", event, key, entry->revision, now_ms() - t_uevent);
+    fflush(stdout);
+}
+
+void RestoreDaemon::scan_devices()
+{
+    std::vector<EbeamDevice> devices;
+    bool sync = false;
+
+    // called on hierarchy changes : enumerate again
+    Calibrator::flush_device_cache();
+    Calibrator::find_devices(display, NULL, false, devices);
+
+    for (unsigned i = 0; i < devices.size(); i++) {
+        EbeamDevice& dev = devices[i];
+        bool known = false;
+
+        for (unsigned j = 0; j < managed.size() && !known; j++)
+            known = (managed[j].device.id == dev.id);
+
+        if (known) {
+            Calibrator::free_device(dev);
+            continue;
+        }
+
+        Managed m;
+        m.device = dev;
+        try {
+            m.calibrator = new Calibrator(dev.id, dev.name, dev.dir, dev.key,
+                                          PRECISION, THR_DOUBLECLICK,
+                                          0, 0, 0, 0,
+                                          NULL, NULL, display);
+        } catch (std::runtime_error& e) {
+            fprintf(stderr, "ERROR: '%s' : %s\n", dev.name, e.what());
+            Calibrator::free_device(dev);
+            continue;
+        }
+        m.calibrator->set_deferred_sync(true);
+        managed.push_back(m);
+
+        // sysfs already done on uevent ?
+        bool sysfs_done = false;
+        double t_uevent = 0;
+        for (unsigned j = 0; j < pending.size(); j++)
+            if (strcmp(pending[j].event, dev.event) == 0) {
+                sysfs_done = true;
+                t_uevent = pending[j].time;
+                pending.erase(pending.begin() + j);
+                break;
+            }
+
+        char key[PROFILE_KEY_LEN];
+        const ProfileEntry* entry = find_profile(dev.key, key);
+        if (entry == NULL)
+            continue;
+
+        double t = now_ms();
+        bool ok;
+        EbeamCalibration cal;
+        DeviceLock lock(dev.dir);
+
+        m.calibrator->load_state(entry->state);
+        m.calibrator->get_calibration(cal);
+        bool zoned = m.calibrator->is_zoned();
+
+        if (!lock.acquire(true))
+            continue;
+
+        // driver restored without X, at boot by ebeam_boot ?
+        bool boot = !sysfs_done &&
+            lock.is_current(DeviceLock::request_hash(DEVLOCK_SYSFS, &cal,
+                                                     zoned));
+
+        if (sysfs_done || boot) {
+            ok = m.calibrator->sync_evdev_calibration();
+            lock.done(DeviceLock::request_hash(DEVLOCK_EVDEV, &cal, zoned),
+                      ok);
+        } else {
+            lock.release();
+            ok = m.calibrator->apply_state(entry->state);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "ERROR: unable to restore '%s'.\n", dev.name);
+            continue;
+        }
+        sync = true;
+
+        if (sysfs_done)
+            printf("'%s' id=%d : X calibration restored from %s "
+                   "(revision %u), %.3f ms after uevent\n",
+                   dev.name, (int) dev.id, key, entry->revision,
+                   now_ms() - t_uevent);
+        else if (boot)
+            printf("'%s' id=%d : X calibration restored from %s "
+                   "(revision %u), driver restored at boot\n",
+                   dev.name, (int) dev.id, key, entry->revision);
+        else
+            printf("'%s' id=%d : restored from %s (revision %u) in %.3f ms\n",
+                   dev.name, (int) dev.id, key, entry->revision,
+                   now_ms() - t);
+    }
+
+    if (sync)
+        XSync(display, False);
+    fflush(stdout);
+}
+
+void RestoreDaemon::drop_device(int id)
+{
+    for (unsigned i = 0; i < managed.size(); i++) {
+        if (managed[i].device.id != (XID) id)
+            continue;
+
+        if (verbose)
+            fprintf(stderr, "'%s' id=%d removed.\n",
+                            managed[i].device.name, id);
+
+        delete managed[i].calibrator;
+        Calibrator::free_device(managed[i].device);
+        managed.erase(managed.begin() + i);
+        return;
+    }
+}
+
+RestoreDaemon::Managed* RestoreDaemon::select_device(const char* device)
+{
+    Managed* found = NULL;
+
+    // same rules as find_device : the last one in identity order
+    for (unsigned i = 0; i < managed.size(); i++) {
+        const EbeamDevice& dev = managed[i].device;
+
+        if (device[0] && !Calibrator::match_device(dev, device))
+            continue;
+
+        if (found == NULL || strcmp(dev.key, found->device.key) >= 0)
+            found = &managed[i];
+    }
+
+    return found;
+}
+
+void RestoreDaemon::serve_client()
+{
+    int fd;
+
+    while ((fd = accept(service_fd, NULL, NULL)) >= 0) {
+        ServiceRequest req;
+        ServiceReply rep;
+
+        memset(&rep, 0, sizeof(rep));
+        rep.magic = SERVICE_MAGIC;
+
+        if (Service::authorized(fd, socket_group) &&
+            Service::receive(fd, req)) {
+            double t = now_ms();
+            rep.status = handle_request(req, rep);
+            XSync(display, False);
+
+            if (verbose)
+                fprintf(stderr, "Service request %u for '%s' : %s "
+                                "in %.3f ms\n", req.op, rep.key,
+                                rep.status ? "done" : "failed",
+                                now_ms() - t);
+
+            Service::reply(fd, rep);
+        }
+
+        close(fd);
+    }
+}
+
+bool RestoreDaemon::handle_request(const ServiceRequest& req,
+                                   ServiceReply& rep)
+{
+    Managed* m = select_device(req.device);
+
+    if (m == NULL) {
+        snprintf(rep.message, sizeof(rep.message), "%s",
+                 req.device[0] ? "device not found." : "no eBeam device found.");
+        return FAILURE;
+    }
+
+    Calibrator* calibrator = m->calibrator;
+
+    if (!calibrator->get_profile_key(rep.key)) {
+        snprintf(rep.message, sizeof(rep.message), "profile key too long.");
+        return FAILURE;
+    }
+
+    switch (req.op) {
+    case SERVICE_QUERY:
+    case SERVICE_SAVE:
+        if (!calibrator->make_state(rep.state)) {
+            snprintf(rep.message, sizeof(rep.message),
+                     "unable to retrieve actual calibration.");
+            return FAILURE;
+        }
+
+        if (req.op == SERVICE_SAVE && (req.flags & SERVICE_STORE)) {
+            if (!store.put(rep.key, rep.state)) {
+                snprintf(rep.message, sizeof(rep.message),
+                         "unable to write the profile store.");
+                return FAILURE;
+            }
+            rep.revision = store.find(rep.key)->revision;
+        }
+        return SUCCESS;
+
+    case SERVICE_RESTORE:
+        if (req.flags & SERVICE_STORE) {
+            const ProfileEntry* entry = NULL;
+
+            if (store.refresh())
+                entry = store.find(rep.key, req.revision);
+
+            if (entry == NULL) {
+                snprintf(rep.message, sizeof(rep.message),
+                         "no profile revision %d for %s",
+                         req.revision, rep.key);
+                return FAILURE;
+            }
+
+            rep.revision = entry->revision;
+            if (!calibrator->apply_state(entry->state)) {
+                snprintf(rep.message, sizeof(rep.message),
+                         "unable to restore the calibration.");
+                return FAILURE;
+            }
+            return SUCCESS;
+        }
+
+        if (!StateFile::check(req.state)) {
+            snprintf(rep.message, sizeof(rep.message), "bad state record.");
+            return FAILURE;
+        }
+
+        if (!calibrator->apply_state(req.state)) {
+            snprintf(rep.message, sizeof(rep.message),
+                     "unable to restore the calibration.");
+            return FAILURE;
+        }
+        return SUCCESS;
+
+    case SERVICE_RESET:
+        if (!calibrator->reset_calibration()) {
+            snprintf(rep.message, sizeof(rep.message),
+                     "unable to reset the calibration.");
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    snprintf(rep.message, sizeof(rep.message), "unknown request %u.", req.op);
+    return FAILURE;
+}
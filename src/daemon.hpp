@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _daemon_hpp
+#define _daemon_hpp
+
+#include "calibrator.hpp"
+#include "profile_store.hpp"
+#include "service.hpp"
+
+#include <vector>
+
+/*
+ * Restore daemon : re-apply the stored profile of eBeam devices as soon as
+ * they appear (replug, resume, X restart).
+ *
+ * Two event sources :
+ *  - kernel uevents (netlink) : a new eventXX node is an eBeam device when
+ *    its sysfs directory has the driver attributes; the driver calibration
+ *    is restored right away, X doesn't know the device yet.
+ *  - XInput hierarchy events : when X enables the device, the evdev
+ *    properties are set.
+ *  - RandR screen and crtc changes : the calibration of every device is
+ *    recomposed for the new resolution and rotation, from its stored
+ *    profile (or its current calibration when it has none), and pushed to
+ *    the driver and evdev. Events of one change are applied once.
+ *
+ * The X connection and the profile store mapping are kept open between
+ * events, the store is remapped only when it was replaced.
+ *
+ * The daemon also answers calibration service requests (see service.hpp)
+ * with the calibrators it keeps for each device, saving clients the X
+ * connection and device discovery.
+ */
+class RestoreDaemon
+{
+public:
+    // socket0 : service socket, NULL for no service
+    // group0 : group of the socket, allowed to use the service
+    RestoreDaemon(const char* store0, const char* socket0,
+                  gid_t group0 = SERVICE_NO_GROUP);
+    ~RestoreDaemon();
+
+    // connect to X and the kernel, restore devices already present
+    bool init();
+
+    // event loop, returns on SIGINT/SIGTERM
+    bool run();
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    /// a device known to X, with its calibrator
+    struct Managed {
+        EbeamDevice device;
+        Calibrator* calibrator;
+    };
+
+    /// sysfs restored on uevent, waiting for X
+    struct Pending {
+        char   event[32];
+        double time;        // uevent time, in ms
+    };
+
+    // read and dispatch uevents
+    void read_uevents();
+
+    // read and dispatch X events
+    void read_x_events();
+
+    // sysfs restore of a new eventXX node
+    void restore_sysfs(const char* event, double t_uevent);
+
+    // look for new devices in X and restore their evdev calibration
+    void scan_devices();
+
+    // forget a device removed from X
+    void drop_device(int id);
+
+    // note a RandR screen or crtc change, false if ev is none
+    bool read_randr_event(XEvent& ev);
+
+    // recompose every device for the new screen geometry
+    void reapply_devices();
+
+    // answer a service client
+    void serve_client();
+
+    // process a service request
+    bool handle_request(const ServiceRequest& req, ServiceReply& rep);
+
+    // device selected by a request : name, id, or last one
+    Managed* select_device(const char* device);
+
+    // stored profile for a device, NULL if none
+    const ProfileEntry* find_profile(const char* device_key, char* key);
+
+    const char* const store_path;
+    const char* const socket_path;
+    const gid_t socket_group;
+    ProfileStore store;
+
+    Display* display;
+    int xi_opcode;
+    int rr_event_base;      // 0 without RandR
+
+    // screen geometry, as last notified by RandR
+    int screen_width;
+    int screen_height;
+    int screen_rotation;
+    double t_screen;        // time of the first unapplied event, 0 if none
+    int uevent_fd;
+    int service_fd;
+
+    std::vector<Managed> managed;
+    std::vector<Pending> pending;
+};
+
+#endif
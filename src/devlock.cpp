@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "devlock.hpp"
+#include "state.hpp"
+#include "timing.hpp"
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+// "EBLK" read as a little-endian 32-bit word
+#define LOCK_MAGIC 0x4b4c4245
+
+/// static verbose
+bool DeviceLock::verbose = false;
+
+DeviceLock::DeviceLock(const char* device_dir)
+  : fd(-1),
+    writable(false),
+    trusted(false),
+    waited(false),
+    t_request(0),
+    wait(0)
+{
+    char real[PATH_MAX];
+
+    // eventXX/device/device and the usb interface path are the same device
+    if (!realpath(device_dir, real))
+        snprintf(real, sizeof(real), "%s", device_dir);
+
+    // one namespace for every user, or the lock is not shared
+    snprintf(path, sizeof(path), "%s/ebeam_tools-%08x.lock", LOCK_DIR,
+             StateFile::crc32(real, strlen(real)));
+}
+
+DeviceLock::~DeviceLock()
+{
+    release();
+}
+
+bool DeviceLock::acquire(bool exclusive)
+{
+    int op = exclusive ? LOCK_EX : LOCK_SH;
+
+    release();
+
+    // the lock works on a read-only file (created by root, or another
+    // user), the result record needs write
+    if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0644)) >= 0)
+        writable = true;
+    else if ((fd = open(path, O_RDONLY | O_NOFOLLOW)) < 0) {
+        fprintf(stderr, "ERROR: unable to open lock file %s : %s%s\n", path,
+                        strerror(errno), errno == ENOENT ?
+                        " (created by ebeam_daemon or ebeam_boot as root)" :
+                        "");
+        return false;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "ERROR: lock file %s is not a regular file\n", path);
+        close(fd);
+        fd = -1;
+        writable = false;
+        return false;
+    }
+
+    // readable by all whatever our umask, so every user shares it
+    if (st.st_uid == geteuid() && (st.st_mode & 0777) != 0644)
+        fchmod(fd, 0644);
+
+    // LOCK_DIR may be world writable : only believe our own or root's record
+    trusted = st.st_uid == 0 || st.st_uid == geteuid();
+
+    t_request = now_ms();
+    waited = false;
+
+    if (flock(fd, op | LOCK_NB) != 0) {
+        waited = true;
+        if (verbose)
+            fprintf(stderr, "Device busy, waiting for %s\n", path);
+
+        while (flock(fd, op) != 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "ERROR: unable to lock %s : %s\n", path,
+                                strerror(errno));
+                close(fd);
+                fd = -1;
+                return false;
+            }
+        }
+    }
+
+    wait = now_ms() - t_request;
+
+    // only count under an exclusive lock, the record is not shared-safe
+    if (waited && exclusive && writable) {
+        LockRecord rec;
+        read_record(rec);
+        rec.contended++;
+        write_record(rec);
+
+        if (verbose)
+            fprintf(stderr, "Waited %.3f ms for the device "
+                            "(%u contended requests so far)\n",
+                            wait, rec.contended);
+    }
+
+    return true;
+}
+
+void DeviceLock::release()
+{
+    if (fd >= 0)
+        close(fd);  // releases the flock
+
+    fd = -1;
+    writable = false;
+    trusted = false;
+}
+
+bool DeviceLock::read_record(LockRecord& rec)
+{
+    if (fd < 0 || !trusted ||
+        pread(fd, &rec, sizeof(rec), 0) != (ssize_t) sizeof(rec) ||
+        rec.magic != LOCK_MAGIC) {
+        memset(&rec, 0, sizeof(rec));
+        rec.magic = LOCK_MAGIC;
+        return false;
+    }
+
+    return true;
+}
+
+void DeviceLock::write_record(const LockRecord& rec)
+{
+    if (fd >= 0 && writable &&
+        pwrite(fd, &rec, sizeof(rec), 0) != (ssize_t) sizeof(rec))
+        fprintf(stderr, "WARNING: unable to update %s\n", path);
+}
+
+bool DeviceLock::coalesce(uint32_t request, bool* status)
+{
+    LockRecord rec;
+
+    // only a request that was in flight with ours counts
+    if (!waited || !read_record(rec) ||
+        rec.request != request || rec.done < t_request)
+        return false;
+
+    *status = rec.status;
+    rec.coalesced++;
+    write_record(rec);
+
+    if (verbose)
+        fprintf(stderr, "Identical request done while waiting, "
+                        "using its result (%u coalesced, %u applied)\n",
+                        rec.coalesced, rec.applies);
+
+    return true;
+}
+
+void DeviceLock::done(uint32_t request, bool status)
+{
+    LockRecord rec;
+
+    read_record(rec);
+    rec.request = request;
+    rec.status = status;
+    rec.done = now_ms();
+    rec.applies++;
+    write_record(rec);
+}
+
+bool DeviceLock::is_current(uint32_t request)
+{
+    LockRecord rec;
+
+    return read_record(rec) && rec.request == request && rec.status;
+}
+
+uint32_t DeviceLock::request_hash(DeviceRequest kind,
+                                  const EbeamCalibration* cal, bool zoned)
+{
+    struct {
+        int32_t          kind;
+        int32_t          zoned;
+        EbeamCalibration cal;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.kind = kind;
+    req.zoned = zoned;
+    if (cal)
+        req.cal = *cal;
+
+    return StateFile::crc32(&req, sizeof(req));
+}
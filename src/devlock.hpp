@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _devlock_hpp
+#define _devlock_hpp
+
+#include <stdint.h>
+#include <limits.h>
+
+#include "sysfs.hpp"
+
+/*
+ * Per-device lock, shared by every process and thread touching the
+ * calibration of a device (ebeam_state, ebeam_calibrator, ebeam_daemon).
+ *
+ * The lock is a flock() on /run/lock/ebeam_tools-<hash>.lock, where hash
+ * is derived from the real path of the device sysfs directory, the same
+ * file for every user. Lock files are created by whoever comes first
+ * (root : ebeam_daemon, ebeam_boot, udev), opened read-only when they
+ * can't be written, and never through a symlink. Readers take it shared,
+ * writers exclusive, so coefficients are never written by two processes
+ * at once nor read while half written.
+ *
+ * Single flight : the lock file also holds the result of the last write
+ * request (a hash of what was written, its status and its end time).
+ * A writer that had to wait, and finds that an identical request
+ * completed meanwhile, takes that result instead of writing again.
+ * The record is only believed in a lock file of root or of the caller.
+ * Conflicting requests are serialized by the lock.
+ */
+
+#ifndef LOCK_DIR
+#define LOCK_DIR "/run/lock"
+#endif
+
+/// kinds of write requests, part of the request hash
+enum DeviceRequest {
+    DEVLOCK_APPLY = 1,  // driver and evdev calibration
+    DEVLOCK_SYSFS,      // driver calibration only
+    DEVLOCK_EVDEV,      // evdev calibration only
+    DEVLOCK_RESET       // back to uncalibrated
+};
+
+/// result record, at the start of the lock file
+struct LockRecord {
+    uint32_t magic;
+    uint32_t request;       // hash of the last write request
+    int32_t  status;        // its result
+    uint32_t applies;       // write requests actually done
+    double   done;          // its end, CLOCK_MONOTONIC ms
+    uint32_t coalesced;     // write requests answered by another one
+    uint32_t contended;     // requests that had to wait for the lock
+};
+
+/// Class for locking the calibration of a device
+class DeviceLock
+{
+public:
+    DeviceLock(const char* device_dir);
+    ~DeviceLock();
+
+    // take the lock, shared for reading or exclusive for writing
+    bool acquire(bool exclusive);
+
+    // release the lock
+    void release();
+
+    // while holding the lock exclusive : did an identical request complete
+    // while we were waiting ? If so, *status is its result
+    bool coalesce(uint32_t request, bool* status);
+
+    // while holding the lock exclusive : record the result of a request
+    void done(uint32_t request, bool status);
+
+    // while holding the lock : was request the last write, successful ?
+    bool is_current(uint32_t request);
+
+    // time spent waiting for the lock, in ms
+    double get_wait() const { return wait; }
+
+    // hash identifying a write request
+    static uint32_t request_hash(DeviceRequest kind,
+                                 const EbeamCalibration* cal, bool zoned);
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    // read/write the result record
+    bool read_record(LockRecord& rec);
+    void write_record(const LockRecord& rec);
+
+    char    path[PATH_MAX];
+    int     fd;
+    bool    writable;   // lock file opened read-write
+    bool    trusted;    // lock file of root or ours : record believed
+    bool    waited;     // the lock was contended
+    double  t_request;  // when acquire() was called
+    double  wait;
+};
+
+#endif
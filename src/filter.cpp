@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "filter.hpp"
+#include "timing.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// synthetic pen of bench() : report rate, speed, noise
+#define BENCH_PEN_RATE  100     // reports/s
+#define BENCH_PEN_SPEED 500     // px/s
+#define BENCH_PEN_NOISE 2.0     // px, standard deviation
+
+// bench() pen path : at rest then moving, in reports
+#define BENCH_PEN_REST  50
+#define BENCH_PEN_MOVE  100
+
+// reports ignored after each rest/move change, for the steady state
+#define BENCH_PEN_SETTLE 20
+
+/// smoothing factor of a first order low-pass at cutoff Hz
+static inline double alpha(double te, double cutoff)
+{
+    double tau = 1.0 / (2 * M_PI * cutoff);
+    return 1.0 / (1.0 + tau / te);
+}
+
+PenFilter::PenFilter()
+  : kind(NONE),
+    min_cutoff(1.0),
+    beta(0.02),
+    d_cutoff(1.0),
+    q(1e5),
+    r(4.0),
+    n(5),
+    count(0),
+    last_t(0)
+{
+    memset(&ax, 0, sizeof(ax));
+    memset(&ay, 0, sizeof(ay));
+}
+
+bool PenFilter::parse(const char* spec)
+{
+    const char* args = strchr(spec, ':');
+    size_t len = args ? (size_t) (args - spec) : strlen(spec);
+    double a = 0, b = 0;
+    int nargs = 0;
+
+    if (args) {
+        nargs = sscanf(args + 1, "%lf,%lf", &a, &b);
+        if (nargs < 1 || a <= 0 || (nargs == 2 && b < 0)) {
+            fprintf(stderr, "ERROR: bad filter parameters '%s'.\n", args + 1);
+            return FAILURE;
+        }
+    }
+
+    if (len == 4 && strncmp(spec, "none", len) == 0)
+        kind = NONE;
+    else if (len == 7 && strncmp(spec, "oneeuro", len) == 0) {
+        kind = ONE_EURO;
+        if (nargs >= 1)
+            min_cutoff = a;
+        if (nargs == 2)
+            beta = b;
+    } else if (len == 6 && strncmp(spec, "kalman", len) == 0) {
+        kind = KALMAN;
+        if (nargs >= 1)
+            q = a;
+        if (nargs == 2 && b > 0)
+            r = b;
+    } else if (len == 6 && strncmp(spec, "median", len) == 0) {
+        kind = MEDIAN;
+        if (nargs >= 1)
+            n = (int) a;
+        if (nargs == 2 || n < 1 || n > FILTER_MEDIAN_MAX || n % 2 == 0) {
+            fprintf(stderr, "ERROR: median window must be odd, "
+                            "1 to %d.\n", FILTER_MEDIAN_MAX);
+            return FAILURE;
+        }
+    } else {
+        fprintf(stderr, "ERROR: unknown filter '%s'.\n", spec);
+        return FAILURE;
+    }
+
+    reset();
+
+    return SUCCESS;
+}
+
+void PenFilter::describe(char* buf, unsigned len) const
+{
+    switch (kind) {
+    case ONE_EURO:
+        snprintf(buf, len, "oneeuro:%g,%g", min_cutoff, beta);
+        break;
+    case KALMAN:
+        snprintf(buf, len, "kalman:%g,%g", q, r);
+        break;
+    case MEDIAN:
+        snprintf(buf, len, "median:%d", n);
+        break;
+    default:
+        snprintf(buf, len, "none");
+    }
+}
+
+void PenFilter::one_euro(AxisFilter& a, double te, double x)
+{
+    double dx = (x - a.x) / te;
+
+    a.dx += alpha(te, d_cutoff) * (dx - a.dx);
+    a.x += alpha(te, min_cutoff + beta * fabs(a.dx)) * (x - a.x);
+}
+
+void PenFilter::kalman(AxisFilter& a, double te, double x)
+{
+    // predict : constant velocity, white acceleration noise
+    a.x += a.v * te;
+    a.P[0] += te * (2 * a.P[1] + te * a.P[2]) + q * te * te * te / 3;
+    a.P[1] += te * a.P[2] + q * te * te / 2;
+    a.P[2] += q * te;
+
+    // update with the measured position
+    double s = a.P[0] + r;
+    double k0 = a.P[0] / s;
+    double k1 = a.P[1] / s;
+    double e = x - a.x;
+
+    a.x += k0 * e;
+    a.v += k1 * e;
+    a.P[2] -= k1 * a.P[1];
+    a.P[0] *= 1 - k0;
+    a.P[1] *= 1 - k0;
+}
+
+double PenFilter::median(AxisFilter& a, double x)
+{
+    double sorted[FILTER_MEDIAN_MAX];
+    int len = count < (unsigned) n ? count + 1 : n;
+
+    a.window[count % n] = x;
+
+    // insertion sort : a few elements
+    for (int i = 0; i < len; i++) {
+        double v = a.window[i];
+        int j = i;
+        for (; j > 0 && sorted[j - 1] > v; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+
+    return sorted[len / 2];
+}
+
+void PenFilter::apply(double t, double x, double y, double& fx, double& fy)
+{
+    double te = t - last_t;
+
+    if (count > 0 && (te <= 0 || te > FILTER_GAP))
+        count = 0;
+    last_t = t;
+
+    switch (kind) {
+    case ONE_EURO:
+    case KALMAN:
+        if (count == 0) {
+            ax.x = x;
+            ay.x = y;
+            ax.dx = ay.dx = 0;
+            ax.v = ay.v = 0;
+            ax.P[0] = ay.P[0] = r;
+            ax.P[1] = ay.P[1] = 0;
+            ax.P[2] = ay.P[2] = q;
+        } else if (kind == ONE_EURO) {
+            one_euro(ax, te, x);
+            one_euro(ay, te, y);
+        } else {
+            kalman(ax, te, x);
+            kalman(ay, te, y);
+        }
+        fx = ax.x;
+        fy = ay.x;
+        break;
+
+    case MEDIAN:
+        fx = median(ax, x);
+        fy = median(ay, y);
+        break;
+
+    default:
+        fx = x;
+        fy = y;
+    }
+
+    count++;
+}
+
+///
+/// benchmark
+///
+
+/// deterministic gaussian noise : Box-Muller on an LCG
+static double bench_noise(unsigned& seed)
+{
+    seed = seed * 1103515245u + 12345u;
+    double u1 = ((seed >> 8) + 1.0) / 16777217.0;
+    seed = seed * 1103515245u + 12345u;
+    double u2 = (seed >> 8) / 16777216.0;
+
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/// true pen position of report i : at rest, then a straight stroke
+/// (diagonal, or back), repeated. Returns the speed along the stroke
+static double bench_pen(unsigned i, double& x, double& y, double& dir_x,
+                        double& dir_y, bool& steady)
+{
+    const unsigned period = BENCH_PEN_REST + BENCH_PEN_MOVE;
+    const double step = (double) BENCH_PEN_SPEED / BENCH_PEN_RATE;
+    unsigned stroke = i / period;
+    unsigned k = i % period;
+    double sign = stroke % 2 ? -1 : 1;
+
+    dir_x = sign * 0.8;
+    dir_y = sign * 0.6;
+
+    // start of the stroke : alternately both ends
+    double s = stroke % 2 ? BENCH_PEN_MOVE * step : 0;
+    if (k >= BENCH_PEN_REST)
+        s += sign * (k - BENCH_PEN_REST) * step;
+
+    x = 200 + 0.8 * s;
+    y = 200 + 0.6 * s;
+    steady = k % BENCH_PEN_REST >= BENCH_PEN_SETTLE &&
+             (k < BENCH_PEN_REST || k - BENCH_PEN_REST >= BENCH_PEN_SETTLE);
+
+    return k >= BENCH_PEN_REST ? BENCH_PEN_SPEED : 0;
+}
+
+bool PenFilter::bench(unsigned n) const
+{
+    PenFilter f = *this;
+    double rest_in = 0, rest_out = 0, lag = 0;
+    unsigned nrest = 0, nmove = 0;
+    unsigned seed = 1;
+    char name[48];
+
+    if (n == 0)
+        return FAILURE;
+
+    describe(name, sizeof(name));
+    f.reset();
+
+    // quality, on a pen that rests then moves
+    for (unsigned i = 0; i < n; i++) {
+        double x, y, dx, dy, fx, fy;
+        bool steady;
+        double speed = bench_pen(i, x, y, dx, dy, steady);
+        double nx = bench_noise(seed) * BENCH_PEN_NOISE;
+        double ny = bench_noise(seed) * BENCH_PEN_NOISE;
+
+        f.apply((double) i / BENCH_PEN_RATE, x + nx, y + ny, fx, fy);
+
+        if (!steady)
+            continue;
+        if (speed == 0) {
+            rest_in += nx * nx + ny * ny;
+            rest_out += (fx - x) * (fx - x) + (fy - y) * (fy - y);
+            nrest++;
+        } else {
+            // behind the true position, along the stroke
+            lag += ((x - fx) * dx + (y - fy) * dy) / speed;
+            nmove++;
+        }
+    }
+
+    // cost : already generated samples, timed alone
+    const unsigned batch = 1024;
+    double in[2 * batch];
+    double sink = 0;
+
+    for (unsigned i = 0; i < batch; i++) {
+        double x, y, dx, dy;
+        bool steady;
+        bench_pen(i, x, y, dx, dy, steady);
+        in[2 * i] = x + bench_noise(seed) * BENCH_PEN_NOISE;
+        in[2 * i + 1] = y + bench_noise(seed) * BENCH_PEN_NOISE;
+    }
+
+    f.reset();
+    double t = now_ms();
+    for (unsigned i = 0; i < n; i++) {
+        double fx, fy;
+        unsigned k = i % batch;
+        f.apply((double) i / BENCH_PEN_RATE, in[2 * k], in[2 * k + 1],
+                fx, fy);
+        sink += fx + fy;
+    }
+    t = now_ms() - t;
+
+    printf("%-20s jitter %.2f px (raw %.2f px), lag %.1f ms at %d px/s, "
+           "%.0f ns/sample%s\n", name,
+           nrest ? sqrt(rest_out / nrest) : 0.0,
+           nrest ? sqrt(rest_in / nrest) : 0.0,
+           nmove ? lag / nmove * 1000 : 0.0, BENCH_PEN_SPEED,
+           t * 1000000.0 / n, sink == sink ? "" : " (nan)");
+
+    return SUCCESS;
+}
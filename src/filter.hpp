@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _filter_hpp
+#define _filter_hpp
+
+/*
+ * Smoothing of the corrected pen positions : eBeam devices return
+ * unstable values, which show up as wobbly handwriting. Three filters,
+ * applied on each axis after the calibration (see pipeline.hpp) :
+ *   - One Euro : adaptive low-pass, the cutoff frequency grows with the
+ *     pen speed (Casiez, Roussel, Vogel, CHI 2012),
+ *   - Kalman : constant velocity model, per axis,
+ *   - median : moving median of the last n positions.
+ * Smoothing costs lag : bench() measures both, on a synthetic pen.
+ *
+ * No allocation, fixed size state : the filter is reset at each pen up.
+ */
+
+// longest median window
+#define FILTER_MEDIAN_MAX 15
+
+// a gap longer than this between two positions resets the filter, in s
+#define FILTER_GAP 0.1
+
+/// filter of one axis
+struct AxisFilter {
+    // One Euro
+    double x;           // last output
+    double dx;          // filtered derivative
+    // Kalman
+    double v;           // velocity
+    double P[3];        // covariance : pp, pv, vv
+    // median
+    double window[FILTER_MEDIAN_MAX];
+};
+
+/// Class for smoothing a pen position stream
+class PenFilter
+{
+public:
+    enum Kind { NONE, ONE_EURO, KALMAN, MEDIAN };
+
+    PenFilter();
+
+    // "none", "oneeuro[:mincutoff[,beta]]", "kalman[:q[,r]]" or
+    // "median[:n]"
+    bool parse(const char* spec);
+
+    Kind get_kind() const { return kind; }
+
+    // name and parameters, for reports
+    void describe(char* buf, unsigned len) const;
+
+    // forget the history : pen up, dropped events
+    void reset() { count = 0; }
+
+    // filter position (x, y) in pixels at time t in s
+    void apply(double t, double x, double y, double& fx, double& fy);
+
+    // smoothing and lag on a synthetic pen, per sample cost
+    bool bench(unsigned n) const;
+
+private:
+    void one_euro(AxisFilter& a, double te, double x);
+    void kalman(AxisFilter& a, double te, double x);
+    double median(AxisFilter& a, double x);
+
+    Kind kind;
+
+    // parameters
+    double min_cutoff;  // One Euro : Hz, at rest
+    double beta;        // One Euro : cutoff increase per px/s
+    double d_cutoff;    // One Euro : derivative cutoff, Hz
+    double q;           // Kalman : acceleration noise, (px/s^2)^2 s
+    double r;           // Kalman : measurement noise, px^2
+    int n;              // median : window length, odd
+
+    // state
+    unsigned count;     // positions since reset
+    double last_t;
+    AxisFilter ax;
+    AxisFilter ay;
+};
+
+#endif
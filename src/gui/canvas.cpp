@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "gui/canvas.hpp"
+#include "state.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <stdexcept>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+///
+/// X window
+///
+
+CanvasX11::CanvasX11(Display* display0, Window win0, GC gc0,
+                     XFontStruct* font_info0, const unsigned long* pixel0)
+  : display(display0),
+    win(win0),
+    gc(gc0),
+    font_info(font_info0),
+    pixel(pixel0)
+{
+}
+
+int CanvasX11::get_width() const
+{
+    return DisplayWidth(display, DefaultScreen(display));
+}
+
+int CanvasX11::get_height() const
+{
+    return DisplayHeight(display, DefaultScreen(display));
+}
+
+void CanvasX11::set_color(int color)
+{
+    XSetForeground(display, gc, pixel[color]);
+}
+
+void CanvasX11::set_line(int width, bool butt)
+{
+    XSetLineAttributes(display, gc, width,
+                                    LineSolid,
+                                    butt ? CapButt : CapRound,
+                                    butt ? JoinMiter : JoinRound);
+}
+
+void CanvasX11::clear()
+{
+    XClearWindow(display, win);
+}
+
+void CanvasX11::fill_rectangle(int x, int y, int w, int h)
+{
+    XFillRectangle(display, win, gc, x, y, w, h);
+}
+
+void CanvasX11::draw_rectangle(int x, int y, int w, int h)
+{
+    XDrawRectangle(display, win, gc, x, y, w, h);
+}
+
+void CanvasX11::draw_line(int x1, int y1, int x2, int y2)
+{
+    XDrawLine(display, win, gc, x1, y1, x2, y2);
+}
+
+void CanvasX11::draw_arc(int x, int y, int w, int h, int angle1, int angle2)
+{
+    XDrawArc(display, win, gc, x, y, w, h, angle1, angle2);
+}
+
+void CanvasX11::fill_arc(int x, int y, int w, int h, int angle1, int angle2)
+{
+    XFillArc(display, win, gc, x, y, w, h, angle1, angle2);
+}
+
+void CanvasX11::draw_string(int x, int y, const char* s, int len)
+{
+    XDrawString(display, win, gc, x, y, s, len);
+}
+
+int CanvasX11::text_width(const char* s, int len) const
+{
+    return XTextWidth(font_info, s, len);
+}
+
+int CanvasX11::text_height() const
+{
+    return font_info->ascent + font_info->descent;
+}
+
+///
+/// memory framebuffer
+///
+
+CanvasMemory::CanvasMemory(int width0, int height0,
+                           const unsigned char (*palette0)[3], int ncolors0)
+  : width(width0),
+    height(height0),
+    pixels(NULL),
+    palette(palette0),
+    ncolors(ncolors0),
+    color(0),
+    line_width(0)
+{
+    if (width <= 0 || height <= 0)
+        throw std::runtime_error("Bad framebuffer size.");
+
+    pixels = (unsigned char*) calloc((size_t) width * height, 1);
+    if (pixels == NULL)
+        throw std::runtime_error("Unable to allocate the framebuffer.");
+}
+
+CanvasMemory::~CanvasMemory()
+{
+    free(pixels);
+}
+
+void CanvasMemory::set_color(int color0)
+{
+    color = (unsigned char) color0;
+}
+
+void CanvasMemory::set_line(int width0, bool /* butt */)
+{
+    line_width = width0;
+}
+
+void CanvasMemory::clear()
+{
+    // palette index 0 : the window background
+    memset(pixels, 0, (size_t) width * height);
+}
+
+void CanvasMemory::fill_rectangle(int x, int y, int w, int h)
+{
+    int x1 = x < 0 ? 0 : x;
+    int y1 = y < 0 ? 0 : y;
+    int x2 = x + w > width ? width : x + w;
+    int y2 = y + h > height ? height : y + h;
+
+    if (x1 >= x2)
+        return;
+
+    for (int j = y1; j < y2; j++)
+        memset(pixels + (size_t) j * width + x1, color, x2 - x1);
+}
+
+void CanvasMemory::draw_rectangle(int x, int y, int w, int h)
+{
+    // the outline goes through x .. x+w, centered on it
+    int lw = line_width > 1 ? line_width : 1;
+    int o = lw / 2;
+
+    fill_rectangle(x - o, y - o, w + lw, lw);           // top
+    fill_rectangle(x - o, y + h - o, w + lw, lw);       // bottom
+    fill_rectangle(x - o, y - o, lw, h + lw);           // left
+    fill_rectangle(x + w - o, y - o, lw, h + lw);       // right
+}
+
+void CanvasMemory::draw_line(int x1, int y1, int x2, int y2)
+{
+    int lw = line_width > 1 ? line_width : 1;
+    int o = lw / 2;
+    int dx = abs(x2 - x1);
+    int dy = -abs(y2 - y1);
+    int sx = x1 < x2 ? 1 : -1;
+    int sy = y1 < y2 ? 1 : -1;
+    int err = dx + dy;
+
+    // Bresenham, the pen is a lw x lw square
+    for (;;) {
+        if (lw == 1) {
+            if (x1 >= 0 && x1 < width && y1 >= 0 && y1 < height)
+                pixels[(size_t) y1 * width + x1] = color;
+        } else
+            fill_rectangle(x1 - o, y1 - o, lw, lw);
+
+        if (x1 == x2 && y1 == y2)
+            break;
+
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x1 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+void CanvasMemory::arc(int x, int y, int w, int h, int angle1, int angle2,
+                       bool fill)
+{
+    if (w <= 0 || h <= 0)
+        return;
+
+    double rx = w / 2.0;
+    double ry = h / 2.0;
+    double cx = x + rx;
+    double cy = y + ry;
+    double r = (rx + ry) / 2;
+    double half = (line_width > 1 ? line_width : 1) / 2.0;
+
+    // angle range, counterclockwise
+    double start = angle1 / 64.0;
+    double extent = angle2 / 64.0;
+    if (extent < 0) {
+        start += extent;
+        extent = -extent;
+    }
+    bool full = extent >= 360;
+    start = fmod(start, 360);
+    if (start < 0)
+        start += 360;
+
+    int margin = fill ? 0 : (int) half + 1;
+    int i1 = x - margin < 0 ? 0 : x - margin;
+    int j1 = y - margin < 0 ? 0 : y - margin;
+    int i2 = x + w + margin > width ? width : x + w + margin;
+    int j2 = y + h + margin > height ? height : y + h + margin;
+
+    for (int j = j1; j < j2; j++) {
+        double ny = (j + 0.5 - cy) / ry;
+        unsigned char* row = pixels + (size_t) j * width;
+
+        for (int i = i1; i < i2; i++) {
+            double nx = (i + 0.5 - cx) / rx;
+            double d = sqrt(nx * nx + ny * ny);
+
+            if (fill ? d > 1 : fabs(d - 1) * r > half)
+                continue;
+
+            if (!full) {
+                // y axis up
+                double a = atan2(cy - (j + 0.5), i + 0.5 - cx) * 180 / M_PI;
+                a -= start;
+                if (a < 0)
+                    a += 360;
+                if (a < 0)
+                    a += 360;
+                if (a > extent)
+                    continue;
+            }
+
+            row[i] = color;
+        }
+    }
+}
+
+void CanvasMemory::draw_arc(int x, int y, int w, int h,
+                            int angle1, int angle2)
+{
+    arc(x, y, w, h, angle1, angle2, false);
+}
+
+void CanvasMemory::fill_arc(int x, int y, int w, int h,
+                            int angle1, int angle2)
+{
+    arc(x, y, w, h, angle1, angle2, true);
+}
+
+void CanvasMemory::draw_string(int x, int y, const char* s, int len)
+{
+    // 7x10 ink box in each 9x15 cell, above the baseline
+    for (int k = 0; k < len; k++, x += CANVAS_CHAR_WIDTH) {
+        unsigned char c = (unsigned char) s[k];
+        uint32_t bits = c * 2654435761U;
+
+        if (c <= ' ')
+            continue;
+
+        for (int row = 0; row < 10; row++) {
+            int j = y - 10 + row;
+            if (j < 0 || j >= height)
+                continue;
+
+            // next pattern bits of the character
+            bits = bits * 1103515245U + 12345U + c;
+            for (int col = 0; col < 7; col++) {
+                int i = x + 1 + col;
+                if (i >= 0 && i < width && (bits >> (16 + col)) & 1)
+                    pixels[(size_t) j * width + i] = color;
+            }
+        }
+    }
+}
+
+int CanvasMemory::text_width(const char* /* s */, int len) const
+{
+    return len * CANVAS_CHAR_WIDTH;
+}
+
+int CanvasMemory::text_height() const
+{
+    return CANVAS_CHAR_ASCENT + CANVAS_CHAR_DESCENT;
+}
+
+uint32_t CanvasMemory::checksum() const
+{
+    return StateFile::crc32(pixels, (size_t) width * height);
+}
+
+bool CanvasMemory::write_ppm(const char* path) const
+{
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", path);
+        return FAILURE;
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+
+    unsigned char* line = (unsigned char*) malloc((size_t) width * 3);
+    bool ok = line != NULL;
+    for (int j = 0; ok && j < height; j++) {
+        const unsigned char* row = pixels + (size_t) j * width;
+        for (int i = 0; i < width; i++) {
+            int c = row[i] < ncolors ? row[i] : 0;
+            memcpy(line + 3 * i, palette[c], 3);
+        }
+        ok = fwrite(line, 3, width, fp) == (size_t) width;
+    }
+    free(line);
+
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
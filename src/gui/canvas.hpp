@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef GUI_CANVAS
+#define GUI_CANVAS
+
+#include <X11/Xlib.h>
+
+#include <stdint.h>
+
+/*
+ * Drawing target of the calibration GUI : the X window (CanvasX11), or a
+ * memory framebuffer (CanvasMemory) for draw benchmarks and golden images,
+ * without X.
+ *
+ * Colors are indexes in the GUI palette; arcs follow the Xlib conventions
+ * (bounding box, angles in 1/64 degree, counterclockwise from 3 o'clock).
+ */
+
+/// Interface for drawing the GUI
+class Canvas
+{
+public:
+    virtual ~Canvas() {}
+
+    virtual int get_width() const = 0;
+    virtual int get_height() const = 0;
+
+    // drawing state
+    virtual void set_color(int color) = 0;
+    virtual void set_line(int width, bool butt) = 0; // butt : else round
+
+    // fill with the background
+    virtual void clear() = 0;
+
+    virtual void fill_rectangle(int x, int y, int w, int h) = 0;
+    virtual void draw_rectangle(int x, int y, int w, int h) = 0;
+    virtual void draw_line(int x1, int y1, int x2, int y2) = 0;
+    virtual void draw_arc(int x, int y, int w, int h,
+                          int angle1, int angle2) = 0;
+    virtual void fill_arc(int x, int y, int w, int h,
+                          int angle1, int angle2) = 0;
+
+    // text, from the baseline
+    virtual void draw_string(int x, int y, const char* s, int len) = 0;
+    virtual int text_width(const char* s, int len) const = 0;
+    virtual int text_height() const = 0;
+};
+
+/// Class for drawing in an X window
+class CanvasX11 : public Canvas
+{
+public:
+    // pixel : X pixel of each palette color
+    CanvasX11(Display* display, Window win, GC gc, XFontStruct* font_info,
+              const unsigned long* pixel);
+
+    int get_width() const;
+    int get_height() const;
+    void set_color(int color);
+    void set_line(int width, bool butt);
+    void clear();
+    void fill_rectangle(int x, int y, int w, int h);
+    void draw_rectangle(int x, int y, int w, int h);
+    void draw_line(int x1, int y1, int x2, int y2);
+    void draw_arc(int x, int y, int w, int h, int angle1, int angle2);
+    void fill_arc(int x, int y, int w, int h, int angle1, int angle2);
+    void draw_string(int x, int y, const char* s, int len);
+    int text_width(const char* s, int len) const;
+    int text_height() const;
+
+private:
+    Display*            display;
+    Window              win;
+    GC                  gc;
+    XFontStruct*        font_info;
+    const unsigned long* pixel;
+};
+
+// fixed cell of the memory canvas text, as the "9x15" X font
+#define CANVAS_CHAR_WIDTH 9
+#define CANVAS_CHAR_ASCENT 12
+#define CANVAS_CHAR_DESCENT 3
+
+/*
+ * Memory framebuffer : one palette index per pixel, up to 8K multi-head.
+ * Text is drawn in the fixed cells of the 9x15 X font, each character as
+ * a pattern of its code : the layout and the content of the text show in
+ * golden images, not the glyph shapes.
+ */
+class CanvasMemory : public Canvas
+{
+public:
+    // palette : RGB of each color, for write_ppm
+    // Throws std::runtime_error if out of memory
+    CanvasMemory(int width, int height,
+                 const unsigned char (*palette)[3], int ncolors);
+    ~CanvasMemory();
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    void set_color(int color);
+    void set_line(int width, bool butt);
+    void clear();
+    void fill_rectangle(int x, int y, int w, int h);
+    void draw_rectangle(int x, int y, int w, int h);
+    void draw_line(int x1, int y1, int x2, int y2);
+    void draw_arc(int x, int y, int w, int h, int angle1, int angle2);
+    void fill_arc(int x, int y, int w, int h, int angle1, int angle2);
+    void draw_string(int x, int y, const char* s, int len);
+    int text_width(const char* s, int len) const;
+    int text_height() const;
+
+    const unsigned char* get_pixels() const { return pixels; }
+
+    // CRC32 of the pixels, for golden images
+    uint32_t checksum() const;
+
+    // viewable image (binary PPM)
+    bool write_ppm(const char* path) const;
+
+private:
+    // ellipse of the bounding box : outline band or filled, angle range
+    void arc(int x, int y, int w, int h, int angle1, int angle2, bool fill);
+
+    int width;
+    int height;
+    unsigned char* pixels;
+    const unsigned char (*palette)[3];
+    int ncolors;
+    unsigned char color;
+    int line_width;
+};
+
+#endif
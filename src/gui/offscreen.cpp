@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "gui/offscreen.hpp"
+
+OffscreenGui::OffscreenGui(Calibrator* w, CanvasMemory* canvas0)
+  : GuiCalibratorX11(w, canvas0->get_width(), canvas0->get_height(), 0,
+                     canvas0)
+{
+}
+
+void OffscreenGui::frame_redraw()
+{
+    redraw();
+}
+
+void OffscreenGui::frame_message(bool ok)
+{
+    draw_message(ok ? "Calibration complete." : "Calibration failed.",
+                 ok ? DARKGREEN : RED);
+}
+
+void OffscreenGui::frame_clock(int elapsed)
+{
+    // clock_tick adds its step first
+    time_elapsed = elapsed;
+    clock_tick();
+}
+
+void OffscreenGui::set_clicks(int n)
+{
+    calibrator->reset_tuples();
+    final_step = n >= NUM_POINTS;
+
+    // far apart raw values : no double click
+    for (int i = 0; i < n && i < NUM_POINTS; i++)
+        calibrator->add_click(1000 * (i + 1), 1000 * (i + 1),
+                              (int) target_x[i], (int) target_y[i]);
+}
+
+const unsigned char (*OffscreenGui::get_palette())[3]
+{
+    return rgb;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef GUI_OFFSCREEN
+#define GUI_OFFSCREEN
+
+#include "gui/x11.hpp"
+
+/*
+ * The calibration GUI drawing into a memory canvas, without X : per frame
+ * cost of each drawing routine (ebeam_bench), and golden images of the
+ * calibration steps (ebeam_bench --golden).
+ */
+
+/// Class for rendering the GUI offscreen
+class OffscreenGui : public GuiCalibratorX11
+{
+public:
+    // the screen is the canvas, w's active zone within it
+    OffscreenGui(Calibrator* w, CanvasMemory* canvas);
+
+    // the drawing routines
+    void frame_redraw();
+    void frame_message(bool ok);    // calibration complete, or failed
+    void frame_clock(int elapsed);  // ms since the last click
+
+    // step of the calibration : n targets clicked, final step at
+    // NUM_POINTS
+    void set_clicks(int n);
+
+    // palette of the canvas
+    static const unsigned char (*get_palette())[3];
+    static int get_num_colors() { return NUM_COLORS; }
+};
+
+#endif
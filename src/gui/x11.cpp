@@ -20,9 +20,15 @@
 /*
  * signal (SIGALRM) based "event loop"
  * Xlib + signal + oop madness
+ *
+ * The handler only flags the tick : the main loop runs it (timer_signal),
+ * so that no Xlib call nor X traffic accounting happens in signal context.
  */
 
 #include "gui/x11.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+#include "xstats.hpp"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,11 +38,8 @@
 
 #include <string>
 #include <stdexcept>
-
-// X
-#ifdef HAVE_X11_XRANDR
-#include <X11/extensions/Xrandr.h> // support for multi-head setups
-#endif
+#include <vector>
+#include <algorithm>
 
 /// look'n fell
 // Timeout parameters
@@ -65,11 +68,19 @@ const std::string help_text[help_lines] = {
 const char* GuiCalibratorX11::colors[GuiCalibratorX11::NUM_COLORS] =
     {"BLACK", "WHITE", "GRAY", "DIMGRAY", "RED", "DARKGREEN"};
 
+// the same, in the X rgb.txt, for offscreen images
+const unsigned char GuiCalibratorX11::rgb[GuiCalibratorX11::NUM_COLORS][3] =
+    {{0, 0, 0}, {255, 255, 255}, {190, 190, 190}, {105, 105, 105},
+     {255, 0, 0}, {0, 100, 0}};
+
+// set by the signal handler, cleared by timer_signal()
+static volatile sig_atomic_t tick_pending = 0;
+
 // signal handler
 void sigalarm_handler(int num)
 {
     if (num == SIGALRM) {
-        GuiCalibratorX11::timer_signal();
+        tick_pending = 1;
     }
 }
 
@@ -87,12 +98,17 @@ GuiCalibratorX11* GuiCalibratorX11::instance = NULL;
 
 GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
   : calibrator(calibrator0),
+    headless(false),
+    result(-1),
+    canvas(NULL),
     display_width(-1),
     display_height(-1),
     raw_X(0),
     raw_Y(0),
     time_elapsed(0)
 {
+    TraceSpan span("gui_setup");
+
     is_running = true;
 
     verbose = calibrator->verbose;
@@ -106,23 +122,25 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
     /*
      * Check server
      */
-    display = XOpenDisplay(NULL);
+    display = X_ROUND_TRIP(XOpenDisplay(NULL));
     if (display == NULL) {
         throw std::runtime_error("Unable to connect to X server.");
     }
 
+    XPhase phase(display, "gui_setup");
+
     screen_num = DefaultScreen(display);
 
     // Is XInput Extension available ?
     int event, error;
-    if (!XQueryExtension(display, "XInputExtension",
-                                  &xi_opcode, &event, &error)) {
+    if (!X_ROUND_TRIP(XQueryExtension(display, "XInputExtension",
+                                      &xi_opcode, &event, &error))) {
         throw std::runtime_error("X Input extension not available.");
     }
 
     // Which version of XI2? We need 2.0
     int major = 2, minor = 0;
-    if (XIQueryVersion(display, &major, &minor) == BadRequest) {
+    if (X_ROUND_TRIP(XIQueryVersion(display, &major, &minor)) == BadRequest) {
         throw std::runtime_error("XI2 not available.");
     }
 
@@ -131,16 +149,26 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
                         major, minor);
 
     // Load font and get font information structure
-    font_info = XLoadQueryFont(display, "9x15");
+    font_info = X_ROUND_TRIP(XLoadQueryFont(display, "9x15"));
     if (font_info == NULL) {
         // fall back to native font
-        font_info = XLoadQueryFont(display, "fixed");
+        font_info = X_ROUND_TRIP(XLoadQueryFont(display, "fixed"));
         if (font_info == NULL) {
+            XStats::close_display(display);
             XCloseDisplay(display);
             throw std::runtime_error("Unable to open font");
         }
     }
 
+    // session log, from the screen setup on
+    if (calibrator->get_session_file() &&
+        !session.create(calibrator->get_session_file(),
+                        calibrator->get_device_name())) {
+        XStats::close_display(display);
+        XCloseDisplay(display);
+        throw std::runtime_error("Unable to record the session.");
+    }
+
     setup_zone();
     
     if (verbose) {
@@ -209,13 +237,13 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
     XISelectEvents(display, win, &mask, 1);
 
     // grab master keyboard
-    XIGrabDevice(display, 3, win,
-                             CurrentTime,
-                             None,
-                             GrabModeAsync,
-                             GrabModeAsync,
-                             False,
-                             &mask);
+    X_ROUND_TRIP(XIGrabDevice(display, 3, win,
+                              CurrentTime,
+                              None,
+                              GrabModeAsync,
+                              GrabModeAsync,
+                              False,
+                              &mask));
 
     // Select raw events from eBeam device
     mask.deviceid = calibrator->get_device_id();
@@ -230,8 +258,8 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
     Colormap colormap = DefaultColormap(display, screen_num);
     XColor color;
     for (int i = 0; i != NUM_COLORS; i++) {
-        XParseColor(display, colormap, colors[i], &color);
-        XAllocColor(display, colormap, &color);
+        X_ROUND_TRIP(XParseColor(display, colormap, colors[i], &color));
+        X_ROUND_TRIP(XAllocColor(display, colormap, &color));
         pixel[i] = color.pixel;
     }
 
@@ -243,6 +271,8 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
     gc = XCreateGC(display, win, 0, NULL);
     XSetFont(display, gc, font_info->fid);
 
+    canvas = new CanvasX11(display, win, gc, font_info, pixel);
+
 
     /*
      * Setup timer : clock animation & event loop
@@ -256,11 +286,45 @@ GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0)
     setitimer(ITIMER_REAL, &timer, NULL);
 }
 
+GuiCalibratorX11::GuiCalibratorX11(Calibrator* calibrator0,
+                                   int width, int height, int rotation,
+                                   Canvas* canvas0)
+  : calibrator(calibrator0),
+    headless(true),
+    result(-1),
+    canvas(canvas0),
+    display(NULL),
+    xi_opcode(0),
+    screen_num(0),
+    font_info(NULL),
+    display_width(-1),
+    display_height(-1),
+    raw_X(0),
+    raw_Y(0),
+    time_elapsed(0)
+{
+    is_running = true;
+    final_step = false;
+
+    verbose = calibrator->verbose;
+
+    min_x = calibrator->get_min_x();
+    min_y = calibrator->get_min_y();
+    max_x = calibrator->get_max_x();
+    max_y = calibrator->get_max_y();
+
+    set_zone(width, height, rotation);
+}
+
 GuiCalibratorX11::~GuiCalibratorX11()
 {
+    if (headless)
+        return;
+
     // ungrab keyboard
     XIUngrabDevice(display, 3, CurrentTime);
 
+    delete canvas;
     XFreeGC(display, gc);
     XCloseDisplay(display);
 }
@@ -281,7 +345,13 @@ void GuiCalibratorX11::destroy_instance()
 
 void GuiCalibratorX11::timer_signal()
 {
+    if (!tick_pending)
+        return;
+    tick_pending = 0;
+
     if (instance != NULL) {
+        XPhase phase(instance->display, "event_loop");
+
         // check timeout, update clock
         instance->clock_tick();
 
@@ -314,11 +384,16 @@ void GuiCalibratorX11::timer_signal()
                     instance->on_button_event((XIRawEvent *) cookie->data);
                     break;
 
-                case XI_KeyPress:
+                case XI_KeyPress: {
+                    SessionRecord rec;
+                    SessionLog::init(rec, SESSION_KEY);
+                    instance->record(rec);
+
                     XFreeEventData(instance->display, cookie);
                     //exit(1);
 		    is_running = false;
                     break;
+                }
 
                 default:
                     if (instance->verbose)
@@ -331,6 +406,189 @@ void GuiCalibratorX11::timer_signal()
     }
 }
 
+bool GuiCalibratorX11::replay(Calibrator* w)
+{
+    SessionLog log;
+    unsigned events = 0;
+    unsigned mismatches = 0;
+
+    if (!log.load(w->get_session_file()))
+        return false;
+
+    // first screen setup : see Calibrator::make_calibrator_gui
+    unsigned first = 0;
+    while (first < log.get_count() &&
+           log.get_record(first).type != SESSION_SETUP)
+        first++;
+    if (first == log.get_count())
+        return false;
+    const SessionRecord& setup = log.get_record(first);
+
+    double t = now_ms();
+    GuiCalibratorX11 gui(w, setup.v.i[0], setup.v.i[1], setup.v.i[2]);
+
+    for (unsigned i = first; i < log.get_count() && is_running; i++)
+        if (!gui.play(log.get_record(i), events))
+            mismatches++;
+
+    t = now_ms() - t;
+
+    printf("Replayed %u events of '%s' in %.3f ms : calibration %s, "
+           "%u difference(s) with the recording\n",
+           events, log.get_header()->device, t,
+           gui.result < 0 ? "not finished" :
+           gui.result ? "complete" : "failed", mismatches);
+
+    is_running = false;
+
+    return mismatches == 0;
+}
+
+bool GuiCalibratorX11::simulate(Calibrator* w, int sessions,
+                                const SimModel& model)
+{
+    const int width = SIM_WIDTH;
+    const int height = SIM_HEIGHT;
+    char dir[64];
+    unsigned events = 0;
+    int failed = 0;
+    std::vector<SessionRecord> records;
+    std::vector<double> errors;
+    double mean_sum = 0;
+
+    if (!PenSimulator::make_sysfs(dir, sizeof(dir)))
+        return false;
+
+    PenSimulator pen(model, 1);
+    double t = now_ms();
+
+    for (int s = 0; s < sessions; s++) {
+        // same parameters as w, a new board position each time
+        Calibrator calibrator("simulated pen", w->get_precision(),
+                              w->get_threshold(),
+                              w->is_zoned() ? w->get_min_x() : 0,
+                              w->is_zoned() ? w->get_min_y() : 0,
+                              w->is_zoned() ? w->get_max_x() : 0,
+                              w->is_zoned() ? w->get_max_y() : 0,
+                              width, height, 0, dir);
+        GuiCalibratorX11 gui(&calibrator, width, height, 0);
+
+        pen.new_board(width, height);
+        pen.make_session(gui.target_x, gui.target_y, NUM_POINTS, records);
+
+        for (unsigned i = 0; i < records.size() && is_running; i++)
+            gui.play(records[i], events);
+
+        // what the driver got, against the ground truth
+        EbeamCalibration cal;
+        if (gui.result != 1 || !EbeamSysfs::read_calibration(dir, cal)) {
+            failed++;
+            continue;
+        }
+
+        double mean, max;
+        pen.accuracy(cal, width, height, mean, max);
+        mean_sum += mean;
+        errors.push_back(max);
+
+        if (verbose)
+            fprintf(stderr, "Session %d : error mean %.2f px, "
+                            "max %.2f px\n", s, mean, max);
+    }
+
+    t = now_ms() - t;
+    PenSimulator::remove_sysfs(dir);
+
+    printf("Simulated %d sessions (%s mapping, noise %g, %u events) "
+           "in %.3f ms : %.1f sessions/s, failed %d (%.1f%%)\n",
+           sessions, model.mapping == SimModel::RADIAL ? "radial" :
+           "projective", model.noise, events, t,
+           t > 0 ? sessions * 1000.0 / t : 0.0,
+           failed, 100.0 * failed / sessions);
+
+    if (!errors.empty()) {
+        std::sort(errors.begin(), errors.end());
+        printf("Accuracy : mean %.2f px, max error p95 %.2f px, "
+               "worst %.2f px\n", mean_sum / errors.size(),
+               errors[(errors.size() - 1) * 95 / 100], errors.back());
+    }
+
+    is_running = false;
+
+    return failed == 0;
+}
+
+bool GuiCalibratorX11::play(const SessionRecord& rec, unsigned& events)
+{
+    unsigned char mask[1] = { 0 };
+    double values[2];
+    XIRawEvent ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    switch (rec.type) {
+    case SESSION_SETUP:
+        set_zone(rec.v.i[0], rec.v.i[1], rec.v.i[2]);
+        break;
+
+    case SESSION_TARGET:
+        if (rec.index < NUM_POINTS &&
+            (target_x[rec.index] != rec.v.d[0] ||
+             target_y[rec.index] != rec.v.d[1])) {
+            fprintf(stderr, "Target %u at (%g, %g) instead of "
+                            "(%g, %g)\n", rec.index,
+                            target_x[rec.index], target_y[rec.index],
+                            rec.v.d[0], rec.v.d[1]);
+            return false;
+        }
+        break;
+
+    case SESSION_MOTION:
+        mask[0] = rec.index;
+        values[0] = rec.v.d[0];
+        values[1] = rec.v.d[1];
+        ev.evtype = XI_RawMotion;
+        ev.valuators.mask_len = sizeof(mask);
+        ev.valuators.mask = mask;
+        ev.raw_values = values;
+        on_motion_event(&ev);
+        events++;
+        break;
+
+    case SESSION_BUTTON:
+        ev.evtype = XI_RawButtonPress;
+        ev.detail = rec.index;
+        on_button_event(&ev);
+        events++;
+        break;
+
+    case SESSION_KEY:
+    case SESSION_TIMEOUT:
+        is_running = false;
+        break;
+
+    case SESSION_RESULT: {
+        EbeamCalibration cal;
+        calibrator->get_calibration(cal);
+
+        bool same = result == rec.status && rec.index < 3;
+        for (int k = 0; same && k < 3; k++)
+            same = cal.H[3 * rec.index + k] == rec.v.l[k];
+        if (!same) {
+            fprintf(stderr, "Result (H row %u) differs from the "
+                            "recording\n", rec.index);
+            return false;
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
 ///
 /// regular members
 ///
@@ -338,26 +596,19 @@ void GuiCalibratorX11::timer_signal()
 void GuiCalibratorX11::setup_zone() {
     int width;
     int height;
+    int rotation;
 
-#ifdef HAVE_X11_XRANDR
-    int nsizes;
-
-    XRRScreenSize* randrsize = XRRSizes(display, screen_num, &nsizes);
-    if (nsizes != 0) {
-        Rotation screenrot = 0;
-        XRRRotations(display, screen_num, &screenrot);
-        bool rot = screenrot & RR_Rotate_90 || screenrot & RR_Rotate_270;
-        width = rot ? randrsize->height : randrsize->width;
-        height = rot ? randrsize->width : randrsize->height;
-    } else {
-        width = DisplayWidth(display, screen_num);
-        height = DisplayHeight(display, screen_num);
-    }
-#else
-    width = DisplayWidth(display, screen_num);
-    height = DisplayHeight(display, screen_num);
-#endif
+    // replay : as recorded
+    if (headless)
+        return;
+
+    Calibrator::get_screen_geometry(display, screen_num,
+                                    width, height, rotation);
+
+    set_zone(width, height, rotation);
+}
 
+void GuiCalibratorX11::set_zone(int width, int height, int rotation) {
     if (display_width == width && display_height == height)
         return; // nothing to do
 
@@ -387,6 +638,37 @@ void GuiCalibratorX11::setup_zone() {
 
     // reset calibration data
     calibrator->reset_tuples();
+
+    // target layout
+    SessionRecord rec;
+    SessionLog::init(rec, SESSION_SETUP);
+    rec.v.i[0] = width;
+    rec.v.i[1] = height;
+    rec.v.i[2] = rotation;
+    rec.v.i[3] = calibrator->get_precision();
+    rec.v.i[4] = calibrator->get_threshold();
+    rec.v.i[5] = calibrator->is_zoned();
+    record(rec);
+
+    SessionLog::init(rec, SESSION_ZONE);
+    rec.v.i[0] = min_x;
+    rec.v.i[1] = min_y;
+    rec.v.i[2] = max_x;
+    rec.v.i[3] = max_y;
+    record(rec);
+
+    for (int i = 0; i < NUM_POINTS; i++) {
+        SessionLog::init(rec, SESSION_TARGET, i);
+        rec.v.d[0] = target_x[i];
+        rec.v.d[1] = target_y[i];
+        record(rec);
+    }
+}
+
+void GuiCalibratorX11::record(SessionRecord& rec)
+{
+    if (!headless)
+        session.append(rec);
 }
 
 /// draw the window
@@ -394,52 +676,52 @@ void GuiCalibratorX11::redraw()
 {
     int w;
 
+    if (canvas == NULL)
+        return;
+
     // check display size
     setup_zone();
 
     /*
      * Print the text
      */
-    int text_height = font_info->ascent + font_info->descent;
+    int text_height = canvas->text_height();
     int text_width = -1;
 
     // max width of lines
     for (int i = 0; i != help_lines; i++) {
-        text_width = std::max(text_width, XTextWidth(font_info,
-                                                     help_text[i].c_str(),
-                                                     help_text[i].length()));
+        text_width = std::max(text_width,
+                              canvas->text_width(help_text[i].c_str(),
+                                                 help_text[i].length()));
     }
 
     int x = min_x + ((max_x - min_x +1) - text_width) / 2;
     int y = min_y + ((max_y - min_y +1) - text_height) / 2 - 60;
 
     // active zone background
-    XSetForeground(display, gc, pixel[GRAY]);
-    XFillRectangle(display, win, gc, min_x,
-                                     min_y,
-                                     max_x - min_x +1,
-                                     max_y - min_y +1);
+    canvas->set_color(GRAY);
+    canvas->fill_rectangle(min_x,
+                           min_y,
+                           max_x - min_x +1,
+                           max_y - min_y +1);
 
     
-    XSetForeground(display, gc, pixel[BLACK]);
-    XSetLineAttributes(display, gc, 2,
-                                    LineSolid,
-                                    CapRound,
-                                    JoinRound);
+    canvas->set_color(BLACK);
+    canvas->set_line(2, false);
 
-    XDrawRectangle(display, win, gc, x - 10,
-                                     y - (help_lines*text_height) - 10,
-                                     text_width + 20,
-                                     (help_lines*text_height) + 20);
+    canvas->draw_rectangle(x - 10,
+                           y - (help_lines*text_height) - 10,
+                           text_width + 20,
+                           (help_lines*text_height) + 20);
 
     // Print help lines
     y -= 3;
     for (int i = help_lines-1; i != -1; i--) {
-        w = XTextWidth(font_info, help_text[i].c_str(), help_text[i].length());
-        XDrawString(display, win, gc, x + (text_width-w)/2,
-                                      y,
-                                      help_text[i].c_str(),
-                                      help_text[i].length());
+        w = canvas->text_width(help_text[i].c_str(), help_text[i].length());
+        canvas->draw_string(x + (text_width-w)/2,
+                            y,
+                            help_text[i].c_str(),
+                            help_text[i].length());
         y -= text_height;
     }
 
@@ -451,25 +733,25 @@ void GuiCalibratorX11::redraw()
 
 		// set color: already clicked or not
 		if (i < calibrator->get_numclicks())
-		XSetForeground(display, gc, pixel[WHITE]);
+		canvas->set_color(WHITE);
 		else
-		XSetForeground(display, gc, pixel[RED]);
+		canvas->set_color(RED);
 
-		XSetLineAttributes(display, gc, 1, LineSolid, CapRound, JoinRound);
+		canvas->set_line(1, false);
 
-		XDrawLine(display, win, gc, target_x[i] - cross_lines,
+		canvas->draw_line(target_x[i] - cross_lines,
 					target_y[i],
 					target_x[i] + cross_lines,
 					target_y[i]);
 
-		XDrawLine(display, win, gc, target_x[i],
+		canvas->draw_line(target_x[i],
 					target_y[i] - cross_lines,
 					target_x[i],
 					target_y[i] + cross_lines);
 
-		XSetLineAttributes(display, gc, 2, LineSolid, CapRound, JoinRound);
+		canvas->set_line(2, false);
 
-		XDrawArc(display, win, gc, target_x[i] - cross_circle,
+		canvas->draw_arc(target_x[i] - cross_circle,
 					target_y[i] - cross_circle,
 					(2 * cross_circle),
 					(2 * cross_circle),
@@ -479,40 +761,37 @@ void GuiCalibratorX11::redraw()
     /*
      * Draw the clock background
      */
-    XSetForeground(display, gc, pixel[DIMGRAY]);
-    XSetLineAttributes(display, gc, 0,
-                                    LineSolid,
-                                    CapRound,
-                                    JoinRound);
-    XFillArc(display, win, gc, min_x + ((max_x - min_x +1) - clock_radius)/2,
-                               min_y + ((max_y - min_y +1) - clock_radius)/2,
-                               clock_radius,
-                               clock_radius,
-                               0, 360 * 64);
+    canvas->set_color(DIMGRAY);
+    canvas->set_line(0, false);
+    canvas->fill_arc(min_x + ((max_x - min_x +1) - clock_radius)/2,
+                     min_y + ((max_y - min_y +1) - clock_radius)/2,
+                     clock_radius,
+                     clock_radius,
+                     0, 360 * 64);
 }
 
 void GuiCalibratorX11::draw_message(const char* msg, const int color)
 {
-    int text_height = font_info->ascent + font_info->descent;
-    int text_width = XTextWidth(font_info, msg, strlen(msg));
+    if (canvas == NULL)
+        return;
+
+    int text_height = canvas->text_height();
+    int text_width = canvas->text_width(msg, strlen(msg));
 
     int x = min_x + ((max_x - min_x +1) - text_width) / 2;
     int y = min_y + ((max_y - min_y +1) - text_height) / 2 + clock_radius + 60;
     
     redraw();
 
-    XSetForeground(display, gc, pixel[color]);
-    XSetLineAttributes(display, gc, 2,
-                                    LineSolid,
-                                    CapRound,
-                                    JoinRound);
+    canvas->set_color(color);
+    canvas->set_line(2, false);
 
-    XDrawRectangle(display, win, gc, x - 10,
-                                     y - text_height - 10,
-                                     text_width + 20,
-                                     text_height + 25);
+    canvas->draw_rectangle(x - 10,
+                           y - text_height - 10,
+                           text_width + 20,
+                           text_height + 25);
 
-    XDrawString(display, win, gc, x, y, msg, strlen(msg));
+    canvas->draw_string(x, y, msg, strlen(msg));
 }
 
 /// events
@@ -525,32 +804,47 @@ void GuiCalibratorX11::clock_tick()
 {
     time_elapsed += time_step;
     if (time_elapsed > max_time) {
+        SessionRecord rec;
+        SessionLog::init(rec, SESSION_TIMEOUT);
+        record(rec);
+
 	is_running = false;
 	return;
 	//exit(1);
     }
 
+    if (canvas == NULL)
+        return;
+
     // Update clock
-    XSetForeground(display, gc, pixel[BLACK]);
-    XSetLineAttributes(display, gc, clock_line_width,
-                                    LineSolid,
-                                    CapButt,
-                                    JoinMiter);
+    canvas->set_color(BLACK);
+    canvas->set_line(clock_line_width, true);
 
     int clock_diameter = clock_radius - clock_line_width;
     double clock_time = ((double)time_elapsed/(double)max_time);
-    XDrawArc(display, win, gc, min_x + ((max_x - min_x +1)  - clock_diameter)/2,
-                               min_y + ((max_y - min_y +1) - clock_diameter)/2,
-                               clock_diameter,
-                               clock_diameter,
-                               90*64,
-                               clock_time * -360 * 64);
+    canvas->draw_arc(min_x + ((max_x - min_x +1)  - clock_diameter)/2,
+                     min_y + ((max_y - min_y +1) - clock_diameter)/2,
+                     clock_diameter,
+                     clock_diameter,
+                     90*64,
+                     clock_time * -360 * 64);
 }
 
 void GuiCalibratorX11::on_motion_event(XIRawEvent *event)
 {
     double *raw_value = event->raw_values;
 
+    // the valuators the handler looks at, as they came
+    SessionRecord rec;
+    SessionLog::init(rec, SESSION_MOTION);
+    for (int v = 0, n = 0; v < 2; v++)
+        if (XIMaskIsSet(event->valuators.mask, v)) {
+            rec.index |= 1 << v;
+            rec.v.d[n] = raw_value[n];
+            n++;
+        }
+    record(rec);
+
     // Only store raw values if not in final step and both are present
     if (!final_step			      &&
 	XIMaskIsSet(event->valuators.mask, 0) &&   // X
@@ -563,6 +857,12 @@ void GuiCalibratorX11::on_motion_event(XIRawEvent *event)
 
 void GuiCalibratorX11::on_button_event(XIRawEvent *event)
 {
+    TraceSpan span("click", calibrator->get_numclicks());
+
+    SessionRecord rec;
+    SessionLog::init(rec, SESSION_BUTTON, event->detail);
+    record(rec);
+
     // final step : wait for a click and leave
     if (final_step) {
         is_running = false;
@@ -574,7 +874,8 @@ void GuiCalibratorX11::on_button_event(XIRawEvent *event)
 
     // Clear window, maybe a bit overdone, but easiest atm.
     // (goal is to clear possible message and other clicks)
-    XClearWindow(display, win);
+    if (canvas)
+        canvas->clear();
 
     // reset timeout
     time_elapsed = 0;
@@ -590,6 +891,18 @@ void GuiCalibratorX11::on_button_event(XIRawEvent *event)
     if (calibrator->get_numclicks() == NUM_POINTS) {
 	final_step = true;
         success = calibrator->finish();
+        result = success;
+
+        // computed calibration, to check replays against
+        EbeamCalibration cal;
+        calibrator->get_calibration(cal);
+        for (int row = 0; row < 3; row++) {
+            SessionLog::init(rec, SESSION_RESULT, row);
+            rec.status = success;
+            for (int k = 0; k < 3; k++)
+                rec.v.l[k] = cal.H[3 * row + k];
+            record(rec);
+        }
 
         if (success) {
 	    draw_message("Calibration complete.", DARKGREEN);
@@ -21,6 +21,9 @@
 #define GUI_CALIBRATOR_X11
 
 #include "calibrator.hpp"
+#include "session.hpp"
+#include "simulator.hpp"
+#include "gui/canvas.hpp"
 
 #include <X11/extensions/XInput2.h>
 
@@ -64,9 +67,21 @@ public:
     // Destroy singleton instance
     static void destroy_instance();
 
-    // signal handling : update clock and process events (fake event loop)
+    // after a timer signal : update clock and process events (fake event
+    // loop), to be called from the main loop, not from the handler
     static void timer_signal();
 
+    // feed the session log of an offline calibrator through the event
+    // handlers, at full speed, without X
+    // Returns false if the replay differs from the recording
+    static bool replay(Calibrator* w);
+
+    // calibrate sessions synthetic sessions of a simulated pen and device
+    // (see simulator.hpp) with the parameters of w, through the event
+    // handlers, without X, and report accuracy, failures and speed
+    // Returns false if a session failed
+    static bool simulate(Calibrator* w, int sessions, const SimModel& model);
+
     // Be verbose or not (duplicate calibrator's state)
     static bool verbose;
     
@@ -80,8 +95,18 @@ protected:
     GuiCalibratorX11(Calibrator* w);
     ~GuiCalibratorX11();
 
+    // headless, for replay() and simulate() : draws into canvas if any
+    // (see offscreen.hpp)
+    GuiCalibratorX11(Calibrator* w, int width, int height, int rotation,
+                     Canvas* canvas = NULL);
+
+    // feed a session record to the event handlers
+    // Returns false if it differs from what happens now
+    bool play(const SessionRecord& rec, unsigned& events);
+
     // drawing functions
     void setup_zone();
+    void set_zone(int width, int height, int rotation);
     void redraw();
     void draw_message(const char* msg, const int color);
 
@@ -94,6 +119,15 @@ protected:
     // calibrator
     Calibrator* calibrator;
 
+    // session log : record events (replay : not recorded again)
+    void record(SessionRecord& rec);
+    SessionLog  session;
+    bool        headless;
+    int         result;     // of calibrator->finish(), -1 : not yet
+
+    // drawing target, NULL : nothing drawn
+    Canvas*     canvas;
+
     // X11 vars
     Display*     display;
     int          xi_opcode; // XI2
@@ -113,6 +147,7 @@ protected:
     // color management
     enum { BLACK=0, WHITE=1, GRAY=2, DIMGRAY=3, RED=4, DARKGREEN=5, NUM_COLORS };
     static const char*  colors[NUM_COLORS];
+    static const unsigned char rgb[NUM_COLORS][3];
     unsigned long       pixel[NUM_COLORS];
 
     // targets
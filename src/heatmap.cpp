@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "heatmap.hpp"
+#include "pool.hpp"
+#include "timing.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+bool ErrorHeatmap::verbose = false;
+
+void ErrorHeatmap::Stats::clear()
+{
+    pixels = 0;
+    quant_sum = 0;
+    quant_max = 0;
+    reproj_sum = 0;
+    reproj_max = 0;
+    memset(hist, 0, sizeof(hist));
+}
+
+void ErrorHeatmap::Stats::merge(const Stats& other)
+{
+    pixels += other.pixels;
+    quant_sum += other.quant_sum;
+    quant_max = std::max(quant_max, other.quant_max);
+    reproj_sum += other.reproj_sum;
+    reproj_max = std::max(reproj_max, other.reproj_max);
+    for (int i = 0; i < 256; i++)
+        hist[i] += other.hist[i];
+}
+
+ErrorHeatmap::ErrorHeatmap(const EbeamCalibration& cal, int width0,
+                           int height0)
+  : width(width0),
+    height(height0),
+    step(1),
+    sample_rms(0),
+    sample_max(0),
+    nodes_x(0),
+    nodes_y(0),
+    grid_w(0),
+    grid_h(0),
+    cells_x(0),
+    cells_y(0),
+    wall_ms(0),
+    workers(0)
+{
+    transform.set_calibration(cal, width, height);
+
+    // adjugate : the inverse, up to a scale
+    double h[9];
+    for (int i = 0; i < 9; i++)
+        h[i] = (double) cal.H[i];
+
+    Hinv[0] = h[4] * h[8] - h[5] * h[7];
+    Hinv[1] = h[2] * h[7] - h[1] * h[8];
+    Hinv[2] = h[1] * h[5] - h[2] * h[4];
+    Hinv[3] = h[5] * h[6] - h[3] * h[8];
+    Hinv[4] = h[0] * h[8] - h[2] * h[6];
+    Hinv[5] = h[2] * h[3] - h[0] * h[5];
+    Hinv[6] = h[3] * h[7] - h[4] * h[6];
+    Hinv[7] = h[1] * h[6] - h[0] * h[7];
+    Hinv[8] = h[0] * h[4] - h[1] * h[3];
+
+    stats.clear();
+}
+
+bool ErrorHeatmap::load_samples(const char* path,
+                                std::vector<HeatSample>& samples)
+{
+    FILE* fp = fopen(path, "r");
+    char line[256];
+    int n = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", path,
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    samples.clear();
+    while (fgets(line, sizeof(line), fp)) {
+        HeatSample s;
+        char* p = line + strspn(line, " \t");
+
+        n++;
+        if (*p == '#' || *p == '\n' || *p == 0)
+            continue;
+
+        if (sscanf(p, "%d %d %lf %lf", &s.X, &s.Y, &s.x, &s.y) != 4) {
+            fprintf(stderr, "ERROR: %s:%d : bad sample line.\n", path, n);
+            fclose(fp);
+            return FAILURE;
+        }
+        samples.push_back(s);
+    }
+    fclose(fp);
+
+    if (verbose)
+        fprintf(stderr, "%u validation samples in %s\n",
+                        (unsigned) samples.size(), path);
+
+    return SUCCESS;
+}
+
+void ErrorHeatmap::set_samples(const std::vector<HeatSample>& samples0)
+{
+    samples = samples0;
+}
+
+/// residuals at the samples, interpolated on the nodes
+void ErrorHeatmap::make_nodes()
+{
+    std::vector<double> rx(samples.size()), ry(samples.size());
+    double sum2 = 0;
+
+    sample_max = 0;
+    for (unsigned k = 0; k < samples.size(); k++) {
+        int x, y;
+        transform.apply_exact(samples[k].X, samples[k].Y, x, y);
+        rx[k] = x - samples[k].x;
+        ry[k] = y - samples[k].y;
+
+        double r2 = rx[k] * rx[k] + ry[k] * ry[k];
+        sum2 += r2;
+        sample_max = std::max(sample_max, sqrt(r2));
+    }
+    sample_rms = samples.empty() ? 0 : sqrt(sum2 / samples.size());
+
+    // past the last pixel on both axes
+    nodes_x = (width - 1) / HEATMAP_CELL + 2;
+    nodes_y = (height - 1) / HEATMAP_CELL + 2;
+    nodes.assign(2 * nodes_x * nodes_y, 0);
+
+    if (samples.empty())
+        return;
+
+    // inverse distance weighting, power 2
+    for (int j = 0; j < nodes_y; j++)
+        for (int i = 0; i < nodes_x; i++) {
+            double x = i * HEATMAP_CELL;
+            double y = j * HEATMAP_CELL;
+            double sw = 0, sx = 0, sy = 0;
+            float* node = &nodes[2 * (j * nodes_x + i)];
+
+            for (unsigned k = 0; k < samples.size(); k++) {
+                double d2 = (samples[k].x - x) * (samples[k].x - x) +
+                            (samples[k].y - y) * (samples[k].y - y);
+                if (d2 < 1e-6) {
+                    // on a sample
+                    sw = 1;
+                    sx = rx[k];
+                    sy = ry[k];
+                    break;
+                }
+                sw += 1 / d2;
+                sx += rx[k] / d2;
+                sy += ry[k] / d2;
+            }
+            node[0] = (float) (sx / sw);
+            node[1] = (float) (sy / sw);
+        }
+}
+
+/// reprojection residual at a screen position, between the nodes
+void ErrorHeatmap::residual(double x, double y, double& dx, double& dy) const
+{
+    int i = (int) x / HEATMAP_CELL;
+    int j = (int) y / HEATMAP_CELL;
+    double tx = x / HEATMAP_CELL - i;
+    double ty = y / HEATMAP_CELL - j;
+
+    i = std::min(std::max(i, 0), nodes_x - 2);
+    j = std::min(std::max(j, 0), nodes_y - 2);
+
+    const float* n00 = &nodes[2 * (j * nodes_x + i)];
+    const float* n10 = n00 + 2;
+    const float* n01 = n00 + 2 * nodes_x;
+    const float* n11 = n01 + 2;
+
+    dx = (1 - ty) * ((1 - tx) * n00[0] + tx * n10[0]) +
+         ty * ((1 - tx) * n01[0] + tx * n11[0]);
+    dy = (1 - ty) * ((1 - tx) * n00[1] + tx * n10[1]) +
+         ty * ((1 - tx) * n01[1] + tx * n11[1]);
+}
+
+/// floor, without the libm call
+static inline int ifloor(double v)
+{
+    int i = (int) v;
+    return i - (i > v);
+}
+
+void ErrorHeatmap::run_band(void* arg, unsigned /* worker */)
+{
+    Band* b = (Band*) arg;
+    b->map->band(*b);
+}
+
+/// one row of cells
+void ErrorHeatmap::band(Band& b)
+{
+    // quantization error and map level of the small squared distances
+    static const int QUANT_TABLE = 16;     // 4 px : saturated
+    double quant[QUANT_TABLE];
+    unsigned char quant_level[QUANT_TABLE];
+    for (int k = 0; k < QUANT_TABLE; k++) {
+        quant[k] = sqrt((double) k);
+        quant_level[k] = (unsigned char)
+            std::min(255, (int) (quant[k] * HEATMAP_QUANT_UNIT + 0.5));
+    }
+
+    const int y0 = b.row * HEATMAP_CELL;
+    const int y1 = std::min(y0 + HEATMAP_CELL, height);
+    const bool reproj = !samples.empty();
+
+    std::vector<double> cell_sum(cells_x, 0);
+    std::vector<unsigned> cell_count(cells_x, 0);
+    std::vector<float> cell_max(cells_x, 0);
+
+    b.stats.clear();
+
+    for (int gj = (y0 + step - 1) / step; gj * step < y1; gj++) {
+        const int y = gj * step;
+        unsigned char* qrow = &quant_map[(size_t) gj * grid_w];
+        unsigned char* rrow = reproj ? &reproj_map[(size_t) gj * grid_w]
+                                     : NULL;
+
+        // raw position of the row start, then incremental along x
+        double nx = Hinv[1] * y + Hinv[2];
+        double ny = Hinv[4] * y + Hinv[5];
+        double nd = Hinv[7] * y + Hinv[8];
+        const double sx = Hinv[0] * step;
+        const double sy = Hinv[3] * step;
+        const double sd = Hinv[6] * step;
+
+        // locals : the byte stores would alias the band statistics
+        double quant_sum = 0, quant_max = 0;
+        double reproj_sum = 0, reproj_max = 0;
+        unsigned long* hist = b.stats.hist;
+
+        for (int cx = 0, gi = 0; cx < cells_x; cx++) {
+            const int gi_end = std::min(((cx + 1) * HEATMAP_CELL + step - 1)
+                                        / step, grid_w);
+            const int gi_start = gi;
+            double cell_quant = 0;
+            double cell_quant_max = 0;
+
+            for (; gi < gi_end; gi++, nx += sx, ny += sy, nd += sd) {
+                const int x = gi * step;
+                double q;
+                unsigned char level;
+
+                if (nd != 0) {
+                    double inv = 1 / nd;
+                    int X = ifloor(nx * inv + 0.5);
+                    int Y = ifloor(ny * inv + 0.5);
+                    int xi, yi;
+
+                    transform.apply_exact(X, Y, xi, yi);
+
+                    int d2 = (xi - x) * (xi - x) + (yi - y) * (yi - y);
+                    if (d2 < QUANT_TABLE) {
+                        q = quant[d2];
+                        level = quant_level[d2];
+                    } else {
+                        q = sqrt((double) d2);
+                        level = 255;
+                    }
+                } else {
+                    // on the line at infinity of H
+                    q = 4;
+                    level = 255;
+                }
+
+                qrow[gi] = level;
+                hist[level]++;
+                cell_quant += q;
+                if (q > cell_quant_max)
+                    cell_quant_max = q;
+            }
+
+            quant_sum += cell_quant;
+            quant_max = std::max(quant_max, cell_quant_max);
+            cell_sum[cx] += cell_quant;
+            cell_count[cx] += gi - gi_start;
+            cell_max[cx] = std::max(cell_max[cx], (float) cell_quant_max);
+
+            if (!reproj || gi == gi_start)
+                continue;
+
+            // linear along the row between two nodes
+            double dx0, dy0, dx1, dy1;
+            const double xa = gi_start * step;
+            residual(xa, y, dx0, dy0);
+            residual(xa + step, y, dx1, dy1);
+            const double ddx = dx1 - dx0;
+            const double ddy = dy1 - dy0;
+
+            for (int k = gi_start; k < gi; k++, dx0 += ddx, dy0 += ddy) {
+                double r = sqrt(dx0 * dx0 + dy0 * dy0);
+
+                rrow[k] = (unsigned char)
+                    std::min(255, (int) (r * HEATMAP_REPROJ_UNIT + 0.5));
+                reproj_sum += r;
+                if (r > reproj_max)
+                    reproj_max = r;
+            }
+        }
+
+        b.stats.quant_sum += quant_sum;
+        b.stats.quant_max = std::max(b.stats.quant_max, quant_max);
+        b.stats.reproj_sum += reproj_sum;
+        b.stats.reproj_max = std::max(b.stats.reproj_max, reproj_max);
+        b.stats.pixels += grid_w;
+    }
+
+    // cells of the band
+    for (int cx = 0; cx < cells_x; cx++) {
+        HeatCell& cell = cells[b.row * cells_x + cx];
+        double dx = 0, dy = 0;
+
+        if (reproj)
+            residual(std::min(cx * HEATMAP_CELL + HEATMAP_CELL / 2, width - 1),
+                     std::min(y0 + HEATMAP_CELL / 2, height - 1), dx, dy);
+
+        cell.dx = (float) dx;
+        cell.dy = (float) dy;
+        cell.quant_mean = cell_count[cx] ?
+                          (float) (cell_sum[cx] / cell_count[cx]) : 0;
+        cell.quant_max = cell_max[cx];
+    }
+}
+
+bool ErrorHeatmap::run(int step0, unsigned workers0)
+{
+    double t = now_ms();
+
+    if (Hinv[0] == 0 && Hinv[4] == 0 && Hinv[8] == 0) {
+        fprintf(stderr, "ERROR: the calibration can't be inverted.\n");
+        return FAILURE;
+    }
+
+    step = std::max(step0, 1);
+    grid_w = (width + step - 1) / step;
+    grid_h = (height + step - 1) / step;
+    cells_x = (width + HEATMAP_CELL - 1) / HEATMAP_CELL;
+    cells_y = (height + HEATMAP_CELL - 1) / HEATMAP_CELL;
+
+    make_nodes();
+
+    quant_map.assign((size_t) grid_w * grid_h, 0);
+    if (!samples.empty())
+        reproj_map.assign((size_t) grid_w * grid_h, 0);
+    cells.resize(cells_x * cells_y);
+
+    WorkPool pool(workers0);
+    workers = pool.get_workers();
+
+    std::vector<Band> bands(cells_y);
+    for (int i = 0; i < cells_y; i++) {
+        bands[i].map = this;
+        bands[i].row = i;
+        pool.add(run_band, &bands[i]);
+    }
+
+    pool.run();
+
+    stats.clear();
+    for (int i = 0; i < cells_y; i++)
+        stats.merge(bands[i].stats);
+
+    wall_ms = now_ms() - t;
+
+    if (verbose)
+        fprintf(stderr, "%d bands on %u threads, %lu steals\n", cells_y,
+                        workers, pool.get_steals());
+
+    return SUCCESS;
+}
+
+bool ErrorHeatmap::write_pgm(const char* path, bool quantization,
+                             double scale) const
+{
+    const std::vector<unsigned char>& map = quantization ? quant_map
+                                                         : reproj_map;
+    const double unit = quantization ? HEATMAP_QUANT_UNIT
+                                     : HEATMAP_REPROJ_UNIT;
+
+    if (map.empty()) {
+        fprintf(stderr, "ERROR: no %s map to write.\n",
+                        quantization ? "quantization" : "reprojection");
+        return FAILURE;
+    }
+
+    // map levels to gray : scale px is white
+    unsigned char gray[256];
+    for (int i = 0; i < 256; i++)
+        gray[i] = (unsigned char)
+            std::min(255, (int) (i / unit / scale * 255 + 0.5));
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", path);
+        return FAILURE;
+    }
+
+    fprintf(fp, "P5\n%d %d\n255\n", grid_w, grid_h);
+
+    std::vector<unsigned char> line(grid_w);
+    bool ok = true;
+    for (int j = 0; ok && j < grid_h; j++) {
+        const unsigned char* row = &map[(size_t) j * grid_w];
+        for (int i = 0; i < grid_w; i++)
+            line[i] = gray[row[i]];
+        ok = fwrite(&line[0], 1, grid_w, fp) == (size_t) grid_w;
+    }
+
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+bool ErrorHeatmap::write_csv(const char* path) const
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", path);
+        return FAILURE;
+    }
+
+    const bool reproj = !samples.empty();
+
+    // cell centers, in screen px
+    fprintf(fp, "x,y,%squantization_mean,quantization_max\n",
+            reproj ? "reprojection_dx,reprojection_dy,reprojection," : "");
+    for (int cy = 0; cy < cells_y; cy++)
+        for (int cx = 0; cx < cells_x; cx++) {
+            const HeatCell& cell = cells[cy * cells_x + cx];
+
+            fprintf(fp, "%d,%d,", cx * HEATMAP_CELL + HEATMAP_CELL / 2,
+                                  cy * HEATMAP_CELL + HEATMAP_CELL / 2);
+            if (reproj)
+                fprintf(fp, "%.3f,%.3f,%.3f,", cell.dx, cell.dy,
+                        sqrt(cell.dx * cell.dx + cell.dy * cell.dy));
+            fprintf(fp, "%.3f,%.3f\n", cell.quant_mean, cell.quant_max);
+        }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+void ErrorHeatmap::report(FILE* fp) const
+{
+    if (stats.pixels == 0)
+        return;
+
+    // quantization p99, from the map levels
+    unsigned long n = 0;
+    int p99 = 255;
+    for (int i = 0; i < 256; i++) {
+        n += stats.hist[i];
+        if (n >= stats.pixels * 0.99) {
+            p99 = i;
+            break;
+        }
+    }
+
+    fprintf(fp, "%dx%d screen, step %d : %lu pixels in %.1f ms "
+                "(%u threads)\n", width, height, step, stats.pixels,
+                wall_ms, workers);
+    fprintf(fp, "quantization : mean %.3f px, p99 %.3f px, max %.3f px\n",
+            stats.quant_sum / stats.pixels,
+            std::min((double) p99 / HEATMAP_QUANT_UNIT, stats.quant_max),
+            stats.quant_max);
+
+    if (!samples.empty())
+        fprintf(fp, "reprojection : mean %.3f px, max %.3f px "
+                    "(%u samples : rms %.3f px, max %.3f px)\n",
+                stats.reproj_sum / stats.pixels, stats.reproj_max,
+                (unsigned) samples.size(), sample_rms, sample_max);
+}
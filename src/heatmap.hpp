@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _heatmap_hpp
+#define _heatmap_hpp
+
+#include "sysfs.hpp"
+#include "transform.hpp"
+
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Spatial error of a stored calibration (ebeam_heatmap), on a dense screen
+ * grid :
+ *   - quantization : each pixel is taken back to the raw position that
+ *     hits it (inverse of H, rounded to the raw integer grid), then through
+ *     the integer transform of the driver (PenTransform::apply_exact);
+ *     the distance to the pixel is what the raw resolution and the fixed
+ *     point rounding cost there.
+ *   - reprojection : residuals of validation samples (raw position, true
+ *     screen position) through the driver transform, interpolated by
+ *     inverse distance weighting on nodes HEATMAP_CELL px apart, and
+ *     bilinearly between the nodes.
+ *
+ * The screen is split in bands of HEATMAP_CELL rows, evaluated on a
+ * work-stealing pool (see pool.hpp). Errors are kept as bytes : a map
+ * of an 8K screen is 33 MB.
+ */
+
+// grid cell and interpolation node spacing, in screen px
+#define HEATMAP_CELL 32
+
+// byte maps, levels per px : 255 is 4 px of quantization error,
+// 32 px of reprojection error
+#define HEATMAP_QUANT_UNIT 64
+#define HEATMAP_REPROJ_UNIT 8
+
+/// a validation sample
+struct HeatSample {
+    int X;          // raw position
+    int Y;
+    double x;       // true screen position
+    double y;
+};
+
+/// errors over a grid cell, for the CSV
+struct HeatCell {
+    float dx;           // reprojection residual at the cell center
+    float dy;
+    float quant_mean;
+    float quant_max;
+};
+
+/// Class for evaluating a calibration over the screen
+class ErrorHeatmap
+{
+public:
+    // driver calibration on a width x height screen
+    ErrorHeatmap(const EbeamCalibration& cal, int width, int height);
+
+    // "X Y x y" lines, # comments
+    static bool load_samples(const char* path,
+                             std::vector<HeatSample>& samples);
+
+    // validation samples, before run()
+    void set_samples(const std::vector<HeatSample>& samples0);
+
+    // every step-th pixel, on workers threads (0 : all cpus)
+    // Returns false if H can't be inverted
+    bool run(int step, unsigned workers);
+
+    // error map as a PGM image, scale px of error is white
+    bool write_pgm(const char* path, bool quantization, double scale) const;
+
+    // one line per grid cell
+    bool write_csv(const char* path) const;
+
+    // error summary and timing
+    void report(FILE* fp) const;
+
+    bool has_samples() const { return !samples.empty(); }
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    /// statistics of a band, merged after the run
+    struct Stats {
+        unsigned long pixels;
+        double quant_sum;
+        double quant_max;
+        double reproj_sum;
+        double reproj_max;
+        unsigned long hist[256];    // quantization map levels
+
+        void clear();
+        void merge(const Stats& other);
+    };
+
+    struct Band {
+        ErrorHeatmap* map;
+        int row;                    // of cells
+        Stats stats;
+    };
+
+    static void run_band(void* arg, unsigned worker);
+    void band(Band& band);
+    void make_nodes();
+    void residual(double x, double y, double& dx, double& dy) const;
+
+    PenTransform transform;
+    double Hinv[9];             // screen to raw
+    int width;
+    int height;
+    int step;
+
+    std::vector<HeatSample> samples;
+    double sample_rms;          // residuals at the samples
+    double sample_max;
+
+    // reprojection residual at the nodes, x then y
+    int nodes_x;
+    int nodes_y;
+    std::vector<float> nodes;
+
+    // results : grid_w x grid_h byte maps, cells
+    int grid_w;
+    int grid_h;
+    std::vector<unsigned char> quant_map;
+    std::vector<unsigned char> reproj_map;
+    int cells_x;
+    int cells_y;
+    std::vector<HeatCell> cells;
+    Stats stats;
+    double wall_ms;
+    unsigned workers;
+};
+
+#endif
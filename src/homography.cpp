@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "homography.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_permutation.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_blas.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+bool Homography::verbose = false;
+
+bool Homography::parse_solver(const char* name, HomographySolver& solver)
+{
+    if (strcmp(name, "lu") == 0)
+        solver = SOLVER_LU;
+    else if (strcmp(name, "qr") == 0)
+        solver = SOLVER_QR;
+    else if (strcmp(name, "svd") == 0)
+        solver = SOLVER_SVD;
+    else
+        return false;
+
+    return true;
+}
+
+const char* Homography::solver_name(HomographySolver solver)
+{
+    switch (solver) {
+    case SOLVER_QR:
+        return "qr";
+    case SOLVER_SVD:
+        return "svd";
+    default:
+        return "lu";
+    }
+}
+
+/// A.h = b, with the LU decomposition of the square A
+static bool solve_lu(const gsl_matrix* A, const gsl_vector* b, gsl_vector* h)
+{
+    int s;
+    bool status = SUCCESS;
+    gsl_matrix * LU = gsl_matrix_calloc(A->size1, A->size2);
+    gsl_permutation * p  = gsl_permutation_alloc(A->size1);
+
+    if (gsl_matrix_memcpy(LU,A)) {
+        fprintf(stderr, "ERROR: gsl memcopy failed.\n");
+        status = FAILURE;
+    } else if (gsl_linalg_LU_decomp(LU,p,&s)) {
+        fprintf(stderr, "ERROR: gsl LU decomposition failed.\n");
+        status = FAILURE;
+    } else if (gsl_linalg_LU_solve(LU, p, b, h)) {
+        fprintf(stderr, "ERROR: gsl solver failed.\n");
+        status = FAILURE;
+    }
+
+    gsl_permutation_free(p);
+    gsl_matrix_free(LU);
+
+    return status;
+}
+
+/// least squares A.h = b : normal equations, LU
+static bool solve_normal(const gsl_matrix* A, const gsl_vector* b,
+                         gsl_vector* h)
+{
+    gsl_matrix * AtA = gsl_matrix_calloc(A->size2, A->size2);
+    gsl_vector * Atb = gsl_vector_calloc(A->size2);
+    bool status;
+
+    gsl_blas_dgemm(CblasTrans, CblasNoTrans, 1.0, A, A, 0.0, AtA);
+    gsl_blas_dgemv(CblasTrans, 1.0, A, b, 0.0, Atb);
+
+    status = solve_lu(AtA, Atb, h);
+
+    gsl_vector_free(Atb);
+    gsl_matrix_free(AtA);
+
+    return status;
+}
+
+/// least squares A.h = b : QR
+static bool solve_qr(const gsl_matrix* A, const gsl_vector* b, gsl_vector* h)
+{
+    bool status = SUCCESS;
+    gsl_matrix * QR = gsl_matrix_alloc(A->size1, A->size2);
+    gsl_vector * tau = gsl_vector_alloc(A->size2);
+    gsl_vector * residual = gsl_vector_alloc(A->size1);
+
+    gsl_matrix_memcpy(QR, A);
+    if (gsl_linalg_QR_decomp(QR, tau)) {
+        fprintf(stderr, "ERROR: gsl QR decomposition failed.\n");
+        status = FAILURE;
+    } else if (gsl_linalg_QR_lssolve(QR, tau, b, h, residual)) {
+        fprintf(stderr, "ERROR: gsl solver failed.\n");
+        status = FAILURE;
+    }
+
+    gsl_vector_free(residual);
+    gsl_vector_free(tau);
+    gsl_matrix_free(QR);
+
+    return status;
+}
+
+/// least squares A.h = b : SVD
+static bool solve_svd(const gsl_matrix* A, const gsl_vector* b,
+                      gsl_vector* h)
+{
+    bool status = SUCCESS;
+    gsl_matrix * U = gsl_matrix_alloc(A->size1, A->size2);
+    gsl_matrix * V = gsl_matrix_alloc(A->size2, A->size2);
+    gsl_vector * S = gsl_vector_alloc(A->size2);
+    gsl_vector * work = gsl_vector_alloc(A->size2);
+
+    gsl_matrix_memcpy(U, A);
+    if (gsl_linalg_SV_decomp(U, V, S, work)) {
+        fprintf(stderr, "ERROR: gsl SV decomposition failed.\n");
+        status = FAILURE;
+    } else if (gsl_linalg_SV_solve(U, V, S, b, h)) {
+        fprintf(stderr, "ERROR: gsl solver failed.\n");
+        status = FAILURE;
+    }
+
+    gsl_vector_free(work);
+    gsl_vector_free(S);
+    gsl_matrix_free(V);
+    gsl_matrix_free(U);
+
+    return status;
+}
+
+bool Homography::solve(const Tuple* tuples, int n, int precision,
+                       HomographySolver solver, long long* H)
+{
+    /*
+    * See :
+    * http://www.csc.kth.se/~perrose/files/pose-init-model/node17_ct.html
+    *
+    * solve A.h=b instead of calculing h=inv(A).b
+    */
+
+    if (n < 4) {
+        fprintf(stderr, "ERROR: not enough points.\n");
+        return FAILURE;
+    }
+
+    // disable gsl error handler
+    gsl_set_error_handler_off();
+
+    gsl_vector * h = gsl_vector_calloc(8); // H coefs (h11, h12, ... , h32)
+
+    gsl_matrix * A = gsl_matrix_alloc (2*n, 8); // A : linear equations matrix
+
+    // fill A, 2 row at a time
+    for (int p=0; p<n; p++) {
+        int X = tuples[p].dev_X;            // device
+        int Y = tuples[p].dev_Y;
+        int x = tuples[p].scr_x;            // screen
+        int y = tuples[p].scr_y;
+
+        gsl_matrix_set (A, p*2, 0, X);      // first row
+        gsl_matrix_set (A, p*2, 1, Y);
+        gsl_matrix_set (A, p*2, 2, 1);
+        gsl_matrix_set (A, p*2, 3, 0);
+        gsl_matrix_set (A, p*2, 4, 0);
+        gsl_matrix_set (A, p*2, 5, 0);
+        gsl_matrix_set (A, p*2, 6, -(X*x));
+        gsl_matrix_set (A, p*2, 7, -(Y*x));
+
+        gsl_matrix_set (A, p*2+1, 0, 0);    // second row
+        gsl_matrix_set (A, p*2+1, 1, 0);
+        gsl_matrix_set (A, p*2+1, 2, 0);
+        gsl_matrix_set (A, p*2+1, 3, X);
+        gsl_matrix_set (A, p*2+1, 4, Y);
+        gsl_matrix_set (A, p*2+1, 5, 1);
+        gsl_matrix_set (A, p*2+1, 6, -(X*y));
+        gsl_matrix_set (A, p*2+1, 7, -(Y*y));
+    }
+
+    gsl_vector * b = gsl_vector_calloc(2*n);  // b coefs (x1, y1, .., xn, yn)
+
+    for (int p=0; p<n; p++) {
+        gsl_vector_set (b, p*2,   tuples[p].scr_x);
+        gsl_vector_set (b, p*2+1, tuples[p].scr_y);
+    }
+
+    bool status;
+    switch (solver) {
+    case SOLVER_QR:
+        status = solve_qr(A, b, h);
+        break;
+    case SOLVER_SVD:
+        status = solve_svd(A, b, h);
+        break;
+    default:
+        status = n == 4 ? solve_lu(A, b, h) : solve_normal(A, b, h);
+        break;
+    }
+
+    // fill H (long long) with rounded (h (double) scaled by 10^precision)
+    // H is left untouched if the solve failed
+    for (int i=0; status && i<8; i++) {
+        if (gsl_vector_get(h, i) >= 0)
+            H[i] = (long long) (((long double) gsl_vector_get(h, i)) *
+                                ((long double) pow(10.0,precision)) + 0.5);
+        else
+            H[i] = (long long) (((long double) gsl_vector_get(h, i)) *
+                                ((long double) pow(10.0,precision)) - 0.5);
+    }
+    if (status)
+        H[8] = (long long) pow(10.0,precision);
+
+    gsl_vector_free(h);
+    gsl_matrix_free(A);
+    gsl_vector_free(b);
+
+    return status;
+}
+
+bool Homography::test(const Tuple* tuples, int n, const long long* H,
+                      int tolerance)
+{
+   /*
+    * From ebeam.c kernel driver, keep in sync
+    *
+    * s64 scale;
+    * scale = ebeam->cursetting.h7 * ebeam->X +
+    *         ebeam->cursetting.h8 * ebeam->Y +
+    *         ebeam->cursetting.h9;
+    *
+    * We *must* round the result, but not with (int) (v1/v2 + 0.5)
+    *
+    * (int) (v1/v2 + 0.5) <=> (int) ( (2*v1 + v2)/(2*v2) )
+    *
+    * ebeam->x = (int) ((((ebeam->cursetting.h1 * ebeam->X +
+    *                      ebeam->cursetting.h2 * ebeam->Y +
+    *                      ebeam->cursetting.h3) << 1) + scale) /
+    *                      (scale << 1));
+    * ebeam->y = (int) ((((ebeam->cursetting.h4 * ebeam->X +
+    *                      ebeam->cursetting.h5 * ebeam->Y +
+    *                      ebeam->cursetting.h6) << 1) + scale) /
+    *                      (scale << 1));
+    */
+
+    for (int p=0; p<n; p++) { // points
+        int X = tuples[p].dev_X; // device
+        int Y = tuples[p].dev_Y;
+
+        long long div = (H[6] * X + H[7] * Y + H[8]);
+        if (div == 0) {
+            if (verbose)
+                fprintf(stderr, "ERROR: Bad H matrix : division by zero\n");
+            return FAILURE;
+        }
+
+        int x = (int) ((2 * (H[0] * X + H[1] * Y + H[2]) + div)/(2*div));
+        int y = (int) ((2 * (H[3] * X + H[4] * Y + H[5]) + div)/(2*div));
+
+        if (abs(x - tuples[p].scr_x) > tolerance ||
+            abs(y - tuples[p].scr_y) > tolerance) {
+            if (verbose) {
+                fprintf(stderr, "ERROR: Bad H matrix :\n");
+                fprintf(stderr, "Point %i : dev(%i ; %i) => scr(%i ; %i), "
+                                "real(%i ; %i)\n",
+                                p+1, X, Y, x, y,
+                                tuples[p].scr_x, tuples[p].scr_y);
+            }
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
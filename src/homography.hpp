@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _homography_hpp
+#define _homography_hpp
+
+/*
+ * Homography between raw device and screen coordinates, in the fixed
+ * point form of the ebeam driver (H coefs scaled by 10^precision, see
+ * below) :
+ *   - solve : from 4 clicks (exact), or more (least squares),
+ *   - test : the driver integer maths against the clicks.
+ *
+ * This module depends on GSL, not on X11.
+ */
+
+/*
+ * eBeam kernel driver use integer (long long) math.
+ * We scale computed H matrix by a 10^PRECISION factor before
+ * converting to long long values.
+ * NOTE :
+ * long long can held 2^63,
+ * internal calculus (in long long) involves int*coef,
+ * so, worst case, coef have to be less than 2^48, approx 10^14.
+ *
+ * Below 10^9, calulated screen value may be inaccurate.
+ * Above 10^14, calculus may overflow.
+ *
+ * Defaulting to 10^12
+ */
+#define PRECISION 12
+
+/// struct to hold associated device and screen coordinates
+struct Tuple {
+    int dev_X;
+    int dev_Y;
+    int scr_x;
+    int scr_y;
+};
+
+/// linear solver used for H
+enum HomographySolver {
+    SOLVER_LU,      // LU, of the normal equations beyond 4 points
+    SOLVER_QR,      // Householder QR least squares
+    SOLVER_SVD      // singular value decomposition
+};
+
+/// Class for computing and checking H matrices
+class Homography
+{
+public:
+    // parse "lu", "qr" or "svd"
+    static bool parse_solver(const char* name, HomographySolver& solver);
+    static const char* solver_name(HomographySolver solver);
+
+    // compute H from n >= 4 tuples, H is only written on success
+    static bool solve(const Tuple* tuples, int n, int precision,
+                      HomographySolver solver, long long* H);
+
+    // does the driver transform of each tuple raw point fall within
+    // tolerance px of its screen point ?
+    static bool test(const Tuple* tuples, int n, const long long* H,
+                     int tolerance = 0);
+
+    // Be verbose or not
+    static bool verbose;
+};
+
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+/*
+ * ebeam_bench : micro benchmarks of the calibration hot paths (make bench),
+ * see bench.hpp. Runs without X nor device : the driver is simulated (see
+ * simulator.hpp), the calibrator is an offline one, the GUI draws into
+ * memory (see gui/offscreen.hpp).
+ *
+ * --golden checks the GUI frames against reference checksums (make golden).
+ */
+
+#include "bench.hpp"
+#include "calibrator.hpp"
+#include "transform.hpp"
+#include "gui/offscreen.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <vector>
+#include <stdexcept>
+
+static void usage_bench(char* cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t--filter <text>: only run the benchmarks "
+                    "whose name contains text\n");
+    fprintf(stderr, "\t--time <ms>: measured time per benchmark "
+                    "(default: 200)\n");
+    fprintf(stderr, "\t--json <file>: also write the results to file\n");
+    fprintf(stderr, "\t--golden <file>: check the GUI frames against "
+                    "the reference checksums, and quit\n");
+    fprintf(stderr, "\t--golden-update <file>: write the reference "
+                    "checksums, and quit\n");
+}
+
+/// screens of the draw benchmarks, with the active zone
+struct DrawScreen {
+    const char* name[3];    // redraw, message, clock benchmarks
+    int width;
+    int height;
+    int zone[4];            // min_x, min_y, max_x, max_y ; 0 : fullscreen
+};
+
+static const DrawScreen draw_screens[] = {
+    {{"draw_redraw_1080p", "draw_message_1080p", "draw_clock_1080p"},
+     1920, 1080, {0, 0, 0, 0}},
+    {{"draw_redraw_4k", "draw_message_4k", "draw_clock_4k"},
+     3840, 2160, {0, 0, 0, 0}},
+    {{"draw_redraw_8k", "draw_message_8k", "draw_clock_8k"},
+     7680, 4320, {0, 0, 0, 0}},
+    // two 8K heads side by side, calibrating the right one
+    {{"draw_redraw_8k_dual", "draw_message_8k_dual", "draw_clock_8k_dual"},
+     15360, 4320, {7680, 0, 15359, 4319}}
+};
+
+/// frames of the golden images
+struct GoldenFrame {
+    const char* name;
+    int clicks;             // NUM_POINTS : final step
+    int clock;              // ms elapsed, -1 : no clock
+    int message;            // final message : 1 complete, 0 failed, -1 none
+    bool zoned;             // quarter of the screen
+};
+
+static const GoldenFrame golden_frames[] = {
+    {"start", 0, -1, -1, false},
+    {"clicks_2", 2, -1, -1, false},
+    {"clock", 1, 7400, -1, false},
+    {"complete", NUM_POINTS, -1, 1, false},
+    {"failed", NUM_POINTS, -1, 0, false},
+    {"zone_start", 0, -1, -1, true},
+    {"zone_clicks_3", 3, 2000, -1, true}
+};
+
+#define GOLDEN_WIDTH 1920
+#define GOLDEN_HEIGHT 1080
+
+/// what the benchmarks work on
+struct BenchContext {
+    std::vector<Tuple> tuples;
+    std::vector<Tuple> tuples9;
+    long long H[9];
+    PenTransform transform;
+    int X;
+    int Y;
+    long sink;              // keeps results alive
+    Calibrator* calibrator;
+    StateRecord state;
+    char state_bin[96];
+    char state_txt[96];
+    float m[9];
+};
+
+/// clicks on a simulated board : k x k grid, or 4 corners
+static void make_tuples(PenSimulator& pen, int k, std::vector<Tuple>& tuples)
+{
+    const int delta_x = SIM_WIDTH / 8;
+    const int delta_y = SIM_HEIGHT / 8;
+
+    tuples.clear();
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++) {
+            Tuple t;
+            double X, Y;
+
+            t.scr_x = delta_x + i * (SIM_WIDTH - 1 - 2 * delta_x) / (k - 1);
+            t.scr_y = delta_y + j * (SIM_HEIGHT - 1 - 2 * delta_y) / (k - 1);
+            pen.to_raw(t.scr_x, t.scr_y, X, Y);
+            t.dev_X = (int) (X + 0.5);
+            t.dev_Y = (int) (Y + 0.5);
+            tuples.push_back(t);
+        }
+}
+
+/// next raw position, walking over the raw range
+static inline void next_raw(BenchContext* c)
+{
+    c->X = (c->X + 1021) & SIM_RAW_MAX;
+    c->Y = (c->Y + 509) & SIM_RAW_MAX;
+}
+
+static void bench_find_H(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    Homography::solve(&c->tuples[0], c->tuples.size(), PRECISION,
+                      SOLVER_LU, c->H);
+}
+
+static void bench_find_H_9_qr(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    Homography::solve(&c->tuples9[0], c->tuples9.size(), PRECISION,
+                      SOLVER_QR, c->H);
+}
+
+static void bench_test_H(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    c->sink += Homography::test(&c->tuples[0], c->tuples.size(), c->H);
+}
+
+static void bench_transform_exact(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    int x, y;
+
+    next_raw(c);
+    c->transform.apply_exact(c->X, c->Y, x, y);
+    c->sink += x + y;
+}
+
+static void bench_transform_lut(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    int x, y;
+
+    next_raw(c);
+    c->transform.apply_lut(c->X, c->Y, x, y);
+    c->sink += x + y;
+}
+
+static void bench_compute_XCTM(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    c->calibrator->compute_XCTM(c->m);
+}
+
+static void bench_state_save_binary(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    StateFile::save(c->state_bin, c->state, STATE_BINARY);
+}
+
+static void bench_state_save_text(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    StateFile::save(c->state_txt, c->state, STATE_TEXT);
+}
+
+static void bench_state_load_binary(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    StateFile state;
+    c->sink += state.load(c->state_bin);
+}
+
+static void bench_state_load_text(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    StateFile state;
+    c->sink += state.load(c->state_txt);
+}
+
+static void bench_make_state(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    StateRecord rec;
+    c->sink += c->calibrator->make_state(rec);
+}
+
+static void bench_load_state(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    c->calibrator->load_state(c->state);
+}
+
+static void bench_sysfs_apply(void* arg)
+{
+    BenchContext* c = (BenchContext*) arg;
+    c->sink += c->calibrator->set_ebeam_calibration();
+}
+
+/// an offscreen GUI, on one screen
+struct DrawContext {
+    CanvasMemory* canvas;
+    OffscreenGui* gui;
+    int elapsed;
+};
+
+static void bench_draw_redraw(void* arg)
+{
+    DrawContext* d = (DrawContext*) arg;
+    d->gui->frame_redraw();
+}
+
+static void bench_draw_message(void* arg)
+{
+    DrawContext* d = (DrawContext*) arg;
+    d->gui->frame_message(true);
+}
+
+static void bench_draw_clock(void* arg)
+{
+    DrawContext* d = (DrawContext*) arg;
+    d->elapsed = (d->elapsed + 100) % 14000;
+    d->gui->frame_clock(d->elapsed);
+}
+
+/// per frame cost of the drawing routines, at each screen size
+static bool bench_draw(MicroBench& bench)
+{
+    for (unsigned i = 0; i < sizeof(draw_screens) / sizeof(draw_screens[0]);
+         i++) {
+        const DrawScreen& s = draw_screens[i];
+        DrawContext d;
+
+        Calibrator calibrator("bench", PRECISION, THR_DOUBLECLICK,
+                              s.zone[0], s.zone[1], s.zone[2], s.zone[3],
+                              s.width, s.height, 0);
+        try {
+            d.canvas = new CanvasMemory(s.width, s.height,
+                                        OffscreenGui::get_palette(),
+                                        OffscreenGui::get_num_colors());
+        } catch (std::runtime_error& e) {
+            fprintf(stderr, "ERROR: %s : %s\n", s.name[0], e.what());
+            return false;
+        }
+        d.gui = new OffscreenGui(&calibrator, d.canvas);
+        d.gui->set_clicks(2);
+        d.elapsed = 0;
+
+        bench.run(s.name[0], bench_draw_redraw, &d);
+        bench.run(s.name[1], bench_draw_message, &d);
+        bench.run(s.name[2], bench_draw_clock, &d);
+
+        delete d.gui;
+        delete d.canvas;
+    }
+
+    return true;
+}
+
+/// render the golden frames : check them against file, or write it
+static bool golden(const char* file, bool update)
+{
+    FILE* fp = fopen(file, update ? "w" : "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", file,
+                        strerror(errno));
+        return false;
+    }
+
+    CanvasMemory canvas(GOLDEN_WIDTH, GOLDEN_HEIGHT,
+                        OffscreenGui::get_palette(),
+                        OffscreenGui::get_num_colors());
+    unsigned failures = 0;
+
+    for (unsigned i = 0; i < sizeof(golden_frames) / sizeof(golden_frames[0]);
+         i++) {
+        const GoldenFrame& f = golden_frames[i];
+        int w = GOLDEN_WIDTH, h = GOLDEN_HEIGHT;
+
+        Calibrator calibrator("golden", PRECISION, THR_DOUBLECLICK,
+                              f.zoned ? w / 2 : 0, 0,
+                              f.zoned ? w - 1 : 0, f.zoned ? h / 2 - 1 : 0,
+                              w, h, 0);
+        OffscreenGui gui(&calibrator, &canvas);
+
+        canvas.clear();
+        gui.set_clicks(f.clicks);
+        if (f.message >= 0)
+            gui.frame_message(f.message);
+        else
+            gui.frame_redraw();
+        if (f.clock >= 0)
+            gui.frame_clock(f.clock);
+
+        unsigned long crc = canvas.checksum();
+
+        if (update) {
+            fprintf(fp, "%s %dx%d %08lx\n", f.name, w, h, crc);
+            continue;
+        }
+
+        // reference of this frame
+        char line[128], name[64];
+        int rw = 0, rh = 0;
+        unsigned long ref = 0;
+        bool found = false;
+
+        rewind(fp);
+        while (!found && fgets(line, sizeof(line), fp))
+            found = sscanf(line, "%63s %dx%d %lx", name, &rw, &rh, &ref) == 4
+                    && strcmp(name, f.name) == 0;
+
+        if (found && rw == w && rh == h && ref == crc) {
+            printf("%-16s ok\n", f.name);
+            continue;
+        }
+
+        // keep the image to look at
+        char ppm[80];
+        snprintf(ppm, sizeof(ppm), "golden_%s.ppm", f.name);
+        canvas.write_ppm(ppm);
+        printf("%-16s FAILED : %08lx, expected %s%08lx, see %s\n", f.name,
+               crc, found ? "" : "(missing) ", ref, ppm);
+        failures++;
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", file);
+        return false;
+    }
+
+    if (update)
+        printf("%s : %u frames written\n", file,
+               (unsigned) (sizeof(golden_frames) / sizeof(golden_frames[0])));
+
+    return failures == 0;
+}
+
+int main(int argc, char** argv)
+{
+    double min_ms = 200;
+    const char* filter = NULL;
+    const char* json = NULL;
+    const char* golden_file = NULL;
+    bool golden_update = false;
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_bench v%s\n\n", VERSION);
+            usage_bench(argv[0]);
+            return 0;
+        } else
+
+        if (strcmp("--filter", argv[i]) == 0 && argc > i+1) {
+            filter = argv[++i];
+        } else
+
+        if (strcmp("--time", argv[i]) == 0 && argc > i+1) {
+            min_ms = atof(argv[++i]);
+            if (min_ms <= 0) {
+                fprintf(stderr, "Error: --time needs a positive duration "
+                                "in ms as argument;\n\n");
+                usage_bench(argv[0]);
+                return 1;
+            }
+        } else
+
+        if (strcmp("--json", argv[i]) == 0 && argc > i+1) {
+            json = argv[++i];
+        } else
+
+        if (strcmp("--golden", argv[i]) == 0 && argc > i+1) {
+            golden_file = argv[++i];
+        } else
+
+        if (strcmp("--golden-update", argv[i]) == 0 && argc > i+1) {
+            golden_file = argv[++i];
+            golden_update = true;
+        } else {
+
+            // unknown option, or missing argument
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_bench(argv[0]);
+            return 1;
+        }
+    }
+
+    if (golden_file)
+        return golden(golden_file, golden_update) ? 0 : 1;
+
+    // a board, its calibration, and a driver to write it to
+    SimModel model;
+    PenSimulator::default_model(model);
+    PenSimulator pen(model, 1);
+    pen.new_board(SIM_WIDTH, SIM_HEIGHT);
+
+    char dir[64];
+    if (!PenSimulator::make_sysfs(dir, sizeof(dir)))
+        return 1;
+
+    BenchContext c;
+    make_tuples(pen, 2, c.tuples);
+    make_tuples(pen, 3, c.tuples9);
+    c.X = c.Y = 0;
+    c.sink = 0;
+    snprintf(c.state_bin, sizeof(c.state_bin), "%sstate.bin", dir);
+    snprintf(c.state_txt, sizeof(c.state_txt), "%sstate.txt", dir);
+
+    Homography::solve(&c.tuples[0], c.tuples.size(), PRECISION, SOLVER_LU,
+                      c.H);
+
+    EbeamCalibration cal;
+    cal.min_x = 0;
+    cal.min_y = 0;
+    cal.max_x = SIM_WIDTH - 1;
+    cal.max_y = SIM_HEIGHT - 1;
+    memcpy(cal.H, c.H, sizeof(cal.H));
+    c.transform.set_calibration(cal, SIM_WIDTH, SIM_HEIGHT);
+
+    c.calibrator = new Calibrator("bench", PRECISION, THR_DOUBLECLICK,
+                                  0, 0, 0, 0, SIM_WIDTH, SIM_HEIGHT, 0, dir);
+    bool ok = EbeamSysfs::write_calibration(dir, cal) &&
+              c.calibrator->make_state(c.state) &&
+              StateFile::save(c.state_bin, c.state, STATE_BINARY) &&
+              StateFile::save(c.state_txt, c.state, STATE_TEXT);
+
+    if (ok) {
+        MicroBench bench(min_ms, filter);
+
+        bench.run("find_H", bench_find_H, &c);
+        bench.run("find_H_9_qr", bench_find_H_9_qr, &c);
+        bench.run("test_H", bench_test_H, &c);
+        bench.run("transform_exact", bench_transform_exact, &c);
+        if (c.transform.build_lut(0, SIM_RAW_MAX, 0, SIM_RAW_MAX, 64))
+            bench.run("transform_lut", bench_transform_lut, &c);
+        bench.run("compute_XCTM", bench_compute_XCTM, &c);
+        bench.run("state_save_binary", bench_state_save_binary, &c);
+        bench.run("state_save_text", bench_state_save_text, &c);
+        bench.run("state_load_binary", bench_state_load_binary, &c);
+        bench.run("state_load_text", bench_state_load_text, &c);
+        bench.run("make_state", bench_make_state, &c);
+        bench.run("load_state", bench_load_state, &c);
+        bench.run("sysfs_apply", bench_sysfs_apply, &c);
+        ok = bench_draw(bench) && ok;
+
+        bench.report(stdout);
+        if (json)
+            ok = bench.write_json(json) && ok;
+    } else
+        fprintf(stderr, "ERROR: unable to set up the simulated device.\n");
+
+    delete c.calibrator;
+    unlink(c.state_bin);
+    unlink(c.state_txt);
+    PenSimulator::remove_sysfs(dir);
+
+    return ok ? 0 : 1;
+}
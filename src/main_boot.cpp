@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * ebeam_boot : restore the ebeam driver calibration of every device from
+ * the profile store, without X (early boot, before the display manager).
+ *
+ * Only the kernel driver half is restored; the evdev half is done by
+ * ebeam_daemon (or ebeam_state --restore) once X runs. ebeam_daemon sees
+ * in the device lock record that the driver is already up to date.
+ *
+ * Links neither X11 nor GSL.
+ */
+
+#include "sysfs.hpp"
+#include "profile_store.hpp"
+#include "devlock.hpp"
+#include "timing.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+static bool verbose = false;
+
+static void usage_boot(char* cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t-v, --verbose: "
+                    "print debug messages during the process\n");
+    fprintf(stderr, "\t--list: list ebeam driver devices and quit\n");
+    fprintf(stderr, "\t--store <file>: "
+                    "profile store (default: %s)\n", PROFILE_STORE_PATH);
+}
+
+/// restore the driver calibration of a device
+static bool restore_device(const SysfsDevice& dev, const ProfileStore& store,
+                           const char* host)
+{
+    char prefix[PROFILE_KEY_LEN];
+    char* device_key = EbeamSysfs::device_key(dev.dir);
+
+    // no X, no RandR output : the profile last saved on this host
+    int n = snprintf(prefix, sizeof(prefix), "%s@%s/", device_key, host);
+    free(device_key);
+    if (n <= 0 || n >= (int) sizeof(prefix)) {
+        fprintf(stderr, "ERROR: profile key too long for %s\n", dev.event);
+        return FAILURE;
+    }
+
+    const ProfileEntry* entry = store.find_latest(prefix);
+    if (entry == NULL) {
+        printf("%s : no profile for %s*\n", dev.event, prefix);
+        return SUCCESS;
+    }
+
+    // as saved : same computation as the daemon for an unchanged screen
+    const StateRecord& saved = entry->state;
+    StateRecord rec;
+    EbeamCalibration cal;
+
+    StateFile::rescale(saved, saved.screen_width, saved.screen_height,
+                       saved.rotation, rec);
+    EbeamSysfs::from_state(rec, cal);
+
+    uint32_t request = DeviceLock::request_hash(DEVLOCK_SYSFS, &cal,
+                                                rec.zoned);
+    DeviceLock lock(dev.dir);
+    bool ok = SUCCESS;
+
+    if (!lock.acquire(true))
+        return FAILURE;
+
+    if (!lock.coalesce(request, &ok)) {
+        ok = EbeamSysfs::write_calibration(dev.dir, cal);
+        lock.done(request, ok);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "ERROR: unable to set eBeam calibration of %s.\n",
+                        dev.event);
+        return FAILURE;
+    }
+
+    printf("%s : driver calibration restored from %s (revision %u)\n",
+           dev.event, entry->key, entry->revision);
+
+    return SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    const char* store_path = PROFILE_STORE_PATH;
+    bool list_devices = false;
+    double t_start = now_ms();
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_boot v%s\n\n", VERSION);
+            usage_boot(argv[0]);
+            return 0;
+        } else
+
+        // Verbose output ?
+        if (strcmp("-v", argv[i]) == 0 ||
+            strcmp("--verbose", argv[i]) == 0) {
+            verbose = true;
+            EbeamSysfs::verbose = true;
+            ProfileStore::verbose = true;
+            StateFile::verbose = true;
+            DeviceLock::verbose = true;
+            fprintf(stderr, "ebeam_boot v%s\n", VERSION);
+        } else
+
+        // Just list devices ?
+        if (strcmp("--list", argv[i]) == 0) {
+            list_devices = true;
+        } else
+
+        // Profile store ?
+        if (strcmp("--store", argv[i]) == 0) {
+            if (argc > i+1)
+                store_path = argv[++i];
+            else {
+                fprintf(stderr, "Error: --store needs a file name "
+                                "as argument;\n");
+                usage_boot(argv[0]);
+                return 1;
+            }
+        } else {
+
+            // unknown option
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_boot(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<SysfsDevice> devices;
+    EbeamSysfs::scan(devices);
+
+    if (list_devices) {
+        for (unsigned i = 0; i < devices.size(); i++) {
+            DeviceIdentity id;
+            EbeamSysfs::identify(devices[i].dir, id);
+            char* key = EbeamSysfs::device_key(id);
+            printf("%s (%s, %04x:%04x, %s)\n", devices[i].event,
+                   devices[i].dir, id.vendor, id.product, key);
+            free(key);
+        }
+        if (devices.empty())
+            printf("No eBeam device found.\n");
+        return devices.empty() ? 1 : 0;
+    }
+
+    if (devices.empty()) {
+        if (verbose)
+            fprintf(stderr, "No eBeam device found.\n");
+        return 0;
+    }
+
+    char host[64];
+    if (gethostname(host, sizeof(host)) != 0)
+        snprintf(host, sizeof(host), "localhost");
+    host[sizeof(host) - 1] = 0;
+
+    ProfileStore store(store_path);
+    if (!store.open())
+        return 1;
+
+    bool ok = true;
+    for (unsigned i = 0; i < devices.size(); i++)
+        ok = restore_device(devices[i], store, host) && ok;
+
+    if (verbose)
+        fprintf(stderr, "%u device(s) in %.3f ms, X calibration left to "
+                        "ebeam_daemon\n",
+                        (unsigned) devices.size(), now_ms() - t_start);
+
+    return ok ? 0 : 1;
+}
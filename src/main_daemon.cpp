@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "daemon.hpp"
+#include "sysfs.hpp"
+#include "devlock.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <grp.h>
+
+static void usage_daemon(char* cmd, const char* socket)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t-v, --verbose: "
+                    "print debug messages during the process\n");
+    fprintf(stderr, "\t--store <file>: "
+                    "profile store (default: %s)\n", PROFILE_STORE_PATH);
+    fprintf(stderr, "\t--socket <path>: "
+                    "calibration service socket (default: %s)\n", socket);
+    fprintf(stderr, "\t--socket-group <group>: "
+                    "group allowed to use the service (default: the "
+                    "daemon's group)\n");
+    fprintf(stderr, "\t--no-service: "
+                    "don't answer calibration service requests\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* store = PROFILE_STORE_PATH;
+    char socket_path[108];
+    bool service = true;
+    gid_t group = SERVICE_NO_GROUP;
+
+    Service::default_path(socket_path, sizeof(socket_path));
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_daemon v%s\n\n", VERSION);
+            usage_daemon(argv[0], socket_path);
+            return 0;
+        } else
+
+        // Verbose output ?
+        if (strcmp("-v", argv[i]) == 0 ||
+            strcmp("--verbose", argv[i]) == 0) {
+            RestoreDaemon::verbose = true;
+            Calibrator::verbose = true;
+            ProfileStore::verbose = true;
+            EbeamSysfs::verbose = true;
+            Service::verbose = true;
+            DeviceLock::verbose = true;
+            fprintf(stderr, "ebeam_daemon v%s\n", VERSION);
+        } else
+
+        // Profile store ?
+        if (strcmp("--store", argv[i]) == 0) {
+            if (argc > i+1)
+                store = argv[++i];
+            else {
+                fprintf(stderr, "Error: --store needs a file name "
+                                "as argument;\n");
+                usage_daemon(argv[0], socket_path);
+                return 1;
+            }
+        } else
+
+        // Service socket ?
+        if (strcmp("--socket", argv[i]) == 0) {
+            if (argc > i+1)
+                snprintf(socket_path, sizeof(socket_path), "%s", argv[++i]);
+            else {
+                fprintf(stderr, "Error: --socket needs a file name "
+                                "as argument;\n");
+                usage_daemon(argv[0], socket_path);
+                return 1;
+            }
+        } else
+
+        // Service group ?
+        if (strcmp("--socket-group", argv[i]) == 0) {
+            struct group* gr = argc > i+1 ? getgrnam(argv[++i]) : NULL;
+            if (gr)
+                group = gr->gr_gid;
+            else {
+                fprintf(stderr, "Error: --socket-group needs a group name "
+                                "as argument;\n");
+                usage_daemon(argv[0], socket_path);
+                return 1;
+            }
+        } else
+
+        // No service ?
+        if (strcmp("--no-service", argv[i]) == 0) {
+            service = false;
+        } else {
+
+            // unknown option
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_daemon(argv[0], socket_path);
+            return 1;
+        }
+    }
+
+    RestoreDaemon daemon(store, service ? socket_path : NULL, group);
+
+    if (!daemon.init())
+        return 1;
+
+    return daemon.run() ? 0 : 1;
+}
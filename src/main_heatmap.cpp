@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+/*
+ * ebeam_heatmap : where on the screen does a stored calibration go wrong ?
+ * Quantization error of the driver integer transform, and reprojection
+ * error of validation samples, over a dense screen grid (see heatmap.hpp),
+ * as PGM images and a CSV per grid cell.
+ *
+ * Links neither X11 nor GSL. Not installed : a development tool.
+ */
+
+#include "heatmap.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+static void usage_heatmap(char* cmd)
+{
+    fprintf(stderr, "Usage: %s [options] --state <file>\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t-v, --verbose: "
+                    "print debug messages during the process\n");
+    fprintf(stderr, "\t--state <file>: calibration state file, "
+                    "as written by ebeam_state --save\n");
+    fprintf(stderr, "\t--samples <file>: validation samples, "
+                    "\"X Y x y\" lines (raw, then screen position)\n");
+    fprintf(stderr, "\t--screen <width> <height>: (default: the screen "
+                    "geometry of the state file)\n");
+    fprintf(stderr, "\t--step <n>: evaluate every n-th pixel "
+                    "(default: 1)\n");
+    fprintf(stderr, "\t--pgm <prefix>: write <prefix>_quantization.pgm "
+                    "and <prefix>_reprojection.pgm\n");
+    fprintf(stderr, "\t--csv <file>: errors per %dx%d px cell\n",
+                    HEATMAP_CELL, HEATMAP_CELL);
+    fprintf(stderr, "\t--scale-quantization <px>: white level "
+                    "(default: 2)\n");
+    fprintf(stderr, "\t--scale-reprojection <px>: white level "
+                    "(default: 8)\n");
+    fprintf(stderr, "\t--threads <n>: (default: one per cpu)\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* state_path = NULL;
+    const char* samples_path = NULL;
+    const char* pgm = NULL;
+    const char* csv = NULL;
+    int width = 0;
+    int height = 0;
+    int step = 1;
+    double scale_quant = 2;
+    double scale_reproj = 8;
+    unsigned threads = 0;
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_heatmap v%s\n\n", VERSION);
+            usage_heatmap(argv[0]);
+            return 0;
+        } else
+
+        // Verbose output ?
+        if (strcmp("-v", argv[i]) == 0 ||
+            strcmp("--verbose", argv[i]) == 0) {
+            ErrorHeatmap::verbose = true;
+            fprintf(stderr, "ebeam_heatmap v%s\n", VERSION);
+        } else
+
+        if (strcmp("--state", argv[i]) == 0 && argc > i+1) {
+            state_path = argv[++i];
+        } else
+
+        if (strcmp("--samples", argv[i]) == 0 && argc > i+1) {
+            samples_path = argv[++i];
+        } else
+
+        if (strcmp("--screen", argv[i]) == 0 && argc > i+2) {
+            width = atoi(argv[++i]);
+            height = atoi(argv[++i]);
+            if (width <= 0 || height <= 0) {
+                fprintf(stderr, "Error: --screen needs a positive width "
+                                "and height.\n\n");
+                usage_heatmap(argv[0]);
+                return 1;
+            }
+        } else
+
+        if (strcmp("--step", argv[i]) == 0 && argc > i+1) {
+            step = atoi(argv[++i]);
+        } else
+
+        if (strcmp("--pgm", argv[i]) == 0 && argc > i+1) {
+            pgm = argv[++i];
+        } else
+
+        if (strcmp("--csv", argv[i]) == 0 && argc > i+1) {
+            csv = argv[++i];
+        } else
+
+        if (strcmp("--scale-quantization", argv[i]) == 0 && argc > i+1) {
+            scale_quant = atof(argv[++i]);
+        } else
+
+        if (strcmp("--scale-reprojection", argv[i]) == 0 && argc > i+1) {
+            scale_reproj = atof(argv[++i]);
+        } else
+
+        if (strcmp("--threads", argv[i]) == 0 && argc > i+1) {
+            threads = atoi(argv[++i]);
+        } else {
+
+            // unknown option, or missing argument
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_heatmap(argv[0]);
+            return 1;
+        }
+    }
+
+    if (state_path == NULL) {
+        fprintf(stderr, "Error: --state is needed.\n\n");
+        usage_heatmap(argv[0]);
+        return 1;
+    }
+
+    if (step < 1 || scale_quant <= 0 || scale_reproj <= 0) {
+        fprintf(stderr, "Error: --step and the scales must be positive.\n");
+        return 1;
+    }
+
+    StateFile state;
+    if (!state.load(state_path))
+        return 1;
+
+    const StateRecord& saved = *state.get_record();
+    StateRecord rec;
+
+    // no --screen
+    if (width == 0) {
+        width = saved.screen_width;
+        height = saved.screen_height;
+    }
+    if (width <= 0 || height <= 0) {
+        fprintf(stderr, "Error: unknown screen geometry in %s, "
+                        "use --screen.\n", state_path);
+        return 1;
+    }
+
+    // as Calibrator::load_state does, for the screen evaluated
+    if (!StateFile::rescale(saved, width, height, saved.rotation, rec))
+        rec = saved;
+
+    EbeamCalibration cal;
+    EbeamSysfs::from_state(rec, cal);
+
+    ErrorHeatmap map(cal, width, height);
+
+    if (samples_path) {
+        std::vector<HeatSample> samples;
+        if (!ErrorHeatmap::load_samples(samples_path, samples))
+            return 1;
+        map.set_samples(samples);
+    }
+
+    if (!map.run(step, threads))
+        return 1;
+
+    map.report(stdout);
+
+    if (pgm) {
+        std::string path(pgm);
+
+        if (!map.write_pgm((path + "_quantization.pgm").c_str(), true,
+                           scale_quant))
+            return 1;
+        if (map.has_samples() &&
+            !map.write_pgm((path + "_reprojection.pgm").c_str(), false,
+                           scale_reproj))
+            return 1;
+    }
+
+    if (csv && !map.write_csv(csv))
+        return 1;
+
+    return 0;
+}
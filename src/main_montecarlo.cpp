@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+/*
+ * ebeam_montecarlo : which number of points, precision and solver give the
+ * best calibration ? Millions of simulated calibrations (see
+ * montecarlo.hpp) on all cores, error distribution, test failures and
+ * throughput per configuration.
+ *
+ * Links GSL, not X11. Not installed : a development tool.
+ */
+
+#include "montecarlo.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage_montecarlo(char* cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t-v, --verbose: "
+                    "print debug messages during the process\n");
+    fprintf(stderr, "\t--trials <n>: trials per configuration "
+                    "(default: 100000)\n");
+    fprintf(stderr, "\t--points <n,...>: clicks per calibration, 4, 5 "
+                    "(4 + center) or a k x k grid (default: 4,5,9)\n");
+    fprintf(stderr, "\t--precision <n,...>: H precision "
+                    "(default: 9,%d,14)\n", PRECISION);
+    fprintf(stderr, "\t--solver <lu|qr|svd,...>: linear solver "
+                    "(default: lu,qr,svd)\n");
+    fprintf(stderr, "\t--sim-model <projective|radial>: board mapping "
+                    "(default: projective)\n");
+    fprintf(stderr, "\t--sim-noise <sigma>: raw sensor jitter "
+                    "(default: 3)\n");
+    fprintf(stderr, "\t--click <sigma>: click error, in px (default: 2)\n");
+    fprintf(stderr, "\t--tolerance <px>: test of H beyond 4 points "
+                    "(default: 10)\n");
+    fprintf(stderr, "\t--screen <width> <height>: (default: %dx%d)\n",
+                    SIM_WIDTH, SIM_HEIGHT);
+    fprintf(stderr, "\t--threads <n>: (default: one per cpu)\n");
+}
+
+/// "a,b,c" : a list of numbers
+static bool parse_ints(const char* arg, std::vector<int>& values)
+{
+    char* end;
+
+    values.clear();
+    do {
+        values.push_back(strtol(arg, &end, 10));
+        if (end == arg || (*end != ',' && *end != 0))
+            return false;
+        arg = end + 1;
+    } while (*end);
+
+    return true;
+}
+
+/// "lu,qr" : a list of solvers
+static bool parse_solvers(const char* arg,
+                          std::vector<HomographySolver>& solvers)
+{
+    char name[16];
+
+    solvers.clear();
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        HomographySolver solver;
+
+        if (len >= sizeof(name))
+            return false;
+        memcpy(name, arg, len);
+        name[len] = 0;
+        if (!Homography::parse_solver(name, solver))
+            return false;
+        solvers.push_back(solver);
+
+        arg += len;
+        if (*arg)
+            arg++;
+    }
+
+    return !solvers.empty();
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long trials = 100000;
+    std::vector<int> points;
+    std::vector<int> precisions;
+    std::vector<HomographySolver> solvers;
+    SimModel model;
+    double click_error = 2;
+    int tolerance = 10;
+    int width = SIM_WIDTH;
+    int height = SIM_HEIGHT;
+    unsigned threads = 0;
+
+    PenSimulator::default_model(model);
+    parse_ints("4,5,9", points);
+    precisions.push_back(9);
+    precisions.push_back(PRECISION);
+    precisions.push_back(14);
+    parse_solvers("lu,qr,svd", solvers);
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_montecarlo v%s\n\n", VERSION);
+            usage_montecarlo(argv[0]);
+            return 0;
+        } else
+
+        // Verbose output ?
+        if (strcmp("-v", argv[i]) == 0 ||
+            strcmp("--verbose", argv[i]) == 0) {
+            MonteCarlo::verbose = true;
+            fprintf(stderr, "ebeam_montecarlo v%s\n", VERSION);
+        } else
+
+        if (strcmp("--trials", argv[i]) == 0 && argc > i+1) {
+            trials = strtoul(argv[++i], NULL, 10);
+        } else
+
+        if (strcmp("--points", argv[i]) == 0 && argc > i+1) {
+            if (!parse_ints(argv[++i], points)) {
+                fprintf(stderr, "Error: bad --points list: %s\n", argv[i]);
+                return 1;
+            }
+            for (unsigned p = 0; p < points.size(); p++)
+                if (!MonteCarlo::valid_points(points[p])) {
+                    fprintf(stderr, "Error: unsupported number of "
+                                    "points: %d\n", points[p]);
+                    return 1;
+                }
+        } else
+
+        if (strcmp("--precision", argv[i]) == 0 && argc > i+1) {
+            if (!parse_ints(argv[++i], precisions)) {
+                fprintf(stderr, "Error: bad --precision list: %s\n",
+                                argv[i]);
+                return 1;
+            }
+        } else
+
+        if (strcmp("--solver", argv[i]) == 0 && argc > i+1) {
+            if (!parse_solvers(argv[++i], solvers)) {
+                fprintf(stderr, "Error: bad --solver list: %s\n", argv[i]);
+                return 1;
+            }
+        } else
+
+        if (strcmp("--sim-model", argv[i]) == 0 && argc > i+1) {
+            if (!PenSimulator::parse_mapping(argv[++i], model.mapping)) {
+                fprintf(stderr, "Error: --sim-model needs projective "
+                                "or radial as argument.\n");
+                return 1;
+            }
+        } else
+
+        if (strcmp("--sim-noise", argv[i]) == 0 && argc > i+1) {
+            model.noise = atof(argv[++i]);
+        } else
+
+        if (strcmp("--click", argv[i]) == 0 && argc > i+1) {
+            click_error = atof(argv[++i]);
+        } else
+
+        if (strcmp("--tolerance", argv[i]) == 0 && argc > i+1) {
+            tolerance = atoi(argv[++i]);
+        } else
+
+        if (strcmp("--screen", argv[i]) == 0 && argc > i+2) {
+            width = atoi(argv[++i]);
+            height = atoi(argv[++i]);
+        } else
+
+        if (strcmp("--threads", argv[i]) == 0 && argc > i+1) {
+            threads = atoi(argv[++i]);
+        } else {
+
+            // unknown option, or missing argument
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_montecarlo(argv[0]);
+            return 1;
+        }
+    }
+
+    if (trials == 0 || width < MC_BLOCKS || height < MC_BLOCKS) {
+        fprintf(stderr, "Error: nothing to simulate.\n");
+        return 1;
+    }
+
+    MonteCarlo mc(model, click_error, tolerance, width, height);
+
+    for (unsigned p = 0; p < points.size(); p++)
+        for (unsigned r = 0; r < precisions.size(); r++)
+            for (unsigned s = 0; s < solvers.size(); s++) {
+                McConfig config;
+                config.points = points[p];
+                config.precision = precisions[r];
+                config.solver = solvers[s];
+                mc.add_config(config);
+            }
+
+    printf("%s board, %dx%d screen, sensor noise %g, click error %g px, "
+           "tolerance %d px\n",
+           model.mapping == SimModel::RADIAL ? "radial" : "projective",
+           width, height, model.noise, click_error, tolerance);
+
+    mc.run(trials, threads);
+    mc.report(stdout);
+
+    return 0;
+}
@@ -0,0 +1,541 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * ebeam_uinput : calibration in userspace, for kernels without the ebeam
+ * driver calibration attributes. The raw events of the device are
+ * transformed with its stored profile and emitted by a uinput device.
+ *
+ * X is only used to find the device, the screen geometry and the profile.
+ */
+
+#include "calibrator.hpp"
+#include "profile_store.hpp"
+#include "pipeline.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+// latency benchmark rate, a pen sends ~100 to 1000 reports/s
+#define BENCH_RATE 1000
+
+// default LUT size of the benchmark
+#define BENCH_CELLS 64
+
+// profile store check period, in s
+#define RELOAD_PERIOD 1
+
+static void usage_uinput(char* cmd)
+{
+    fprintf(stderr, "Usage: %s [options]\n", cmd);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "\t-h, --help: print this help message\n");
+    fprintf(stderr, "\t-v, --verbose: "
+                    "print debug messages during the process\n");
+    fprintf(stderr, "\t--device <device name, id, vendor:product, "
+                    "serial:<serial> or phys:<usb port>>: "
+                    "select a specific device\n");
+    fprintf(stderr, "\t--restore <file>: "
+                    "calibration state file (default: the profile store)\n");
+    fprintf(stderr, "\t--store <file>: "
+                    "profile store (default: %s)\n", PROFILE_STORE_PATH);
+    fprintf(stderr, "\t--lut <cells>: "
+                    "interpolate in a cells x cells mesh LUT\n");
+    fprintf(stderr, "\t--filter <none|oneeuro[:mincutoff[,beta]]|"
+                    "kalman[:q[,r]]|median[:n]>: "
+                    "smooth the corrected positions\n");
+    fprintf(stderr, "\t--predict <ms>[:linear|quadratic[,n]]: "
+                    "extrapolate the pen position ms ahead, fitting the "
+                    "last n positions\n");
+    fprintf(stderr, "\t--record <file>: "
+                    "record the corrected positions as a pen trace\n");
+    fprintf(stderr, "\t--replay <file>: "
+                    "prediction error on a recorded pen trace and quit\n");
+    fprintf(stderr, "\t--bench <n>: "
+                    "benchmark with n synthetic reports and quit\n");
+    fprintf(stderr, "\t--stress <n>: "
+                    "check n synthetic reports against concurrent "
+                    "calibration swaps and quit\n");
+}
+
+static void on_signal(int)
+{
+    PenPipeline::stop();
+}
+
+/// synthetic calibration of the benchmark : raw range to a 1920x1080
+/// screen, with some perspective
+static void bench_calibration(EbeamCalibration& cal)
+{
+    const double scale = 1e12;
+
+    memset(&cal, 0, sizeof(cal));
+    cal.max_x = 1919;
+    cal.max_y = 1079;
+    cal.H[0] = (long long) (0.47 * scale);
+    cal.H[1] = (long long) (0.01 * scale);
+    cal.H[2] = (long long) (5 * scale);
+    cal.H[3] = (long long) (0.005 * scale);
+    cal.H[4] = (long long) (0.26 * scale);
+    cal.H[5] = (long long) (3 * scale);
+    cal.H[6] = (long long) (1e-6 * scale);
+    cal.H[7] = (long long) (2e-6 * scale);
+    cal.H[8] = (long long) scale;
+}
+
+/// where the calibration comes from, and what it is rescaled for
+struct Source {
+    const char*   file;         // state file, NULL : profile store
+    ProfileStore* store;
+    char          key[PROFILE_KEY_LEN];
+    uint32_t      revision;     // of the profile in use
+    int           width;        // screen geometry
+    int           height;
+    int           rotation;
+    int           raw_min_x;    // LUT range
+    int           raw_max_x;
+    int           raw_min_y;
+    int           raw_max_y;
+    int           cells;        // 0 : exact transform
+};
+
+/// reload thread state
+struct Reloader {
+    Source*       source;
+    PenPipeline*  pipeline;
+    volatile bool done;
+};
+
+/// read the calibration, changed is false if the profile is the same
+static bool read_state(Source& src, bool force, StateRecord& saved,
+                       bool& changed)
+{
+    changed = true;
+
+    if (src.file) {
+        StateFile state;
+
+        // state files are only read again on request
+        if (!force) {
+            changed = false;
+            return SUCCESS;
+        }
+        if (!state.load(src.file))
+            return FAILURE;
+        saved = *state.get_record();
+        return SUCCESS;
+    }
+
+    if (!src.store->refresh())
+        return FAILURE;
+
+    const ProfileEntry* entry = src.store->find(src.key);
+    if (entry == NULL) {
+        fprintf(stderr, "ERROR: no profile for %s\n", src.key);
+        return FAILURE;
+    }
+
+    changed = force || entry->revision != src.revision;
+    src.revision = entry->revision;
+    saved = entry->state;
+
+    return SUCCESS;
+}
+
+/// new transform snapshot, for the screen of src
+static PenTransform* make_transform(const Source& src,
+                                    const StateRecord& saved)
+{
+    StateRecord rec;
+    EbeamCalibration cal;
+
+    if (!StateFile::rescale(saved, src.width, src.height, src.rotation,
+                            rec)) {
+        if (Calibrator::verbose)
+            fprintf(stderr, "WARNING: unknown screen geometry in state, "
+                            "restoring as is.\n");
+        rec = saved;
+    }
+
+    EbeamSysfs::from_state(rec, cal);
+
+    PenTransform* transform = new PenTransform;
+    transform->set_calibration(cal, src.width, src.height);
+    if (!transform->build_lut(src.raw_min_x, src.raw_max_x,
+                              src.raw_min_y, src.raw_max_y, src.cells)) {
+        delete transform;
+        return NULL;
+    }
+
+    return transform;
+}
+
+/// reload on SIGHUP, or when the profile is saved again : the event loop
+/// switches to the new transform between two reports, without waiting
+static void* reload_thread(void* arg)
+{
+    Reloader* r = (Reloader*) arg;
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    while (!r->done) {
+        struct timespec period = { RELOAD_PERIOD, 0 };
+        int sig = sigtimedwait(&set, NULL, &period);
+        StateRecord saved;
+        bool changed;
+
+        if (r->done)
+            break;
+
+        if (!read_state(*r->source, sig == SIGHUP, saved, changed) ||
+            !changed)
+            continue;
+
+        PenTransform* next = make_transform(*r->source, saved);
+        if (next == NULL)
+            continue;
+
+        delete r->pipeline->swap_transform(next);
+
+        printf("Calibration reloaded from %s\n",
+               r->source->file ? r->source->file : r->source->key);
+        fflush(stdout);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    const char* pre_device = NULL;
+    const char* file = NULL;
+    const char* store_path = PROFILE_STORE_PATH;
+    int cells = 0;
+    int bench = 0;
+    int stress = 0;
+    PenFilter filter;
+    bool filtered = false;
+    PenPredictor predictor;
+    const char* record = NULL;
+    const char* replay = NULL;
+
+    for (int i=1; i<argc; i++) {
+        // Display help ?
+        if (strcmp("-h", argv[i]) == 0 ||
+            strcmp("--help", argv[i]) == 0) {
+            fprintf(stderr, "ebeam_uinput v%s\n\n", VERSION);
+            usage_uinput(argv[0]);
+            return 0;
+        } else
+
+        // Verbose output ?
+        if (strcmp("-v", argv[i]) == 0 ||
+            strcmp("--verbose", argv[i]) == 0) {
+            Calibrator::verbose = true;
+            ProfileStore::verbose = true;
+            StateFile::verbose = true;
+            EbeamSysfs::verbose = true;
+            PenPipeline::verbose = true;
+            fprintf(stderr, "ebeam_uinput v%s\n", VERSION);
+        } else
+
+        // Select specific device ?
+        if (strcmp("--device", argv[i]) == 0) {
+            if (argc > i+1)
+                pre_device = argv[++i];
+            else {
+                fprintf(stderr, "Error: --device needs a device name or "
+                                "id as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // State file ?
+        if (strcmp("--restore", argv[i]) == 0) {
+            if (argc > i+1)
+                file = argv[++i];
+            else {
+                fprintf(stderr, "Error: --restore needs a file name "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Profile store ?
+        if (strcmp("--store", argv[i]) == 0) {
+            if (argc > i+1)
+                store_path = argv[++i];
+            else {
+                fprintf(stderr, "Error: --store needs a file name "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Mesh LUT ?
+        if (strcmp("--lut", argv[i]) == 0) {
+            if (argc > i+1 && atoi(argv[i+1]) > 0)
+                cells = atoi(argv[++i]);
+            else {
+                fprintf(stderr, "Error: --lut needs a number of cells "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Smoothing ?
+        if (strcmp("--filter", argv[i]) == 0) {
+            if (argc > i+1 && filter.parse(argv[i+1])) {
+                filtered = true;
+                i++;
+            } else {
+                fprintf(stderr, "Error: --filter needs a filter "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Prediction ?
+        if (strcmp("--predict", argv[i]) == 0) {
+            if (argc > i+1 && predictor.parse(argv[i+1]))
+                i++;
+            else {
+                fprintf(stderr, "Error: --predict needs a time in ms "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Record a pen trace ?
+        if (strcmp("--record", argv[i]) == 0) {
+            if (argc > i+1)
+                record = argv[++i];
+            else {
+                fprintf(stderr, "Error: --record needs a file name "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Replay a pen trace ?
+        if (strcmp("--replay", argv[i]) == 0) {
+            if (argc > i+1)
+                replay = argv[++i];
+            else {
+                fprintf(stderr, "Error: --replay needs a file name "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Benchmark ?
+        if (strcmp("--bench", argv[i]) == 0) {
+            if (argc > i+1 && atoi(argv[i+1]) > 0)
+                bench = atoi(argv[++i]);
+            else {
+                fprintf(stderr, "Error: --bench needs a number of reports "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else
+
+        // Stress test ?
+        if (strcmp("--stress", argv[i]) == 0) {
+            if (argc > i+1 && atoi(argv[i+1]) > 0)
+                stress = atoi(argv[++i]);
+            else {
+                fprintf(stderr, "Error: --stress needs a number of reports "
+                                "as argument;\n");
+                usage_uinput(argv[0]);
+                return 1;
+            }
+        } else {
+
+            // unknown option
+            fprintf(stderr, "Error: Unknown option: %s\n\n", argv[i]);
+            usage_uinput(argv[0]);
+            return 1;
+        }
+    }
+
+    // synthetic events through pipes : no device, no X
+    if (stress)
+        return PenPipeline::stress(stress) ? 0 : 1;
+
+    if (replay)
+        return predictor.replay(replay, filter) ? 0 : 1;
+
+    if (bench) {
+        PenTransform transform;
+        EbeamCalibration cal;
+        bool ok;
+
+        bench_calibration(cal);
+        transform.set_calibration(cal, cal.max_x + 1, cal.max_y + 1);
+        ok = PenPipeline::bench(transform, filter, predictor, bench,
+                                BENCH_RATE);
+
+        ok = transform.build_lut(0, PIPELINE_BENCH_RAW,
+                                 0, PIPELINE_BENCH_RAW,
+                                 cells ? cells : BENCH_CELLS) && ok;
+        ok = PenPipeline::bench(transform, filter, predictor, bench,
+                                BENCH_RATE) && ok;
+
+        // smoothing against lag : the chosen filter, or all of them
+        if (filtered)
+            ok = filter.bench(bench) && ok;
+        else {
+            static const char* filters[] = { "none", "oneeuro", "kalman",
+                                              "median" };
+            for (unsigned i = 0; i < sizeof(filters)/sizeof(*filters); i++)
+                ok = filter.parse(filters[i]) && filter.bench(bench) && ok;
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    Display* display = XOpenDisplay(NULL);
+    if (display == NULL) {
+        fprintf(stderr, "ERROR: Unable to connect to X server.\n");
+        return 1;
+    }
+
+    std::vector<EbeamDevice> devices;
+    Calibrator::find_devices(display, pre_device, false, devices);
+    if (devices.empty()) {
+        fprintf(stderr, "Error: No eBeam device found.\n");
+        XCloseDisplay(display);
+        return 1;
+    }
+
+    // as find_device : the last one in identity order
+    const EbeamDevice& dev = devices.back();
+    ProfileStore store(store_path);
+    Source src;
+    char node[64];
+    bool ok = true;
+
+    memset(&src, 0, sizeof(src));
+    src.file = file;
+    src.store = &store;
+    src.cells = cells;
+    snprintf(node, sizeof(node), "/dev/input/%s", dev.event);
+
+    if (EbeamSysfs::is_ebeam(dev.dir)) {
+        fprintf(stderr, "ERROR: '%s' is handled by the ebeam kernel driver, "
+                        "use ebeam_state --restore.\n", dev.name);
+        ok = false;
+    } else if (!file)
+        ok = store.open() &&
+             Calibrator::make_profile_key(display, dev.key, src.key);
+
+    // X is not needed any more
+    Calibrator::get_screen_geometry(display, DefaultScreen(display),
+                                    src.width, src.height, src.rotation);
+    for (unsigned i = 0; i < devices.size(); i++)
+        Calibrator::free_device(devices[i]);
+    Calibrator::flush_device_cache();
+    XCloseDisplay(display);
+
+    StateRecord saved;
+    bool changed;
+    if (!ok || !read_state(src, true, saved, changed))
+        return 1;
+
+    PenPipeline pipeline(NULL);
+
+    if (!pipeline.open_input(node))
+        return 1;
+    pipeline.set_filter(filter);
+    pipeline.set_predictor(predictor);
+
+    pipeline.get_raw_range(src.raw_min_x, src.raw_max_x,
+                           src.raw_min_y, src.raw_max_y);
+
+    PenTransform* transform = make_transform(src, saved);
+    if (transform == NULL)
+        return 1;
+    pipeline.swap_transform(transform);
+
+    if (!pipeline.open_output(UINPUT_DEVICE_NAME)) {
+        delete pipeline.swap_transform(NULL);
+        return 1;
+    }
+
+    FILE* trace = NULL;
+    if (record) {
+        if ( (trace = fopen(record, "w")) == NULL ) {
+            fprintf(stderr, "ERROR: unable to open %s\n", record);
+            delete pipeline.swap_transform(NULL);
+            return 1;
+        }
+        fprintf(trace, "# ebeam_tools pen trace, %dx%d screen\n",
+                src.width, src.height);
+        pipeline.set_trace(trace);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      // no SA_RESTART : interrupt epoll
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // SIGHUP is for the reload thread only
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, NULL);
+
+    Reloader reloader = { &src, &pipeline, false };
+    pthread_t reload;
+    bool reloading = pthread_create(&reload, NULL, reload_thread,
+                                    &reloader) == 0;
+
+    ok = pipeline.run();
+
+    if (reloading) {
+        reloader.done = true;
+        pthread_kill(reload, SIGHUP);
+        pthread_join(reload, NULL);
+    }
+    delete pipeline.swap_transform(NULL);
+
+    if (trace && fclose(trace) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", record);
+        ok = false;
+    }
+
+    if (Calibrator::verbose)
+        fprintf(stderr, "%lu reports, %lu events dropped.\n",
+                        pipeline.get_reports(), pipeline.get_dropped());
+
+    return ok ? 0 : 1;
+}
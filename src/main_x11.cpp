@@ -18,19 +18,87 @@
  */
 
 #include "calibrator.hpp"
+#include "simulator.hpp"
 #include "gui/x11.hpp"
 
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// take the simulation options out of argv, the others are the calibrator's
+/// Returns the number of sessions to simulate, 0 if none
+static int parse_simulation(int& argc, char** argv, SimModel& model)
+{
+    int sessions = 0;
+    int n = 1;
+
+    PenSimulator::default_model(model);
+
+    for (int i = 1; i < argc; i++) {
+        // Simulate sessions ?
+        if (strcmp("--simulate", argv[i]) == 0) {
+            if (argc <= i+1 || (sessions = atoi(argv[++i])) <= 0) {
+                fprintf(stderr, "Error: --simulate needs a positive number "
+                                "of sessions.\n");
+                exit(1);
+            }
+        } else
+
+        // Simulated board mapping ?
+        if (strcmp("--sim-model", argv[i]) == 0) {
+            if (argc <= i+1 ||
+                !PenSimulator::parse_mapping(argv[++i], model.mapping)) {
+                fprintf(stderr, "Error: --sim-model needs projective "
+                                "or radial as argument.\n");
+                exit(1);
+            }
+        } else
+
+        // Simulated jitter ?
+        if (strcmp("--sim-noise", argv[i]) == 0) {
+            if (argc > i+1)
+                model.noise = atof(argv[++i]);
+            else {
+                fprintf(stderr, "Error: --sim-noise needs a number "
+                                "as argument.\n");
+                exit(1);
+            }
+        } else
+            argv[n++] = argv[i];
+    }
+
+    argc = n;
+    argv[n] = NULL;
+
+    return sessions;
+}
 
 int main(int argc, char** argv)
 {
-    Calibrator* calibrator = Calibrator::make_calibrator_gui(argc, argv);
+    SimModel model;
+    int sessions = parse_simulation(argc, argv, model);
+
+    Calibrator* calibrator = sessions ?
+        Calibrator::make_calibrator_gui(argc, argv, SIM_WIDTH, SIM_HEIGHT) :
+        Calibrator::make_calibrator_gui(argc, argv);
+
+    // recorded or synthetic sessions : no window, no event loop
+    if (calibrator->is_offline()) {
+        bool ok = sessions ?
+                  GuiCalibratorX11::simulate(calibrator, sessions, model) :
+                  GuiCalibratorX11::replay(calibrator);
+        delete calibrator;
+        return ok ? 0 : 1;
+    }
 
     GuiCalibratorX11::make_instance( calibrator );
 
-    // processes events
-    while(GuiCalibratorX11::is_running)
+    // processes events, once per timer signal
+    while(GuiCalibratorX11::is_running) {
         pause();
+        GuiCalibratorX11::timer_signal();
+    }
     
     GuiCalibratorX11::destroy_instance();
     delete calibrator;
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "monitor.hpp"
+#include "timing.hpp"
+
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+// prior variances, in px^2 : a shift is readily believed, a scale or a
+// rotation needs landmarks apart
+#define PRIOR_SHIFT 1e4
+#define PRIOR_LINEAR 1e2
+
+// tap scatter around a landmark, in px : the first samples are weighed
+// against the prior with it
+#define TAP_SIGMA 5
+
+// smallest triangle of landmarks (twice its area, in normalized screen
+// coords) that tells the scale and rotation, not only the shift
+#define MIN_SPAN 0.05
+
+// samples in the RLS memory : older ones barely count
+#define WINDOW ((unsigned) (1 / (1 - MONITOR_FORGET)))
+
+bool DriftMonitor::verbose = false;
+
+static volatile sig_atomic_t quit = 0;
+
+DriftEstimator::DriftEstimator(int width0, int height0, double forget0)
+  : width(width0 > 0 ? width0 : 1),
+    height(height0 > 0 ? height0 : 1),
+    forget(forget0)
+{
+    reset();
+}
+
+void DriftEstimator::reset()
+{
+    memset(P, 0, sizeof(P));
+    P[0] = PRIOR_LINEAR;
+    P[4] = PRIOR_LINEAR;
+    P[8] = PRIOR_SHIFT;
+
+    memset(theta, 0, sizeof(theta));
+    samples = 0;
+}
+
+void DriftEstimator::update(double x, double y, double ex, double ey)
+{
+    const double phi[3] = { x / width, y / height, 1 };
+    const double prior[3] = { PRIOR_LINEAR, PRIOR_LINEAR, PRIOR_SHIFT };
+    double Pphi[3];
+
+    // gain P phi / (forget r + phi' P phi), r the tap variance, then
+    // P = (P - k phi' P) / forget : the same forget in both
+    double denom = forget * TAP_SIGMA * TAP_SIGMA;
+
+    for (int i = 0; i < 3; i++) {
+        Pphi[i] = P[3*i] * phi[0] + P[3*i + 1] * phi[1] + P[3*i + 2] * phi[2];
+        denom += phi[i] * Pphi[i];
+    }
+
+    // innovations : correction needed minus correction estimated
+    double cx, cy;
+    correction(x, y, cx, cy);
+    const double rx = (ex - x) - cx;
+    const double ry = (ey - y) - cy;
+
+    for (int i = 0; i < 3; i++) {
+        double k = Pphi[i] / denom;
+        theta[i] += k * rx;
+        theta[3 + i] += k * ry;
+    }
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            P[3*i + j] = (P[3*i + j] - Pphi[i] * Pphi[j] / denom) / forget;
+
+    // forgetting inflates the directions without samples : clamp them to
+    // their prior (D P D, D diagonal, keeps P positive)
+    for (int i = 0; i < 3; i++) {
+        if (P[4*i] <= prior[i])
+            continue;
+        double s = sqrt(prior[i] / P[4*i]);
+        for (int j = 0; j < 3; j++) {
+            P[3*i + j] *= s;
+            P[3*j + i] *= s;
+        }
+    }
+
+    samples++;
+}
+
+void DriftEstimator::correction(double x, double y,
+                                double& dx, double& dy) const
+{
+    const double u = x / width;
+    const double v = y / height;
+
+    dx = theta[0] * u + theta[1] * v + theta[2];
+    dy = theta[3] * u + theta[4] * v + theta[5];
+}
+
+double DriftEstimator::sigma(double x, double y) const
+{
+    const double phi[3] = { x / width, y / height, 1 };
+    double v = 0;
+
+    // phi' P phi : P is in px^2, weighed with the tap variance
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            v += phi[i] * P[3*i + j] * phi[j];
+
+    return sqrt(std::max(v, 0.0));
+}
+
+double DriftEstimator::displacement(double sigmas) const
+{
+    const double w = width;
+    const double h = height;
+    const double pts[5][2] = {
+        { 0, 0 }, { w, 0 }, { 0, h }, { w, h }, { w / 2, h / 2 }
+    };
+    double worst = 0;
+
+    for (int i = 0; i < 5; i++) {
+        double dx, dy;
+        correction(pts[i][0], pts[i][1], dx, dy);
+        worst = std::max(worst, sqrt(dx * dx + dy * dy) -
+                                sigmas * sigma(pts[i][0], pts[i][1]));
+    }
+
+    return worst;
+}
+
+DriftMonitor::DriftMonitor(const PenTransform* transform0, int width0,
+                           int height0, double threshold0)
+  : transform(transform0),
+    width(width0),
+    height(height0),
+    threshold(threshold0),
+    estimator(width0, height0),
+    alert(false),
+    in_fd(-1),
+    own_in(false),
+    pos_x(0),
+    pos_y(0),
+    down(false),
+    taps(0),
+    alerts(0),
+    t_start(now_ms()),
+    cpu_start(thread_cpu_ms())
+{
+}
+
+DriftMonitor::~DriftMonitor()
+{
+    if (own_in && in_fd >= 0)
+        close(in_fd);
+}
+
+bool DriftMonitor::load_landmarks(const char* path,
+                                  std::vector<Landmark>& landmarks)
+{
+    FILE* fp = fopen(path, "r");
+    char line[256];
+    int n = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", path,
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    landmarks.clear();
+    while (fgets(line, sizeof(line), fp)) {
+        Landmark l;
+        char* p = line + strspn(line, " \t");
+
+        n++;
+        if (*p == '#' || *p == '\n' || *p == 0)
+            continue;
+
+        l.radius = MONITOR_RADIUS;
+        if (sscanf(p, "%lf %lf %lf", &l.x, &l.y, &l.radius) < 2 ||
+            l.radius <= 0) {
+            fprintf(stderr, "ERROR: %s:%d : bad landmark line.\n", path, n);
+            fclose(fp);
+            return FAILURE;
+        }
+        landmarks.push_back(l);
+    }
+    fclose(fp);
+
+    if (landmarks.empty()) {
+        fprintf(stderr, "ERROR: no landmark in %s\n", path);
+        return FAILURE;
+    }
+
+    if (verbose)
+        fprintf(stderr, "%u landmarks in %s\n",
+                        (unsigned) landmarks.size(), path);
+
+    return SUCCESS;
+}
+
+bool DriftMonitor::set_landmarks(const std::vector<Landmark>& landmarks0)
+{
+    landmarks = landmarks0;
+    last_sample.assign(landmarks.size(), 0);
+
+    // one or two landmarks, or a line of them, only tell a shift
+    if (!spans(false)) {
+        fprintf(stderr, "ERROR: the drift monitor needs at least 3 "
+                        "landmarks, not on a line.\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+bool DriftMonitor::spans(bool recent) const
+{
+    const unsigned n = estimator.get_samples();
+    std::vector<const Landmark*> used;
+
+    for (unsigned i = 0; i < landmarks.size(); i++)
+        if (!recent || (last_sample[i] && n - last_sample[i] < WINDOW))
+            used.push_back(&landmarks[i]);
+
+    // any triangle large enough
+    for (unsigned i = 0; i < used.size(); i++)
+        for (unsigned j = i + 1; j < used.size(); j++)
+            for (unsigned k = j + 1; k < used.size(); k++) {
+                double ux = (used[j]->x - used[i]->x) / width;
+                double uy = (used[j]->y - used[i]->y) / height;
+                double vx = (used[k]->x - used[i]->x) / width;
+                double vy = (used[k]->y - used[i]->y) / height;
+                if (fabs(ux * vy - uy * vx) >= MIN_SPAN)
+                    return true;
+            }
+
+    return false;
+}
+
+double DriftMonitor::drift(double sigmas) const
+{
+    // recent samples around the screen : the whole correction holds
+    if (spans(true))
+        return estimator.displacement(sigmas);
+
+    // only its value at the landmarks sampled is known
+    const unsigned n = estimator.get_samples();
+    double worst = 0;
+
+    for (unsigned i = 0; i < landmarks.size(); i++) {
+        double dx, dy;
+        if (last_sample[i] == 0 || n - last_sample[i] >= WINDOW)
+            continue;
+        estimator.correction(landmarks[i].x, landmarks[i].y, dx, dy);
+        worst = std::max(worst, sqrt(dx * dx + dy * dy) - sigmas *
+                                estimator.sigma(landmarks[i].x, landmarks[i].y));
+    }
+
+    return worst;
+}
+
+bool DriftMonitor::open_input(const char* node)
+{
+    struct input_absinfo abs_x, abs_y;
+
+    if ( (in_fd = open(node, O_RDONLY | O_NONBLOCK)) < 0 ) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", node,
+                        strerror(errno));
+        return FAILURE;
+    }
+    own_in = true;
+
+    if (ioctl(in_fd, EVIOCGABS(ABS_X), &abs_x) < 0 ||
+        ioctl(in_fd, EVIOCGABS(ABS_Y), &abs_y) < 0) {
+        fprintf(stderr, "ERROR: %s has no absolute axes.\n", node);
+        return FAILURE;
+    }
+
+    pos_x = abs_x.value;
+    pos_y = abs_y.value;
+
+    if (verbose)
+        fprintf(stderr, "Monitoring %s, %s positions\n", node,
+                        transform ? "raw" : "screen");
+
+    return SUCCESS;
+}
+
+static void on_signal(int)
+{
+    quit = 1;
+}
+
+void DriftMonitor::stop()
+{
+    quit = 1;
+}
+
+void DriftMonitor::process(const struct input_event& ev)
+{
+    switch (ev.type) {
+    case EV_ABS:
+        if (ev.code == ABS_X)
+            pos_x = ev.value;
+        else if (ev.code == ABS_Y)
+            pos_y = ev.value;
+        break;
+
+    case EV_KEY:
+        if ((ev.code == BTN_TOUCH || ev.code == BTN_LEFT) && ev.value == 1)
+            down = true;
+        break;
+
+    case EV_SYN:
+        // the position of the pen-down comes with its report
+        if (ev.code == SYN_REPORT && down) {
+            down = false;
+            pen_down(pos_x, pos_y);
+        } else if (ev.code == SYN_DROPPED)
+            down = false;
+        break;
+    }
+}
+
+void DriftMonitor::pen_down(int X, int Y)
+{
+    int x = X, y = Y;
+    double dx, dy;
+
+    taps++;
+
+    if (transform)
+        transform->apply_exact(X, Y, x, y);
+
+    // landmarks are looked for where the pen should be, once corrected
+    estimator.correction(x, y, dx, dy);
+
+    int best = -1;
+    double best_d2 = 0;
+    for (unsigned i = 0; i < landmarks.size(); i++) {
+        const Landmark& l = landmarks[i];
+        double ux = x + dx - l.x;
+        double uy = y + dy - l.y;
+        double d2 = ux * ux + uy * uy;
+
+        if (d2 < l.radius * l.radius && (best < 0 || d2 < best_d2)) {
+            best = i;
+            best_d2 = d2;
+        }
+    }
+
+    if (best < 0)
+        return;
+
+    estimator.update(x, y, landmarks[best].x, landmarks[best].y);
+    last_sample[best] = estimator.get_samples();
+
+    double drift = this->drift();
+
+    if (verbose)
+        fprintf(stderr, "Tap at %d %d, landmark %g %g : drift %.1f px "
+                        "(%u samples)\n", x, y, landmarks[best].x,
+                        landmarks[best].y, drift, estimator.get_samples());
+
+    if (estimator.get_samples() < MONITOR_MIN_SAMPLES)
+        return;
+
+    char date[32];
+    time_t t = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+
+    // only a drift the samples are sure of raises the alert (the first
+    // ones are few, and the corners are extrapolated), hysteresis : a
+    // single noisy tap doesn't toggle it
+    if (!alert && this->drift(MONITOR_SIGMAS) > threshold) {
+        alert = true;
+        alerts++;
+        printf("%s ALERT: calibration drift %.1f px (threshold %g px), "
+               "the sensor has moved : recalibrate with ebeam_calibrator\n",
+               date, drift, threshold);
+        fflush(stdout);
+    } else if (alert && drift < threshold / 2) {
+        alert = false;
+        printf("%s calibration drift back to %.1f px\n", date, drift);
+        fflush(stdout);
+    }
+}
+
+bool DriftMonitor::run()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      // no SA_RESTART : interrupt poll()
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    quit = 0;
+
+    while (!quit) {
+        struct pollfd fds[1];
+
+        fds[0].fd = in_fd;
+        fds[0].events = POLLIN;
+
+        if (poll(fds, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: poll : %s\n", strerror(errno));
+            return FAILURE;
+        }
+
+        // everything available, a batch at a time
+        for (;;) {
+            struct input_event buf[MONITOR_BATCH];
+            ssize_t len = read(in_fd, buf, sizeof(buf));
+
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && errno == EAGAIN)
+                break;
+            if (len < 0) {
+                fprintf(stderr, "ERROR: unable to read events : %s\n",
+                                strerror(errno));
+                return FAILURE;
+            }
+
+            // end of input : device unplugged, or replay
+            if (len == 0)
+                return SUCCESS;
+
+            if (len % sizeof(struct input_event) != 0) {
+                fprintf(stderr, "ERROR: partial input event.\n");
+                return FAILURE;
+            }
+
+            for (unsigned i = 0; i < len / sizeof(struct input_event); i++)
+                process(buf[i]);
+        }
+    }
+
+    return SUCCESS;
+}
+
+void DriftMonitor::report(FILE* fp) const
+{
+    double wall = now_ms() - t_start;
+    double cpu = thread_cpu_ms() - cpu_start;
+
+    fprintf(fp, "%lu taps, %u near a landmark, drift %.1f px, "
+                "%lu alert(s), cpu %.3f%% over %.1f s\n",
+            taps, estimator.get_samples(), drift(),
+            alerts, wall > 0 ? 100 * cpu / wall : 0, wall / 1000);
+}
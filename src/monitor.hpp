@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _monitor_hpp
+#define _monitor_hpp
+
+#include "transform.hpp"
+
+#include <linux/input.h>
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Calibration drift monitor (ebeam_state --monitor) : the sensor was
+ * bumped, and the stored calibration no longer matches the board.
+ *
+ * Pen-down positions are read from the evdev node of the device, beside X
+ * (the node is not grabbed). A tap within the radius of a landmark - a UI
+ * element at a known screen position, or a mark tapped from time to time
+ * for verification - is a sample : where the pen landed, and where it
+ * should have.
+ *
+ * The drift is an affine correction of the screen positions,
+ *   (dx, dy) = A (x / width, y / height) + b,
+ * updated at each sample by recursive least squares with forgetting : one
+ * 3x3 covariance shared by both axes, a few dozen flops, clamped to the
+ * prior in the directions the samples don't cover. The displacement is the
+ * largest correction over the screen corners and center when the recent
+ * samples come from 3 landmarks not on a line, else over the landmarks
+ * sampled only : a shift is all they tell. An alert is raised when the
+ * displacement is above the threshold by MONITOR_SIGMAS standard
+ * deviations of the estimate (from the covariance and the tap scatter),
+ * and cleared under half of it. At least 3 landmarks, not on a line, are
+ * needed.
+ *
+ * Positions are screen pixels when the driver calibration is enabled, or
+ * read from the output device of ebeam_uinput (which grabs the device),
+ * else raw positions taken through the stored calibration (X calibrated).
+ * The monitor sleeps in poll() between events : no timer, no X traffic.
+ */
+
+// landmark radius, in px
+#define MONITOR_RADIUS 40
+
+// alert threshold, in px
+#define MONITOR_THRESHOLD 8
+
+// samples before any alert
+#define MONITOR_MIN_SAMPLES 6
+
+// the alert needs the drift over the threshold by that many standard
+// deviations of the estimate
+#define MONITOR_SIGMAS 3
+
+// RLS forgetting factor : about the last 50 samples count
+#define MONITOR_FORGET 0.98
+
+// events read at once
+#define MONITOR_BATCH 64
+
+/// a screen position the pen is expected to hit
+struct Landmark {
+    double x;
+    double y;
+    double radius;
+};
+
+/// Class for estimating the drift from (observed, expected) positions
+class DriftEstimator
+{
+public:
+    DriftEstimator(int width, int height, double forget = MONITOR_FORGET);
+
+    // back to no drift
+    void reset();
+
+    // pen at (x, y), expected at (ex, ey)
+    void update(double x, double y, double ex, double ey);
+
+    // estimated correction at (x, y)
+    void correction(double x, double y, double& dx, double& dy) const;
+
+    // standard deviation of the correction at (x, y), per axis, in px
+    double sigma(double x, double y) const;
+
+    // largest correction over the screen corners and center, in px, less
+    // sigmas standard deviations
+    double displacement(double sigmas = 0) const;
+
+    unsigned get_samples() const { return samples; }
+
+private:
+    int width;
+    int height;
+    double forget;
+    double P[9];            // covariance, row major
+    double theta[6];        // dx coefs, then dy coefs
+    unsigned samples;
+};
+
+/// Class for watching the pen-down positions of a device
+class DriftMonitor
+{
+public:
+    // transform : raw positions to screen, NULL if the driver does it
+    DriftMonitor(const PenTransform* transform0, int width, int height,
+                 double threshold0);
+    ~DriftMonitor();
+
+    // "x y [radius]" lines, screen px, # comments
+    static bool load_landmarks(const char* path,
+                               std::vector<Landmark>& landmarks);
+
+    // false if they don't make a triangle
+    bool set_landmarks(const std::vector<Landmark>& landmarks0);
+
+    // evdev node of the device, read only and not grabbed
+    bool open_input(const char* node);
+
+    // or an already open file descriptor, left open
+    void set_fd(int fd) { in_fd = fd; }
+
+    // event loop, until end of input, error or stop()
+    bool run();
+
+    // a pen-down at (X, Y), raw or screen position
+    void pen_down(int X, int Y);
+
+    // make run() return, from a signal handler
+    static void stop();
+
+    // taps, samples, displacement and cpu use
+    void report(FILE* fp) const;
+
+    double get_displacement() const { return drift(); }
+    bool is_alert() const { return alert; }
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    void process(const struct input_event& ev);
+
+    // do the landmarks, or those sampled recently, make a triangle ?
+    bool spans(bool recent) const;
+
+    // displacement, over what the samples tell, less sigmas standard
+    // deviations
+    double drift(double sigmas = 0) const;
+
+    const PenTransform* transform;
+    int width;
+    int height;
+    double threshold;
+    std::vector<Landmark> landmarks;
+    std::vector<unsigned> last_sample;  // per landmark, 0 : none
+    DriftEstimator estimator;
+    bool alert;
+
+    // evdev state
+    int in_fd;
+    bool own_in;
+    int pos_x;
+    int pos_y;
+    bool down;              // pen-down seen, until its SYN_REPORT
+
+    // statistics
+    unsigned long taps;
+    unsigned long alerts;
+    double t_start;
+    double cpu_start;
+};
+
+#endif
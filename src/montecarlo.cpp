@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "montecarlo.hpp"
+#include "pool.hpp"
+#include "timing.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+bool MonteCarlo::verbose = false;
+
+void MonteCarlo::Stats::clear()
+{
+    trials = 0;
+    solve_failed = 0;
+    test_failed = 0;
+    sum_mean = 0;
+    worst = 0;
+    cpu_ms = 0;
+    hist.assign(MC_BINS, 0);
+}
+
+void MonteCarlo::Stats::merge(const Stats& other)
+{
+    trials += other.trials;
+    solve_failed += other.solve_failed;
+    test_failed += other.test_failed;
+    sum_mean += other.sum_mean;
+    worst = std::max(worst, other.worst);
+    cpu_ms += other.cpu_ms;
+    for (unsigned i = 0; i < hist.size(); i++)
+        hist[i] += other.hist[i];
+}
+
+/// upper edge of the bin holding the p-th fraction of the samples
+double MonteCarlo::Stats::percentile(double p) const
+{
+    unsigned long total = 0;
+    for (unsigned i = 0; i < hist.size(); i++)
+        total += hist[i];
+    if (total == 0)
+        return 0;
+
+    unsigned long rank = (unsigned long) ceil(p * total);
+    unsigned long seen = 0;
+    for (unsigned i = 0; i < hist.size(); i++) {
+        seen += hist[i];
+        if (seen >= rank && seen > 0)
+            return i == hist.size() - 1 ? worst : (i + 1) * MC_BIN;
+    }
+
+    return worst;
+}
+
+MonteCarlo::MonteCarlo(const SimModel& model0, double click_error0,
+                       int tolerance0, int width0, int height0)
+  : model(model0),
+    click_error(click_error0),
+    tolerance(tolerance0),
+    width(width0),
+    height(height0),
+    wall_ms(0),
+    steals(0),
+    workers(0)
+{
+}
+
+bool MonteCarlo::valid_points(int points)
+{
+    int k = (int) floor(sqrt((double) points) + 0.5);
+
+    return points == 5 || (k >= 2 && k * k == points);
+}
+
+void MonteCarlo::add_config(const McConfig& config)
+{
+    configs.push_back(config);
+}
+
+/// screen points to click : a grid inset like the calibration window
+void MonteCarlo::targets(int points, std::vector<Tuple>& tuples) const
+{
+    const int k = points == 5 ? 2 : (int) floor(sqrt((double) points) + 0.5);
+    const int delta_x = width / MC_BLOCKS;
+    const int delta_y = height / MC_BLOCKS;
+    Tuple t;
+
+    tuples.clear();
+    t.dev_X = t.dev_Y = 0;
+
+    for (int i = 0; i < k; i++)
+        for (int j = 0; j < k; j++) {
+            t.scr_x = delta_x + i * (width - 1 - 2 * delta_x) / (k - 1);
+            t.scr_y = delta_y + j * (height - 1 - 2 * delta_y) / (k - 1);
+            tuples.push_back(t);
+        }
+
+    if (points == 5) {
+        t.scr_x = width / 2;
+        t.scr_y = height / 2;
+        tuples.push_back(t);
+    }
+}
+
+void MonteCarlo::trial(const McConfig& config, PenSimulator& pen,
+                       Stats& stats) const
+{
+    std::vector<Tuple> tuples;
+    EbeamCalibration cal;
+
+    targets(config.points, tuples);
+    pen.new_board(width, height);
+    stats.trials++;
+
+    // the clicks : off target by the hand, then by the sensor
+    for (unsigned p = 0; p < tuples.size(); p++) {
+        double X, Y;
+
+        pen.to_raw(tuples[p].scr_x + pen.gaussian() * click_error,
+                   tuples[p].scr_y + pen.gaussian() * click_error, X, Y);
+        X += pen.gaussian() * model.noise;
+        Y += pen.gaussian() * model.noise;
+
+        tuples[p].dev_X = std::max(0, std::min(SIM_RAW_MAX,
+                                               (int) floor(X + 0.5)));
+        tuples[p].dev_Y = std::max(0, std::min(SIM_RAW_MAX,
+                                               (int) floor(Y + 0.5)));
+    }
+
+    if (!Homography::solve(&tuples[0], tuples.size(), config.precision,
+                           config.solver, cal.H)) {
+        stats.solve_failed++;
+        return;
+    }
+
+    // exact on 4 points, as the calibrator, a fit beyond
+    if (!Homography::test(&tuples[0], tuples.size(), cal.H,
+                          tuples.size() == 4 ? 0 : tolerance)) {
+        stats.test_failed++;
+        return;
+    }
+
+    double mean, max;
+    cal.min_x = 0;
+    cal.min_y = 0;
+    cal.max_x = width - 1;
+    cal.max_y = height - 1;
+    pen.accuracy(cal, width, height, mean, max);
+
+    stats.sum_mean += mean;
+    stats.worst = std::max(stats.worst, max);
+    stats.hist[std::min(MC_BINS - 1, (int) (max / MC_BIN))]++;
+}
+
+void MonteCarlo::run_chunk(void* arg, unsigned worker)
+{
+    Chunk* chunk = (Chunk*) arg;
+    MonteCarlo* mc = chunk->mc;
+    Stats& stats = mc->partial[worker][chunk->config];
+    double t = thread_cpu_ms();
+
+    // seeded by position, not by worker nor configuration : every
+    // configuration sees the same boards and clicks
+    PenSimulator pen(mc->model, 1 + (unsigned) chunk->first * 2654435761u);
+
+    for (unsigned long i = 0; i < chunk->count; i++)
+        mc->trial(mc->configs[chunk->config], pen, stats);
+
+    stats.cpu_ms += thread_cpu_ms() - t;
+}
+
+void MonteCarlo::run(unsigned long trials, unsigned workers0)
+{
+    WorkPool pool(workers0);
+    std::vector<Chunk> chunks;
+
+    workers = pool.get_workers();
+
+    partial.assign(workers, std::vector<Stats>(configs.size()));
+    for (unsigned w = 0; w < workers; w++)
+        for (unsigned c = 0; c < configs.size(); c++)
+            partial[w][c].clear();
+
+    for (unsigned c = 0; c < configs.size(); c++)
+        for (unsigned long first = 0; first < trials; first += MC_CHUNK) {
+            Chunk chunk;
+            chunk.mc = this;
+            chunk.config = c;
+            chunk.first = first;
+            chunk.count = std::min((unsigned long) MC_CHUNK, trials - first);
+            chunks.push_back(chunk);
+        }
+
+    // chunks won't move from now on
+    for (unsigned i = 0; i < chunks.size(); i++)
+        pool.add(run_chunk, &chunks[i]);
+
+    double t = now_ms();
+    pool.run();
+    wall_ms = now_ms() - t;
+    steals = pool.get_steals();
+
+    results.assign(configs.size(), Stats());
+    for (unsigned c = 0; c < configs.size(); c++) {
+        results[c].clear();
+        for (unsigned w = 0; w < workers; w++)
+            results[c].merge(partial[w][c]);
+    }
+    partial.clear();
+}
+
+void MonteCarlo::report(FILE* fp) const
+{
+    unsigned long total = 0;
+
+    fprintf(fp, "%-6s %-4s %-6s %9s %8s %8s %7s %7s %7s %7s %7s %10s\n",
+            "points", "prec", "solver", "trials", "solve%", "test%",
+            "mean", "p50", "p95", "p99", "max", "trials/s");
+
+    for (unsigned c = 0; c < configs.size(); c++) {
+        const McConfig& config = configs[c];
+        const Stats& s = results[c];
+        unsigned long ok = s.trials - s.solve_failed - s.test_failed;
+
+        fprintf(fp, "%-6d %-4d %-6s %9lu %7.3f%% %7.3f%% "
+                    "%7.3f %7.3f %7.3f %7.3f %7.3f %10.0f\n",
+                config.points, config.precision,
+                Homography::solver_name(config.solver), s.trials,
+                s.trials ? 100.0 * s.solve_failed / s.trials : 0.0,
+                s.trials ? 100.0 * s.test_failed / s.trials : 0.0,
+                ok ? s.sum_mean / ok : 0.0,
+                s.percentile(0.50), s.percentile(0.95), s.percentile(0.99),
+                s.worst, s.cpu_ms > 0 ? s.trials * 1000.0 / s.cpu_ms : 0.0);
+
+        total += s.trials;
+    }
+
+    fprintf(fp, "%lu trials on %u thread(s) in %.3f ms : %.0f trials/s",
+            total, workers, wall_ms,
+            wall_ms > 0 ? total * 1000.0 / wall_ms : 0.0);
+    if (verbose)
+        fprintf(fp, ", %lu chunk(s) stolen", steals);
+    fprintf(fp, "\n");
+}
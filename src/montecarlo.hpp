@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _montecarlo_hpp
+#define _montecarlo_hpp
+
+#include "homography.hpp"
+#include "simulator.hpp"
+
+#include <stdio.h>
+
+#include <vector>
+
+/*
+ * Monte Carlo comparison of calibration configurations (ebeam_montecarlo):
+ * each trial places a simulated board (see simulator.hpp), clicks the
+ * targets with some click error and sensor noise, computes H with the
+ * configuration (number of points, precision, solver), tests it like the
+ * calibrator does, and measures its screen error against the board.
+ *
+ * Trials are split in chunks run on a work-stealing pool (see pool.hpp).
+ * A chunk draws its random numbers from its own seed : the results do not
+ * depend on the number of threads nor on the scheduling, and the
+ * configurations are compared on the same boards.
+ *
+ * This module depends on GSL, not on X11.
+ */
+
+// targets inset, as in the calibration window (NUM_BLOCKS)
+#define MC_BLOCKS 8
+
+// trials per pool task
+#define MC_CHUNK 1000
+
+// error histogram : MC_BINS bins of MC_BIN px, the last one open
+#define MC_BINS 2000
+#define MC_BIN 0.025
+
+/// a calibration configuration
+struct McConfig {
+    int points;                 // 4, 5 (4 + center) or k x k grid
+    int precision;              // see calibrator.hpp
+    HomographySolver solver;
+};
+
+/// Class for running Monte Carlo calibration trials
+class MonteCarlo
+{
+public:
+    // click_error : std deviation of the click position, px
+    // tolerance : test of H with more than 4 points, px
+    MonteCarlo(const SimModel& model, double click_error, int tolerance,
+               int width, int height);
+
+    // is a number of points supported ?
+    static bool valid_points(int points);
+
+    void add_config(const McConfig& config);
+
+    // trials per configuration, on workers threads (0 : all cpus)
+    void run(unsigned long trials, unsigned workers);
+
+    // one line per configuration
+    void report(FILE* fp) const;
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    /// results of a configuration
+    struct Stats {
+        unsigned long trials;
+        unsigned long solve_failed;
+        unsigned long test_failed;
+        double sum_mean;            // of the trials mean error
+        double worst;               // trials max error
+        double cpu_ms;
+        std::vector<unsigned long> hist;    // of the trials max error
+
+        void clear();
+        void merge(const Stats& other);
+        double percentile(double p) const;
+    };
+
+    struct Chunk {
+        MonteCarlo* mc;
+        unsigned config;
+        unsigned long first;
+        unsigned long count;
+    };
+
+    static void run_chunk(void* arg, unsigned worker);
+    void trial(const McConfig& config, PenSimulator& pen, Stats& stats) const;
+    void targets(int points, std::vector<Tuple>& tuples) const;
+
+    SimModel model;
+    double click_error;
+    int tolerance;
+    int width;
+    int height;
+
+    std::vector<McConfig> configs;
+
+    // [worker][config], merged into results
+    std::vector<std::vector<Stats> > partial;
+    std::vector<Stats> results;
+    double wall_ms;
+    unsigned long steals;
+    unsigned workers;
+};
+
+#endif
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "pipeline.hpp"
+#include "timing.hpp"
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/uinput.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+/// static verbose
+bool PenPipeline::verbose = false;
+
+/// set by stop()
+static volatile sig_atomic_t quit = 0;
+
+PenPipeline::PenPipeline(const PenTransform* transform0)
+  : transform(transform0),
+    qs_count(0),
+    qs_online(0),
+    in_fd(-1),
+    out_fd(-1),
+    epoll_fd(-1),
+    own_in(false),
+    own_out(false),
+    trace(NULL),
+    lifted(false),
+    nframe(0),
+    raw_x(0),
+    raw_y(0),
+    moved(false),
+    dropping(false),
+    touch_down(false),
+    left_down(false),
+    reports(0),
+    dropped(0)
+{
+    memset(&abs_x, 0, sizeof(abs_x));
+    memset(&abs_y, 0, sizeof(abs_y));
+    pthread_mutex_init(&swap_lock, NULL);
+}
+
+PenPipeline::~PenPipeline()
+{
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+
+    if (own_out) {
+        ioctl(out_fd, UI_DEV_DESTROY);
+        close(out_fd);
+    }
+
+    if (own_in) {
+        ioctl(in_fd, EVIOCGRAB, 0);
+        close(in_fd);
+    }
+
+    pthread_mutex_destroy(&swap_lock);
+}
+
+bool PenPipeline::open_input(const char* node)
+{
+    if ( (in_fd = open(node, O_RDONLY | O_NONBLOCK)) < 0 ) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", node,
+                        strerror(errno));
+        return FAILURE;
+    }
+    own_in = true;
+
+    if (ioctl(in_fd, EVIOCGABS(ABS_X), &abs_x) < 0 ||
+        ioctl(in_fd, EVIOCGABS(ABS_Y), &abs_y) < 0) {
+        fprintf(stderr, "ERROR: %s has no absolute axes.\n", node);
+        return FAILURE;
+    }
+
+    // X must not see the raw events any more
+    if (ioctl(in_fd, EVIOCGRAB, 1) != 0) {
+        fprintf(stderr, "ERROR: unable to grab %s : %s\n", node,
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    raw_x = abs_x.value;
+    raw_y = abs_y.value;
+
+    if (verbose)
+        fprintf(stderr, "Reading %s, raw range %d..%d x %d..%d\n", node,
+                        abs_x.minimum, abs_x.maximum,
+                        abs_y.minimum, abs_y.maximum);
+
+    return SUCCESS;
+}
+
+bool PenPipeline::open_output(const char* name)
+{
+    static const char* nodes[] = { "/dev/uinput", "/dev/input/uinput" };
+    unsigned char keys[KEY_MAX/8 + 1];
+    struct uinput_user_dev dev;
+    struct input_id id;
+    bool has_keys = false;
+
+    for (unsigned i = 0; out_fd < 0 && i < sizeof(nodes)/sizeof(*nodes); i++)
+        out_fd = open(nodes[i], O_WRONLY | O_NONBLOCK);
+
+    if (out_fd < 0) {
+        fprintf(stderr, "ERROR: unable to open uinput : %s\n",
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    ioctl(out_fd, UI_SET_EVBIT, EV_SYN);
+    ioctl(out_fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(out_fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(out_fd, UI_SET_ABSBIT, ABS_X);
+    ioctl(out_fd, UI_SET_ABSBIT, ABS_Y);
+
+    // same buttons as the raw device
+    memset(keys, 0, sizeof(keys));
+    if (in_fd >= 0 &&
+        ioctl(in_fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) >= 0)
+        for (int k = 0; k < KEY_MAX; k++)
+            if (keys[k/8] & (1 << (k%8))) {
+                ioctl(out_fd, UI_SET_KEYBIT, k);
+                has_keys = true;
+            }
+    if (!has_keys)
+        ioctl(out_fd, UI_SET_KEYBIT, BTN_LEFT);
+
+    memset(&dev, 0, sizeof(dev));
+    snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "%s", name);
+    dev.id.bustype = BUS_VIRTUAL;
+    if (in_fd >= 0 && ioctl(in_fd, EVIOCGID, &id) >= 0) {
+        dev.id.vendor = id.vendor;
+        dev.id.product = id.product;
+    }
+    dev.id.version = 1;
+
+    // screen coordinates : no X calibration needed
+    dev.absmin[ABS_X] = 0;
+    dev.absmax[ABS_X] = transform->get_width() - 1;
+    dev.absmin[ABS_Y] = 0;
+    dev.absmax[ABS_Y] = transform->get_height() - 1;
+
+    if (write(out_fd, &dev, sizeof(dev)) != (ssize_t) sizeof(dev) ||
+        ioctl(out_fd, UI_DEV_CREATE) != 0) {
+        fprintf(stderr, "ERROR: unable to create uinput device : %s\n",
+                        strerror(errno));
+        close(out_fd);
+        out_fd = -1;
+        return FAILURE;
+    }
+    own_out = true;
+
+    if (verbose)
+        fprintf(stderr, "Created uinput device '%s', %dx%d\n", name,
+                        transform->get_width(), transform->get_height());
+
+    return SUCCESS;
+}
+
+void PenPipeline::set_fds(int in, int out)
+{
+    in_fd = in;
+    out_fd = out;
+}
+
+void PenPipeline::get_raw_range(int& min_x, int& max_x,
+                                int& min_y, int& max_y) const
+{
+    min_x = abs_x.minimum;
+    max_x = abs_x.maximum;
+    min_y = abs_y.minimum;
+    max_y = abs_y.maximum;
+}
+
+void PenPipeline::set_filter(const PenFilter& filter0)
+{
+    filter = filter0;
+    filter.reset();
+}
+
+void PenPipeline::set_predictor(const PenPredictor& predictor0)
+{
+    predictor = predictor0;
+    predictor.reset();
+}
+
+void PenPipeline::stop()
+{
+    quit = 1;
+}
+
+const PenTransform* PenPipeline::swap_transform(const PenTransform* next)
+{
+    pthread_mutex_lock(&swap_lock);
+
+    const PenTransform* old =
+        __atomic_exchange_n(&transform, next, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // grace period : run() is waiting for events, or went through a
+    // quiescent state since the swap
+    unsigned long count = __atomic_load_n(&qs_count, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&qs_online, __ATOMIC_SEQ_CST) &&
+           __atomic_load_n(&qs_count, __ATOMIC_ACQUIRE) == count) {
+        struct timespec ts = { 0, 20000 };
+        nanosleep(&ts, NULL);
+    }
+
+    pthread_mutex_unlock(&swap_lock);
+
+    return old;
+}
+
+void PenPipeline::resync(const struct input_event& syn)
+{
+    struct input_absinfo abs;
+    unsigned char keys[KEY_MAX/8 + 1];
+
+    // not an evdev node (bench) : keep the last position
+    if (ioctl(in_fd, EVIOCGABS(ABS_X), &abs) == 0) {
+        raw_x = abs.value;
+        moved = true;
+    }
+    if (ioctl(in_fd, EVIOCGABS(ABS_Y), &abs) == 0) {
+        raw_y = abs.value;
+        moved = true;
+    }
+
+    // a lost release would leave the button down : release it now
+    memset(keys, 0, sizeof(keys));
+    if (ioctl(in_fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+        static const int buttons[] = { BTN_TOUCH, BTN_LEFT };
+        bool sent[] = { touch_down, left_down };
+
+        for (int i = 0; i < 2; i++) {
+            if (!sent[i] || (keys[buttons[i] / 8] & (1 << (buttons[i] % 8))))
+                continue;
+            frame[nframe] = syn;
+            frame[nframe].type = EV_KEY;
+            frame[nframe].code = buttons[i];
+            frame[nframe++].value = 0;
+            lifted = true;
+        }
+    }
+
+    // positions were lost
+    filter.reset();
+    predictor.reset();
+}
+
+bool PenPipeline::flush_frame(const struct input_event& syn)
+{
+    if (moved) {
+        int x, y;
+
+        // one snapshot for the whole report
+        const PenTransform* t = __atomic_load_n(&transform, __ATOMIC_ACQUIRE);
+        t->apply(raw_x, raw_y, x, y);
+
+        double time = syn.time.tv_sec + syn.time.tv_usec / 1000000.0;
+        if (trace)
+            fprintf(trace, "%.6f %d %d\n", time, x, y);
+
+        correct(*t, time, x, y);
+
+        frame[nframe] = syn;
+        frame[nframe].type = EV_ABS;
+        frame[nframe].code = ABS_X;
+        frame[nframe++].value = x;
+        frame[nframe] = syn;
+        frame[nframe].type = EV_ABS;
+        frame[nframe].code = ABS_Y;
+        frame[nframe++].value = y;
+        moved = false;
+    }
+
+    // nothing to report
+    if (nframe == 0)
+        return SUCCESS;
+
+    frame[nframe++] = syn;
+
+    // next stroke : no history
+    if (lifted) {
+        filter.reset();
+        predictor.reset();
+        if (trace)
+            fputs("up\n", trace);
+        lifted = false;
+    }
+
+    // button state as the clients will see it
+    for (int i = 0; i < nframe; i++)
+        if (frame[i].type == EV_KEY && frame[i].code == BTN_TOUCH)
+            touch_down = frame[i].value != 0;
+        else if (frame[i].type == EV_KEY && frame[i].code == BTN_LEFT)
+            left_down = frame[i].value != 0;
+
+    const char* p = (const char*) frame;
+    size_t len = nframe * sizeof(struct input_event);
+    nframe = 0;
+
+    while (len > 0) {
+        ssize_t n = write(out_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "ERROR: unable to write events : %s\n",
+                            strerror(errno));
+            return FAILURE;
+        }
+        p += n;
+        len -= n;
+    }
+
+    reports++;
+
+    return SUCCESS;
+}
+
+void PenPipeline::correct(const PenTransform& t, double time, int& x, int& y)
+{
+    if (filter.get_kind() == PenFilter::NONE && !predictor.is_active())
+        return;
+
+    double fx, fy, px, py;
+    filter.apply(time, x, y, fx, fy);
+    predictor.apply(time, fx, fy, px, py);
+
+    x = std::max(0, std::min(t.get_width() - 1, (int) floor(px + 0.5)));
+    y = std::max(0, std::min(t.get_height() - 1, (int) floor(py + 0.5)));
+}
+
+bool PenPipeline::process(const struct input_event& ev)
+{
+    // report damaged by a kernel buffer overrun : skip it
+    if (dropping) {
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            dropping = false;
+            resync(ev);
+            if (nframe > 0)
+                return flush_frame(ev);
+        }
+        return SUCCESS;
+    }
+
+    switch (ev.type) {
+    case EV_SYN:
+        if (ev.code == SYN_REPORT)
+            return flush_frame(ev);
+        if (ev.code == SYN_DROPPED) {
+            dropped += nframe + 1;
+            nframe = 0;
+            dropping = true;
+        }
+        break;
+
+    case EV_ABS:
+        // positions are written with the SYN_REPORT
+        if (ev.code == ABS_X) {
+            raw_x = ev.value;
+            moved = true;
+        } else if (ev.code == ABS_Y) {
+            raw_y = ev.value;
+            moved = true;
+        }
+        break;
+
+    case EV_MSC:
+        break;
+
+    case EV_KEY:
+        if ((ev.code == BTN_TOUCH || ev.code == BTN_LEFT) && ev.value == 0)
+            lifted = true;
+        // fall through
+
+    default:
+        // room for ABS_X, ABS_Y and SYN_REPORT
+        if (nframe < PIPELINE_FRAME - 3)
+            frame[nframe++] = ev;
+        else
+            dropped++;
+    }
+
+    return SUCCESS;
+}
+
+bool PenPipeline::run()
+{
+    bool ok = run_loop();
+
+    // swap_transform() must not wait for us any more
+    set_online(0);
+
+    return ok;
+}
+
+bool PenPipeline::run_loop()
+{
+    struct epoll_event e;
+
+    quit = 0;
+
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+
+    if ( (epoll_fd = epoll_create(1)) < 0 ) {
+        fprintf(stderr, "ERROR: epoll : %s\n", strerror(errno));
+        return FAILURE;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.events = EPOLLIN;
+    e.data.fd = in_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in_fd, &e) != 0) {
+        fprintf(stderr, "ERROR: epoll : %s\n", strerror(errno));
+        return FAILURE;
+    }
+
+    while (!quit) {
+        // no snapshot held while waiting
+        set_online(0);
+        int n = epoll_wait(epoll_fd, &e, 1, -1);
+        set_online(1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: epoll : %s\n", strerror(errno));
+            return FAILURE;
+        }
+
+        // everything available, a batch at a time
+        for (;; quiescent()) {
+            struct input_event buf[PIPELINE_BATCH];
+            ssize_t len = read(in_fd, buf, sizeof(buf));
+
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && errno == EAGAIN)
+                break;
+            if (len < 0) {
+                fprintf(stderr, "ERROR: unable to read events : %s\n",
+                                strerror(errno));
+                return FAILURE;
+            }
+
+            // end of input (bench)
+            if (len == 0)
+                return SUCCESS;
+
+            if (len % sizeof(struct input_event) != 0) {
+                fprintf(stderr, "ERROR: partial input event.\n");
+                return FAILURE;
+            }
+
+            for (unsigned i = 0; i < len / sizeof(struct input_event); i++)
+                if (!process(buf[i]))
+                    return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+///
+/// benchmark
+///
+
+/// synthetic reports, written by the generator thread
+struct BenchGenerator {
+    int      fd;
+    unsigned n;
+    int      rate;      // reports/s, 0 : as fast as possible
+};
+
+/// corrected reports, read by the consumer thread
+struct BenchConsumer {
+    int      fd;
+    unsigned n;
+    double*  latency;   // n slots, in us
+    unsigned count;
+};
+
+/// raw position of the i-th synthetic report : spread over the raw range
+static void bench_point(unsigned i, int& X, int& Y)
+{
+    X = (int) ((i * 7919u) % (PIPELINE_BENCH_RAW + 1));
+    Y = (int) ((i * 104729u) % (PIPELINE_BENCH_RAW + 1));
+}
+
+static void* bench_generate(void* arg)
+{
+    BenchGenerator* gen = (BenchGenerator*) arg;
+    struct input_event evs[3];
+    struct timespec next, ts;
+
+    memset(evs, 0, sizeof(evs));
+    evs[0].type = EV_ABS;
+    evs[0].code = ABS_X;
+    evs[1].type = EV_ABS;
+    evs[1].code = ABS_Y;
+    evs[2].type = EV_SYN;
+    evs[2].code = SYN_REPORT;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (unsigned i = 0; i < gen->n; i++) {
+        bench_point(i, evs[0].value, evs[1].value);
+
+        // send time, for the latency
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (int k = 0; k < 3; k++) {
+            evs[k].time.tv_sec = ts.tv_sec;
+            evs[k].time.tv_usec = ts.tv_nsec / 1000;
+        }
+
+        if (write(gen->fd, evs, sizeof(evs)) != (ssize_t) sizeof(evs))
+            break;
+
+        if (gen->rate) {
+            next.tv_nsec += 1000000000L / gen->rate;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    close(gen->fd);
+
+    return NULL;
+}
+
+static void* bench_consume(void* arg)
+{
+    BenchConsumer* con = (BenchConsumer*) arg;
+    struct input_event buf[PIPELINE_BATCH];
+    struct timespec ts;
+    ssize_t len;
+
+    while ((len = read(con->fd, buf, sizeof(buf))) > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        for (unsigned i = 0; i < len / sizeof(struct input_event); i++) {
+            if (buf[i].type != EV_SYN || con->count >= con->n)
+                continue;
+            con->latency[con->count++] =
+                (ts.tv_sec - buf[i].time.tv_sec) * 1000000.0 +
+                ts.tv_nsec / 1000.0 - buf[i].time.tv_usec;
+        }
+    }
+
+    return NULL;
+}
+
+/// one run through pipes, returns the elapsed time in ms, < 0 on error
+static double bench_run(const PenTransform& transform,
+                        const PenFilter& filter,
+                        const PenPredictor& predictor, unsigned n, int rate,
+                        std::vector<double>& latency, unsigned& count)
+{
+    int in[2], out[2];
+    pthread_t gen_thread, con_thread;
+
+    if (pipe(in) != 0)
+        return -1;
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    BenchGenerator gen = { in[1], n, rate };
+    BenchConsumer con = { out[0], n, &latency[0], 0 };
+
+    pthread_create(&con_thread, NULL, bench_consume, &con);
+    pthread_create(&gen_thread, NULL, bench_generate, &gen);
+
+    PenPipeline pipeline(&transform);
+    pipeline.set_fds(in[0], out[1]);
+    pipeline.set_filter(filter);
+    pipeline.set_predictor(predictor);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bool ok = pipeline.run();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    // unblock the generator on error, end the consumer
+    close(in[0]);
+    close(out[1]);
+    pthread_join(gen_thread, NULL);
+    pthread_join(con_thread, NULL);
+    close(out[0]);
+
+    count = con.count;
+    if (!ok || pipeline.get_reports() != n)
+        return -1;
+
+    return (t1.tv_sec - t0.tv_sec) * 1000.0 +
+           (t1.tv_nsec - t0.tv_nsec) / 1000000.0;
+}
+
+bool PenPipeline::bench(const PenTransform& transform,
+                        const PenFilter& filter,
+                        const PenPredictor& predictor, unsigned n, int rate)
+{
+    std::vector<double> latency(n ? n : 1);
+    unsigned count;
+    char name[64];
+    int len;
+
+    if (transform.get_cells())
+        len = snprintf(name, sizeof(name), "LUT %dx%d",
+                       transform.get_cells(), transform.get_cells());
+    else
+        len = snprintf(name, sizeof(name), "exact");
+    if (filter.get_kind() != PenFilter::NONE) {
+        name[len++] = '+';
+        filter.describe(name + len, sizeof(name) - len);
+        len = strlen(name);
+    }
+    if (predictor.is_active() && len + 1 < (int) sizeof(name)) {
+        name[len++] = '+';
+        predictor.describe(name + len, sizeof(name) - len);
+    }
+
+    // LUT accuracy, on the same positions
+    if (transform.get_cells()) {
+        int err = 0;
+        for (unsigned i = 0; i < n; i++) {
+            int X, Y, x0, y0, x1, y1;
+            bench_point(i, X, Y);
+            transform.apply_exact(X, Y, x0, y0);
+            transform.apply_lut(X, Y, x1, y1);
+            err = std::max(err, std::max(abs(x1 - x0), abs(y1 - y0)));
+        }
+        printf("%-20s max error %d px\n", name, err);
+    }
+
+    // throughput
+    double t = bench_run(transform, filter, predictor, n, 0, latency,
+                         count);
+    if (t < 0) {
+        fprintf(stderr, "ERROR: benchmark run failed.\n");
+        return FAILURE;
+    }
+    printf("%-20s %u reports in %.3f ms : %.0f reports/s\n",
+           name, n, t, t > 0 ? n * 1000.0 / t : 0);
+
+    // latency, at a pen-like rate
+    unsigned paced = std::min(n, (unsigned) rate * 2);
+    if (rate <= 0 || paced == 0)
+        return SUCCESS;
+
+    if (bench_run(transform, filter, predictor, paced, rate, latency,
+                  count) < 0 || count == 0) {
+        fprintf(stderr, "ERROR: benchmark run failed.\n");
+        return FAILURE;
+    }
+
+    double sum = 0;
+    for (unsigned i = 0; i < count; i++)
+        sum += latency[i];
+    std::sort(latency.begin(), latency.begin() + count);
+
+    printf("%-20s latency at %d reports/s : mean %.1f us, p99 %.1f us, "
+           "max %.1f us\n", name, rate, sum / count,
+           latency[(count - 1) * 99 / 100], latency[count - 1]);
+
+    return SUCCESS;
+}
+
+///
+/// stress test of swap_transform
+///
+
+// generation g maps (X, Y) to (X + g, Y + g)
+#define STRESS_SCALE 1000
+
+// LUT size of the swapped transforms
+#define STRESS_CELLS 8
+
+/// swaps transforms until told to stop
+struct StressSwapper {
+    PenPipeline*  pipeline;
+    PenTransform* current;
+    volatile bool done;
+    unsigned      swaps;
+};
+
+/// checks the corrected reports
+struct StressChecker {
+    int           fd;
+    unsigned      reports;
+    unsigned      bad;      // x and y from different generations
+    unsigned      stale;    // generation going backwards, or bogus
+    unsigned      last;     // generation of the last report
+    StressSwapper* swapper;
+};
+
+static void stress_calibration(unsigned g, EbeamCalibration& cal)
+{
+    memset(&cal, 0, sizeof(cal));
+    cal.H[0] = cal.H[4] = cal.H[8] = STRESS_SCALE;
+    cal.H[2] = cal.H[5] = (long long) g * STRESS_SCALE;
+}
+
+static void* stress_swap(void* arg)
+{
+    StressSwapper* sw = (StressSwapper*) arg;
+    EbeamCalibration cal;
+
+    while (!sw->done) {
+        PenTransform* next = new PenTransform;
+        stress_calibration(sw->swaps + 1, cal);
+        next->set_calibration(cal, INT_MAX, INT_MAX);
+
+        // the LUT lives on the heap too : freed memory is reused soon
+        // (cells dividing the range : the LUT is exact for a translation)
+        next->build_lut(0, PIPELINE_BENCH_RAW + 1, 0, PIPELINE_BENCH_RAW + 1,
+                        STRESS_CELLS);
+
+        const PenTransform* old = sw->pipeline->swap_transform(next);
+        sw->current = next;
+        __atomic_add_fetch(&sw->swaps, 1, __ATOMIC_RELEASE);
+
+        // poison before freeing : a late reader would see garbage
+        PenTransform* dead = (PenTransform*) old;
+        stress_calibration(0x100000, cal);
+        cal.H[5] = -cal.H[5];
+        dead->set_calibration(cal, INT_MAX, INT_MAX);
+        dead->build_lut(0, PIPELINE_BENCH_RAW + 1, 0, PIPELINE_BENCH_RAW + 1,
+                        STRESS_CELLS);
+        delete dead;
+    }
+
+    return NULL;
+}
+
+static void* stress_check(void* arg)
+{
+    StressChecker* ck = (StressChecker*) arg;
+    struct input_event buf[PIPELINE_BATCH];
+    int x = 0, y = 0;
+    ssize_t len;
+
+    while ((len = read(ck->fd, buf, sizeof(buf))) > 0) {
+        for (unsigned i = 0; i < len / sizeof(struct input_event); i++) {
+            const struct input_event& ev = buf[i];
+
+            if (ev.type == EV_ABS && ev.code == ABS_X)
+                x = ev.value;
+            else if (ev.type == EV_ABS && ev.code == ABS_Y)
+                y = ev.value;
+            else if (ev.type != EV_SYN)
+                continue;
+            else {
+                int X, Y;
+                bench_point(ck->reports++, X, Y);
+
+                int gx = x - X;
+                int gy = y - Y;
+                unsigned swaps = __atomic_load_n(&ck->swapper->swaps,
+                                                 __ATOMIC_ACQUIRE);
+
+                if (gx != gy)
+                    ck->bad++;
+                else if (gx < (int) ck->last || gx > (int) swaps + 1)
+                    ck->stale++;
+                else
+                    ck->last = gx;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+bool PenPipeline::stress(unsigned n)
+{
+    int in[2], out[2];
+    pthread_t gen_thread, swap_thread, check_thread;
+    EbeamCalibration cal;
+
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        fprintf(stderr, "ERROR: pipe : %s\n", strerror(errno));
+        return FAILURE;
+    }
+
+    PenTransform* first = new PenTransform;
+    stress_calibration(0, cal);
+    first->set_calibration(cal, INT_MAX, INT_MAX);
+
+    PenPipeline pipeline(first);
+    pipeline.set_fds(in[0], out[1]);
+
+    StressSwapper sw = { &pipeline, first, false, 0 };
+    StressChecker ck = { out[0], 0, 0, 0, 0, &sw };
+    BenchGenerator gen = { in[1], n, 0 };
+
+    pthread_create(&check_thread, NULL, stress_check, &ck);
+    pthread_create(&swap_thread, NULL, stress_swap, &sw);
+    pthread_create(&gen_thread, NULL, bench_generate, &gen);
+
+    double t = now_ms();
+    bool ok = pipeline.run();
+    t = now_ms() - t;
+
+    sw.done = true;
+    pthread_join(swap_thread, NULL);
+    close(in[0]);
+    close(out[1]);
+    pthread_join(gen_thread, NULL);
+    pthread_join(check_thread, NULL);
+    close(out[0]);
+    delete sw.current;
+
+    printf("%u reports, %u swaps in %.3f ms : %u inconsistent, "
+           "%u stale\n", ck.reports, sw.swaps, t, ck.bad, ck.stale);
+
+    return ok && ck.reports == n && ck.bad == 0 && ck.stale == 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _pipeline_hpp
+#define _pipeline_hpp
+
+#include "transform.hpp"
+#include "filter.hpp"
+#include "predict.hpp"
+
+#include <linux/input.h>
+#include <pthread.h>
+#include <stdio.h>
+
+/*
+ * Userspace calibration, for kernels without the ebeam driver calibration
+ * attributes : raw events are read from the (grabbed) evdev node of the
+ * device, positions are transformed (see transform.hpp), and the corrected
+ * events are emitted by a uinput device covering the whole screen.
+ *
+ * Events are read in batches with epoll. Positions are buffered until the
+ * SYN_REPORT closing their report, which is then transformed once and
+ * written with a single write(). All buffers are fixed size : no
+ * allocation once running.
+ *
+ * The transform is an immutable snapshot, replaced while running with
+ * swap_transform() (new calibration, reload) : RCU style, the event loop
+ * reads the snapshot pointer once per report, without any lock, so both
+ * coordinates of a report always come from the same calibration. The old
+ * snapshot is handed back once the loop went through a quiescent state
+ * (end of a batch, or waiting for events) : QSBR, nothing to do on the
+ * read side but bump a counter.
+ *
+ * Corrected positions may be smoothed (see filter.hpp) and extrapolated
+ * (see predict.hpp) before being written; both are reset when the pen is
+ * lifted. They can also be recorded, before smoothing, as a pen trace.
+ */
+
+// events of one report, at most
+#define PIPELINE_FRAME 64
+
+// events read at once
+#define PIPELINE_BATCH 64
+
+// raw range of the synthetic reports of bench() : 0..PIPELINE_BENCH_RAW
+#define PIPELINE_BENCH_RAW 4095
+
+/// Class for transforming the events of a device through uinput
+class PenPipeline
+{
+public:
+    // transform0 may be NULL until run()
+    PenPipeline(const PenTransform* transform0);
+    ~PenPipeline();
+
+    // raw events : open and grab an evdev node
+    bool open_input(const char* node);
+
+    // corrected events : create a uinput device
+    bool open_output(const char* name);
+
+    // or already open file descriptors, left open
+    void set_fds(int in, int out);
+
+    // raw range of the input axes, as reported by the evdev node
+    void get_raw_range(int& min_x, int& max_x, int& min_y, int& max_y) const;
+
+    // smoothing and prediction of the corrected positions, before run()
+    void set_filter(const PenFilter& filter0);
+    void set_predictor(const PenPredictor& predictor0);
+
+    // record the corrected positions to trace (see predict.hpp), left open
+    void set_trace(FILE* trace0) { trace = trace0; }
+
+    // event loop, until end of input, error or stop()
+    bool run();
+
+    // publish a new transform, from any thread
+    // Returns the previous one, no longer used by run() : the caller
+    // can delete it
+    const PenTransform* swap_transform(const PenTransform* next);
+
+    // make run() return, from a signal handler
+    static void stop();
+
+    // reports written, events dropped (overflow, SYN_DROPPED)
+    unsigned long get_reports() const { return reports; }
+    unsigned long get_dropped() const { return dropped; }
+
+    // throughput and latency of n synthetic reports through pipes,
+    // as fast as possible then at rate reports/s
+    static bool bench(const PenTransform& transform, const PenFilter& filter,
+                      const PenPredictor& predictor, unsigned n, int rate);
+
+    // n synthetic reports while another thread keeps swapping transforms,
+    // check that every report used a single, live transform
+    static bool stress(unsigned n);
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    // body of run()
+    bool run_loop();
+
+    // dispatch one raw event
+    bool process(const struct input_event& ev);
+
+    // transform and write the current report
+    bool flush_frame(const struct input_event& syn);
+
+    // smoothing and prediction of position (x, y) at time t
+    void correct(const PenTransform& t, double time, int& x, int& y);
+
+    // after SYN_DROPPED : current position and buttons from the evdev
+    // node, a release lost in the drop is added to the frame
+    void resync(const struct input_event& syn);
+
+    // QSBR : the event loop holds no snapshot. Full fences as liburcu :
+    // snapshot loads never move across the counter or the online flag
+    void quiescent() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&qs_count, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    void set_online(int online) {
+        if (!online)
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        __atomic_store_n(&qs_online, online, __ATOMIC_SEQ_CST);
+        if (online)
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    const PenTransform* transform;  // current snapshot, atomic
+    unsigned long qs_count;         // quiescent states of run()
+    int qs_online;                  // run() may hold a snapshot
+    pthread_mutex_t swap_lock;      // one writer at a time
+
+    int in_fd;
+    int out_fd;
+    int epoll_fd;
+    bool own_in;            // opened by us : grabbed evdev node
+    bool own_out;           // opened by us : uinput device
+
+    PenFilter filter;
+    PenPredictor predictor;
+    FILE* trace;
+    bool lifted;            // pen up in the current report
+
+    // report being built
+    struct input_event frame[PIPELINE_FRAME];
+    int nframe;
+    int raw_x;
+    int raw_y;
+    bool moved;
+    bool dropping;          // until the SYN_REPORT after SYN_DROPPED
+    bool touch_down;        // BTN_TOUCH, BTN_LEFT as last written
+    bool left_down;
+
+    struct input_absinfo abs_x;
+    struct input_absinfo abs_y;
+
+    unsigned long reports;
+    unsigned long dropped;
+};
+
+#endif
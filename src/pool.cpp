@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "pool.hpp"
+
+#include <stdio.h>
+#include <unistd.h>
+
+WorkPool::WorkPool(unsigned workers)
+  : dealt(0),
+    steals(0)
+{
+    if (workers == 0)
+        workers = cpus();
+
+    for (unsigned i = 0; i < workers; i++) {
+        Queue* queue = new Queue;
+        pthread_mutex_init(&queue->lock, NULL);
+        queues.push_back(queue);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    for (unsigned i = 0; i < queues.size(); i++) {
+        pthread_mutex_destroy(&queues[i]->lock);
+        delete queues[i];
+    }
+}
+
+unsigned WorkPool::cpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+void WorkPool::add(void (*run)(void* arg, unsigned worker), void* arg)
+{
+    PoolTask task;
+
+    task.run = run;
+    task.arg = arg;
+    queues[dealt++ % queues.size()]->tasks.push_back(task);
+}
+
+bool WorkPool::next(unsigned self, PoolTask& task, unsigned long& stolen)
+{
+    const unsigned n = queues.size();
+
+    // own queue, newest first
+    Queue* own = queues[self];
+    pthread_mutex_lock(&own->lock);
+    bool found = !own->tasks.empty();
+    if (found) {
+        task = own->tasks.back();
+        own->tasks.pop_back();
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    // others, oldest first
+    for (unsigned i = 1; !found && i < n; i++) {
+        Queue* victim = queues[(self + i) % n];
+        pthread_mutex_lock(&victim->lock);
+        found = !victim->tasks.empty();
+        if (found) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            stolen++;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return found;
+}
+
+void* WorkPool::worker_main(void* arg)
+{
+    Worker* worker = (Worker*) arg;
+    PoolTask task;
+
+    while (worker->pool->next(worker->index, task, worker->steals))
+        task.run(task.arg, worker->index);
+
+    return NULL;
+}
+
+void WorkPool::run()
+{
+    std::vector<Worker> workers(queues.size());
+
+    for (unsigned i = 0; i < workers.size(); i++) {
+        workers[i].pool = this;
+        workers[i].index = i;
+        workers[i].steals = 0;
+    }
+
+    // worker 0 is us
+    unsigned started = 1;
+    for (; started < workers.size(); started++)
+        if (pthread_create(&workers[started].thread, NULL, worker_main,
+                           &workers[started]) != 0) {
+            // the others steal its tasks
+            fprintf(stderr, "Warning: unable to start a thread, "
+                            "running on %u.\n", started);
+            break;
+        }
+
+    worker_main(&workers[0]);
+
+    for (unsigned i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    steals = 0;
+    for (unsigned i = 0; i < workers.size(); i++)
+        steals += workers[i].steals;
+
+    dealt = 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _pool_hpp
+#define _pool_hpp
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+/*
+ * Work-stealing thread pool, for batch computations (see montecarlo.hpp) :
+ * tasks are dealt round robin to one queue per worker before run(); each
+ * worker takes from the back of its own queue, and when it runs dry,
+ * steals from the front of the others. No task is added while running,
+ * so the pool is done when every queue is empty.
+ */
+
+/// a unit of work : run(arg, index of the worker running it)
+struct PoolTask {
+    void (*run)(void* arg, unsigned worker);
+    void* arg;
+};
+
+/// Class for running tasks on all cores
+class WorkPool
+{
+public:
+    // workers = 0 : one per online cpu
+    WorkPool(unsigned workers = 0);
+    ~WorkPool();
+
+    unsigned get_workers() const { return queues.size(); }
+
+    // queue a task, before run()
+    void add(void (*run)(void* arg, unsigned worker), void* arg);
+
+    // run all queued tasks, the calling thread being worker 0
+    // Returns when they are all done
+    void run();
+
+    // tasks taken from another worker's queue by the last run()
+    unsigned long get_steals() const { return steals; }
+
+    // number of online cpus
+    static unsigned cpus();
+
+private:
+    struct Queue {
+        pthread_mutex_t lock;
+        std::deque<PoolTask> tasks;
+    };
+
+    struct Worker {
+        WorkPool* pool;
+        unsigned index;
+        unsigned long steals;
+        pthread_t thread;
+    };
+
+    static void* worker_main(void* arg);
+    bool next(unsigned self, PoolTask& task, unsigned long& stolen);
+
+    std::vector<Queue*> queues;
+    unsigned dealt;
+    unsigned long steals;
+};
+
+#endif
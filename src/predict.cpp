@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "predict.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+/// one position of a trace
+struct TracePoint {
+    double t;
+    double x;
+    double y;
+};
+
+PenPredictor::PenPredictor()
+  : model(LINEAR),
+    ahead(0),
+    n(4),
+    count(0)
+{
+    memset(hist_t, 0, sizeof(hist_t));
+    memset(hist_x, 0, sizeof(hist_x));
+    memset(hist_y, 0, sizeof(hist_y));
+}
+
+bool PenPredictor::parse(const char* spec)
+{
+    char name[16];
+    double ms = 0;
+    int m = 0;
+
+    name[0] = '\0';
+    int nargs = sscanf(spec, "%lf:%15[a-z],%d", &ms, name, &m);
+
+    if (nargs < 1 || ms < 0 || ms > 1000) {
+        fprintf(stderr, "ERROR: bad prediction '%s' : 0 to 1000 ms.\n",
+                        spec);
+        return FAILURE;
+    }
+
+    if (nargs >= 2) {
+        if (strcmp(name, "linear") == 0)
+            model = LINEAR;
+        else if (strcmp(name, "quadratic") == 0)
+            model = QUADRATIC;
+        else {
+            fprintf(stderr, "ERROR: unknown prediction model '%s'.\n", name);
+            return FAILURE;
+        }
+    }
+
+    if (nargs == 3) {
+        if (m < 2 || m > PREDICT_HISTORY) {
+            fprintf(stderr, "ERROR: prediction fit needs 2 to %d "
+                            "positions.\n", PREDICT_HISTORY);
+            return FAILURE;
+        }
+        n = m;
+    }
+
+    ahead = ms / 1000;
+    reset();
+
+    return SUCCESS;
+}
+
+void PenPredictor::describe(char* buf, unsigned len) const
+{
+    snprintf(buf, len, "%g ms %s,%d", ahead * 1000,
+             model == LINEAR ? "linear" : "quadratic", n);
+}
+
+double PenPredictor::extrapolate(const double* tau, const double* v, int m,
+                                 int order) const
+{
+    double s[5] = { 0, 0, 0, 0, 0 };
+    double b[3] = { 0, 0, 0 };
+
+    // normal equations of the least squares fit, in tau
+    for (int i = 0; i < m; i++) {
+        double p = 1;
+        for (int k = 0; k <= 2 * order; k++) {
+            if (k <= order)
+                b[k] += v[i] * p;
+            s[k] += p;
+            p *= tau[i];
+        }
+    }
+
+    if (order == 1) {
+        double det = s[0] * s[2] - s[1] * s[1];
+        if (det == 0)
+            return v[m - 1];
+        double c0 = (b[0] * s[2] - s[1] * b[1]) / det;
+        double c1 = (s[0] * b[1] - s[1] * b[0]) / det;
+        return c0 + c1 * ahead;
+    }
+
+    // order 2 : Cramer's rule on the 3x3 system
+    double det = s[0] * (s[2] * s[4] - s[3] * s[3]) -
+                 s[1] * (s[1] * s[4] - s[3] * s[2]) +
+                 s[2] * (s[1] * s[3] - s[2] * s[2]);
+    if (det == 0)
+        return v[m - 1];
+
+    double c0 = (b[0] * (s[2] * s[4] - s[3] * s[3]) -
+                 s[1] * (b[1] * s[4] - s[3] * b[2]) +
+                 s[2] * (b[1] * s[3] - s[2] * b[2])) / det;
+    double c1 = (s[0] * (b[1] * s[4] - s[3] * b[2]) -
+                 b[0] * (s[1] * s[4] - s[3] * s[2]) +
+                 s[2] * (s[1] * b[2] - b[1] * s[2])) / det;
+    double c2 = (s[0] * (s[2] * b[2] - b[1] * s[3]) -
+                 s[1] * (s[1] * b[2] - b[1] * s[2]) +
+                 b[0] * (s[1] * s[3] - s[2] * s[2])) / det;
+
+    return c0 + (c1 + c2 * ahead) * ahead;
+}
+
+void PenPredictor::apply(double t, double x, double y,
+                         double& px, double& py)
+{
+    px = x;
+    py = y;
+
+    if (!is_active())
+        return;
+
+    // new stroke after a gap
+    if (count > 0) {
+        double te = t - hist_t[(count - 1) % PREDICT_HISTORY];
+        if (te <= 0 || te > FILTER_GAP)
+            count = 0;
+    }
+
+    hist_t[count % PREDICT_HISTORY] = t;
+    hist_x[count % PREDICT_HISTORY] = x;
+    hist_y[count % PREDICT_HISTORY] = y;
+    count++;
+
+    int m = count < (unsigned) n ? count : n;
+    int order = std::min(model == LINEAR ? 1 : 2, m - 1);
+    if (order == 0)
+        return;
+
+    // oldest first, time relative to the last position
+    double tau[PREDICT_HISTORY], vx[PREDICT_HISTORY], vy[PREDICT_HISTORY];
+    for (int i = 0; i < m; i++) {
+        unsigned k = (count - m + i) % PREDICT_HISTORY;
+        tau[i] = hist_t[k] - t;
+        vx[i] = hist_x[k];
+        vy[i] = hist_y[k];
+    }
+
+    px = extrapolate(tau, vx, m, order);
+    py = extrapolate(tau, vy, m, order);
+
+    // no flying ink : bound the extrapolated move
+    double dx = px - x;
+    double dy = py - y;
+    double d = sqrt(dx * dx + dy * dy);
+    double max = PREDICT_MAX_SPEED * ahead;
+    if (d > max) {
+        px = x + dx * max / d;
+        py = y + dy * max / d;
+    }
+}
+
+///
+/// replay of recorded traces
+///
+
+/// true position at time t, interpolated in the stroke
+static bool trace_at(const std::vector<TracePoint>& stroke, unsigned from,
+                     double t, double& x, double& y)
+{
+    for (unsigned i = from; i + 1 < stroke.size(); i++) {
+        const TracePoint& a = stroke[i];
+        const TracePoint& b = stroke[i + 1];
+        if (t < a.t || t > b.t)
+            continue;
+        double u = b.t > a.t ? (t - a.t) / (b.t - a.t) : 0;
+        x = a.x + u * (b.x - a.x);
+        y = a.y + u * (b.y - a.y);
+        return true;
+    }
+
+    return false;
+}
+
+/// errors of one stroke, with and without prediction
+static void replay_stroke(const std::vector<TracePoint>& stroke,
+                          PenFilter& filter, PenPredictor& predictor,
+                          double ahead, std::vector<double>& err,
+                          std::vector<double>& lag)
+{
+    filter.reset();
+    predictor.reset();
+
+    for (unsigned i = 0; i < stroke.size(); i++) {
+        const TracePoint& p = stroke[i];
+        double fx, fy, px, py, x, y;
+
+        filter.apply(p.t, p.x, p.y, fx, fy);
+        predictor.apply(p.t, fx, fy, px, py);
+
+        // where the pen is by the time this position is drawn
+        if (!trace_at(stroke, i, p.t + ahead, x, y))
+            continue;
+
+        err.push_back(sqrt((px - x) * (px - x) + (py - y) * (py - y)));
+        lag.push_back(sqrt((fx - x) * (fx - x) + (fy - y) * (fy - y)));
+    }
+}
+
+/// mean, 95th percentile and max of errors
+static void replay_report(const char* name, std::vector<double>& err)
+{
+    double sum = 0;
+
+    for (unsigned i = 0; i < err.size(); i++)
+        sum += err[i];
+    std::sort(err.begin(), err.end());
+
+    printf("%-40s error mean %.2f px, p95 %.2f px, max %.2f px\n", name,
+           sum / err.size(), err[(err.size() - 1) * 95 / 100], err.back());
+}
+
+bool PenPredictor::replay(const char* trace, const PenFilter& filter) const
+{
+    if (!is_active()) {
+        fprintf(stderr, "ERROR: no prediction to replay.\n");
+        return FAILURE;
+    }
+
+    FILE* fp = fopen(trace, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s : %s\n", trace,
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    PenFilter f = filter;
+    PenPredictor p = *this;
+    std::vector<TracePoint> stroke;
+    std::vector<double> err, lag;
+    unsigned positions = 0, strokes = 0;
+    double duration = 0;
+    char line[128];
+    int lineno = 0;
+
+    for (bool end = false; !end; ) {
+        TracePoint pt;
+
+        end = fgets(line, sizeof(line), fp) == NULL;
+        lineno++;
+
+        if (!end && (line[0] == '#' || line[0] == '\n'))
+            continue;
+
+        if (!end && sscanf(line, "%lf %lf %lf", &pt.t, &pt.x, &pt.y) == 3) {
+            // a long gap ends the stroke too
+            if (!stroke.empty() && (pt.t <= stroke.back().t ||
+                                    pt.t - stroke.back().t > FILTER_GAP)) {
+                duration += stroke.back().t - stroke.front().t;
+                replay_stroke(stroke, f, p, ahead, err, lag);
+                strokes++;
+                stroke.clear();
+            }
+            stroke.push_back(pt);
+            positions++;
+            continue;
+        }
+
+        if (!end && strncmp(line, "up", 2) != 0) {
+            fprintf(stderr, "ERROR: %s:%d : bad trace line.\n", trace,
+                            lineno);
+            fclose(fp);
+            return FAILURE;
+        }
+
+        // pen up, or end of trace
+        if (!stroke.empty()) {
+            duration += stroke.back().t - stroke.front().t;
+            replay_stroke(stroke, f, p, ahead, err, lag);
+            strokes++;
+            stroke.clear();
+        }
+    }
+    fclose(fp);
+
+    if (err.empty()) {
+        fprintf(stderr, "ERROR: %s : no stroke long enough for %g ms.\n",
+                        trace, ahead * 1000);
+        return FAILURE;
+    }
+
+    char smooth[32], name[64];
+    filter.describe(smooth, sizeof(smooth));
+
+    printf("%s : %u positions, %u strokes, %.0f reports/s\n", trace,
+           positions, strokes,
+           duration > 0 ? (positions - strokes) / duration : 0.0);
+
+    // the pen has moved on by the time a position is drawn
+    snprintf(name, sizeof(name), "%s, no prediction", smooth);
+    replay_report(name, lag);
+
+    int len = snprintf(name, sizeof(name), "%s, predict ", smooth);
+    describe(name + len, sizeof(name) - len);
+    replay_report(name, err);
+
+    return SUCCESS;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _predict_hpp
+#define _predict_hpp
+
+#include "filter.hpp"
+
+/*
+ * Motion prediction : the ultrasonic sensor reports at a low rate, and the
+ * ink trails the pen tip. The position is extrapolated some ms ahead from
+ * the last calibrated (and smoothed) positions, with a least squares
+ * polynomial fit over the last n positions of the stroke :
+ *   - linear : velocity,
+ *   - quadratic : velocity and acceleration.
+ * The extrapolated move is bounded by PREDICT_MAX_SPEED.
+ *
+ * replay() quantifies the prediction error on pen traces recorded by
+ * ebeam_uinput --record : text, one "<time in s> <x> <y>" line per
+ * position, "up" at the end of each stroke.
+ *
+ * No allocation, fixed size state.
+ */
+
+// positions kept for the fit, at most
+#define PREDICT_HISTORY 8
+
+// fastest believable pen, in px/s
+#define PREDICT_MAX_SPEED 5000
+
+/// Class for extrapolating a pen position stream
+class PenPredictor
+{
+public:
+    enum Model { LINEAR, QUADRATIC };
+
+    PenPredictor();
+
+    // "<ms>[:linear|quadratic[,n]]", 0 ms : no prediction
+    bool parse(const char* spec);
+
+    bool is_active() const { return ahead > 0; }
+
+    // parameters, for reports
+    void describe(char* buf, unsigned len) const;
+
+    // forget the history : pen up, dropped events
+    void reset() { count = 0; }
+
+    // position (x, y) at time t in s, predicted position (px, py)
+    void apply(double t, double x, double y, double& px, double& py);
+
+    // prediction error on a recorded trace, after filter
+    bool replay(const char* trace, const PenFilter& filter) const;
+
+private:
+    double extrapolate(const double* tau, const double* v, int m,
+                       int order) const;
+
+    Model model;
+    double ahead;       // s
+    int n;              // positions used by the fit
+
+    // last positions, ring buffer
+    unsigned count;
+    double hist_t[PREDICT_HISTORY];
+    double hist_x[PREDICT_HISTORY];
+    double hist_y[PREDICT_HISTORY];
+};
+
+#endif
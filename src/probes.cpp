@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "probes.hpp"
+
+#ifdef HAVE_SYS_SDT_H
+
+// the tracer increments them while attached
+#define EBEAM_DEFINE_SEMAPHORE(name) \
+    unsigned short EBEAM_SEMAPHORE(name) \
+        __attribute__((section(".probes"))) = 0
+
+EBEAM_DEFINE_SEMAPHORE(find_devices);
+EBEAM_DEFINE_SEMAPHORE(device_found);
+EBEAM_DEFINE_SEMAPHORE(sysfs_read);
+EBEAM_DEFINE_SEMAPHORE(sysfs_write);
+EBEAM_DEFINE_SEMAPHORE(xi_property);
+EBEAM_DEFINE_SEMAPHORE(add_click);
+EBEAM_DEFINE_SEMAPHORE(find_H);
+EBEAM_DEFINE_SEMAPHORE(test_H);
+
+#endif
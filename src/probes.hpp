@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _probes_hpp
+#define _probes_hpp
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * USDT static probes (provider ebeam_tools), for bpftrace, perf or
+ * SystemTap on a production binary :
+ *
+ *   find_devices(ndevices, ncandidates, found, duration_us)
+ *   device_found(id, name, event, sysfs dir)
+ *   sysfs_read(dir, attribute, value, duration_ns, ok)
+ *   sysfs_write(dir, attribute, value string, duration_ns, ok)
+ *   xi_property(device id, property, nitems)
+ *   add_click(num, raw X, raw Y, screen x, screen y, accepted)
+ *   find_H(npoints, precision, duration_ns, ok)
+ *   test_H(npoints, duration_ns, ok)
+ *
+ * A probe is a nop until a tracer attaches; durations are only measured
+ * while its semaphore is set by the tracer. Without sys/sdt.h, the
+ * probes compile to nothing.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define EBEAM_SEMAPHORE(name) ebeam_tools_##name##_semaphore
+
+// set by the tracer while attached, see probes.cpp
+extern unsigned short EBEAM_SEMAPHORE(find_devices);
+extern unsigned short EBEAM_SEMAPHORE(device_found);
+extern unsigned short EBEAM_SEMAPHORE(sysfs_read);
+extern unsigned short EBEAM_SEMAPHORE(sysfs_write);
+extern unsigned short EBEAM_SEMAPHORE(xi_property);
+extern unsigned short EBEAM_SEMAPHORE(add_click);
+extern unsigned short EBEAM_SEMAPHORE(find_H);
+extern unsigned short EBEAM_SEMAPHORE(test_H);
+
+#define EBEAM_PROBE_ENABLED(name) __builtin_expect(EBEAM_SEMAPHORE(name), 0)
+
+#define EBEAM_PROBE3(name, a, b, c) \
+    STAP_PROBE3(ebeam_tools, name, a, b, c)
+#define EBEAM_PROBE4(name, a, b, c, d) \
+    STAP_PROBE4(ebeam_tools, name, a, b, c, d)
+#define EBEAM_PROBE5(name, a, b, c, d, e) \
+    STAP_PROBE5(ebeam_tools, name, a, b, c, d, e)
+#define EBEAM_PROBE6(name, a, b, c, d, e, f) \
+    STAP_PROBE6(ebeam_tools, name, a, b, c, d, e, f)
+
+#else
+
+#define EBEAM_PROBE_ENABLED(name) 0
+
+// arguments are not evaluated, only marked used
+#define EBEAM_PROBE3(name, a, b, c) \
+    do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); } while (0)
+#define EBEAM_PROBE4(name, a, b, c, d) \
+    do { EBEAM_PROBE3(name, a, b, c); (void) sizeof(d); } while (0)
+#define EBEAM_PROBE5(name, a, b, c, d, e) \
+    do { EBEAM_PROBE4(name, a, b, c, d); (void) sizeof(e); } while (0)
+#define EBEAM_PROBE6(name, a, b, c, d, e, f) \
+    do { EBEAM_PROBE5(name, a, b, c, d, e); (void) sizeof(f); } while (0)
+
+#endif
+
+/// start of a probed call, 0 when the probe is not attached
+#define EBEAM_PROBE_START(name) \
+    (EBEAM_PROBE_ENABLED(name) ? probe_ns() : 0)
+
+/// duration since EBEAM_PROBE_START, in ns
+#define EBEAM_PROBE_ELAPSED(start) ((start) ? probe_ns() - (start) : 0)
+
+/// monotonic time, in ns
+static inline int64_t probe_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
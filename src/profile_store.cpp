@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "profile_store.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+// compile time check of the on-disk layout
+typedef char profile_entry_size_check[sizeof(ProfileEntry) == 352 ? 1 : -1];
+typedef char profile_header_size_check[sizeof(ProfileHeader) == 24 ? 1 : -1];
+
+// index slots per distinct key, at least
+#define INDEX_LOAD 2
+
+/// static verbose
+bool ProfileStore::verbose = false;
+
+ProfileStore::ProfileStore(const char* path0)
+  : path(path0),
+    map(NULL),
+    map_len(0),
+    entries(NULL),
+    count(0),
+    own_entries(NULL),
+    index(NULL),
+    index_size(0),
+    file_dev(0),
+    file_ino(0),
+    file_mtime(0)
+{
+}
+
+ProfileStore::~ProfileStore()
+{
+    close();
+}
+
+void ProfileStore::close()
+{
+    if (map)
+        munmap(map, map_len);
+    free(own_entries);
+
+    map = NULL;
+    map_len = 0;
+    entries = NULL;
+    count = 0;
+    own_entries = NULL;
+    index = NULL;
+    index_size = 0;
+    file_dev = 0;
+    file_ino = 0;
+    file_mtime = 0;
+}
+
+bool ProfileStore::open()
+{
+    struct stat st;
+    int fd;
+
+    close();
+
+    if ( (fd = ::open(path, O_RDONLY)) < 0 ) {
+        if (errno == ENOENT) {
+            if (verbose)
+                fprintf(stderr, "Profile store %s is empty.\n", path);
+            return true;
+        }
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", path);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < PROFILE_HEADER_V2) {
+        fprintf(stderr, "ERROR: bad profile store (truncated) %s\n", path);
+        ::close(fd);
+        return false;
+    }
+
+    file_dev = st.st_dev;
+    file_ino = st.st_ino;
+    file_mtime = st.st_mtime;
+
+    map_len = st.st_size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: unable to map %s : %s\n", path,
+                        strerror(errno));
+        map = NULL;
+        map_len = 0;
+        return false;
+    }
+
+    const ProfileHeader* hdr = (const ProfileHeader*) map;
+
+    if (hdr->magic == PROFILE_MAGIC && hdr->version == 1)
+        return open_v1();
+
+    size_t hdr_len = hdr->version == 2 ? PROFILE_HEADER_V2
+                                       : sizeof(ProfileHeader);
+    uint32_t slots = hdr->version == 2 ? 0 : hdr->index_size;
+
+    if (hdr->magic != PROFILE_MAGIC ||
+        (hdr->version != PROFILE_VERSION && hdr->version != 2) ||
+        hdr->entry_size != sizeof(ProfileEntry) ||
+        map_len < hdr_len) {
+        fprintf(stderr, "ERROR: %s is not a version %d profile store.\n",
+                        path, PROFILE_VERSION);
+        close();
+        return false;
+    }
+
+    size_t len = map_len - hdr_len;
+
+    if ((slots & (slots - 1)) != 0 ||
+        len != hdr->count * sizeof(ProfileEntry) + slots * sizeof(uint32_t)) {
+        fprintf(stderr, "ERROR: bad profile store (size) %s\n", path);
+        close();
+        return false;
+    }
+
+    entries = (const ProfileEntry*) ((const char*) map + hdr_len);
+
+    if (StateFile::crc32(entries, len) != hdr->crc) {
+        fprintf(stderr, "ERROR: bad profile store (CRC mismatch) %s\n", path);
+        close();
+        return false;
+    }
+
+    count = hdr->count;
+    index_size = slots;
+    index = slots ? (const uint32_t*) (entries + count) : NULL;
+
+    // a slot points to an entry, or is empty
+    for (uint32_t i = 0; i < index_size; i++)
+        if (index[i] > count) {
+            fprintf(stderr, "ERROR: bad profile store (index) %s\n", path);
+            close();
+            return false;
+        }
+
+    if (verbose)
+        fprintf(stderr, "Profile store %s : %u entries, %u index slots.\n",
+                        path, count, index_size);
+
+    return true;
+}
+
+bool ProfileStore::open_v1()
+{
+    const ProfileHeader* hdr = (const ProfileHeader*) map;
+    const char* v1 = (const char*) map + PROFILE_HEADER_V2;
+    size_t len = map_len - PROFILE_HEADER_V2;
+
+    if (hdr->entry_size != PROFILE_ENTRY_V1 ||
+        len != (size_t) hdr->count * PROFILE_ENTRY_V1) {
+        fprintf(stderr, "ERROR: bad profile store (size) %s\n", path);
+        close();
+        return false;
+    }
+
+    if (StateFile::crc32(v1, len) != hdr->crc) {
+        fprintf(stderr, "ERROR: bad profile store (CRC mismatch) %s\n", path);
+        close();
+        return false;
+    }
+
+    if (hdr->count &&
+        (own_entries = (ProfileEntry*)
+                calloc(hdr->count, sizeof(ProfileEntry))) == NULL) {
+        fprintf(stderr, "ERROR: out of memory reading %s\n", path);
+        close();
+        return false;
+    }
+
+    // same key/time/revision prefix, schema 1 state
+    for (unsigned i = 0; i < hdr->count; i++, v1 += PROFILE_ENTRY_V1) {
+        memcpy(own_entries + i, v1, PROFILE_KEY_LEN + 16);
+        StateFile::upgrade(own_entries[i].state,
+                           v1 + PROFILE_KEY_LEN + 16);
+    }
+
+    entries = own_entries;
+    count = hdr->count;
+
+    if (verbose)
+        fprintf(stderr, "Profile store %s : %u version 1 entries, "
+                        "upgraded on the next save.\n", path, count);
+
+    return true;
+}
+
+bool ProfileStore::refresh()
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        // still empty ?
+        if (errno == ENOENT && file_ino == 0)
+            return true;
+        return open();
+    }
+
+    // put() renames a new file over the old one
+    if (st.st_dev == file_dev && st.st_ino == file_ino &&
+        st.st_mtime == file_mtime)
+        return true;
+
+    if (verbose)
+        fprintf(stderr, "Profile store %s changed, reloading.\n", path);
+
+    return open();
+}
+
+unsigned ProfileStore::lower_bound(const char* key) const
+{
+    unsigned lo = 0;
+    unsigned hi = count;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (strncmp(entries[mid].key, key, PROFILE_KEY_LEN) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+const ProfileEntry* ProfileStore::find(const char* key, int revision) const
+{
+    const ProfileEntry* first;
+    int n = history(key, &first);
+
+    if (revision < 0 || revision >= n)
+        return NULL;
+
+    return first + revision;
+}
+
+uint32_t ProfileStore::key_hash(const char* key)
+{
+    return StateFile::crc32(key, strnlen(key, PROFILE_KEY_LEN));
+}
+
+unsigned ProfileStore::lookup(const char* key) const
+{
+    // version 2 store : bisection
+    if (index == NULL) {
+        unsigned i = lower_bound(key);
+        if (i < count && strncmp(entries[i].key, key, PROFILE_KEY_LEN) == 0)
+            return i;
+        return count;
+    }
+
+    // slots hold entry index + 1, 0 ends the probe sequence
+    uint32_t mask = index_size - 1;
+    for (uint32_t h = key_hash(key) & mask; index[h]; h = (h + 1) & mask) {
+        unsigned i = index[h] - 1;
+        if (strncmp(entries[i].key, key, PROFILE_KEY_LEN) == 0)
+            return i;
+    }
+
+    return count;
+}
+
+void ProfileStore::build_index(const ProfileEntry* entries, unsigned count,
+                               uint32_t* slots, uint32_t size)
+{
+    uint32_t mask = size - 1;
+
+    // the newest entry of each key starts its run
+    for (unsigned i = 0; i < count; i++) {
+        if (i > 0 &&
+            strncmp(entries[i].key, entries[i-1].key, PROFILE_KEY_LEN) == 0)
+            continue;
+
+        uint32_t h = key_hash(entries[i].key) & mask;
+        while (slots[h])
+            h = (h + 1) & mask;
+        slots[h] = i + 1;
+    }
+}
+
+int ProfileStore::history(const char* key, const ProfileEntry** first) const
+{
+    unsigned i = lookup(key);
+    unsigned j = i;
+
+    while (j < count && strncmp(entries[j].key, key, PROFILE_KEY_LEN) == 0)
+        j++;
+
+    *first = entries + i;
+
+    return j - i;
+}
+
+const ProfileEntry* ProfileStore::find_latest(const char* prefix) const
+{
+    size_t len = strlen(prefix);
+    const ProfileEntry* latest = NULL;
+
+    // keys sharing the prefix are contiguous
+    for (unsigned i = lower_bound(prefix);
+         i < count && strncmp(entries[i].key, prefix, len) == 0; i++)
+        if (latest == NULL || entries[i].time > latest->time)
+            latest = entries + i;
+
+    return latest;
+}
+
+bool ProfileStore::put(const char* key, const StateRecord& state)
+{
+    char lock_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    int lock_fd;
+    bool ok = true;
+
+    if (strlen(key) >= PROFILE_KEY_LEN) {
+        fprintf(stderr, "ERROR: profile key too long : %s\n", key);
+        return false;
+    }
+
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    // serialize writers
+    if ( (lock_fd = ::open(lock_path, O_RDWR | O_CREAT, 0644)) < 0 ||
+         flock(lock_fd, LOCK_EX) != 0 ) {
+        fprintf(stderr, "ERROR: unable to lock %s\n", lock_path);
+        if (lock_fd >= 0)
+            ::close(lock_fd);
+        return false;
+    }
+
+    // reload under the lock, another writer may have been there
+    if (!open()) {
+        ::close(lock_fd);
+        return false;
+    }
+
+    // insertion point, and the current history of key
+    unsigned at = lower_bound(key);
+    const ProfileEntry* first = entries + at;
+    unsigned old_n = 0;
+    while (at + old_n < count &&
+           strncmp(first[old_n].key, key, PROFILE_KEY_LEN) == 0)
+        old_n++;
+    unsigned keep = old_n < PROFILE_HISTORY ? old_n : PROFILE_HISTORY - 1;
+    unsigned new_count = count - old_n + keep + 1;
+
+    ProfileEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.key, key, PROFILE_KEY_LEN - 1);
+    entry.time = time(NULL);
+    entry.revision = old_n ? first->revision + 1 : 1;
+    entry.state = state;
+    StateFile::seal(entry.state);
+
+    ProfileHeader hdr;
+    hdr.magic = PROFILE_MAGIC;
+    hdr.version = PROFILE_VERSION;
+    hdr.entry_size = sizeof(ProfileEntry);
+    hdr.count = new_count;
+    hdr.reserved = 0;
+
+    // entries before key, new entry, kept history, entries after key
+    const ProfileEntry* after = first + old_n;
+    size_t n_after = count - at - old_n;
+
+    // distinct keys, to size the index
+    unsigned keys = 1;
+    for (unsigned i = 0; i < count; i++)
+        if ((i == 0 || strncmp(entries[i].key, entries[i-1].key,
+                               PROFILE_KEY_LEN) != 0) &&
+            strncmp(entries[i].key, key, PROFILE_KEY_LEN) != 0)
+            keys++;
+
+    hdr.index_size = 8;
+    while (hdr.index_size < keys * INDEX_LOAD)
+        hdr.index_size *= 2;
+
+    size_t entries_len = new_count * sizeof(ProfileEntry);
+    size_t len = entries_len + hdr.index_size * sizeof(uint32_t);
+
+    char* buf = (char*) calloc(1, len);
+    if (buf == NULL) {
+        ::close(lock_fd);
+        return false;
+    }
+
+    char* p = buf;
+    memcpy(p, entries, at * sizeof(ProfileEntry));
+    p += at * sizeof(ProfileEntry);
+    memcpy(p, &entry, sizeof(ProfileEntry));
+    p += sizeof(ProfileEntry);
+    memcpy(p, first, keep * sizeof(ProfileEntry));
+    p += keep * sizeof(ProfileEntry);
+    memcpy(p, after, n_after * sizeof(ProfileEntry));
+
+    build_index((const ProfileEntry*) buf, new_count,
+                (uint32_t*) (buf + entries_len), hdr.index_size);
+
+    hdr.crc = StateFile::crc32(buf, len);
+
+    FILE* fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", tmp_path);
+        free(buf);
+        ::close(lock_fd);
+        return false;
+    }
+
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && ok;
+    ok = fwrite(buf, len, 1, fp) == 1 && ok;
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fsync(fileno(fp)) == 0) && ok;
+    ok = (fclose(fp) == 0) && ok;
+    free(buf);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        unlink(tmp_path);
+        ::close(lock_fd);
+        return false;
+    }
+
+    // map the new store
+    ok = open();
+    ::close(lock_fd);
+
+    if (ok && verbose)
+        fprintf(stderr, "Stored revision %u of '%s' in %s\n",
+                        entry.revision, key, path);
+
+    return ok;
+}
+
+bool ProfileStore::make_key(char* key, const char* device_key,
+                            const char* host, const char* output)
+{
+    int n = snprintf(key, PROFILE_KEY_LEN, "%s@%s/%s",
+                     device_key, host, output);
+
+    return n > 0 && n < PROFILE_KEY_LEN;
+}
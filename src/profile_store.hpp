@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _profile_store_hpp
+#define _profile_store_hpp
+
+#include "state.hpp"
+
+#include <sys/types.h>
+
+/*
+ * Calibration profile store : one file holding the calibration of many
+ * devices, keyed by device identity, host and output.
+ *
+ * Layout : a header followed by fixed size entries, sorted by key then by
+ * decreasing revision, so the history of a key is the run of entries
+ * following its newest one. A hash index (open addressing on the CRC32 of
+ * the key, linear probing) follows the entries : a lookup costs one or two
+ * probes whatever the number of devices. Version 2 stores have no index and
+ * are searched by bisection until the next put(). Version 1 stores hold
+ * schema 1 states : they are upgraded in memory on open(), and rewritten in
+ * the current format by the next put().
+ *
+ * Updates rewrite the whole store in a temporary file renamed over the old
+ * one, under an exclusive lock on <store>.lock.
+ */
+
+// default store location
+#ifndef PROFILE_STORE_PATH
+#define PROFILE_STORE_PATH "/var/lib/ebeam_tools/profiles"
+#endif
+
+// "EBPS" read as a little-endian 32-bit word
+#define PROFILE_MAGIC   0x53504245
+#define PROFILE_VERSION 3
+
+// max key length, including the terminating 0
+#define PROFILE_KEY_LEN 112
+
+// number of revisions kept per key
+#define PROFILE_HISTORY 8
+
+/// store file header
+struct ProfileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;    // sizeof(ProfileEntry)
+    uint32_t count;         // number of entries
+    uint32_t crc;           // CRC32 of the entries and the index
+    uint32_t index_size;    // number of index slots, a power of 2
+    uint32_t reserved;
+};
+
+// version 1 and 2 header : no index
+#define PROFILE_HEADER_V2 16
+
+// version 1 entry : key, time, revision, reserved and a schema 1 state
+#define PROFILE_ENTRY_V1 (PROFILE_KEY_LEN + 16 + STATE_SCHEMA1_SIZE)
+
+/// one revision of a profile
+struct ProfileEntry {
+    char        key[PROFILE_KEY_LEN];
+    int64_t     time;       // save time, seconds since the epoch
+    uint32_t    revision;   // increasing for a given key
+    uint32_t    reserved;
+    StateRecord state;
+};
+
+/// Class for looking up and updating calibration profiles
+class ProfileStore
+{
+public:
+    ProfileStore(const char* path0);
+    ~ProfileStore();
+
+    // map the store, a missing store is an empty one
+    bool open();
+
+    // release the mapping
+    void close();
+
+    // remap the store if it was replaced since open()
+    bool refresh();
+
+    // profile for key : revision 0 is the newest, 1 the previous one, ...
+    // Returns NULL if not found
+    const ProfileEntry* find(const char* key, int revision = 0) const;
+
+    // number of stored revisions for key, newest first from *first
+    int history(const char* key, const ProfileEntry** first) const;
+
+    // most recently saved profile among the keys starting with prefix
+    // Returns NULL if not found
+    const ProfileEntry* find_latest(const char* prefix) const;
+
+    // store a new revision for key
+    bool put(const char* key, const StateRecord& state);
+
+    // build a store key from device identity, host and output names
+    static bool make_key(char* key, const char* device_key,
+                         const char* host, const char* output);
+
+    // index hash of a store key
+    static uint32_t key_hash(const char* key);
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    // upgrade the mapped version 1 store into own_entries
+    bool open_v1();
+
+    // index of the first entry with key >= key
+    unsigned lower_bound(const char* key) const;
+
+    // index of the newest entry of key, count if none
+    unsigned lookup(const char* key) const;
+
+    // build the index of sorted entries, slots must hold size zeros
+    static void build_index(const ProfileEntry* entries, unsigned count,
+                            uint32_t* slots, uint32_t size);
+
+    const char* const path;
+
+    // file mapping
+    void*   map;
+    size_t  map_len;
+
+    const ProfileEntry* entries;
+    unsigned            count;
+    ProfileEntry*       own_entries;    // upgraded version 1 entries
+    const uint32_t*     index;      // NULL for a version 2 store
+    uint32_t            index_size;
+
+    // identity of the mapped file, to detect updates
+    dev_t   file_dev;
+    ino_t   file_ino;
+    time_t  file_mtime;
+};
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "service.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+// don't wait forever for a stuck peer, in seconds
+#define SERVICE_TIMEOUT 5
+
+/// static verbose
+bool Service::verbose = false;
+
+/// fill a socket address, false if path is too long
+static bool make_addr(const char* path, struct sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long : %s\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    return true;
+}
+
+/// set send and receive timeouts
+static void set_timeout(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = SERVICE_TIMEOUT;
+    tv.tv_usec = 0;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/// read or write exactly len bytes, *done : number of bytes transferred
+static bool xfer(int fd, void* buf, size_t len, bool write_it,
+                 size_t* done = NULL)
+{
+    char* p = (char*) buf;
+
+    while (len > 0) {
+        ssize_t n = write_it ? write(fd, p, len) : read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        p += n;
+        len -= n;
+    }
+
+    if (done)
+        *done = p - (char*) buf;
+
+    return len == 0;
+}
+
+/// is path a socket of root or of the caller, not writable by others ?
+static bool trusted(const char* path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) != 0)
+        return false;
+
+    if (!S_ISSOCK(st.st_mode) ||
+        (st.st_uid != 0 && st.st_uid != getuid()) ||
+        (st.st_mode & S_IWOTH) != 0) {
+        fprintf(stderr, "ERROR: not using %s : not a socket of root or "
+                        "uid %u, or writable by others\n",
+                        path, (unsigned) getuid());
+        return false;
+    }
+
+    return true;
+}
+
+/// connected socket, -1 if nobody listens
+static int connect_to(const char* path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!make_addr(path, addr) || !trusted(path))
+        return -1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        if (errno == EACCES)
+            fprintf(stderr, "WARNING: no access to the calibration service "
+                            "%s (not in its group ?), working without it\n",
+                            path);
+        close(fd);
+        return -1;
+    }
+
+    set_timeout(fd);
+
+    return fd;
+}
+
+void Service::default_path(char* path, size_t len)
+{
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+
+    if (geteuid() != 0 && dir && dir[0])
+        snprintf(path, len, "%s/ebeam_tools.sock", dir);
+    else
+        snprintf(path, len, "%s", SERVICE_SOCKET_PATH);
+}
+
+int Service::listen(const char* path, gid_t group)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!make_addr(path, addr))
+        return -1;
+
+    // a socket file left by a dead daemon is removed, a live one is not
+    if (available(path)) {
+        fprintf(stderr, "ERROR: a daemon is already listening on %s\n", path);
+        return -1;
+    }
+    unlink(path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "ERROR: socket : %s\n", strerror(errno));
+        return -1;
+    }
+
+    // owner and group only : requests rewrite the calibration
+    mode_t old_mask = umask(0117);
+    int err = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    umask(old_mask);
+
+    if (err == 0 && group != SERVICE_NO_GROUP &&
+        chown(path, (uid_t) -1, group) != 0) {
+        fprintf(stderr, "ERROR: unable to set the group of %s : %s\n", path,
+                        strerror(errno));
+        unlink(path);
+        close(fd);
+        return -1;
+    }
+
+    if (err != 0 || ::listen(fd, 8) != 0) {
+        fprintf(stderr, "ERROR: unable to listen on %s : %s\n", path,
+                        strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (verbose)
+        fprintf(stderr, "Listening on %s\n", path);
+
+    return fd;
+}
+
+bool Service::authorized(int fd, gid_t group)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        fprintf(stderr, "ERROR: unable to identify a service client : %s\n",
+                        strerror(errno));
+        return false;
+    }
+
+    if (group == SERVICE_NO_GROUP)
+        group = getegid();
+
+    if (cred.uid == 0 || cred.uid == geteuid() || cred.gid == group)
+        return true;
+
+    // supplementary groups of the client's user
+    struct passwd* pw = getpwuid(cred.uid);
+    if (pw) {
+        gid_t groups[64];
+        int n = sizeof(groups) / sizeof(groups[0]);
+
+        if (getgrouplist(pw->pw_name, cred.gid, groups, &n) >= 0)
+            for (int i = 0; i < n; i++)
+                if (groups[i] == group)
+                    return true;
+    }
+
+    fprintf(stderr, "WARNING: service request of uid %u refused : not in "
+                    "group %u\n", (unsigned) cred.uid, (unsigned) group);
+    return false;
+}
+
+bool Service::receive(int fd, ServiceRequest& req)
+{
+    size_t done;
+
+    set_timeout(fd);
+
+    if (!xfer(fd, &req, sizeof(req), false, &done)) {
+        // nothing sent : a client checking that we are there
+        if (done > 0)
+            fprintf(stderr, "ERROR: short service request.\n");
+        return FAILURE;
+    }
+
+    if (req.magic != SERVICE_MAGIC || req.version != SERVICE_VERSION) {
+        fprintf(stderr, "ERROR: bad service request (version %u).\n",
+                        req.version);
+        return FAILURE;
+    }
+
+    req.device[sizeof(req.device) - 1] = 0;
+
+    return SUCCESS;
+}
+
+bool Service::reply(int fd, const ServiceReply& rep)
+{
+    return xfer(fd, (void*) &rep, sizeof(rep), true);
+}
+
+bool Service::available(const char* path)
+{
+    int fd = connect_to(path);
+
+    if (fd < 0)
+        return false;
+
+    close(fd);
+
+    return true;
+}
+
+bool Service::call(const char* path, const ServiceRequest& req,
+                   ServiceReply& rep)
+{
+    int fd = connect_to(path);
+
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: no calibration service on %s\n", path);
+        return FAILURE;
+    }
+
+    bool ok = xfer(fd, (void*) &req, sizeof(req), true) &&
+              xfer(fd, &rep, sizeof(rep), false);
+    close(fd);
+
+    if (!ok || rep.magic != SERVICE_MAGIC) {
+        fprintf(stderr, "ERROR: no reply from the calibration service.\n");
+        return FAILURE;
+    }
+
+    rep.key[sizeof(rep.key) - 1] = 0;
+    rep.message[sizeof(rep.message) - 1] = 0;
+
+    if (rep.status != SUCCESS) {
+        fprintf(stderr, "ERROR: %s\n", rep.message);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+void Service::init_request(ServiceRequest& req, ServiceOp op,
+                           const char* device)
+{
+    memset(&req, 0, sizeof(req));
+    req.magic = SERVICE_MAGIC;
+    req.version = SERVICE_VERSION;
+    req.op = op;
+
+    if (device)
+        snprintf(req.device, sizeof(req.device), "%s", device);
+}
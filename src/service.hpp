@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _service_hpp
+#define _service_hpp
+
+#include "state.hpp"
+#include "profile_store.hpp"
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+ * Calibration service protocol, between ebeam_daemon and its clients
+ * (ebeam_state), over a UNIX stream socket.
+ *
+ * One request per connection : the client sends a ServiceRequest, the
+ * daemon answers with a ServiceReply and closes. Both are fixed size,
+ * native byte order (the peers are on the same host).
+ *
+ * The socket is read/write for the daemon's user and group (0660), the
+ * group can be set (ebeam_daemon --socket-group). The daemon checks every
+ * client with SO_PEERCRED : root, its own user, or a member of the group.
+ * Clients only connect to a socket owned by root or by themselves, and not
+ * writable by others.
+ *
+ * A root daemon listens on SERVICE_SOCKET_PATH, a user daemon (the usual
+ * case, it needs the user's display) in $XDG_RUNTIME_DIR. Clients try
+ * their own path, then the system one.
+ */
+
+// socket of a root daemon
+#ifndef SERVICE_SOCKET_PATH
+#define SERVICE_SOCKET_PATH "/run/ebeam_tools.sock"
+#endif
+
+// no socket group : the daemon's group
+#define SERVICE_NO_GROUP ((gid_t) -1)
+
+// "EBSS" read as a little-endian 32-bit word
+#define SERVICE_MAGIC   0x53534245
+#define SERVICE_VERSION 1
+
+/// requests
+enum ServiceOp {
+    SERVICE_QUERY = 1,  // current calibration of the device
+    SERVICE_SAVE,       // same, and store it with SERVICE_STORE
+    SERVICE_RESTORE,    // apply state, or the stored profile (SERVICE_STORE)
+    SERVICE_RESET       // back to uncalibrated
+};
+
+// request flag : through the daemon profile store
+#define SERVICE_STORE 0x1
+
+struct ServiceRequest {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    op;         // ServiceOp
+    uint32_t    flags;
+    int32_t     revision;   // profile revision, for SERVICE_RESTORE
+    char        device[64]; // name or id, empty : last device found
+    StateRecord state;      // for SERVICE_RESTORE without SERVICE_STORE
+};
+
+struct ServiceReply {
+    uint32_t    magic;
+    int32_t     status;     // SUCCESS or FAILURE
+    uint32_t    revision;   // profile revision saved or restored
+    uint32_t    reserved;
+    char        key[PROFILE_KEY_LEN];
+    char        message[128];   // error message
+    StateRecord state;      // for SERVICE_QUERY and SERVICE_SAVE
+};
+
+/// Client and server helpers
+class Service
+{
+public:
+    // default socket : SERVICE_SOCKET_PATH for root, else
+    // $XDG_RUNTIME_DIR/ebeam_tools.sock (SERVICE_SOCKET_PATH if unset)
+    static void default_path(char* path, size_t len);
+
+    // server side : listening socket, mode 0660, of group if given
+    // Returns -1 on error
+    static int listen(const char* path, gid_t group = SERVICE_NO_GROUP);
+
+    // server side : may the client on fd use the service ?
+    static bool authorized(int fd, gid_t group);
+
+    // server side : read a request from a client
+    static bool receive(int fd, ServiceRequest& req);
+
+    // server side : answer a client
+    static bool reply(int fd, const ServiceReply& rep);
+
+    // client side : is a daemon answering on path ?
+    static bool available(const char* path);
+
+    // client side : send a request and wait for the reply
+    static bool call(const char* path, const ServiceRequest& req,
+                     ServiceReply& rep);
+
+    // fill the header of a request
+    static void init_request(ServiceRequest& req, ServiceOp op,
+                             const char* device);
+
+    // Be verbose or not
+    static bool verbose;
+};
+
+#endif
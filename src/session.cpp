@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "session.hpp"
+#include "state.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+// compile time check of the on-disk layout
+typedef char session_header_size_check[sizeof(SessionHeader) == 64 ? 1 : -1];
+typedef char session_record_size_check[sizeof(SessionRecord) == 40 ? 1 : -1];
+
+/// static verbose
+bool SessionLog::verbose = false;
+
+/// CRC32 of a header or record, with its crc field taken as 0
+template <class T>
+static uint32_t session_crc(const T& t)
+{
+    T copy = t;
+    copy.crc = 0;
+    return StateFile::crc32(&copy, sizeof(copy));
+}
+
+SessionLog::SessionLog()
+  : fd(-1),
+    failed(false),
+    start_s(0),
+    start_ns(0),
+    map(NULL),
+    map_len(0),
+    header(NULL),
+    records(NULL),
+    count(0)
+{
+}
+
+SessionLog::~SessionLog()
+{
+    close();
+}
+
+void SessionLog::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+
+    if (map)
+        munmap(map, map_len);
+    map = NULL;
+    map_len = 0;
+    header = NULL;
+    records = NULL;
+    count = 0;
+}
+
+void SessionLog::init(SessionRecord& rec, SessionType type, int index)
+{
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.index = index;
+}
+
+bool SessionLog::create(const char* path, const char* device)
+{
+    SessionHeader h;
+    struct timespec ts;
+
+    close();
+
+    if ( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                    0644)) < 0 ) {
+        fprintf(stderr, "ERROR: unable to open %s for writing : %s\n", path,
+                        strerror(errno));
+        return FAILURE;
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.magic = SESSION_MAGIC;
+    h.version = SESSION_VERSION;
+    h.record_size = sizeof(SessionRecord);
+    h.start = time(NULL);
+    strncpy(h.device, device, sizeof(h.device) - 1);
+    h.crc = session_crc(h);
+
+    if (write(fd, &h, sizeof(h)) != (ssize_t) sizeof(h)) {
+        fprintf(stderr, "ERROR: unable to write %s : %s\n", path,
+                        strerror(errno));
+        close();
+        return FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_s = ts.tv_sec;
+    start_ns = ts.tv_nsec;
+    failed = false;
+
+    if (verbose)
+        fprintf(stderr, "Recording the session to %s\n", path);
+
+    return SUCCESS;
+}
+
+void SessionLog::append(SessionRecord& rec)
+{
+    struct timespec ts;
+
+    if (fd < 0 || failed)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec.time = (ts.tv_sec - start_s) * 1000 + (ts.tv_nsec - start_ns) / 1000000;
+    rec.crc = session_crc(rec);
+
+    // O_APPEND : one record per write, never interleaved
+    if (write(fd, &rec, sizeof(rec)) != (ssize_t) sizeof(rec)) {
+        static const char msg[] = "ERROR: unable to write the session log, "
+                                  "recording stopped.\n";
+        failed = true;
+        if (write(2, msg, sizeof(msg) - 1) < 0)
+            return;
+    }
+}
+
+bool SessionLog::load(const char* path)
+{
+    struct stat st;
+    int in;
+
+    close();
+
+    if ( (in = open(path, O_RDONLY)) < 0 ) {
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", path);
+        return FAILURE;
+    }
+
+    if (fstat(in, &st) != 0 || st.st_size < (off_t) sizeof(SessionHeader)) {
+        fprintf(stderr, "ERROR: bad session log (truncated) %s\n", path);
+        ::close(in);
+        return FAILURE;
+    }
+
+    map_len = st.st_size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, in, 0);
+    ::close(in);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: unable to map %s : %s\n", path,
+                        strerror(errno));
+        map = NULL;
+        map_len = 0;
+        return FAILURE;
+    }
+
+    header = (const SessionHeader*) map;
+
+    if (header->magic != SESSION_MAGIC || session_crc(*header) != header->crc) {
+        fprintf(stderr, "ERROR: %s is not a session log.\n", path);
+        close();
+        return FAILURE;
+    }
+
+    if (header->version > SESSION_VERSION ||
+        header->record_size != sizeof(SessionRecord)) {
+        fprintf(stderr, "ERROR: session log %s uses version %u, "
+                        "only %u is supported.\n",
+                        path, header->version, SESSION_VERSION);
+        close();
+        return FAILURE;
+    }
+
+    records = (const SessionRecord*) ((const char*) map + sizeof(*header));
+    count = (map_len - sizeof(*header)) / sizeof(SessionRecord);
+
+    // up to the first damaged record
+    for (unsigned i = 0; i < count; i++)
+        if (session_crc(records[i]) != records[i].crc) {
+            fprintf(stderr, "WARNING: session log %s damaged after "
+                            "%u records.\n", path, i);
+            count = i;
+            break;
+        }
+
+    if (verbose)
+        fprintf(stderr, "Loaded session log %s : '%s', %u records\n",
+                        path, header->device, count);
+
+    return SUCCESS;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _session_hpp
+#define _session_hpp
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Calibration session log, written by ebeam_calibrator --record : the
+ * screen and target layout, then every raw event of the device seen by
+ * the calibration window, with its time, and the calibration result.
+ * ebeam_calibrator --replay feeds it back through the same handlers,
+ * without X nor device, to reproduce a session.
+ *
+ * Append-only binary file, host byte order : a header, then fixed size
+ * records, each with its own CRC32. A log cut short (crash, full disk)
+ * is read up to its last complete record.
+ *
+ * Records are written with a single write(), from the SIGALRM event loop
+ * of the calibration window : no allocation, no stdio.
+ * Loading is done by mapping the file, records are used in place.
+ */
+
+// "EBSL" read as a little-endian 32-bit word
+#define SESSION_MAGIC   0x4c534245
+#define SESSION_VERSION 1
+
+/// record types
+enum SessionType {
+    SESSION_SETUP = 1,  // i : width, height, rotation, precision,
+                        //     threshold, zoned
+    SESSION_ZONE,       // i : min_x, min_y, max_x, max_y
+    SESSION_TARGET,     // index : point, d : x, y
+    SESSION_MOTION,     // index : valuator mask (bit 0 X, bit 1 Y),
+                        // d : raw X, raw Y
+    SESSION_BUTTON,     // index : button
+    SESSION_KEY,        // key press : abort
+    SESSION_TIMEOUT,    // no click in time : abort
+    SESSION_RESULT      // status : finish(), index : H row, l : H row
+};
+
+/// log header
+struct SessionHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   // sizeof(SessionRecord) at write time
+    uint32_t crc;           // CRC32 of the header, computed with crc = 0
+    uint32_t reserved;
+    int64_t  start;         // time of the session, in s since the epoch
+    char     device[40];    // device name
+};
+
+/// one event of the session
+struct SessionRecord {
+    uint16_t type;
+    uint16_t index;
+    uint32_t time;          // ms since the start of the session
+    uint32_t crc;           // CRC32 of the record, computed with crc = 0
+    int32_t  status;
+    union {
+        int32_t i[6];
+        double  d[3];
+        int64_t l[3];
+    } v;
+};
+
+/// Class for writing and reading calibration session logs
+class SessionLog
+{
+public:
+    SessionLog();
+    ~SessionLog();
+
+    // start a new log
+    bool create(const char* path, const char* device);
+
+    // append rec, time and crc filled in; safe in a signal handler
+    void append(SessionRecord& rec);
+
+    // map and check a log
+    bool load(const char* path);
+
+    // close the log, release the mapping
+    void close();
+
+    // loaded log
+    const SessionHeader* get_header() const { return header; }
+    unsigned get_count() const { return count; }
+    const SessionRecord& get_record(unsigned i) const { return records[i]; }
+
+    // zeroed record of the given type
+    static void init(SessionRecord& rec, SessionType type, int index = 0);
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    // writing
+    int fd;
+    bool failed;            // a write failed, reported once
+    long start_s;           // monotonic start of the session
+    long start_ns;
+
+    // file mapping
+    void* map;
+    size_t map_len;
+    const SessionHeader* header;
+    const SessionRecord* records;
+    unsigned count;
+};
+
+#endif
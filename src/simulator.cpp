@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "simulator.hpp"
+#include "transform.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <algorithm>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// raw samples period, in ms
+#define SIM_PERIOD 10
+
+// samples while the pen travels to a target
+#define SIM_TRAVEL 5
+
+// accuracy grid : SIM_GRID x SIM_GRID points over the active zone
+#define SIM_GRID 16
+
+/// attributes of the ebeam driver
+static const char* sim_attrs[] = {
+    "min_x", "min_y", "max_x", "max_y",
+    "h1", "h2", "h3", "h4", "h5", "h6", "h7", "h8", "h9",
+    "calibrated"
+};
+
+PenSimulator::PenSimulator(const SimModel& model0, unsigned seed0)
+  : model(model0),
+    seed(seed0),
+    time(0),
+    k(0),
+    width(0),
+    height(0)
+{
+    memset(G, 0, sizeof(G));
+}
+
+bool PenSimulator::parse_mapping(const char* name, SimModel::Mapping& mapping)
+{
+    if (strcmp(name, "projective") == 0)
+        mapping = SimModel::PROJECTIVE;
+    else if (strcmp(name, "radial") == 0)
+        mapping = SimModel::RADIAL;
+    else
+        return false;
+
+    return true;
+}
+
+void PenSimulator::default_model(SimModel& model)
+{
+    model.mapping = SimModel::PROJECTIVE;
+    model.noise = 3;
+    model.outlier = 0.01;
+    model.bounce = 0.05;
+    model.samples = 10;
+}
+
+/// uniform in [0, 1), LCG
+double PenSimulator::uniform()
+{
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 8) / 16777216.0;
+}
+
+/// standard normal, Box-Muller
+double PenSimulator::gaussian()
+{
+    double u1 = 1.0 - uniform();
+    double u2 = uniform();
+
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+void PenSimulator::new_board(int width0, int height0)
+{
+    const double c = SIM_RAW_MAX / 2.0;
+    double qx[4], qy[4];
+
+    width = width0;
+    height = height0;
+
+    // screen corners UL, UR, LR, LL seen by the receiver : a slightly
+    // rotated, off-center rectangle, and some perspective
+    double size = c * (0.6 + 0.3 * uniform());
+    double angle = (uniform() - 0.5) * 10 * M_PI / 180;
+    double ox = c + (uniform() - 0.5) * 400;
+    double oy = c + (uniform() - 0.5) * 400;
+    double ratio = (double) height / width;
+
+    for (int i = 0; i < 4; i++) {
+        double u = (i == 1 || i == 2) ? 1 : -1;
+        double v = (i >= 2) ? ratio : -ratio;
+        double x = u * size + (uniform() - 0.5) * 160;
+        double y = v * size + (uniform() - 0.5) * 160;
+        qx[i] = ox + x * cos(angle) - y * sin(angle);
+        qy[i] = oy + x * sin(angle) + y * cos(angle);
+    }
+
+    // unit square to quad (Heckbert)
+    double a, b, d, e, g, h;
+    double dx1 = qx[1] - qx[2], dx2 = qx[3] - qx[2];
+    double dx3 = qx[0] - qx[1] + qx[2] - qx[3];
+    double dy1 = qy[1] - qy[2], dy2 = qy[3] - qy[2];
+    double dy3 = qy[0] - qy[1] + qy[2] - qy[3];
+    double det = dx1 * dy2 - dx2 * dy1;
+
+    g = (dx3 * dy2 - dx2 * dy3) / det;
+    h = (dx1 * dy3 - dx3 * dy1) / det;
+    a = qx[1] - qx[0] + g * qx[1];
+    b = qx[3] - qx[0] + h * qx[3];
+    d = qy[1] - qy[0] + g * qy[1];
+    e = qy[3] - qy[0] + h * qy[3];
+
+    // screen to unit square first
+    G[0] = a / width;  G[1] = b / height; G[2] = qx[0];
+    G[3] = d / width;  G[4] = e / height; G[5] = qy[0];
+    G[6] = g / width;  G[7] = h / height; G[8] = 1;
+
+    k = model.mapping == SimModel::RADIAL ? (uniform() - 0.5) * 0.04 : 0;
+}
+
+void PenSimulator::to_raw(double x, double y, double& X, double& Y) const
+{
+    const double c = SIM_RAW_MAX / 2.0;
+    double w = G[6] * x + G[7] * y + G[8];
+
+    X = (G[0] * x + G[1] * y + G[2]) / w;
+    Y = (G[3] * x + G[4] * y + G[5]) / w;
+
+    if (k != 0) {
+        double r2 = ((X - c) * (X - c) + (Y - c) * (Y - c)) / (c * c);
+        X = c + (X - c) * (1 + k * r2);
+        Y = c + (Y - c) * (1 + k * r2);
+    }
+}
+
+void PenSimulator::add_sample(std::vector<SessionRecord>& records,
+                              double X, double Y)
+{
+    SessionRecord rec;
+
+    // sensor noise, and now and then a wild sample
+    X += gaussian() * model.noise;
+    Y += gaussian() * model.noise;
+    if (uniform() < model.outlier) {
+        X += (uniform() - 0.5) * 400;
+        Y += (uniform() - 0.5) * 400;
+    }
+
+    SessionLog::init(rec, SESSION_MOTION, 3);
+    rec.time = time;
+    rec.v.d[0] = std::max(0, std::min(SIM_RAW_MAX, (int) floor(X + 0.5)));
+    rec.v.d[1] = std::max(0, std::min(SIM_RAW_MAX, (int) floor(Y + 0.5)));
+    records.push_back(rec);
+
+    time += SIM_PERIOD;
+}
+
+void PenSimulator::make_session(const double* target_x,
+                                const double* target_y, int num,
+                                std::vector<SessionRecord>& records)
+{
+    SessionRecord rec;
+    double X = SIM_RAW_MAX / 2.0, Y = SIM_RAW_MAX / 2.0;
+
+    records.clear();
+    time = 0;
+
+    // the last target once more : leave the final screen
+    for (int i = 0; i <= num; i++) {
+        double TX, TY;
+        int t = std::min(i, num - 1);
+        to_raw(target_x[t], target_y[t], TX, TY);
+
+        // reaching for the target
+        for (int s = 1; s <= SIM_TRAVEL; s++)
+            add_sample(records, X + (TX - X) * s / SIM_TRAVEL,
+                                Y + (TY - Y) * s / SIM_TRAVEL);
+        X = TX;
+        Y = TY;
+
+        // resting on it
+        for (int s = 0; s < model.samples; s++)
+            add_sample(records, X, Y);
+
+        SessionLog::init(rec, SESSION_BUTTON, 1);
+        rec.time = time;
+        records.push_back(rec);
+
+        // pen bounce : clicked again at once
+        if (uniform() < model.bounce) {
+            add_sample(records, X, Y);
+            SessionLog::init(rec, SESSION_BUTTON, 1);
+            rec.time = time;
+            records.push_back(rec);
+        }
+
+        // next target : reading it, moving the arm
+        time += 300 + (uint32_t) (900 * uniform());
+    }
+}
+
+void PenSimulator::accuracy(const EbeamCalibration& cal, int width0,
+                            int height0, double& mean, double& max) const
+{
+    PenTransform transform;
+    double sum = 0;
+
+    transform.set_calibration(cal, width0, height0);
+    max = 0;
+
+    for (int i = 0; i < SIM_GRID; i++)
+        for (int j = 0; j < SIM_GRID; j++) {
+            double x = cal.min_x + (cal.max_x - cal.min_x) * i /
+                                   (SIM_GRID - 1.0);
+            double y = cal.min_y + (cal.max_y - cal.min_y) * j /
+                                   (SIM_GRID - 1.0);
+            double X, Y;
+            int sx, sy;
+
+            to_raw(x, y, X, Y);
+            transform.apply_exact((int) floor(X + 0.5), (int) floor(Y + 0.5),
+                                  sx, sy);
+
+            double err = sqrt((sx - x) * (sx - x) + (sy - y) * (sy - y));
+            sum += err;
+            max = std::max(max, err);
+        }
+
+    mean = sum / (SIM_GRID * SIM_GRID);
+}
+
+bool PenSimulator::make_sysfs(char* dir, size_t len)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/ebeam_sim.XXXXXX");
+    if (mkdtemp(path) == NULL) {
+        fprintf(stderr, "ERROR: unable to create the simulated device.\n");
+        return FAILURE;
+    }
+
+    // sysfs dirs end with /
+    snprintf(dir, len, "%s/", path);
+
+    for (unsigned i = 0; i < sizeof(sim_attrs)/sizeof(*sim_attrs); i++) {
+        char fname[96];
+        snprintf(fname, sizeof(fname), "%s%s", dir, sim_attrs[i]);
+
+        FILE* fp = fopen(fname, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "ERROR: unable to create %s\n", fname);
+            remove_sysfs(dir);
+            return FAILURE;
+        }
+        fputs("0\n", fp);
+        fclose(fp);
+    }
+
+    return SUCCESS;
+}
+
+void PenSimulator::remove_sysfs(const char* dir)
+{
+    for (unsigned i = 0; i < sizeof(sim_attrs)/sizeof(*sim_attrs); i++) {
+        char fname[96];
+        snprintf(fname, sizeof(fname), "%s%s", dir, sim_attrs[i]);
+        unlink(fname);
+    }
+
+    rmdir(dir);
+}
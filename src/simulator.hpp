@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _simulator_hpp
+#define _simulator_hpp
+
+#include "session.hpp"
+#include "sysfs.hpp"
+
+#include <vector>
+
+/*
+ * Synthetic pen, for calibration benchmarks without a board nor a person
+ * (ebeam_calibrator --simulate) :
+ *   - ground truth : where the board sits in front of the screen, a
+ *     random projective mapping from screen to raw device coordinates,
+ *     optionally with a radial distortion the calibration can't model,
+ *   - noise : gaussian jitter of the raw samples, and outliers,
+ *   - clicks : the pen moves to each target, rests a few samples, clicks,
+ *     and sometimes bounces (double click).
+ * Sessions are produced as session log records (see session.hpp), the
+ * raw event stream the calibration window consumes.
+ *
+ * The ebeam driver is simulated by a directory holding its calibration
+ * attributes (see sysfs.hpp).
+ */
+
+// raw range of the simulated device
+#define SIM_RAW_MAX 4095
+
+// simulated screen
+#define SIM_WIDTH 1920
+#define SIM_HEIGHT 1080
+
+/// simulation parameters
+struct SimModel {
+    enum Mapping { PROJECTIVE, RADIAL };
+
+    Mapping  mapping;
+    double   noise;         // raw sample jitter, standard deviation
+    double   outlier;       // probability of a wild sample
+    double   bounce;        // probability of a double click
+    int      samples;       // resting samples before a click
+};
+
+/// Class for generating synthetic calibration sessions
+class PenSimulator
+{
+public:
+    PenSimulator(const SimModel& model0, unsigned seed0);
+
+    // parse "projective" or "radial"
+    static bool parse_mapping(const char* name, SimModel::Mapping& mapping);
+
+    // default model
+    static void default_model(SimModel& model);
+
+    // new board position for a width x height screen
+    void new_board(int width, int height);
+
+    // raw position of screen point (x, y), without noise
+    void to_raw(double x, double y, double& X, double& Y) const;
+
+    // event stream of a session : click each target in turn, then once
+    // more to leave
+    void make_session(const double* target_x, const double* target_y,
+                      int num, std::vector<SessionRecord>& records);
+
+    // screen error of a driver calibration against the ground truth,
+    // on a grid over the active zone, in px
+    void accuracy(const EbeamCalibration& cal, int width, int height,
+                  double& mean, double& max) const;
+
+    // simulated ebeam driver : a directory with its attributes
+    static bool make_sysfs(char* dir, size_t len);
+    static void remove_sysfs(const char* dir);
+
+    // random numbers, repeatable for a given seed
+    double uniform();       // in [0, 1)
+    double gaussian();      // standard normal
+
+private:
+    void add_sample(std::vector<SessionRecord>& records, double X, double Y);
+
+    SimModel model;
+    unsigned seed;
+    uint32_t time;          // ms, of the next record
+
+    // ground truth : screen to raw homography, then radial distortion
+    double G[9];
+    double k;               // distortion, relative at the raw range edge
+    int width;
+    int height;
+};
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "state.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+// compile time check of the on-disk layout
+typedef char state_record_size_check[sizeof(StateRecord) == 224 ? 1 : -1];
+
+/// static verbose
+bool StateFile::verbose = false;
+
+/// CRC32 lookup table, built on first use
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static uint32_t crc32_update(uint32_t crc, const void* buf, size_t len)
+{
+    const unsigned char* p = (const unsigned char*) buf;
+
+    if (!crc_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+        crc_table_ready = true;
+    }
+
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+uint32_t StateFile::crc32(const void* buf, size_t len)
+{
+    return crc32_update(0, buf, len);
+}
+
+/// CRC of a record, as if its crc field was 0
+static uint32_t record_crc(const StateRecord* rec, size_t len)
+{
+    const uint32_t zero = 0;
+    const size_t off = offsetof(StateRecord, crc);
+    const char* p = (const char*) rec;
+    uint32_t crc;
+
+    crc = crc32_update(0, p, off);
+    crc = crc32_update(crc, &zero, sizeof(zero));
+    crc = crc32_update(crc, p + off + sizeof(zero), len - off - sizeof(zero));
+
+    return crc;
+}
+
+StateFile::StateFile()
+  : map(NULL),
+    map_len(0),
+    record(NULL),
+    format(STATE_BINARY)
+{
+    memset(&own_record, 0, sizeof(own_record));
+}
+
+StateFile::~StateFile()
+{
+    close();
+}
+
+void StateFile::close()
+{
+    if (map)
+        munmap(map, map_len);
+
+    map = NULL;
+    map_len = 0;
+    record = NULL;
+}
+
+bool StateFile::load(const char* path)
+{
+    FILE* fp;
+    uint32_t magic = 0;
+
+    close();
+
+    // peek at the magic number to choose the parser
+    if ( !(fp = fopen(path, "r")) ) {
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", path);
+        return false;
+    }
+    if (fread(&magic, sizeof(magic), 1, fp) != 1)
+        magic = 0;
+    fclose(fp);
+
+    if (magic == STATE_MAGIC)
+        return load_binary(path);
+
+    return load_text(path);
+}
+
+bool StateFile::load_binary(const char* path)
+{
+    struct stat st;
+    int fd;
+
+    if ( (fd = open(path, O_RDONLY)) < 0 ) {
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", path);
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < STATE_SCHEMA1_SIZE) {
+        fprintf(stderr, "ERROR: bad state file (truncated) %s\n", path);
+        ::close(fd);
+        return false;
+    }
+
+    map_len = st.st_size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: unable to map %s : %s\n", path,
+                        strerror(errno));
+        map = NULL;
+        map_len = 0;
+        return false;
+    }
+
+    const StateRecord* rec = (const StateRecord*) map;
+
+    if (rec->schema > STATE_SCHEMA) {
+        fprintf(stderr, "ERROR: state file %s uses schema %u, "
+                        "only %u is supported.\n",
+                        path, rec->schema, STATE_SCHEMA);
+        close();
+        return false;
+    }
+
+    size_t min_size = rec->schema < 2 ? STATE_SCHEMA1_SIZE
+                                      : sizeof(StateRecord);
+
+    if (rec->size < min_size || rec->size > map_len) {
+        fprintf(stderr, "ERROR: bad state file (size) %s\n", path);
+        close();
+        return false;
+    }
+
+    if (record_crc(rec, rec->size) != rec->crc) {
+        fprintf(stderr, "ERROR: bad state file (CRC mismatch) %s\n", path);
+        close();
+        return false;
+    }
+
+    format = STATE_BINARY;
+
+    if (rec->schema < 2) {
+        // no normalized calibration : upgrade a copy
+        upgrade(own_record, rec);
+        record = &own_record;
+    } else
+        record = rec;
+
+    if (verbose)
+        fprintf(stderr, "Loaded binary state file %s (schema %u)\n",
+                        path, rec->schema);
+
+    return true;
+}
+
+bool StateFile::load_text(const char* path)
+{
+    FILE* fp;
+    char version[16];
+    StateRecord& rec = own_record;
+
+    if ( !(fp = fopen(path, "r")) ) {
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", path);
+        return false;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+
+    // version check
+    // for now, keep going
+    if (fscanf(fp, "%15s\n", version) != 1) {
+        fprintf(stderr, "ERROR: bad state file (version) %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    if (strcmp(version, VERSION) != 0) {
+        fprintf(stderr, "WARNING: version mismatch : state file is %s, "
+                        "application is %s.\n", version, VERSION);
+        fprintf(stderr, "         Proceeding anyway.\n");
+    }
+
+    // min/max
+    int v[4];
+    if (fscanf(fp, "%d\n%d\n%d\n%d\n", &v[0], &v[1], &v[2], &v[3]) != 4) {
+        fprintf(stderr, "ERROR: bad state file (min/max) %s\n", path);
+        fclose(fp);
+        return false;
+    }
+    rec.min_x = v[0];
+    rec.max_x = v[1];
+    rec.min_y = v[2];
+    rec.max_y = v[3];
+
+    // H matrix
+    for (int i = 0; i<9 ; i++) {
+        long long h;
+        if (fscanf(fp, "%lld\n", &h) != 1) {
+            fprintf(stderr, "ERROR: bad state file (H coefs) %s\n", path);
+            fclose(fp);
+            return false;
+        }
+        rec.H[i] = h;
+    }
+
+    fclose(fp);
+
+    // text files don't store precision : H[8] is 10^precision
+    for (long long h = rec.H[8]; h >= 10; h /= 10)
+        rec.precision++;
+
+    // screen geometry is unknown, let the caller guess the zone flag
+    rec.zoned = -1;
+
+    seal(rec);
+    record = &rec;
+    format = STATE_TEXT;
+
+    if (verbose)
+        fprintf(stderr, "Loaded text state file %s (version %s)\n",
+                        path, version);
+
+    return true;
+}
+
+void StateFile::upgrade(StateRecord& rec, const void* old)
+{
+    memset(&rec, 0, sizeof(rec));
+    memcpy(&rec, old, STATE_SCHEMA1_SIZE);
+    rec.rotation = 0;
+    normalize(rec);
+    seal(rec);
+}
+
+bool StateFile::normalize(StateRecord& rec)
+{
+    const double w = rec.screen_width;
+    const double h = rec.screen_height;
+
+    memset(rec.zone, 0, sizeof(rec.zone));
+    memset(rec.Hn, 0, sizeof(rec.Hn));
+
+    if (rec.screen_width <= 0 || rec.screen_height <= 0)
+        return false;
+
+    rec.zone[0] = rec.min_x / w;
+    rec.zone[1] = rec.min_y / h;
+    rec.zone[2] = (rec.max_x + 1) / w;
+    rec.zone[3] = (rec.max_y + 1) / h;
+
+    // Hn maps device coords to pixel centers : u = (x + 0.5) / w
+    // Hn = diag(1/w, 1/h, 1) . T(0.5, 0.5) . H / 10^precision
+    const double scale = pow(10.0, rec.precision);
+    for (int j = 0; j < 3; j++) {
+        rec.Hn[j]     = (rec.H[j]     + 0.5 * rec.H[6 + j]) / (w * scale);
+        rec.Hn[3 + j] = (rec.H[3 + j] + 0.5 * rec.H[6 + j]) / (h * scale);
+        rec.Hn[6 + j] = rec.H[6 + j] / scale;
+    }
+
+    return true;
+}
+
+/// round to nearest, as find_H does
+static long long round_ll(long double v)
+{
+    return (long long) (v >= 0 ? v + 0.5 : v - 0.5);
+}
+
+/*
+ * Rotation of normalized screen coordinates.
+ * A point at (a, b) on the unrotated screen is at (u, v) on a screen
+ * rotated by 'degrees' (RandR convention, counter-clockwise) :
+ *   90  : u = 1 - b, v = a
+ *   180 : u = 1 - a, v = 1 - b
+ *   270 : u = b,     v = 1 - a
+ * Rotations compose by adding angles.
+ */
+static void rotation_matrix(int degrees, double* R)
+{
+    static const double rot[4][9] = {
+        { 1,  0, 0,   0,  1, 0,   0, 0, 1 },
+        { 0, -1, 1,   1,  0, 0,   0, 0, 1 },
+        {-1,  0, 1,   0, -1, 1,   0, 0, 1 },
+        { 0,  1, 0,  -1,  0, 1,   0, 0, 1 }
+    };
+
+    memcpy(R, rot[((degrees / 90) % 4 + 4) % 4], 9 * sizeof(double));
+}
+
+bool StateFile::rescale(const StateRecord& rec, int width, int height,
+                        int rotation, StateRecord& out)
+{
+    out = rec;
+
+    if (rec.screen_width <= 0 || rec.screen_height <= 0 ||
+        width <= 0 || height <= 0)
+        return false;
+
+    if (rec.screen_width == width && rec.screen_height == height &&
+        rec.rotation == rotation)
+        return true; // exact values, nothing to do
+
+    double R[9];
+    rotation_matrix(rotation - rec.rotation, R);
+
+    // active zone : transform both corners, keep the bounding box
+    double u[2], v[2];
+    for (int c = 0; c < 2; c++) {
+        double a = rec.zone[2*c];
+        double b = rec.zone[2*c + 1];
+        u[c] = R[0] * a + R[1] * b + R[2];
+        v[c] = R[3] * a + R[4] * b + R[5];
+    }
+
+    out.min_x = (int) round_ll((u[0] < u[1] ? u[0] : u[1]) * width);
+    out.max_x = (int) round_ll((u[0] < u[1] ? u[1] : u[0]) * width) - 1;
+    out.min_y = (int) round_ll((v[0] < v[1] ? v[0] : v[1]) * height);
+    out.max_y = (int) round_ll((v[0] < v[1] ? v[1] : v[0]) * height) - 1;
+
+    // H = T(-0.5, -0.5) . diag(width, height, 1) . R . Hn, scaled by
+    // 10^precision. The last row of R is (0, 0, 1) : keep the exact
+    // h7, h8, h9
+    const long double scale = pow(10.0, rec.precision);
+    for (int j = 0; j < 3; j++) {
+        long double u = R[0] * rec.Hn[j] + R[1] * rec.Hn[3 + j]
+                      + R[2] * rec.Hn[6 + j];
+        long double v = R[3] * rec.Hn[j] + R[4] * rec.Hn[3 + j]
+                      + R[5] * rec.Hn[6 + j];
+
+        out.H[j]     = round_ll((u * width  - 0.5 * rec.Hn[6 + j]) * scale);
+        out.H[3 + j] = round_ll((v * height - 0.5 * rec.Hn[6 + j]) * scale);
+    }
+
+    out.screen_width = width;
+    out.screen_height = height;
+    out.rotation = rotation;
+    normalize(out);
+
+    if (verbose)
+        fprintf(stderr, "Rescaled calibration from %dx%d (%d deg) "
+                        "to %dx%d (%d deg)\n",
+                        rec.screen_width, rec.screen_height, rec.rotation,
+                        width, height, rotation);
+
+    return true;
+}
+
+void StateFile::seal(StateRecord& rec)
+{
+    rec.magic = STATE_MAGIC;
+    rec.schema = STATE_SCHEMA;
+    rec.size = sizeof(StateRecord);
+    rec.crc = 0;
+    rec.crc = record_crc(&rec, sizeof(StateRecord));
+}
+
+bool StateFile::check(const StateRecord& rec)
+{
+    return rec.magic == STATE_MAGIC &&
+           rec.schema == STATE_SCHEMA &&
+           rec.size == sizeof(StateRecord) &&
+           record_crc(&rec, sizeof(StateRecord)) == rec.crc;
+}
+
+bool StateFile::write_binary(FILE* fp, const StateRecord& rec)
+{
+    StateRecord out = rec;
+
+    seal(out);
+
+    return fwrite(&out, sizeof(out), 1, fp) == 1;
+}
+
+bool StateFile::write_text(FILE* fp, const StateRecord& rec)
+{
+    // version
+    fprintf(fp, "%s\n", VERSION);
+
+    // min/max
+    fprintf(fp, "%d\n%d\n%d\n%d\n", rec.min_x, rec.max_x, rec.min_y, rec.max_y);
+
+    // H matrix
+    for (int i = 0; i<9 ; i++)
+        fprintf(fp, "%lld\n", (long long) rec.H[i]);
+
+    return !ferror(fp);
+}
+
+bool StateFile::save(const char* path, const StateRecord& rec,
+                     StateFormat fmt)
+{
+    // write to path.tmp then rename, so that an interrupted save
+    // never leaves a truncated state file behind
+    size_t len = strlen(path) + 5;
+    char* tmp = (char*) malloc(len);
+    FILE* fp;
+    bool ok;
+
+    if (tmp == NULL)
+        return false;
+    snprintf(tmp, len, "%s.tmp", path);
+
+    if ( !(fp = fopen(tmp, "w")) ) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", tmp);
+        free(tmp);
+        return false;
+    }
+
+    if (fmt == STATE_BINARY)
+        ok = write_binary(fp, rec);
+    else
+        ok = write_text(fp, rec);
+
+    ok = (fflush(fp) == 0) && ok;
+    ok = (fsync(fileno(fp)) == 0) && ok;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "ERROR: unable to write %s\n", path);
+        unlink(tmp);
+        free(tmp);
+        return false;
+    }
+
+    free(tmp);
+
+    if (verbose)
+        fprintf(stderr, "Wrote %s state file %s\n",
+                        fmt == STATE_BINARY ? "binary" : "text", path);
+
+    return true;
+}
+
+bool StateFile::parse_format(const char* name, StateFormat& fmt)
+{
+    if (strcmp(name, "text") == 0) {
+        fmt = STATE_TEXT;
+        return true;
+    }
+
+    if (strcmp(name, "binary") == 0) {
+        fmt = STATE_BINARY;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _state_hpp
+#define _state_hpp
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Calibration state file, as written by ebeam_state --save.
+ *
+ * Two formats are handled :
+ *  - text   : legacy format, one value per line
+ *             (version, min_x, max_x, min_y, max_y, h1 .. h9)
+ *  - binary : one fixed size record, host byte order, with a magic number,
+ *             a schema version and a CRC32 of the whole record.
+ *
+ * Schema 2 records also hold the calibration in normalized screen
+ * coordinates ([0,1] on both axes) with the screen geometry and rotation
+ * it was captured at, so that it can be recomposed for another resolution
+ * or rotation without recalibrating (see rescale()).
+ *
+ * Loading is done by mapping the file, the binary record is used in place.
+ */
+
+// "EBST" read as a little-endian 32-bit word
+#define STATE_MAGIC  0x54534245
+#define STATE_SCHEMA 2
+
+// record size of schema 1 files
+#define STATE_SCHEMA1_SIZE 120
+
+enum StateFormat {
+    STATE_TEXT = 0,
+    STATE_BINARY = 1
+};
+
+/// binary state record, also used in memory for text files
+struct StateRecord {
+    uint32_t magic;
+    uint16_t schema;
+    uint16_t size;          // sizeof(StateRecord) at write time
+    uint32_t crc;           // CRC32 of the record, computed with crc = 0
+
+    int32_t  precision;     // H coefs are scaled by 10^precision
+    int32_t  zoned;         // 0 : full screen, 1 : active zone
+
+    int32_t  min_x;         // active zone, in screen pixels
+    int32_t  min_y;
+    int32_t  max_x;
+    int32_t  max_y;
+
+    int32_t  screen_width;  // screen geometry at save time, 0 if unknown
+    int32_t  screen_height;
+    int32_t  rotation;      // screen rotation at save time, in degrees
+
+    int64_t  H[9];          // H matrix, as set in the ebeam driver
+
+    // schema 2
+    double   zone[4];       // normalized active zone : min_x, min_y,
+                            // max_x, max_y (max excluded)
+    double   Hn[9];         // H matrix, device to normalized screen coords
+};
+
+/// Class for reading and writing calibration state files
+class StateFile
+{
+public:
+    StateFile();
+    ~StateFile();
+
+    // map and check a state file, text or binary
+    bool load(const char* path);
+
+    // release the file mapping
+    void close();
+
+    // loaded record, NULL if nothing is loaded
+    const StateRecord* get_record() const { return record; }
+
+    // format of the loaded file
+    StateFormat get_format() const { return format; }
+
+    // fill magic/schema/size/crc fields of rec
+    static void seal(StateRecord& rec);
+
+    // is rec a sealed, current schema record ?
+    static bool check(const StateRecord& rec);
+
+    // current schema copy in rec of the schema 1 record at old
+    static void upgrade(StateRecord& rec, const void* old);
+
+    // fill the normalized fields of rec from the absolute ones
+    // Returns false if the screen geometry of rec is unknown
+    static bool normalize(StateRecord& rec);
+
+    // recompose rec for a width x height screen with the given rotation
+    // (in degrees), from its normalized fields
+    // Returns false if rec can't be rescaled (unknown geometry)
+    static bool rescale(const StateRecord& rec, int width, int height,
+                        int rotation, StateRecord& out);
+
+    // write rec to path (via a temporary file and rename)
+    static bool save(const char* path, const StateRecord& rec,
+                     StateFormat fmt);
+
+    // parse a format name ("text" or "binary"), returns false if unknown
+    static bool parse_format(const char* name, StateFormat& fmt);
+
+    // CRC32 (IEEE 802.3) of len bytes
+    static uint32_t crc32(const void* buf, size_t len);
+
+    // Be verbose or not
+    static bool verbose;
+
+private:
+    bool load_binary(const char* path);
+    bool load_text(const char* path);
+
+    static bool write_binary(FILE* fp, const StateRecord& rec);
+    static bool write_text(FILE* fp, const StateRecord& rec);
+
+    // file mapping
+    void*   map;
+    size_t  map_len;
+
+    // record in use, points into map or to own_record
+    // (text files and older schemas)
+    const StateRecord* record;
+    StateRecord        own_record;
+
+    StateFormat format;
+};
+
+#endif
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "sysfs.hpp"
+#include "probes.hpp"
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+/// static verbose
+bool EbeamSysfs::verbose = false;
+
+/// strdup helper : non-ansi
+static char* my_strdup(const char* s) {
+    size_t len = strlen(s) + 1;
+    void* p = malloc(len);
+
+    if (p == NULL)
+        return NULL;
+
+    return (char*) memcpy(p, s, len);
+}
+
+/// write a value to dir/name
+static bool write_attr(const char* dir, const char* name, const char* value)
+{
+    char fname[PATH_MAX];
+    FILE *fp;
+    int64_t t = EBEAM_PROBE_START(sysfs_write);
+    bool ok = SUCCESS;
+
+    snprintf(fname, sizeof(fname), "%s%s", dir, name); // dir end with /
+
+    if (EbeamSysfs::verbose)
+        fprintf(stderr, "Writing %s to %s\n", value, fname);
+
+    if ( !(fp = fopen(fname, "w")) ) {
+        fprintf(stderr, "ERROR: unable to open %s for writing.\n", fname);
+        ok = FAILURE;
+    } else {
+        fprintf(fp, "%s", value);
+
+        // sysfs reports a rejected value on close
+        if (fclose(fp) != 0) {
+            fprintf(stderr, "ERROR: unable to write %s\n", fname);
+            ok = FAILURE;
+        }
+    }
+
+    EBEAM_PROBE5(sysfs_write, dir, name, value, EBEAM_PROBE_ELAPSED(t), ok);
+
+    return ok;
+}
+
+/// read a value from dir/name
+static bool read_attr(const char* dir, const char* name, long long& value)
+{
+    char fname[PATH_MAX];
+    FILE *fp;
+    int64_t t = EBEAM_PROBE_START(sysfs_read);
+    bool ok = SUCCESS;
+
+    snprintf(fname, sizeof(fname), "%s%s", dir, name);
+
+    if ( !(fp = fopen(fname, "r")) ) {
+        fprintf(stderr, "ERROR: unable to open %s for reading.\n", fname);
+        ok = FAILURE;
+    } else {
+        if (fscanf(fp, "%lld", &value) != 1) {
+            fprintf(stderr, "ERROR: unable to parse %s\n", fname);
+            ok = FAILURE;
+        }
+        fclose(fp);
+    }
+
+    EBEAM_PROBE5(sysfs_read, dir, name, ok ? value : 0,
+                 EBEAM_PROBE_ELAPSED(t), ok);
+
+    if (ok && EbeamSysfs::verbose)
+        fprintf(stderr, "Read %lld from %s\n", value, fname);
+
+    return ok;
+}
+
+bool EbeamSysfs::read_calibration(const char* dir, EbeamCalibration& cal)
+{
+    long long v[4];
+
+    if (!read_attr(dir, "min_x", v[0]) ||
+        !read_attr(dir, "min_y", v[1]) ||
+        !read_attr(dir, "max_x", v[2]) ||
+        !read_attr(dir, "max_y", v[3]))
+        return FAILURE;
+
+    cal.min_x = (int) v[0];
+    cal.min_y = (int) v[1];
+    cal.max_x = (int) v[2];
+    cal.max_y = (int) v[3];
+
+    for (int i=1; i<=9; i++) {
+        char name[4];
+        sprintf(name, "h%d", i);
+        if (!read_attr(dir, name, cal.H[i-1]))
+            return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+bool EbeamSysfs::write_calibration(const char* dir,
+                                   const EbeamCalibration& cal)
+{
+    int n = 0; // number of file written
+    DIR* dp = opendir(dir);
+
+    if (dp == NULL) {
+        fprintf(stderr, "ERROR: unable to open %s\n", dir);
+        return FAILURE;
+    }
+
+    // only write the attributes the driver exposes
+    dirent* ep;
+    while ((ep = readdir(dp))) {
+        char value[50];
+        const char* name = ep->d_name;
+
+        if (strcmp(name, "min_x") == 0)
+            sprintf(value, "%d", cal.min_x);
+        else if (strcmp(name, "min_y") == 0)
+            sprintf(value, "%d", cal.min_y);
+        else if (strcmp(name, "max_x") == 0)
+            sprintf(value, "%d", cal.max_x);
+        else if (strcmp(name, "max_y") == 0)
+            sprintf(value, "%d", cal.max_y);
+        else if (name[0] == 'h' && name[1] >= '1' && name[1] <= '9' &&
+                 name[2] == 0)
+            sprintf(value, "%lld", cal.H[name[1] - '1']);
+        else
+            continue;
+
+        if (!write_attr(dir, name, value)) {
+            closedir(dp);
+            return FAILURE;
+        }
+        n++;
+    }
+
+    closedir(dp);
+
+    if (n != 13) {
+        fprintf(stderr, "ERROR: only %d parameters set, "
+                        "not in sync with ebeam kernel module ?\n", n);
+        return FAILURE;
+    }
+
+    // enabling calibration
+    if (!write_attr(dir, "calibrated", "1"))
+        return FAILURE;
+
+    if (verbose)
+        fprintf(stderr, "eBeam calibration done\n");
+
+    return SUCCESS;
+}
+
+bool EbeamSysfs::reset_calibration(const char* dir)
+{
+    if (!write_attr(dir, "calibrated", "0"))
+        return FAILURE;
+
+    if (verbose)
+        fprintf(stderr, "eBeam calibration resetted.\n");
+
+    return SUCCESS;
+}
+
+bool EbeamSysfs::is_calibrated(const char* dir)
+{
+    long long value;
+
+    return read_attr(dir, "calibrated", value) && value != 0;
+}
+
+bool EbeamSysfs::is_ebeam(const char* dir)
+{
+    char fname[PATH_MAX];
+
+    snprintf(fname, sizeof(fname), "%scalibrated", dir);
+
+    return access(fname, F_OK) == 0;
+}
+
+void EbeamSysfs::event_dir(const char* event, char* dir, size_t len)
+{
+    snprintf(dir, len, "/sys/class/input/%s/device/device/", event);
+}
+
+int EbeamSysfs::scan(std::vector<SysfsDevice>& devices)
+{
+    DIR* dp = opendir("/sys/class/input");
+
+    if (dp == NULL) {
+        fprintf(stderr, "ERROR: unable to open /sys/class/input\n");
+        return 0;
+    }
+
+    dirent* ep;
+    while ((ep = readdir(dp))) {
+        SysfsDevice dev;
+
+        if (strncmp(ep->d_name, "event", 5) != 0 ||
+            strlen(ep->d_name) >= sizeof(dev.event))
+            continue;
+
+        strcpy(dev.event, ep->d_name);
+        event_dir(dev.event, dev.dir, sizeof(dev.dir));
+
+        if (!is_ebeam(dev.dir))
+            continue;
+
+        if (verbose)
+            fprintf(stderr, "Found ebeam driver device %s (%s)\n",
+                            dev.event, dev.dir);
+
+        devices.push_back(dev);
+    }
+
+    closedir(dp);
+
+    return devices.size();
+}
+
+bool EbeamSysfs::find_named(const char* name, char* event, size_t len)
+{
+    DIR* dp = opendir("/sys/class/input");
+    bool found = false;
+
+    if (dp == NULL) {
+        fprintf(stderr, "ERROR: unable to open /sys/class/input\n");
+        return false;
+    }
+
+    dirent* ep;
+    while (!found && (ep = readdir(dp))) {
+        char fname[PATH_MAX];
+        char line[128];
+        FILE* fp;
+
+        if (strncmp(ep->d_name, "event", 5) != 0)
+            continue;
+
+        snprintf(fname, sizeof(fname), "/sys/class/input/%s/device/name",
+                 ep->d_name);
+        if ( !(fp = fopen(fname, "r")) )
+            continue;
+        if (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = 0;
+            if (strcmp(line, name) == 0) {
+                snprintf(event, len, "%s", ep->d_name);
+                found = true;
+            }
+        }
+        fclose(fp);
+    }
+
+    closedir(dp);
+
+    if (found && verbose)
+        fprintf(stderr, "Found '%s' : %s\n", name, event);
+
+    return found;
+}
+
+/// read a hexadecimal attribute (idVendor, idProduct)
+static unsigned read_hex(const char* dir, const char* name)
+{
+    char fname[PATH_MAX];
+    unsigned value = 0;
+    FILE *fp;
+
+    snprintf(fname, sizeof(fname), "%s/%s", dir, name);
+    if ((fp = fopen(fname, "r"))) {
+        if (fscanf(fp, "%x", &value) != 1)
+            value = 0;
+        fclose(fp);
+    }
+
+    return value;
+}
+
+bool EbeamSysfs::identify(const char* dir, DeviceIdentity& id)
+{
+    char real[PATH_MAX];
+    char usb[PATH_MAX];
+    char fname[PATH_MAX];
+    FILE *fp;
+
+    memset(&id, 0, sizeof(id));
+
+    // dir is the usb interface, e.g. /sys/devices/.../3-1.4/3-1.4:1.0
+    if (!realpath(dir, real))
+        return FAILURE;
+
+    const char* phys = strrchr(real, '/');
+    snprintf(id.phys, sizeof(id.phys), "%s", phys ? phys + 1 : real);
+
+    // vendor, product and serial are on the parent usb device
+    snprintf(usb, sizeof(usb), "%s/..", real);
+    id.vendor = read_hex(usb, "idVendor");
+    id.product = read_hex(usb, "idProduct");
+
+    snprintf(fname, sizeof(fname), "%s/serial", usb);
+    if ((fp = fopen(fname, "r"))) {
+        if (fscanf(fp, "%63s", id.serial) != 1)
+            id.serial[0] = 0;
+        fclose(fp);
+    }
+
+    return SUCCESS;
+}
+
+char* EbeamSysfs::device_key(const DeviceIdentity& id)
+{
+    char buffer[128];
+
+    if (id.serial[0])
+        snprintf(buffer, sizeof(buffer), "serial:%s", id.serial);
+    else if (id.phys[0])
+        // no serial, fall back to the usb port path
+        snprintf(buffer, sizeof(buffer), "phys:%s", id.phys);
+    else
+        snprintf(buffer, sizeof(buffer), "unknown");
+
+    return my_strdup(buffer);
+}
+
+char* EbeamSysfs::device_key(const char* dir)
+{
+    DeviceIdentity id;
+
+    identify(dir, id);
+
+    return device_key(id);
+}
+
+bool EbeamSysfs::is_selector(const char* selector)
+{
+    unsigned vendor, product;
+    char end;
+
+    if (strncmp(selector, "serial:", 7) == 0 ||
+        strncmp(selector, "phys:", 5) == 0)
+        return true;
+
+    // exactly <hex>:<hex>
+    return sscanf(selector, "%x:%x%c", &vendor, &product, &end) == 2 &&
+           strchr(selector, ':') - selector == 4;
+}
+
+bool EbeamSysfs::match(const DeviceIdentity& id, const char* selector)
+{
+    unsigned vendor, product;
+
+    if (strncmp(selector, "serial:", 7) == 0)
+        return id.serial[0] && strcmp(id.serial, selector + 7) == 0;
+
+    // the usb port (3-1.4) or the interface (3-1.4:1.0)
+    if (strncmp(selector, "phys:", 5) == 0) {
+        size_t len = strlen(selector + 5);
+        return len > 0 && strncmp(id.phys, selector + 5, len) == 0 &&
+               (id.phys[len] == 0 || id.phys[len] == ':');
+    }
+
+    if (!is_selector(selector) ||
+        sscanf(selector, "%x:%x", &vendor, &product) != 2)
+        return false;
+
+    return id.vendor == vendor && id.product == product;
+}
+
+void EbeamSysfs::from_state(const StateRecord& rec, EbeamCalibration& cal)
+{
+    cal.min_x = rec.min_x;
+    cal.min_y = rec.min_y;
+    cal.max_x = rec.max_x;
+    cal.max_y = rec.max_y;
+
+    for (int i = 0; i<9 ; i++)
+        cal.H[i] = rec.H[i];
+}
+
+void EbeamSysfs::to_state(const EbeamCalibration& cal, StateRecord& rec)
+{
+    rec.min_x = cal.min_x;
+    rec.min_y = cal.min_y;
+    rec.max_x = cal.max_x;
+    rec.max_y = cal.max_y;
+
+    for (int i = 0; i<9 ; i++)
+        rec.H[i] = cal.H[i];
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _sysfs_hpp
+#define _sysfs_hpp
+
+#include "state.hpp"
+
+#include <vector>
+
+/*
+ * Access to the ebeam kernel driver calibration attributes :
+ *   min_x, min_y, max_x, max_y, h1 .. h9 and calibrated,
+ * in the sysfs directory of the usb interface
+ * (/sys/class/input/eventXX/device/device/).
+ */
+
+// name of the ebeam_uinput output device
+#define UINPUT_DEVICE_NAME "ebeam_tools calibrated pen"
+
+/// calibration data, as held by the ebeam driver
+struct EbeamCalibration {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+    long long H[9];
+};
+
+/// USB identity of a device, see EbeamSysfs::identify
+struct DeviceIdentity {
+    unsigned vendor;    // idVendor, 0 if unknown
+    unsigned product;   // idProduct
+    char serial[64];    // usb serial, empty if none
+    char phys[32];      // usb interface path, e.g. 3-1.4:1.0
+};
+
+/// a device found by EbeamSysfs::scan
+struct SysfsDevice {
+    char event[16];     // eventXX
+    char dir[64];       // sysfs directory
+};
+
+/// Class for reading and writing ebeam driver calibration
+class EbeamSysfs
+{
+public:
+    // read the driver calibration
+    static bool read_calibration(const char* dir, EbeamCalibration& cal);
+
+    // write the driver calibration and enable it
+    static bool write_calibration(const char* dir,
+                                  const EbeamCalibration& cal);
+
+    // disable the driver calibration
+    static bool reset_calibration(const char* dir);
+
+    // is the driver calibration enabled ?
+    static bool is_calibrated(const char* dir);
+
+    // does dir look like an ebeam driver device ?
+    static bool is_ebeam(const char* dir);
+
+    // sysfs dir of an eventXX node
+    static void event_dir(const char* event, char* dir, size_t len);
+
+    // find the ebeam driver devices in /sys/class/input, without X
+    // Returns the number of devices found
+    static int scan(std::vector<SysfsDevice>& devices);
+
+    // eventXX of the input device called name, without X
+    // Returns false if there is none
+    static bool find_named(const char* name, char* event, size_t len);
+
+    // read the usb identity of the device behind a sysfs dir
+    static bool identify(const char* dir, DeviceIdentity& id);
+
+    // Stable identity of the device behind a sysfs dir :
+    // "serial:<usb serial>", or "phys:<usb port path>" when no serial
+    // Returns a malloc'ed string
+    static char* device_key(const char* dir);
+    static char* device_key(const DeviceIdentity& id);
+
+    // is selector an identity selector :
+    // <vendor>:<product> (hex), serial:<serial> or phys:<port path> ?
+    static bool is_selector(const char* selector);
+
+    // does the identity match an identity selector ?
+    static bool match(const DeviceIdentity& id, const char* selector);
+
+    // conversion from/to state records
+    static void from_state(const StateRecord& rec, EbeamCalibration& cal);
+    static void to_state(const EbeamCalibration& cal, StateRecord& rec);
+
+    // Be verbose or not
+    static bool verbose;
+};
+
+#endif
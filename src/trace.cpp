@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "trace.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+bool Trace::enabled = false;
+const char* Trace::path = NULL;
+Trace::Buffer* Trace::buffers = NULL;
+unsigned Trace::threads = 0;
+
+// buffer of the calling thread, NULL until its first span
+static __thread void* trace_buffer = NULL;
+
+int64_t Trace::now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Trace::Buffer* Trace::thread_buffer()
+{
+    Buffer* buffer = (Buffer*) trace_buffer;
+
+    if (buffer)
+        return buffer;
+
+    buffer = (Buffer*) calloc(1, sizeof(Buffer));
+    if (buffer == NULL)
+        return NULL;
+    buffer->tid = __atomic_add_fetch(&threads, 1, __ATOMIC_RELAXED);
+
+    // lock-free push
+    buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer,
+                                        true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    trace_buffer = buffer;
+    return buffer;
+}
+
+void Trace::record(const char* name, int64_t start, int arg)
+{
+    Buffer* buffer = thread_buffer();
+    if (buffer == NULL)
+        return;
+
+    // reserve the slot first, in one atomic step : a span ending in a
+    // signal handler that interrupts us takes the next one
+    unsigned i = __atomic_fetch_add(&buffer->count, 1, __ATOMIC_RELAXED);
+    if (i >= TRACE_BUFFER)
+        return;
+
+    TraceEvent& ev = buffer->events[i];
+    ev.name = name;
+    ev.start = start;
+    ev.duration = now_us() - start;
+    ev.arg = arg;
+}
+
+bool Trace::start(const char* path0)
+{
+    static bool registered = false;
+
+    path = path0;
+    enabled = true;
+
+    // the gui and the cli leave with exit()
+    if (!registered) {
+        atexit(at_exit);
+        registered = true;
+    }
+
+    // main thread buffer, before any signal handler needs it
+    return thread_buffer() != NULL;
+}
+
+void Trace::at_exit()
+{
+    if (enabled)
+        stop();
+}
+
+bool Trace::stop()
+{
+    enabled = false;
+
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: unable to write trace %s\n", path);
+        return FAILURE;
+    }
+
+    const long pid = getpid();
+    unsigned long dropped = 0;
+    bool first = true;
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+
+    Buffer* buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+    for (; buffer; buffer = buffer->next) {
+        unsigned count = __atomic_load_n(&buffer->count, __ATOMIC_RELAXED);
+        unsigned n = count < TRACE_BUFFER ? count : TRACE_BUFFER;
+        dropped += count - n;
+
+        for (unsigned i = 0; i < n; i++) {
+            const TraceEvent& ev = buffer->events[i];
+
+            fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,"
+                        "\"tid\":%u,\"ts\":%lld,\"dur\":%lld",
+                    first ? "" : ",\n", ev.name, pid, buffer->tid,
+                    (long long) ev.start, (long long) ev.duration);
+            if (ev.arg >= 0)
+                fprintf(fp, ",\"args\":{\"n\":%d}", ev.arg);
+            fprintf(fp, "}");
+            first = false;
+        }
+
+        // threads are done : events are ours now
+        __atomic_store_n(&buffer->count, 0, __ATOMIC_RELAXED);
+    }
+
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (dropped)
+        fprintf(stderr, "Warning: %lu span(s) dropped, trace buffer full\n",
+                        dropped);
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: unable to write trace %s\n", path);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
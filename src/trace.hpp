@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _trace_hpp
+#define _trace_hpp
+
+#include <stdint.h>
+
+/*
+ * Phase timing of a calibration (--trace <file>) : scoped spans, written
+ * at exit as Chrome trace events (chrome://tracing, Perfetto).
+ *
+ * Each thread records into its own buffer, without lock; buffers are
+ * chained to a global list with an atomic push on their first span, and
+ * only read by Trace::stop, once the threads are done. A full buffer
+ * drops its next spans (counted).
+ *
+ * Disabled, a span costs a test of Trace::enabled.
+ */
+
+// spans per thread buffer
+#define TRACE_BUFFER 4096
+
+/// a finished span
+struct TraceEvent {
+    const char* name;       // static string
+    int64_t start;          // us, monotonic
+    int64_t duration;       // us
+    int arg;                // -1 : none
+};
+
+/// Class for recording and exporting spans
+class Trace
+{
+public:
+    // record spans, written to path at exit (or by stop())
+    static bool start(const char* path);
+
+    // write the spans recorded so far and stop recording
+    static bool stop();
+
+    // monotonic time, in us
+    static int64_t now_us();
+
+    // add a finished span to the calling thread buffer
+    static void record(const char* name, int64_t start, int arg);
+
+    // fast check, for TraceSpan
+    static bool enabled;
+
+private:
+    struct Buffer {
+        Buffer* next;
+        unsigned tid;
+        unsigned count;     // reserved slots, may exceed TRACE_BUFFER
+        TraceEvent events[TRACE_BUFFER];
+    };
+
+    static Buffer* thread_buffer();
+    static void at_exit();
+
+    static const char* path;
+    static Buffer* buffers;
+    static unsigned threads;
+};
+
+/// Class for timing a scope
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name0, int arg0 = -1)
+      : name(name0),
+        arg(arg0),
+        start(Trace::enabled ? Trace::now_us() : -1)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (start >= 0)
+            Trace::record(name, start, arg);
+    }
+
+private:
+    const char* name;
+    int arg;
+    int64_t start;
+};
+
+#endif
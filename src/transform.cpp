@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "transform.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef SUCCESS
+#define SUCCESS 1
+#endif
+#ifndef FAILURE
+#define FAILURE 0
+#endif
+
+// max LUT size, per axis
+#define LUT_MAX_CELLS 1024
+
+PenTransform::PenTransform()
+  : width(1),
+    height(1),
+    cells(0),
+    min_x(0),
+    min_y(0),
+    scale_x(0),
+    scale_y(0)
+{
+    memset(H, 0, sizeof(H));
+    H[0] = H[4] = H[8] = 1;
+}
+
+void PenTransform::set_calibration(const EbeamCalibration& cal, int width0,
+                                   int height0)
+{
+    for (int i = 0; i<9 ; i++)
+        H[i] = cal.H[i];
+
+    width = width0 > 0 ? width0 : 1;
+    height = height0 > 0 ? height0 : 1;
+
+    // a LUT of the previous calibration is wrong now
+    cells = 0;
+    lut.clear();
+}
+
+void PenTransform::clamp(int& x, int& y) const
+{
+    if (x < 0)
+        x = 0;
+    else if (x >= width)
+        x = width - 1;
+
+    if (y < 0)
+        y = 0;
+    else if (y >= height)
+        y = height - 1;
+}
+
+void PenTransform::apply_exact(int X, int Y, int& x, int& y) const
+{
+    // From ebeam.c kernel driver, keep in sync with Calibrator::test_H
+    long long div = H[6] * X + H[7] * Y + H[8];
+
+    if (div == 0) {
+        x = y = 0;
+        return;
+    }
+
+    x = (int) ((2 * (H[0] * X + H[1] * Y + H[2]) + div)/(2*div));
+    y = (int) ((2 * (H[3] * X + H[4] * Y + H[5]) + div)/(2*div));
+
+    clamp(x, y);
+}
+
+bool PenTransform::build_lut(int raw_min_x, int raw_max_x,
+                             int raw_min_y, int raw_max_y, int cells0)
+{
+    cells = 0;
+    lut.clear();
+
+    if (cells0 == 0)
+        return SUCCESS;
+
+    if (cells0 < 1 || cells0 > LUT_MAX_CELLS ||
+        raw_max_x <= raw_min_x || raw_max_y <= raw_min_y) {
+        fprintf(stderr, "ERROR: bad LUT geometry (%d cells, "
+                        "raw range %d..%d x %d..%d)\n", cells0,
+                        raw_min_x, raw_max_x, raw_min_y, raw_max_y);
+        return FAILURE;
+    }
+
+    long long range_x = raw_max_x - raw_min_x;
+    long long range_y = raw_max_y - raw_min_y;
+
+    lut.resize(2 * (cells0 + 1) * (cells0 + 1));
+
+    // exact transform at the grid nodes, unclamped and unrounded
+    for (int j = 0; j <= cells0; j++) {
+        for (int i = 0; i <= cells0; i++) {
+            long long X = raw_min_x + range_x * i / cells0;
+            long long Y = raw_min_y + range_y * j / cells0;
+            double div = (double) H[6] * X + (double) H[7] * Y + H[8];
+            int* node = &lut[2 * (j * (cells0 + 1) + i)];
+
+            if (div == 0) {
+                node[0] = node[1] = 0;
+                continue;
+            }
+            node[0] = (int) (((double) H[0] * X + (double) H[1] * Y + H[2])
+                             / div * (1 << LUT_SHIFT));
+            node[1] = (int) (((double) H[3] * X + (double) H[4] * Y + H[5])
+                             / div * (1 << LUT_SHIFT));
+        }
+    }
+
+    min_x = raw_min_x;
+    min_y = raw_min_y;
+    scale_x = ((long long) cells0 << 16) / range_x;
+    scale_y = ((long long) cells0 << 16) / range_y;
+    cells = cells0;
+
+    return SUCCESS;
+}
+
+void PenTransform::apply_lut(int X, int Y, int& x, int& y) const
+{
+    // cell and position in the cell, 16 fractional bits
+    long long fx = (X - min_x) * scale_x;
+    long long fy = (Y - min_y) * scale_y;
+    int i = (int) (fx >> 16);
+    int j = (int) (fy >> 16);
+
+    // out of the raw range : extrapolate from the border cell
+    if (i < 0)
+        i = 0;
+    else if (i >= cells)
+        i = cells - 1;
+    if (j < 0)
+        j = 0;
+    else if (j >= cells)
+        j = cells - 1;
+
+    long long u = fx - i * 65536LL;
+    long long v = fy - j * 65536LL;
+
+    const int* n00 = &lut[2 * (j * (cells + 1) + i)];
+    const int* n10 = n00 + 2;
+    const int* n01 = n00 + 2 * (cells + 1);
+    const int* n11 = n01 + 2;
+
+    for (int k = 0; k < 2; k++) {
+        long long top = n00[k] * 65536LL + (n10[k] - n00[k]) * u;
+        long long bot = n01[k] * 65536LL + (n11[k] - n01[k]) * u;
+        long long val = top * 65536LL + (bot - top) * v;
+
+        // back to pixels, rounded
+        val = (val + (1LL << (31 + LUT_SHIFT))) >> (32 + LUT_SHIFT);
+        if (k == 0)
+            x = (int) val;
+        else
+            y = (int) val;
+    }
+
+    clamp(x, y);
+}
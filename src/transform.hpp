@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _transform_hpp
+#define _transform_hpp
+
+#include "sysfs.hpp"
+
+#include <vector>
+
+/*
+ * Raw pen position to screen position, in userspace, for kernels without
+ * the ebeam driver calibration (see pipeline.hpp).
+ *
+ * The exact transform is the fixed point homography of the ebeam driver
+ * (same rounding as Calibrator::test_H) : 9 multiplications and 2 64-bit
+ * divisions per position.
+ * A mesh LUT can be built instead : the exact transform is sampled on a
+ * cells x cells grid over the raw range, and positions are interpolated
+ * bilinearly in fixed point, without division.
+ */
+
+// LUT values : screen pixels, 8 fractional bits
+#define LUT_SHIFT 8
+
+/// Class for transforming raw pen positions to screen positions
+class PenTransform
+{
+public:
+    PenTransform();
+
+    // driver calibration, screen size in pixels
+    void set_calibration(const EbeamCalibration& cal, int width0,
+                         int height0);
+
+    // sample the exact transform on a cells x cells grid over the raw
+    // range, cells = 0 goes back to the exact transform
+    bool build_lut(int raw_min_x, int raw_max_x,
+                   int raw_min_y, int raw_max_y, int cells);
+
+    // screen position of raw (X, Y), clamped to the screen
+    void apply(int X, int Y, int& x, int& y) const
+    {
+        if (cells)
+            apply_lut(X, Y, x, y);
+        else
+            apply_exact(X, Y, x, y);
+    }
+
+    // ebeam driver computation
+    void apply_exact(int X, int Y, int& x, int& y) const;
+
+    // bilinear interpolation in the LUT
+    void apply_lut(int X, int Y, int& x, int& y) const;
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    int get_cells() const { return cells; }
+
+private:
+    void clamp(int& x, int& y) const;
+
+    long long H[9];
+    int width;
+    int height;
+
+    // mesh LUT : (cells + 1)^2 nodes, x then y
+    int cells;
+    int min_x;
+    int min_y;
+    long long scale_x;      // raw to cell, 16 fractional bits
+    long long scale_y;
+    std::vector<int> lut;
+};
+
+#endif
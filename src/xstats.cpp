@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#include "xstats.hpp"
+#include "timing.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool XStats::enabled = false;
+XPhaseStats XStats::phases[XSTATS_MAX];
+XCallStats XStats::calls[XSTATS_MAX];
+unsigned XStats::num_phases = 0;
+unsigned XStats::num_calls = 0;
+XPhase* XStats::current = NULL;
+XRoundTrip* XStats::active = NULL;
+
+// length of a call name, up to its arguments
+static size_t call_length(const char* name)
+{
+    const char* paren = strchr(name, '(');
+    size_t len = paren ? (size_t) (paren - name) : strlen(name);
+
+    while (len > 0 && name[len-1] == ' ')
+        len--;
+    return len;
+}
+
+void XStats::enable()
+{
+    if (enabled)
+        return;
+
+    enabled = true;
+    atexit(at_exit);
+}
+
+void XStats::at_exit()
+{
+    report(stderr);
+}
+
+XPhaseStats* XStats::phase(const char* name)
+{
+    for (unsigned i = 0; i < num_phases; i++)
+        if (strcmp(phases[i].name, name) == 0)
+            return &phases[i];
+
+    // full : the last slot takes the rest
+    if (num_phases == XSTATS_MAX)
+        return &phases[XSTATS_MAX-1];
+
+    XPhaseStats* stats = &phases[num_phases++];
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name;
+    return stats;
+}
+
+XCallStats* XStats::call(const char* name)
+{
+    size_t len = call_length(name);
+
+    for (unsigned i = 0; i < num_calls; i++)
+        if (call_length(calls[i].name) == len &&
+            strncmp(calls[i].name, name, len) == 0)
+            return &calls[i];
+
+    if (num_calls == XSTATS_MAX)
+        return &calls[XSTATS_MAX-1];
+
+    XCallStats* stats = &calls[num_calls++];
+    memset(stats, 0, sizeof(*stats));
+    stats->name = name;
+    return stats;
+}
+
+void XStats::close_display(Display* display)
+{
+    for (XPhase* p = current; p; p = p->parent)
+        if (p->display == display) {
+            p->flush();
+            p->display = NULL;
+        }
+}
+
+void XStats::report(FILE* fp)
+{
+    unsigned long requests = 0;
+    unsigned round_trips = 0;
+    double blocked = 0;
+
+    // pending phases, e.g. exit() from inside one
+    for (XPhase* p = current; p; p = p->parent)
+        p->flush();
+
+    fprintf(fp, "\nX traffic by phase:\n");
+    fprintf(fp, "%-28s %6s %9s %11s %11s %11s\n", "phase", "calls",
+            "requests", "round trips", "blocked ms", "wall ms");
+    for (unsigned i = 0; i < num_phases; i++) {
+        const XPhaseStats& p = phases[i];
+        fprintf(fp, "%-28s %6u %9lu %11u %11.3f %11.3f\n", p.name, p.count,
+                p.requests, p.round_trips, p.blocked_ms, p.wall_ms);
+        requests += p.requests;
+        round_trips += p.round_trips;
+        blocked += p.blocked_ms;
+    }
+    fprintf(fp, "%-28s %6s %9lu %11u %11.3f\n", "total", "",
+            requests, round_trips, blocked);
+
+    fprintf(fp, "\nX round trips by call:\n");
+    fprintf(fp, "%-28s %6s %11s %11s\n", "call", "count", "blocked ms",
+            "mean ms");
+    for (unsigned i = 0; i < num_calls; i++) {
+        const XCallStats& c = calls[i];
+        fprintf(fp, "%-28.*s %6u %11.3f %11.3f\n", (int) call_length(c.name),
+                c.name, c.count, c.blocked_ms,
+                c.count ? c.blocked_ms / c.count : 0.0);
+    }
+}
+
+XPhase::XPhase(Display* display0, const char* name)
+  : display(display0),
+    stats(NULL),
+    parent(NULL),
+    mark(0),
+    start(0)
+{
+    if (!XStats::enabled || display == NULL)
+        return;
+
+    stats = XStats::phase(name);
+    stats->count++;
+    start = now_ms();
+
+    // the outer phase gets the requests issued so far
+    parent = XStats::current;
+    if (parent)
+        parent->flush();
+    XStats::current = this;
+
+    mark = NextRequest(display);
+}
+
+XPhase::~XPhase()
+{
+    if (stats == NULL)
+        return;
+
+    flush();
+    stats->wall_ms += now_ms() - start;
+
+    XStats::current = parent;
+    if (parent && parent->display)
+        parent->mark = NextRequest(parent->display);
+}
+
+void XPhase::flush()
+{
+    if (display == NULL)
+        return;
+
+    unsigned long next = NextRequest(display);
+    stats->requests += next - mark;
+    mark = next;
+}
+
+void XRoundTrip::begin()
+{
+    // previous call of the same expression
+    if (XStats::active)
+        XStats::active->end();
+
+    XStats::active = this;
+    start = now_ms();
+}
+
+void XRoundTrip::end()
+{
+    double blocked = now_ms() - start;
+    start = -1;
+    if (XStats::active == this)
+        XStats::active = NULL;
+
+    XCallStats* call = XStats::call(name);
+    call->count++;
+    call->blocked_ms += blocked;
+
+    XPhaseStats* phase = XStats::current ? XStats::current->stats
+                                         : XStats::phase("other");
+    phase->round_trips++;
+    phase->blocked_ms += blocked;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2012 Yann Cantin <yann.cantin@laposte.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+
+#ifndef _xstats_hpp
+#define _xstats_hpp
+
+#include <X11/Xlib.h>
+
+#include <stdio.h>
+
+/*
+ * X server traffic accounting (--xstats) : requests, round trips and
+ * time blocked waiting on the server, per phase and per call, printed
+ * at exit.
+ *
+ * A phase (XPhase) counts the requests issued on its display, from
+ * NextRequest. Phases nest : requests, round trips and blocked time go
+ * to the innermost one, wall time includes the inner phases. Round
+ * trips are the synchronous calls wrapped in X_ROUND_TRIP; outside of
+ * any phase, they are accounted to "other".
+ *
+ * Main thread only : X is not used from the worker threads.
+ */
+
+// distinct phases and calls
+#define XSTATS_MAX 32
+
+/// a synchronous X call : XSync(display, False) -> "XSync"
+#define X_ROUND_TRIP(call) (XRoundTrip(#call), call)
+
+/// totals of a phase
+struct XPhaseStats {
+    const char* name;
+    unsigned count;         // times entered
+    unsigned long requests;
+    unsigned round_trips;
+    double blocked_ms;
+    double wall_ms;
+};
+
+/// totals of a call
+struct XCallStats {
+    const char* name;       // up to '('
+    unsigned count;
+    double blocked_ms;
+};
+
+class XPhase;
+class XRoundTrip;
+
+/// Class for accounting the X traffic
+class XStats
+{
+public:
+    // account from now on, report at exit
+    static void enable();
+
+    // print the tables
+    static void report(FILE* fp);
+
+    // stop counting the requests of display, before XCloseDisplay
+    static void close_display(Display* display);
+
+    // fast check, for XPhase and XRoundTrip
+    static bool enabled;
+
+private:
+    friend class XPhase;
+    friend class XRoundTrip;
+
+    static XPhaseStats* phase(const char* name);
+    static XCallStats* call(const char* name);
+    static void at_exit();
+
+    static XPhaseStats phases[XSTATS_MAX];
+    static XCallStats calls[XSTATS_MAX];
+    static unsigned num_phases;
+    static unsigned num_calls;
+    static XPhase* current;
+    static XRoundTrip* active;
+};
+
+/// Class for accounting a scope to a phase
+class XPhase
+{
+public:
+    XPhase(Display* display, const char* name);
+    ~XPhase();
+
+private:
+    friend class XStats;
+    friend class XRoundTrip;
+
+    // add the requests issued since the last mark
+    void flush();
+
+    Display* display;       // NULL once closed
+    XPhaseStats* stats;     // NULL when disabled
+    XPhase* parent;
+    unsigned long mark;
+    double start;
+};
+
+/// Class for timing a synchronous call
+class XRoundTrip
+{
+public:
+    XRoundTrip(const char* name0)
+      : name(name0),
+        start(-1)
+    {
+        if (XStats::enabled)
+            begin();
+    }
+
+    ~XRoundTrip()
+    {
+        if (start >= 0)
+            end();
+    }
+
+private:
+    friend class XStats;
+
+    void begin();
+    void end();
+
+    const char* name;
+    double start;
+};
+
+#endif